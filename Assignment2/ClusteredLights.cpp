@@ -0,0 +1,121 @@
+//***************************************************************************************
+// ClusteredLights.cpp
+//***************************************************************************************
+
+#include "ClusteredLights.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Must match cbLightCull in Shaders/LightCull.hlsl.
+	struct LightCullConstants
+	{
+		XMFLOAT4X4 View;
+		XMFLOAT2 InvProjScale;
+		float NearZ;
+		float FarZ;
+		UINT LightCount;
+		UINT LightCullPad0;
+		UINT LightCullPad1;
+		UINT LightCullPad2;
+	};
+}
+
+ClusteredLights::ClusteredLights(ID3D12Device* device, UINT frameCount)
+{
+	auto createBuffer = [device](UINT64 byteSize, Microsoft::WRL::ComPtr<ID3D12Resource>& buffer)
+	{
+		ThrowIfFailed(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(byteSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_COMMON,
+			nullptr,
+			IID_PPV_ARGS(&buffer)));
+	};
+
+	mClusterLightCounts.resize(frameCount);
+	mClusterLightIndices.resize(frameCount);
+	for(UINT i = 0; i < frameCount; ++i)
+	{
+		createBuffer(ClusterCount*sizeof(UINT), mClusterLightCounts[i]);
+		createBuffer((UINT64)ClusterCount*MaxLightsPerCluster*sizeof(UINT), mClusterLightIndices[i]);
+	}
+}
+
+void ClusteredLights::SliceConstants(float nearZ, float farZ, float& scale, float& bias)
+{
+	// slice = GridZ*log(z/nearZ)/log(farZ/nearZ).
+	scale = GridZ / log2f(farZ / nearZ);
+	bias = -log2f(nearZ)*scale;
+}
+
+void ClusteredLights::Cull(
+	ID3D12GraphicsCommandList* cmdList,
+	UINT frameIndex,
+	ID3D12RootSignature* rootSig,
+	ID3D12PipelineState* cullPso,
+	D3D12_GPU_VIRTUAL_ADDRESS lights,
+	UINT lightCount,
+	FXMMATRIX view,
+	CXMMATRIX proj,
+	float nearZ,
+	float farZ)
+{
+	LightCullConstants constants;
+	XMStoreFloat4x4(&constants.View, XMMatrixTranspose(view));
+
+	XMFLOAT4X4 p;
+	XMStoreFloat4x4(&p, proj);
+	constants.InvProjScale = XMFLOAT2(1.0f / p(0, 0), 1.0f / p(1, 1));
+	constants.NearZ = nearZ;
+	constants.FarZ = farZ;
+	constants.LightCount = lightCount;
+	constants.LightCullPad0 = 0;
+	constants.LightCullPad1 = 0;
+	constants.LightCullPad2 = 0;
+
+	ID3D12Resource* counts = mClusterLightCounts[frameIndex].Get();
+	ID3D12Resource* indices = mClusterLightIndices[frameIndex].Get();
+
+	D3D12_RESOURCE_BARRIER toCull[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(counts,
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(indices,
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+	};
+	cmdList->ResourceBarrier(_countof(toCull), toCull);
+
+	cmdList->SetPipelineState(cullPso);
+	cmdList->SetComputeRootSignature(rootSig);
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(LightCullConstants) / 4, &constants, 0);
+	cmdList->SetComputeRootShaderResourceView(1, lights);
+	cmdList->SetComputeRootUnorderedAccessView(2, counts->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(3, indices->GetGPUVirtualAddress());
+
+	// One group per cluster; every cluster's count is written, even with no lights.
+	cmdList->Dispatch(GridX, GridY, GridZ);
+
+	// A compute command list can not transition to PIXEL_SHADER_RESOURCE;
+	// the pixel shader's reads promote the buffers from COMMON instead.
+	D3D12_RESOURCE_BARRIER toCommon[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(counts,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+		CD3DX12_RESOURCE_BARRIER::Transition(indices,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON)
+	};
+	cmdList->ResourceBarrier(_countof(toCommon), toCommon);
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS ClusteredLights::ClusterLightCounts(UINT frameIndex)const
+{
+	return mClusterLightCounts[frameIndex]->GetGPUVirtualAddress();
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS ClusteredLights::ClusterLightIndices(UINT frameIndex)const
+{
+	return mClusterLightIndices[frameIndex]->GetGPUVirtualAddress();
+}
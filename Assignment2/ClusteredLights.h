@@ -0,0 +1,72 @@
+//***************************************************************************************
+// ClusteredLights.h
+//
+// Clustered forward shading of many point and spot lights.  The view frustum is cut
+// into GridX by GridY screen tiles and GridZ depth slices, each slice GridZ-th root of
+// FarZ/NearZ times deeper than the one before, so the clusters stay about as deep as
+// they are wide.  Each frame a compute shader tests every light against every
+// cluster and writes the ones that reach it to the cluster's slots of a light index
+// list; the pixel shader works out its cluster from its screen position and view depth
+// and only evaluates those lights.  A cluster keeps at most MaxLightsPerCluster
+// lights, which bounds the cost of a pixel however many lights the scene has.
+//
+// The lights are a structured buffer of Light, the point lights first; the app fills
+// it in every frame.  The directional lights stay in the pass constants.
+//
+// The cull can run on a compute queue while the graphics queue still shades an
+// earlier frame, so each frame resource has its own cluster buffers.  They rest in
+// COMMON, which the pixel shader's reads promote from.
+//***************************************************************************************
+
+#ifndef CLUSTEREDLIGHTS_H
+#define CLUSTEREDLIGHTS_H
+
+#include "../../Common/d3dUtil.h"
+
+class ClusteredLights
+{
+public:
+	// Must match Shaders/ClusterGrid.hlsl.
+	static const UINT GridX = 16;
+	static const UINT GridY = 9;
+	static const UINT GridZ = 24;
+	static const UINT MaxLightsPerCluster = 64;
+	static const UINT ClusterCount = GridX*GridY*GridZ;
+
+	// frameCount is the number of frame resources.
+	ClusteredLights(ID3D12Device* device, UINT frameCount);
+	ClusteredLights(const ClusteredLights& rhs) = delete;
+	ClusteredLights& operator=(const ClusteredLights& rhs) = delete;
+	~ClusteredLights() = default;
+
+	// The slice of view depth z is log2(z)*scale + bias, for the pass constants.
+	static void SliceConstants(float nearZ, float farZ, float& scale, float& bias);
+
+	// Records the binning of lightCount lights at lights into the clusters
+	// of the camera's view and perspective proj, for frame resource
+	// frameIndex; cmdList can be a compute command list.  Leaves the cluster
+	// buffers in COMMON.
+	void Cull(
+		ID3D12GraphicsCommandList* cmdList,
+		UINT frameIndex,
+		ID3D12RootSignature* rootSig,
+		ID3D12PipelineState* cullPso,
+		D3D12_GPU_VIRTUAL_ADDRESS lights,
+		UINT lightCount,
+		DirectX::FXMMATRIX view,
+		DirectX::CXMMATRIX proj,
+		float nearZ,
+		float farZ);
+
+	// For the root SRVs the pixel shader reads: a light count per cluster, and
+	// MaxLightsPerCluster light indices per cluster.
+	D3D12_GPU_VIRTUAL_ADDRESS ClusterLightCounts(UINT frameIndex)const;
+	D3D12_GPU_VIRTUAL_ADDRESS ClusterLightIndices(UINT frameIndex)const;
+
+private:
+	// One of each per frame resource.
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mClusterLightCounts;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mClusterLightIndices;
+};
+
+#endif // CLUSTEREDLIGHTS_H
@@ -1,33 +1,104 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT drawListCount, UINT64 timestampByteSize, UINT passCount, UINT objectCount, UINT instanceCount, UINT materialCount, UINT lightCount, UINT waveVertCount)
+    : mPassCount(passCount), mInstanceCount(instanceCount), mLightCount(lightCount), mWaveVertCount(waveVertCount)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
 		IID_PPV_ARGS(CmdListAlloc.GetAddressOf())));
+    BuildDrawCommandLists(device, drawListCount);
+    BuildTimestampReadback(device, timestampByteSize);
 
-  //  FrameCB = std::make_unique<UploadBuffer<FrameConstants>>(device, 1, true);
-    PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
-    MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
-    ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+    // One page holds all of the arrays, each aligned to 256 bytes, with room
+    // to spare for other per-frame data; more pages are only made if it runs out.
+    auto aligned = [](UINT64 byteSize) { return (byteSize + 255) & ~255ull; };
+    UINT64 pageByteSize =
+        aligned(UploadArray<ObjectConstants>::ByteSize(objectCount, true)) +
+        aligned(UploadArray<MaterialData>::ByteSize(materialCount, false)) +
+        aligned(UploadArray<PassConstants>::ByteSize(passCount, true)) +
+        aligned(UploadArray<InstanceData>::ByteSize(instanceCount, false)) +
+        aligned(UploadArray<Light>::ByteSize(lightCount, false)) +
+        aligned(UploadArray<WaveDynamicVertex>::ByteSize(waveVertCount, false)) +
+        64*1024;
+    Allocator = std::make_unique<UploadAllocator>(device, pageByteSize);
 
-    WavesVB = std::make_unique<UploadBuffer<Vertex>>(device, waveVertCount, false);
+    ObjectCB = UploadArray<ObjectConstants>(*Allocator, objectCount, true);
+    MaterialBuffer = UploadArray<MaterialData>(*Allocator, materialCount, false);
+    Allocator->KeepAllocations();
+
+    BeginFrame();
 }
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT drawListCount, UINT64 timestampByteSize, UINT passCount, UINT objectCount, UINT instanceCount, UINT materialCount, UINT lightCount)
+	: FrameResource(device, drawListCount, timestampByteSize, passCount, objectCount, instanceCount, materialCount, lightCount, 0)
 {
-	ThrowIfFailed(device->CreateCommandAllocator(
-		D3D12_COMMAND_LIST_TYPE_DIRECT,
-		IID_PPV_ARGS(CmdListAlloc.GetAddressOf())));
+}
+
+void FrameResource::BeginFrame()
+{
+    Allocator->Reset();
+
+    PassCB = UploadArray<PassConstants>(*Allocator, mPassCount, true);
+    InstanceBuffer = UploadArray<InstanceData>(*Allocator, mInstanceCount, false);
+    LightBuffer = UploadArray<Light>(*Allocator, mLightCount, false);
+    if(mWaveVertCount > 0)
+        WavesVB = UploadArray<WaveDynamicVertex>(*Allocator, mWaveVertCount, false);
+}
+
+void FrameResource::BuildComputeCommandLists(ID3D12Device* device, D3D12_COMMAND_LIST_TYPE type)
+{
+    ThrowIfFailed(device->CreateCommandAllocator(
+        type,
+        IID_PPV_ARGS(ComputeCmdListAlloc.GetAddressOf())));
 
-	//  FrameCB = std::make_unique<UploadBuffer<FrameConstants>>(device, 1, true);
-	PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
-	MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
-	ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+    ThrowIfFailed(device->CreateCommandList(
+        0,
+        type,
+        ComputeCmdListAlloc.Get(),
+        nullptr,
+        IID_PPV_ARGS(CullCmdList.GetAddressOf())));
+    CullCmdList->Close();
 
+    ThrowIfFailed(device->CreateCommandList(
+        0,
+        type,
+        ComputeCmdListAlloc.Get(),
+        nullptr,
+        IID_PPV_ARGS(WavesCmdList.GetAddressOf())));
+    WavesCmdList->Close();
 }
 
-FrameResource::~FrameResource()
+void FrameResource::BuildDrawCommandLists(ID3D12Device* device, UINT drawListCount)
 {
+    DrawCmdListAllocs.resize(drawListCount);
+    DrawCmdLists.resize(drawListCount);
+
+    for(UINT i = 0; i < drawListCount; ++i)
+    {
+        ThrowIfFailed(device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_DIRECT,
+            IID_PPV_ARGS(DrawCmdListAllocs[i].GetAddressOf())));
+
+        ThrowIfFailed(device->CreateCommandList(
+            0,
+            D3D12_COMMAND_LIST_TYPE_DIRECT,
+            DrawCmdListAllocs[i].Get(),
+            nullptr,
+            IID_PPV_ARGS(DrawCmdLists[i].GetAddressOf())));
 
-}
\ No newline at end of file
+        // Start off in a closed state, like the main command list.  Draw
+        // resets them before recording.
+        DrawCmdLists[i]->Close();
+    }
+}
+
+void FrameResource::BuildTimestampReadback(ID3D12Device* device, UINT64 timestampByteSize)
+{
+    ThrowIfFailed(device->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+        D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(timestampByteSize),
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(TimestampReadback.GetAddressOf())));
+}
@@ -2,12 +2,48 @@
 
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
-#include "../../Common/UploadBuffer.h"
+#include "UploadAllocator.h"
 
 struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+	UINT     MaterialIndex = 0;
+	// First instance of an instanced render item in InstanceBuffer.
+	UINT     InstanceOffset = 0;
+	// How far a terrain chunk's vertices are moved toward their next level of
+	// detail, in [0, 1].
+	float    Morph = 0.0f;
+	UINT     ObjPad1 = 0;
+};
+
+// One per instance of an instanced render item, read by the vertex shader
+// with SV_InstanceID.
+struct InstanceData
+{
+    DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+	UINT MaterialIndex = 0;
+	UINT InstancePad0 = 0;
+	UINT InstancePad1 = 0;
+	UINT InstancePad2 = 0;
+};
+
+// Material data for the structured buffer the shaders index with a draw's (or an
+// instance's) material index.
+struct MaterialData
+{
+	DirectX::XMFLOAT4 DiffuseAlbedo = { 1.0f, 1.0f, 1.0f, 1.0f };
+	DirectX::XMFLOAT3 FresnelR0 = { 0.01f, 0.01f, 0.01f };
+	float Roughness = 64.0f;
+
+	// Used in texture mapping.
+	DirectX::XMFLOAT4X4 MatTransform = MathHelper::Identity4x4();
+
+	UINT DiffuseMapIndex = 0;
+	UINT MaterialPad0;
+	UINT MaterialPad1;
+	UINT MaterialPad2;
 };
 
 struct PassConstants
@@ -39,6 +75,14 @@ struct PassConstants
     // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
     // are spot lights for a maximum of MaxLights per object.
     Light Lights[MaxLights];
+
+	// The first ClusterPointLightCount lights of LightBuffer are point lights,
+	// the rest spot lights.  A view depth z is in cluster slice
+	// log2(z)*ClusterSliceScale + ClusterSliceBias; see ClusteredLights.h.
+	UINT  ClusterPointLightCount = 0;
+	float ClusterSliceScale = 0.0f;
+	float ClusterSliceBias = 0.0f;
+	UINT  cbPerObjectPad3 = 0;
 };
 
 struct Vertex
@@ -48,34 +92,99 @@ struct Vertex
 	DirectX::XMFLOAT2 TexC;
 };
 
+// The CPU water grid is drawn from two vertex streams.  The x/z position and
+// tex-coords never change and live in a default-heap buffer built once...
+struct WaveStaticVertex
+{
+    DirectX::XMFLOAT2 PosXZ;
+    DirectX::XMFLOAT2 TexC;
+};
+
+// ...while only the height and the normal are uploaded every frame.  The normal
+// always points up, so just x and z are stored and the vertex shader rebuilds y.
+struct WaveDynamicVertex
+{
+    float Height;
+    DirectX::PackedVector::XMSHORTN2 NormalXZ;
+};
+
 // Stores the resources needed for the CPU to build the command lists
 // for a frame.  
 struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount);
-	FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount);
+    FrameResource(ID3D12Device* device, UINT drawListCount, UINT64 timestampByteSize, UINT passCount, UINT objectCount, UINT instanceCount, UINT materialCount, UINT lightCount, UINT waveVertCount);
+	FrameResource(ID3D12Device* device, UINT drawListCount, UINT64 timestampByteSize, UINT passCount, UINT objectCount, UINT instanceCount, UINT materialCount, UINT lightCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
-    ~FrameResource();
+    ~FrameResource() = default;
+
+    // Hands this frame's transient upload memory out again and allocates the
+    // per-frame buffers below from it.  Call once the fence says the GPU is
+    // done with the frame resource, before anything else is allocated.
+    void BeginFrame();
+
+    // Makes the compute allocator and command lists below, of type
+    // COMPUTE for a compute queue or DIRECT to run them on the graphics queue.
+    void BuildComputeCommandLists(ID3D12Device* device, D3D12_COMMAND_LIST_TYPE type);
 
     // We cannot reset the allocator until the GPU is done processing the commands.
     // So each frame needs their own allocator.
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
 
+    // One allocator and command list per draw pass, so the passes can be
+    // recorded on different threads.  The lists are created closed.
+    std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> DrawCmdListAllocs;
+    std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> DrawCmdLists;
+
+    // The frame's compute work: the culls, and the GPU waves step in a list of
+    // its own so the queue can wait in between.  Both lists are recorded from
+    // the one allocator, one after the other, and are created closed.
+    Microsoft::WRL::ComPtr<ID3D12CommandAllocator> ComputeCmdListAlloc;
+    Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> CullCmdList;
+    Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> WavesCmdList;
+
+    // The profiler's GPU timestamps for this frame are resolved here, and read
+    // back once the fence says the GPU is done with the frame.
+    Microsoft::WRL::ComPtr<ID3D12Resource> TimestampReadback;
+
     // We cannot update a cbuffer until the GPU is done processing the commands
-    // that reference it.  So each frame needs their own cbuffers.
-   // std::unique_ptr<UploadBuffer<FrameConstants>> FrameCB = nullptr;
-    std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
-    std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
-    std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
+    // that reference it.  So each frame has its own upload memory, which all of
+    // the arrays below are suballocated from.  Anything else the CPU writes
+    // for the GPU each frame can be allocated from it too, after BeginFrame.
+    std::unique_ptr<UploadAllocator> Allocator;
 
-    // We cannot update a dynamic vertex buffer until the GPU is done processing
-    // the commands that reference it.  So each frame needs their own.
-    std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
+    // Allocated once and kept: only the items and materials that changed are
+    // written, so these hold on to what earlier frames wrote.
+    UploadArray<ObjectConstants> ObjectCB;
+
+    // All the materials, indexed in the shaders rather than bound per draw.
+    UploadArray<MaterialData> MaterialBuffer;
+
+    // Allocated again by every BeginFrame, and written in full every frame.
+    UploadArray<PassConstants> PassCB;
+
+    // Instances of all the instanced render items, back to back.
+    UploadArray<InstanceData> InstanceBuffer;
+
+    // The point and spot lights, binned into clusters on the GPU each frame.
+    UploadArray<Light> LightBuffer;
+
+    // Heights and normals of the CPU waves; empty with the GPU waves.  Written
+    // in bulk through Data() instead of one CopyData per vertex.
+    UploadArray<WaveDynamicVertex> WavesVB;
 
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
     UINT64 Fence = 0;
+
+private:
+    UINT mPassCount = 0;
+    UINT mInstanceCount = 0;
+    UINT mLightCount = 0;
+    UINT mWaveVertCount = 0;
+
+    void BuildDrawCommandLists(ID3D12Device* device, UINT drawListCount);
+    void BuildTimestampReadback(ID3D12Device* device, UINT64 timestampByteSize);
 };
\ No newline at end of file
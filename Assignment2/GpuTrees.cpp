@@ -0,0 +1,197 @@
+//***************************************************************************************
+// GpuTrees.cpp
+//***************************************************************************************
+
+#include "GpuTrees.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Must match [numthreads] in Shaders/TreeCull.hlsl.
+	const UINT TreeThreadGroupSize = 64;
+
+	// Must match VisibleTree in Shaders/TreeCull.hlsl and Shaders/TreeSprite.hlsl.
+	struct VisibleTree
+	{
+		XMFLOAT3 Pos;
+		XMFLOAT2 Size;
+		UINT Slice;
+	};
+
+	// Must match cbCull in Shaders/TreeCull.hlsl.
+	struct CullConstants
+	{
+		XMFLOAT4 FrustumPlanes[6];
+		XMFLOAT3 EyePosW;
+		UINT TreeCount;
+		float LodStart;
+		float LodEnd;
+		UINT CullFrustum;
+		UINT CullPad0;
+	};
+}
+
+GpuTrees::GpuTrees(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+	const Tree* trees, UINT treeCount, UINT frameCount)
+	: mTreeCount(treeCount)
+{
+	// The buffers can not be empty, so an empty forest keeps one unused tree.
+	UINT bufferCount = (std::max)(treeCount, 1u);
+	std::vector<Tree> initTrees(trees, trees + treeCount);
+	initTrees.resize(bufferCount);
+
+	mTrees = d3dUtil::CreateDefaultBuffer(device, cmdList,
+		initTrees.data(), bufferCount*sizeof(Tree), mTreesUpload);
+
+	D3D12_DRAW_ARGUMENTS resetArgs = { 4, 0, 0, 0 };
+	mDrawArgsReset = d3dUtil::CreateDefaultBuffer(device, cmdList,
+		&resetArgs, sizeof(resetArgs), mDrawArgsResetUpload);
+
+	// CreateDefaultBuffer leaves them in GENERIC_READ, which has states a
+	// compute command list can not use.  Reads promote them from COMMON.
+	D3D12_RESOURCE_BARRIER toCommon[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mTrees.Get(),
+			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COMMON),
+		CD3DX12_RESOURCE_BARRIER::Transition(mDrawArgsReset.Get(),
+			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COMMON)
+	};
+	cmdList->ResourceBarrier(_countof(toCommon), toCommon);
+
+	mVisibleTrees.resize(frameCount);
+	mDrawArgs.resize(frameCount);
+	for(UINT i = 0; i < frameCount; ++i)
+	{
+		ThrowIfFailed(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(bufferCount*sizeof(VisibleTree), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_COMMON,
+			nullptr,
+			IID_PPV_ARGS(&mVisibleTrees[i])));
+
+		ThrowIfFailed(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(sizeof(D3D12_DRAW_ARGUMENTS), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+			D3D12_RESOURCE_STATE_COMMON,
+			nullptr,
+			IID_PPV_ARGS(&mDrawArgs[i])));
+	}
+
+	// Only draw arguments, so no root signature is needed.
+	D3D12_INDIRECT_ARGUMENT_DESC argDesc = {};
+	argDesc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW;
+
+	D3D12_COMMAND_SIGNATURE_DESC signatureDesc = {};
+	signatureDesc.ByteStride = sizeof(D3D12_DRAW_ARGUMENTS);
+	signatureDesc.NumArgumentDescs = 1;
+	signatureDesc.pArgumentDescs = &argDesc;
+	ThrowIfFailed(device->CreateCommandSignature(&signatureDesc, nullptr, IID_PPV_ARGS(&mCommandSignature)));
+}
+
+void GpuTrees::SetLodDistances(float start, float end)
+{
+	mLodStart = start;
+	mLodEnd = (std::max)(end, start + 1.0f);
+}
+
+UINT64 GpuTrees::ReleaseUploadBuffers()
+{
+	UINT64 bytes = 0;
+	if(mTreesUpload != nullptr)
+	{
+		bytes += mTreesUpload->GetDesc().Width;
+		mTreesUpload = nullptr;
+	}
+	if(mDrawArgsResetUpload != nullptr)
+	{
+		bytes += mDrawArgsResetUpload->GetDesc().Width;
+		mDrawArgsResetUpload = nullptr;
+	}
+	return bytes;
+}
+
+void GpuTrees::Cull(
+	ID3D12GraphicsCommandList* cmdList,
+	UINT frameIndex,
+	ID3D12RootSignature* rootSig,
+	ID3D12PipelineState* cullPso,
+	FXMMATRIX viewProj,
+	const XMFLOAT3& eyePosW,
+	bool cullFrustum)
+{
+	CullConstants constants;
+
+	// The planes of a row-vector viewProj, z in [0, 1], normals pointing in.
+	XMMATRIX m = XMMatrixTranspose(viewProj);
+	XMVECTOR planes[6] =
+	{
+		m.r[3] + m.r[0],	// left
+		m.r[3] - m.r[0],	// right
+		m.r[3] + m.r[1],	// bottom
+		m.r[3] - m.r[1],	// top
+		m.r[2],				// near
+		m.r[3] - m.r[2]		// far
+	};
+	for(int i = 0; i < 6; ++i)
+		XMStoreFloat4(&constants.FrustumPlanes[i], XMPlaneNormalize(planes[i]));
+
+	constants.EyePosW = eyePosW;
+	constants.TreeCount = mTreeCount;
+	constants.LodStart = mLodStart;
+	constants.LodEnd = mLodEnd;
+	constants.CullFrustum = cullFrustum ? 1 : 0;
+	constants.CullPad0 = 0;
+
+	ID3D12Resource* visibleTrees = mVisibleTrees[frameIndex].Get();
+	ID3D12Resource* drawArgs = mDrawArgs[frameIndex].Get();
+
+	// Restart the count, and make both outputs writable.
+	D3D12_RESOURCE_BARRIER toCopy[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(drawArgs,
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST),
+		CD3DX12_RESOURCE_BARRIER::Transition(visibleTrees,
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+	};
+	cmdList->ResourceBarrier(_countof(toCopy), toCopy);
+
+	cmdList->CopyBufferRegion(drawArgs, 0, mDrawArgsReset.Get(), 0, sizeof(D3D12_DRAW_ARGUMENTS));
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(drawArgs,
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+	cmdList->SetPipelineState(cullPso);
+	cmdList->SetComputeRootSignature(rootSig);
+	cmdList->SetComputeRoot32BitConstants(0, sizeof(CullConstants) / 4, &constants, 0);
+	cmdList->SetComputeRootShaderResourceView(1, mTrees->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(2, visibleTrees->GetGPUVirtualAddress());
+	cmdList->SetComputeRootUnorderedAccessView(3, drawArgs->GetGPUVirtualAddress());
+
+	UINT numGroups = (mTreeCount + TreeThreadGroupSize - 1) / TreeThreadGroupSize;
+	if(numGroups > 0)
+		cmdList->Dispatch(numGroups, 1, 1);
+
+	// The sprite vertex shader and ExecuteIndirect promote them from COMMON.
+	D3D12_RESOURCE_BARRIER toCommon[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(drawArgs,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+		CD3DX12_RESOURCE_BARRIER::Transition(visibleTrees,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON)
+	};
+	cmdList->ResourceBarrier(_countof(toCommon), toCommon);
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS GpuTrees::VisibleTrees(UINT frameIndex)const
+{
+	return mVisibleTrees[frameIndex]->GetGPUVirtualAddress();
+}
+
+void GpuTrees::Draw(ID3D12GraphicsCommandList* cmdList, UINT frameIndex)
+{
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	cmdList->ExecuteIndirect(mCommandSignature.Get(), 1, mDrawArgs[frameIndex].Get(), 0, nullptr, 0);
+}
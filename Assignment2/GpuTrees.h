@@ -0,0 +1,93 @@
+//***************************************************************************************
+// GpuTrees.h
+//
+// Tree billboards culled and drawn without the CPU looking at a single tree.  All the
+// trees live in one buffer on the GPU.  Each frame a compute shader tests them against
+// the view frustum and a distance LOD, appends the survivors to a visible-tree buffer
+// and counts them straight into the instance count of a DrawInstanced argument buffer.
+// One ExecuteIndirect then draws a camera-facing quad per visible tree; the vertex
+// shader builds the quad from SV_VertexID, so there is no geometry shader.
+//
+// The LOD thins the forest out with distance: from LodStart on, a growing share of
+// the trees (picked by a per-tree hash, so the same ones go first) is dropped, until
+// none are left at LodEnd.
+//
+// The cull can run on a compute queue while the graphics queue still draws an earlier
+// frame, so each frame resource has its own visible trees and draw arguments, and the
+// buffers rest in COMMON: the draws' reads promote them, and they decay back.
+//***************************************************************************************
+
+#ifndef GPUTREES_H
+#define GPUTREES_H
+
+#include "../../Common/d3dUtil.h"
+
+class GpuTrees
+{
+public:
+	// Layout of the tree buffer, and of the tree sprite vertices before them.
+	struct Tree
+	{
+		DirectX::XMFLOAT3 Pos;
+		DirectX::XMFLOAT2 Size;
+	};
+
+	// Records the upload of the trees into cmdList.  frameCount is the number
+	// of frame resources.
+	GpuTrees(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+		const Tree* trees, UINT treeCount, UINT frameCount);
+	GpuTrees(const GpuTrees& rhs) = delete;
+	GpuTrees& operator=(const GpuTrees& rhs) = delete;
+	~GpuTrees() = default;
+
+	UINT TreeCount()const { return mTreeCount; }
+
+	float GetLodStart()const { return mLodStart; }
+	float GetLodEnd()const { return mLodEnd; }
+	void SetLodDistances(float start, float end);
+
+	// Frees the buffers the trees were uploaded from, once the constructor's
+	// copies have executed.  Returns the bytes released.
+	UINT64 ReleaseUploadBuffers();
+
+	// Records the culling pass of frame resource frameIndex; cmdList can be a
+	// compute command list.  viewProj is the camera's; with cullFrustum false
+	// only the LOD drops trees.  Leaves that frame's buffers in COMMON.
+	void Cull(
+		ID3D12GraphicsCommandList* cmdList,
+		UINT frameIndex,
+		ID3D12RootSignature* rootSig,
+		ID3D12PipelineState* cullPso,
+		DirectX::FXMMATRIX viewProj,
+		const DirectX::XMFLOAT3& eyePosW,
+		bool cullFrustum);
+
+	// The visible trees, for the root SRV the sprite vertex shader reads.
+	D3D12_GPU_VIRTUAL_ADDRESS VisibleTrees(UINT frameIndex)const;
+
+	// Draws the visible trees as a triangle strip quad each.  The sprite PSO
+	// and the root arguments have to be set.
+	void Draw(ID3D12GraphicsCommandList* cmdList, UINT frameIndex);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Resource> mTrees;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mTreesUpload;
+
+	// Written by the cull shader, one of each per frame resource; the draw
+	// arguments count the trees in the visible trees.
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mVisibleTrees;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mDrawArgs;
+
+	// Copied over mDrawArgs before each cull: 4 vertices, 0 instances.
+	Microsoft::WRL::ComPtr<ID3D12Resource> mDrawArgsReset;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mDrawArgsResetUpload;
+
+	Microsoft::WRL::ComPtr<ID3D12CommandSignature> mCommandSignature;
+
+	UINT mTreeCount = 0;
+
+	float mLodStart = 200.0f;
+	float mLodEnd = 500.0f;
+};
+
+#endif // GPUTREES_H
@@ -0,0 +1,382 @@
+//***************************************************************************************
+// GpuWaves.cpp
+//***************************************************************************************
+
+#include "GpuWaves.h"
+#include <algorithm>
+#include <vector>
+#include <cassert>
+
+using namespace DirectX;
+
+// Must match [numthreads] in Shaders/WaveSim.hlsl.
+static const int gWaveThreadGroupSize = 16;
+
+GpuWaves::GpuWaves(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+	int m, int n, float dx, float dt, float speed, float damping)
+{
+	md3dDevice = device;
+
+	mNumRows = m;
+	mNumCols = n;
+
+	mVertexCount = m*n;
+	mTriangleCount = (m - 1)*(n - 1) * 2;
+
+	mTimeStep = dt;
+	mSpatialStep = dx;
+
+	float d = damping*dt + 2.0f;
+	float e = (speed*speed)*(dt*dt) / (dx*dx);
+	mK[0] = (damping*dt - 2.0f) / d;
+	mK[1] = (4.0f - 8.0f*e) / d;
+	mK[2] = (2.0f*e) / d;
+
+	BuildResources(cmdList);
+}
+
+int GpuWaves::RowCount()const
+{
+	return mNumRows;
+}
+
+int GpuWaves::ColumnCount()const
+{
+	return mNumCols;
+}
+
+int GpuWaves::VertexCount()const
+{
+	return mVertexCount;
+}
+
+int GpuWaves::TriangleCount()const
+{
+	return mTriangleCount;
+}
+
+float GpuWaves::Width()const
+{
+	return mNumCols*mSpatialStep;
+}
+
+float GpuWaves::Depth()const
+{
+	return mNumRows*mSpatialStep;
+}
+
+float GpuWaves::SpatialStep()const
+{
+	return mSpatialStep;
+}
+
+CD3DX12_GPU_DESCRIPTOR_HANDLE GpuWaves::DisplacementMap()const
+{
+	return mSrvTable[mCurrSol];
+}
+
+UINT GpuWaves::DescriptorCount()const
+{
+	// 3 SRV tables of (height, normal, tangent), 3 solution UAVs, normal + tangent UAVs.
+	return 3 * 3 + 3 + 2;
+}
+
+void GpuWaves::BuildResources(ID3D12GraphicsCommandList* cmdList)
+{
+	// All the textures for the wave simulation will be bound as a shader resource and
+	// unordered access view at some point since we ping-pong the buffers.
+
+	D3D12_RESOURCE_DESC texDesc;
+	ZeroMemory(&texDesc, sizeof(D3D12_RESOURCE_DESC));
+	texDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	texDesc.Alignment = 0;
+	texDesc.Width = mNumCols;
+	texDesc.Height = mNumRows;
+	texDesc.DepthOrArraySize = 1;
+	texDesc.MipLevels = 1;
+	texDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.SampleDesc.Quality = 0;
+	texDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	texDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+	for(int k = 0; k < 3; ++k)
+	{
+		ThrowIfFailed(md3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&texDesc,
+			D3D12_RESOURCE_STATE_COMMON,
+			nullptr,
+			IID_PPV_ARGS(&mSolution[k])));
+	}
+
+	D3D12_RESOURCE_DESC vecDesc = texDesc;
+	vecDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&vecDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&mNormalMap)));
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&vecDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&mTangentMap)));
+
+	//
+	// In order to copy CPU memory data into our default buffer, we need to create
+	// an intermediate upload heap.
+	//
+
+	int prev = (mCurrSol + 2) % 3;
+	int next = (mCurrSol + 1) % 3;
+
+	const UINT num2DSubresources = texDesc.DepthOrArraySize * texDesc.MipLevels;
+	const UINT64 uploadBufferSize = GetRequiredIntermediateSize(mSolution[mCurrSol].Get(), 0, num2DSubresources);
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(mPrevUploadBuffer.GetAddressOf())));
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(mCurrUploadBuffer.GetAddressOf())));
+
+	// Describe the data we want to copy into the default buffer.
+	std::vector<float> initData(mNumRows*mNumCols, 0.0f);
+
+	D3D12_SUBRESOURCE_DATA subResourceData = {};
+	subResourceData.pData = initData.data();
+	subResourceData.RowPitch = mNumCols*sizeof(float);
+	subResourceData.SlicePitch = subResourceData.RowPitch * mNumRows;
+
+	//
+	// Schedule to copy the data to the default resource, and change states.
+	// Between updates the current solution and the normal/tangent maps rest in COMMON,
+	// which the vertex shader's reads promote from, and the other two solutions stay in
+	// the UAV state.
+	//
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mSolution[prev].Get(),
+		D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+	UpdateSubresources(cmdList, mSolution[prev].Get(), mPrevUploadBuffer.Get(), 0, 0, num2DSubresources, &subResourceData);
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mSolution[prev].Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mSolution[mCurrSol].Get(),
+		D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+	UpdateSubresources(cmdList, mSolution[mCurrSol].Get(), mCurrUploadBuffer.Get(), 0, 0, num2DSubresources, &subResourceData);
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mSolution[mCurrSol].Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON));
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mSolution[next].Get(),
+		D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+	// The normal and tangent maps are created in COMMON and filled in by the first Update.
+}
+
+UINT64 GpuWaves::ReleaseUploadBuffers()
+{
+	UINT64 byteSize = 0;
+	if(mPrevUploadBuffer != nullptr)
+		byteSize += mPrevUploadBuffer->GetDesc().Width;
+	if(mCurrUploadBuffer != nullptr)
+		byteSize += mCurrUploadBuffer->GetDesc().Width;
+
+	mPrevUploadBuffer = nullptr;
+	mCurrUploadBuffer = nullptr;
+
+	return byteSize;
+}
+
+void GpuWaves::BuildDescriptors(
+	CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuDescriptor,
+	CD3DX12_GPU_DESCRIPTOR_HANDLE hGpuDescriptor,
+	UINT descriptorSize)
+{
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = 1;
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+	uavDesc.Texture2D.MipSlice = 0;
+
+	// SRV tables: (height k, normal, tangent) for k = 0, 1, 2.
+	for(int k = 0; k < 3; ++k)
+	{
+		mSrvTable[k] = hGpuDescriptor;
+
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		md3dDevice->CreateShaderResourceView(mSolution[k].Get(), &srvDesc, hCpuDescriptor);
+		hCpuDescriptor.Offset(1, descriptorSize);
+
+		srvDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+		md3dDevice->CreateShaderResourceView(mNormalMap.Get(), &srvDesc, hCpuDescriptor);
+		hCpuDescriptor.Offset(1, descriptorSize);
+
+		md3dDevice->CreateShaderResourceView(mTangentMap.Get(), &srvDesc, hCpuDescriptor);
+		hCpuDescriptor.Offset(1, descriptorSize);
+
+		hGpuDescriptor.Offset(3, descriptorSize);
+	}
+
+	// Solution UAVs.
+	uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	for(int k = 0; k < 3; ++k)
+	{
+		mSolUav[k] = hGpuDescriptor;
+
+		md3dDevice->CreateUnorderedAccessView(mSolution[k].Get(), nullptr, &uavDesc, hCpuDescriptor);
+		hCpuDescriptor.Offset(1, descriptorSize);
+		hGpuDescriptor.Offset(1, descriptorSize);
+	}
+
+	// Normal + tangent UAV table.
+	mNormalTangentUav = hGpuDescriptor;
+
+	uavDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	md3dDevice->CreateUnorderedAccessView(mNormalMap.Get(), nullptr, &uavDesc, hCpuDescriptor);
+	hCpuDescriptor.Offset(1, descriptorSize);
+
+	md3dDevice->CreateUnorderedAccessView(mTangentMap.Get(), nullptr, &uavDesc, hCpuDescriptor);
+}
+
+void GpuWaves::Update(
+	float dt,
+	ID3D12GraphicsCommandList* cmdList,
+	ID3D12RootSignature* rootSig,
+	ID3D12PipelineState* updatePso,
+	ID3D12PipelineState* disturbPso,
+	ID3D12PipelineState* normalsPso)
+{
+	// Accumulate time and work out how many fixed steps it buys.
+	mAccumTime += dt;
+
+	int steps = 0;
+	for(; steps < mMaxSubsteps && mAccumTime >= mTimeStep; ++steps)
+		mAccumTime -= mTimeStep;
+
+	// Hit the cap: drop the backlog rather than falling further behind.
+	if(mAccumTime >= mTimeStep)
+		mAccumTime = 0.0f;
+
+	if(steps == 0 && mPendingDisturbances.empty() && mNormalsValid)
+		return;
+
+	UINT numGroupsX = (UINT)(mNumCols + gWaveThreadGroupSize - 1) / gWaveThreadGroupSize;
+	UINT numGroupsY = (UINT)(mNumRows + gWaveThreadGroupSize - 1) / gWaveThreadGroupSize;
+
+	int gridSize[2] = { mNumCols, mNumRows };
+
+	cmdList->SetComputeRootSignature(rootSig);
+	cmdList->SetComputeRoot32BitConstants(0, 3, mK, 0);
+	cmdList->SetComputeRoot32BitConstants(0, 2, gridSize, 6);
+	cmdList->SetComputeRoot32BitConstants(0, 1, &mSpatialStep, 8);
+
+	// The current solution and the normal/tangent maps are written below.
+	D3D12_RESOURCE_BARRIER toUav[3] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mSolution[mCurrSol].Get(),
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(mNormalMap.Get(),
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+		CD3DX12_RESOURCE_BARRIER::Transition(mTangentMap.Get(),
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+	};
+	cmdList->ResourceBarrier(_countof(toUav), toUav);
+
+	//
+	// Apply the queued disturbances to the current solution.
+	//
+	if(!mPendingDisturbances.empty())
+	{
+		cmdList->SetPipelineState(disturbPso);
+		cmdList->SetComputeRootDescriptorTable(3, mSolUav[mCurrSol]);
+
+		for(auto& d : mPendingDisturbances)
+		{
+			int disturbIndex[2] = { d.J, d.I };
+			cmdList->SetComputeRoot32BitConstants(0, 1, &d.Magnitude, 3);
+			cmdList->SetComputeRoot32BitConstants(0, 2, disturbIndex, 4);
+
+			cmdList->Dispatch(1, 1, 1);
+			cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(mSolution[mCurrSol].Get()));
+		}
+
+		mPendingDisturbances.clear();
+	}
+
+	// Only update the simulation at the specified time step.  All three
+	// solutions are in the UAV state here, so the steps just rotate them.
+	for(int s = 0; s < steps; ++s)
+	{
+		int prev = (mCurrSol + 2) % 3;
+		int next = (mCurrSol + 1) % 3;
+
+		cmdList->SetPipelineState(updatePso);
+		cmdList->SetComputeRootDescriptorTable(1, mSolUav[prev]);
+		cmdList->SetComputeRootDescriptorTable(2, mSolUav[mCurrSol]);
+		cmdList->SetComputeRootDescriptorTable(3, mSolUav[next]);
+
+		cmdList->Dispatch(numGroupsX, numGroupsY, 1);
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+
+		// Ping-pong buffers in preparation for the next update.
+		// The previous solution is no longer needed and becomes the target of the next solution in the next update.
+		// The current solution becomes the previous solution.
+		// The next solution becomes the current solution.
+		mCurrSol = next;
+	}
+
+	//
+	// Compute normals and tangents using finite difference scheme.
+	//
+	cmdList->SetPipelineState(normalsPso);
+	cmdList->SetComputeRootDescriptorTable(2, mSolUav[mCurrSol]);
+	cmdList->SetComputeRootDescriptorTable(4, mNormalTangentUav);
+
+	cmdList->Dispatch(numGroupsX, numGroupsY, 1);
+
+	mNormalsValid = true;
+
+	// The vertex shader reads the current solution and the normal/tangent maps,
+	// possibly on another queue; its reads promote them from COMMON and they
+	// decay back when that work is done.
+	D3D12_RESOURCE_BARRIER toCommon[3] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mSolution[mCurrSol].Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+		CD3DX12_RESOURCE_BARRIER::Transition(mNormalMap.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+		CD3DX12_RESOURCE_BARRIER::Transition(mTangentMap.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+	};
+	cmdList->ResourceBarrier(_countof(toCommon), toCommon);
+}
+
+void GpuWaves::Disturb(int i, int j, float magnitude)
+{
+	// Don't disturb boundaries.
+	assert(i > 1 && i < mNumRows-2);
+	assert(j > 1 && j < mNumCols-2);
+
+	mPendingDisturbances.push_back({ i, j, magnitude });
+}
@@ -0,0 +1,121 @@
+//***************************************************************************************
+// GpuWaves.h
+//
+// Performs the calculations for the wave simulation using the ComputeShader on the GPU.
+// The solution is saved to a floating-point texture.  The client must then set this
+// texture as a SRV and do the displacement mapping in the vertex shader over a grid.
+// Normals and x-axis tangents are also computed on the GPU and kept in textures so the
+// CPU never touches the wave data after initialization.
+//***************************************************************************************
+
+#ifndef GPUWAVES_H
+#define GPUWAVES_H
+
+#include "../../Common/d3dUtil.h"
+
+class GpuWaves
+{
+public:
+	// Note that m,n do not need to be divisible by 16; the shaders reject
+	// the threads of the last group that fall outside the grid.
+	GpuWaves(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+		int m, int n, float dx, float dt, float speed, float damping);
+	GpuWaves(const GpuWaves& rhs) = delete;
+	GpuWaves& operator=(const GpuWaves& rhs) = delete;
+	~GpuWaves() = default;
+
+	int RowCount()const;
+	int ColumnCount()const;
+	int VertexCount()const;
+	int TriangleCount()const;
+	float Width()const;
+	float Depth()const;
+	float SpatialStep()const;
+
+	// Most time steps one Update may record; any time left over after that
+	// is dropped.
+	int GetMaxSubsteps()const { return mMaxSubsteps; }
+	void SetMaxSubsteps(int maxSubsteps) { mMaxSubsteps = maxSubsteps; }
+
+	// Height field, normal map and tangent map, bound as one contiguous SRV table (t1..t3).
+	CD3DX12_GPU_DESCRIPTOR_HANDLE DisplacementMap()const;
+
+	UINT DescriptorCount()const;
+
+	void BuildResources(ID3D12GraphicsCommandList* cmdList);
+
+	// Frees the buffers the initial solutions were uploaded from, once the
+	// BuildResources copies have executed.  Returns the bytes released.
+	UINT64 ReleaseUploadBuffers();
+
+	void BuildDescriptors(
+		CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuDescriptor,
+		CD3DX12_GPU_DESCRIPTOR_HANDLE hGpuDescriptor,
+		UINT descriptorSize);
+
+	// Records the simulation step(s) and the normal/tangent pass; cmdList can
+	// be a compute command list.  Leaves the height, normal and tangent maps in
+	// COMMON, which the vertex shader's reads promote from.  The caller must
+	// not let it run while an earlier frame's draws still read the maps.
+	void Update(
+		float dt,
+		ID3D12GraphicsCommandList* cmdList,
+		ID3D12RootSignature* rootSig,
+		ID3D12PipelineState* updatePso,
+		ID3D12PipelineState* disturbPso,
+		ID3D12PipelineState* normalsPso);
+
+	// Queued and applied on the GPU by the next Update.
+	void Disturb(int i, int j, float magnitude);
+
+private:
+	struct Disturbance
+	{
+		int I;
+		int J;
+		float Magnitude;
+	};
+
+	int mNumRows = 0;
+	int mNumCols = 0;
+
+	int mVertexCount = 0;
+	int mTriangleCount = 0;
+
+	// Simulation constants we can precompute.
+	float mK[3];
+
+	float mTimeStep = 0.0f;
+	float mSpatialStep = 0.0f;
+
+	// Simulated time not yet consumed by a step.
+	float mAccumTime = 0.0f;
+	int mMaxSubsteps = 4;
+
+	std::vector<Disturbance> mPendingDisturbances;
+
+	ID3D12Device* md3dDevice = nullptr;
+
+	bool mNormalsValid = false;
+
+	// The three solution textures are ping-ponged by rotating mCurrSol:
+	// prev = (curr + 2) % 3 and next = (curr + 1) % 3.
+	int mCurrSol = 1;
+
+	// One SRV table per solution texture, laid out as (height, normal, tangent),
+	// so that rotating the solutions never rewrites a descriptor the GPU may
+	// still be reading from an earlier frame.
+	CD3DX12_GPU_DESCRIPTOR_HANDLE mSrvTable[3];
+	CD3DX12_GPU_DESCRIPTOR_HANDLE mSolUav[3];
+	CD3DX12_GPU_DESCRIPTOR_HANDLE mNormalTangentUav;
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mSolution[3];
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mNormalMap = nullptr;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mTangentMap = nullptr;
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mPrevUploadBuffer = nullptr;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mCurrUploadBuffer = nullptr;
+};
+
+#endif // GPUWAVES_H
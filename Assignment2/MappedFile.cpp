@@ -0,0 +1,41 @@
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const std::wstring& filename)
+{
+	mFile = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(mFile == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+		return;
+	mSize = (size_t)size.QuadPart;
+
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mMapping != nullptr)
+		mView = MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+
+	if(mView != nullptr)
+	{
+		mData = static_cast<const BYTE*>(mView);
+		return;
+	}
+
+	mBuffer.resize(mSize);
+	DWORD bytesRead = 0;
+	if(ReadFile(mFile, mBuffer.data(), (DWORD)mSize, &bytesRead, nullptr) && bytesRead == mSize)
+		mData = mBuffer.data();
+	else
+		mSize = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	if(mView != nullptr)
+		UnmapViewOfFile(mView);
+	if(mMapping != nullptr)
+		CloseHandle(mMapping);
+	if(mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+}
@@ -0,0 +1,34 @@
+//***************************************************************************************
+// MappedFile.h
+//
+// Read-only view of a whole file, memory-mapped so the pages are read in as they are
+// touched.  Falls back to reading the file into memory if it can not be mapped.
+//***************************************************************************************
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "../../Common/d3dUtil.h"
+
+class MappedFile
+{
+public:
+	// Data() is null if the file could not be opened or is empty.
+	explicit MappedFile(const std::wstring& filename);
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+	~MappedFile();
+
+	const BYTE* Data()const { return mData; }
+	size_t Size()const { return mSize; }
+
+private:
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+	void* mView = nullptr;
+	std::vector<BYTE> mBuffer;
+	const BYTE* mData = nullptr;
+	size_t mSize = 0;
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,265 @@
+#include "PipelineCache.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	const UINT32 FileMagic = 0x4f535050; // "PPSO"
+	const UINT32 FileVersion = 1;
+}
+
+PipelineCache::PipelineCache(ID3D12Device* device, IDXGIAdapter* adapter, const std::wstring& filename)
+	: mFilename(filename), mDevice(device)
+{
+	DXGI_ADAPTER_DESC adapterDesc;
+	ThrowIfFailed(adapter->GetDesc(&adapterDesc));
+
+	// The user mode driver version; D3D12 has no query of its own.
+	LARGE_INTEGER driverVersion = {};
+	adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driverVersion);
+
+	mHeader.Magic = FileMagic;
+	mHeader.Version = FileVersion;
+	mHeader.VendorId = adapterDesc.VendorId;
+	mHeader.DeviceId = adapterDesc.DeviceId;
+	mHeader.SubSysId = adapterDesc.SubSysId;
+	mHeader.Revision = adapterDesc.Revision;
+	mHeader.DriverVersion = driverVersion.QuadPart;
+
+	// Pipeline libraries need ID3D12Device1 and a driver that supports them.
+	if(SUCCEEDED(device->QueryInterface(IID_PPV_ARGS(&mDevice1))))
+	{
+		ComPtr<ID3D12PipelineLibrary> probe;
+		if(mDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&probe)) == DXGI_ERROR_UNSUPPORTED)
+			mDevice1.Reset();
+	}
+	mHeader.UsesLibrary = mDevice1 != nullptr;
+
+	ReadFile();
+
+	if(mDevice1 != nullptr && mLibrary == nullptr)
+		CreateLibrary(nullptr, 0);
+}
+
+ComPtr<ID3D12PipelineState> PipelineCache::CreateGraphicsPipeline(
+	const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	ComPtr<ID3D12PipelineState> pso;
+	std::wstring wname = AnsiToWString(name);
+
+	if(mLibrary != nullptr)
+	{
+		// E_INVALIDARG means it is not in the library, or its description changed.
+		if(SUCCEEDED(mLibrary->LoadGraphicsPipeline(wname.c_str(), &desc, IID_PPV_ARGS(&pso))))
+		{
+			++mLoadedCount;
+			mPipelines.push_back({ wname, pso });
+			return pso;
+		}
+	}
+	else
+	{
+		auto it = mCachedBlobs.find(name);
+		if(it != mCachedBlobs.end())
+		{
+			D3D12_GRAPHICS_PIPELINE_STATE_DESC cachedDesc = desc;
+			cachedDesc.CachedPSO = { it->second.data(), it->second.size() };
+			if(SUCCEEDED(mDevice->CreateGraphicsPipelineState(&cachedDesc, IID_PPV_ARGS(&pso))))
+			{
+				++mLoadedCount;
+				return pso;
+			}
+		}
+	}
+
+	ThrowIfFailed(mDevice->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pso)));
+	++mCreatedCount;
+
+	StorePipeline(name, pso.Get());
+	return pso;
+}
+
+ComPtr<ID3D12PipelineState> PipelineCache::CreateComputePipeline(
+	const std::string& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+{
+	ComPtr<ID3D12PipelineState> pso;
+	std::wstring wname = AnsiToWString(name);
+
+	if(mLibrary != nullptr)
+	{
+		if(SUCCEEDED(mLibrary->LoadComputePipeline(wname.c_str(), &desc, IID_PPV_ARGS(&pso))))
+		{
+			++mLoadedCount;
+			mPipelines.push_back({ wname, pso });
+			return pso;
+		}
+	}
+	else
+	{
+		auto it = mCachedBlobs.find(name);
+		if(it != mCachedBlobs.end())
+		{
+			D3D12_COMPUTE_PIPELINE_STATE_DESC cachedDesc = desc;
+			cachedDesc.CachedPSO = { it->second.data(), it->second.size() };
+			if(SUCCEEDED(mDevice->CreateComputePipelineState(&cachedDesc, IID_PPV_ARGS(&pso))))
+			{
+				++mLoadedCount;
+				return pso;
+			}
+		}
+	}
+
+	ThrowIfFailed(mDevice->CreateComputePipelineState(&desc, IID_PPV_ARGS(&pso)));
+	++mCreatedCount;
+
+	StorePipeline(name, pso.Get());
+	return pso;
+}
+
+void PipelineCache::Save()
+{
+	// Called on exit, so failures only lose the cache; nothing throws.
+	if(!mDirty)
+		return;
+
+	std::vector<char> payload;
+	if(mLibrary != nullptr)
+	{
+		// A PSO whose description changed can not be stored over the old one
+		// under the same name, so start a new library from this run's PSOs.
+		if(mRebuildLibrary)
+		{
+			ComPtr<ID3D12PipelineLibrary> library;
+			if(FAILED(mDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&library))))
+				return;
+			for(auto& e : mPipelines)
+				library->StorePipeline(e.first.c_str(), e.second.Get());
+			mLibrary = library;
+			mRebuildLibrary = false;
+		}
+
+		payload.resize(mLibrary->GetSerializedSize());
+		if(FAILED(mLibrary->Serialize(payload.data(), payload.size())))
+			return;
+	}
+	else
+	{
+		// Count, then for each PSO its name and blob, both prefixed by their size.
+		auto write = [&payload](const void* data, size_t size)
+		{
+			const char* bytes = static_cast<const char*>(data);
+			payload.insert(payload.end(), bytes, bytes + size);
+		};
+
+		UINT32 count = (UINT32)mCachedBlobs.size();
+		write(&count, sizeof(count));
+		for(auto& e : mCachedBlobs)
+		{
+			UINT32 nameSize = (UINT32)e.first.size();
+			UINT32 blobSize = (UINT32)e.second.size();
+			write(&nameSize, sizeof(nameSize));
+			write(e.first.data(), nameSize);
+			write(&blobSize, sizeof(blobSize));
+			write(e.second.data(), blobSize);
+		}
+	}
+
+	std::ofstream fout(mFilename, std::ios::binary | std::ios::trunc);
+	fout.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+	fout.write(payload.data(), payload.size());
+
+	mDirty = false;
+}
+
+void PipelineCache::ReadFile()
+{
+	std::ifstream fin(mFilename, std::ios::binary);
+	if(!fin)
+		return;
+
+	FileHeader header;
+	if(!fin.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return;
+
+	// Made for another adapter or driver; it is rebuilt as the PSOs are created.
+	if(memcmp(&header, &mHeader, sizeof(header)) != 0)
+		return;
+
+	mFileData.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+	if(mDevice1 != nullptr)
+	{
+		CreateLibrary(mFileData.data(), mFileData.size());
+		return;
+	}
+
+	// Stop at the first entry that does not fit; what was read is still usable.
+	size_t offset = 0;
+	auto read = [this, &offset](void* data, size_t size)
+	{
+		if(offset + size > mFileData.size())
+			return false;
+		CopyMemory(data, mFileData.data() + offset, size);
+		offset += size;
+		return true;
+	};
+
+	UINT32 count = 0;
+	if(!read(&count, sizeof(count)))
+		return;
+
+	for(UINT32 i = 0; i < count; ++i)
+	{
+		UINT32 nameSize = 0;
+		if(!read(&nameSize, sizeof(nameSize)))
+			break;
+		std::string name(nameSize, '\0');
+		if(!read(&name[0], nameSize))
+			break;
+
+		UINT32 blobSize = 0;
+		if(!read(&blobSize, sizeof(blobSize)))
+			break;
+		std::vector<char> blob(blobSize);
+		if(!read(blob.data(), blobSize))
+			break;
+
+		mCachedBlobs[name] = std::move(blob);
+	}
+
+	mFileData.clear();
+}
+
+void PipelineCache::CreateLibrary(const void* data, size_t size)
+{
+	// A library the driver rejects (corrupt, or D3D12_ERROR_DRIVER_VERSION_MISMATCH
+	// despite the header) is replaced by an empty one.
+	if(size == 0 || FAILED(mDevice1->CreatePipelineLibrary(data, size, IID_PPV_ARGS(&mLibrary))))
+	{
+		mFileData.clear();
+		ThrowIfFailed(mDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&mLibrary)));
+		mDirty = true;
+	}
+}
+
+void PipelineCache::StorePipeline(const std::string& name, ID3D12PipelineState* pso)
+{
+	mDirty = true;
+
+	if(mLibrary != nullptr)
+	{
+		std::wstring wname = AnsiToWString(name);
+		mPipelines.push_back({ wname, pso });
+
+		if(FAILED(mLibrary->StorePipeline(wname.c_str(), pso)))
+			mRebuildLibrary = true;
+		return;
+	}
+
+	ComPtr<ID3DBlob> blob;
+	if(SUCCEEDED(pso->GetCachedBlob(&blob)))
+	{
+		const char* bytes = static_cast<const char*>(blob->GetBufferPointer());
+		mCachedBlobs[name].assign(bytes, bytes + blob->GetBufferSize());
+	}
+}
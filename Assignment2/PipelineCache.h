@@ -0,0 +1,81 @@
+//***************************************************************************************
+// PipelineCache.h
+//
+// Keeps the driver's compiled pipeline states on disk so they are not rebuilt from
+// the shader bytecode on every launch.  The PSOs go into an ID3D12PipelineLibrary;
+// on devices without one (before ID3D12Device1) each PSO's GetCachedBlob is kept
+// instead and passed back through CachedPSO.
+//
+// The file starts with the adapter and driver version it was made with, and is
+// ignored when either differs.  A PSO whose description changed is rebuilt.
+// Save writes the file only if something was rebuilt.
+//***************************************************************************************
+
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+#include "../../Common/d3dUtil.h"
+
+class PipelineCache
+{
+public:
+	PipelineCache(ID3D12Device* device, IDXGIAdapter* adapter, const std::wstring& filename);
+	PipelineCache(const PipelineCache& rhs) = delete;
+	PipelineCache& operator=(const PipelineCache& rhs) = delete;
+	~PipelineCache() = default;
+
+	// Same as ID3D12Device::CreateGraphicsPipelineState/CreateComputePipelineState;
+	// name identifies the PSO in the cache and must be unique.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> CreateGraphicsPipeline(
+		const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> CreateComputePipeline(
+		const std::string& name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc);
+
+	// Does not throw; a cache that can not be written is just rebuilt next run.
+	void Save();
+
+	UINT LoadedCount()const { return mLoadedCount; }
+	UINT CreatedCount()const { return mCreatedCount; }
+
+private:
+	struct FileHeader
+	{
+		UINT32 Magic;
+		UINT32 Version;
+		UINT32 VendorId;
+		UINT32 DeviceId;
+		UINT32 SubSysId;
+		UINT32 Revision;
+		UINT64 DriverVersion;
+		UINT32 UsesLibrary;
+		UINT32 Pad;
+	};
+
+	void ReadFile();
+	void CreateLibrary(const void* data, size_t size);
+	void StorePipeline(const std::string& name, ID3D12PipelineState* pso);
+
+	std::wstring mFilename;
+	FileHeader mHeader = {};
+
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D12Device1> mDevice1;
+	Microsoft::WRL::ComPtr<ID3D12PipelineLibrary> mLibrary;
+
+	// The library reads from the file contents for as long as it lives.
+	std::vector<char> mFileData;
+
+	// Fallback without a library: cached blob of each PSO, by name.
+	std::unordered_map<std::string, std::vector<char>> mCachedBlobs;
+
+	// Every PSO made this run, to rebuild the library from if a stored PSO
+	// could not be replaced in place.
+	std::vector<std::pair<std::wstring, Microsoft::WRL::ComPtr<ID3D12PipelineState>>> mPipelines;
+	bool mRebuildLibrary = false;
+	bool mDirty = false;
+
+	UINT mLoadedCount = 0;
+	UINT mCreatedCount = 0;
+};
+
+#endif // PIPELINECACHE_H
@@ -0,0 +1,199 @@
+#include "Profiler.h"
+#include <sstream>
+#include <iomanip>
+
+Profiler::Profiler(ID3D12Device* device, ID3D12CommandQueue* queue, UINT frameCount, UINT maxGpuScopes)
+{
+	mMaxGpuScopes = maxGpuScopes;
+
+	// A begin and an end timestamp per scope, for every frame resource.
+	D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+	queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	queryHeapDesc.Count = 2*mMaxGpuScopes*frameCount;
+	ThrowIfFailed(device->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&mQueryHeap)));
+
+	UINT64 gpuFrequency = 0;
+	ThrowIfFailed(queue->GetTimestampFrequency(&gpuFrequency));
+	mGpuTicksPerMs = gpuFrequency / 1000.0;
+
+	LARGE_INTEGER cpuFrequency;
+	QueryPerformanceFrequency(&cpuFrequency);
+	mCpuTicksPerMs = cpuFrequency.QuadPart / 1000.0;
+
+	mFrames.resize(frameCount);
+}
+
+UINT Profiler::AddCpuScope(const std::string& name)
+{
+	Scope scope;
+	scope.Name = name;
+	scope.History.resize(HistoryLength, 0.0);
+	mCpuScopes.push_back(scope);
+
+	for(auto& frame : mFrames)
+	{
+		frame.CpuMs.resize(mCpuScopes.size(), 0.0);
+		frame.CpuStart.resize(mCpuScopes.size());
+	}
+
+	return (UINT)mCpuScopes.size() - 1;
+}
+
+UINT Profiler::AddGpuScope(const std::string& name, ID3D12CommandQueue* queue)
+{
+	assert(mGpuScopes.size() < mMaxGpuScopes);
+
+	Scope scope;
+	scope.Name = name;
+	scope.History.resize(HistoryLength, 0.0);
+
+	scope.GpuTicksPerMs = mGpuTicksPerMs;
+	if(queue != nullptr)
+	{
+		UINT64 gpuFrequency = 0;
+		ThrowIfFailed(queue->GetTimestampFrequency(&gpuFrequency));
+		scope.GpuTicksPerMs = gpuFrequency / 1000.0;
+	}
+	mGpuScopes.push_back(scope);
+
+	return (UINT)mGpuScopes.size() - 1;
+}
+
+UINT64 Profiler::ReadbackByteSize()const
+{
+	return 2*mMaxGpuScopes*sizeof(UINT64);
+}
+
+bool Profiler::OpenCsv(const std::string& filename)
+{
+	mCsv.open(filename, std::ios::out | std::ios::trunc);
+	if(!mCsv)
+		return false;
+
+	mCsv << "frame";
+	for(auto& scope : mCpuScopes)
+		mCsv << ",cpu " << scope.Name;
+	for(auto& scope : mGpuScopes)
+		mCsv << ",gpu " << scope.Name;
+	mCsv << "\n";
+
+	return true;
+}
+
+bool Profiler::BeginFrame(UINT frameIndex, ID3D12Resource* timestampReadback)
+{
+	FrameTimes& frame = mFrames[frameIndex];
+	bool reported = frame.Submitted;
+
+	if(frame.Submitted)
+	{
+		std::vector<double> gpuMs(mGpuScopes.size(), 0.0);
+
+		if(!mGpuScopes.empty())
+		{
+			D3D12_RANGE readRange = { 0, 2*mGpuScopes.size()*sizeof(UINT64) };
+			UINT64* timestamps = nullptr;
+			ThrowIfFailed(timestampReadback->Map(0, &readRange, reinterpret_cast<void**>(&timestamps)));
+
+			for(size_t i = 0; i < mGpuScopes.size(); ++i)
+				gpuMs[i] = (timestamps[2*i + 1] - timestamps[2*i]) / mGpuScopes[i].GpuTicksPerMs;
+
+			// Nothing was written.
+			D3D12_RANGE writeRange = { 0, 0 };
+			timestampReadback->Unmap(0, &writeRange);
+		}
+
+		for(size_t i = 0; i < mCpuScopes.size(); ++i)
+			AddSample(mCpuScopes[i], frame.CpuMs[i]);
+		for(size_t i = 0; i < mGpuScopes.size(); ++i)
+			AddSample(mGpuScopes[i], gpuMs[i]);
+
+		mHistoryIndex = (mHistoryIndex + 1) % HistoryLength;
+		mHistoryCount = (std::min)(mHistoryCount + 1, HistoryLength);
+
+		if(mCsv.is_open())
+			WriteCsvRow(frame, gpuMs);
+
+		mLastFrameNumber = frame.FrameNumber;
+		mLastCpuMs = frame.CpuMs;
+		mLastGpuMs = gpuMs;
+	}
+
+	mCurrFrame = frameIndex;
+
+	frame.FrameNumber = mFrameCount++;
+	frame.Submitted = false;
+	std::fill(frame.CpuMs.begin(), frame.CpuMs.end(), 0.0);
+
+	return reported;
+}
+
+void Profiler::BeginCpu(UINT scope)
+{
+	QueryPerformanceCounter(&mFrames[mCurrFrame].CpuStart[scope]);
+}
+
+void Profiler::EndCpu(UINT scope)
+{
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+
+	// A scope entered more than once a frame reports the total.
+	FrameTimes& frame = mFrames[mCurrFrame];
+	frame.CpuMs[scope] += (end.QuadPart - frame.CpuStart[scope].QuadPart) / mCpuTicksPerMs;
+}
+
+void Profiler::BeginGpu(ID3D12GraphicsCommandList* cmdList, UINT scope)
+{
+	UINT query = 2*(mCurrFrame*mMaxGpuScopes + scope);
+	cmdList->EndQuery(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query);
+}
+
+void Profiler::EndGpu(ID3D12GraphicsCommandList* cmdList, UINT scope)
+{
+	UINT query = 2*(mCurrFrame*mMaxGpuScopes + scope) + 1;
+	cmdList->EndQuery(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query);
+}
+
+void Profiler::ResolveGpu(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* timestampReadback)
+{
+	if(!mGpuScopes.empty())
+	{
+		cmdList->ResolveQueryData(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP,
+			2*mCurrFrame*mMaxGpuScopes, 2*(UINT)mGpuScopes.size(), timestampReadback, 0);
+	}
+
+	mFrames[mCurrFrame].Submitted = true;
+}
+
+std::wstring Profiler::Summary()const
+{
+	std::wostringstream out;
+	out << std::fixed << std::setprecision(2);
+
+	double count = (std::max)(mHistoryCount, 1u);
+	for(auto& scope : mCpuScopes)
+		out << L"  " << AnsiToWString(scope.Name) << L" " << scope.Sum / count;
+
+	out << L"  | gpu";
+	for(auto& scope : mGpuScopes)
+		out << L"  " << AnsiToWString(scope.Name) << L" " << scope.Sum / count;
+
+	return out.str();
+}
+
+void Profiler::AddSample(Scope& scope, double ms)
+{
+	scope.Sum += ms - scope.History[mHistoryIndex];
+	scope.History[mHistoryIndex] = ms;
+}
+
+void Profiler::WriteCsvRow(const FrameTimes& frame, const std::vector<double>& gpuMs)
+{
+	mCsv << frame.FrameNumber;
+	for(double ms : frame.CpuMs)
+		mCsv << "," << ms;
+	for(double ms : gpuMs)
+		mCsv << "," << ms;
+	mCsv << "\n";
+}
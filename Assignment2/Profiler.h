@@ -0,0 +1,130 @@
+//***************************************************************************************
+// Profiler.h
+//
+// CPU scope timers and GPU timestamp queries for finding where the frame time goes.
+// The scopes are registered up front, so each has its own slot and scopes timed on
+// different threads never touch the same data.
+//
+// The GPU timestamps of a frame are resolved into that frame resource's readback
+// buffer and only read once its fence has passed, so the results lag the CPU by the
+// frames in flight; a frame's CPU times are kept until its GPU times arrive, and the
+// two are reported together.
+//***************************************************************************************
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "../../Common/d3dUtil.h"
+#include <fstream>
+
+class Profiler
+{
+public:
+	Profiler(ID3D12Device* device, ID3D12CommandQueue* queue, UINT frameCount, UINT maxGpuScopes);
+	Profiler(const Profiler& rhs) = delete;
+	Profiler& operator=(const Profiler& rhs) = delete;
+	~Profiler() = default;
+
+	// Register every scope before the first BeginFrame.  queue is the one the
+	// GPU scope's command lists run on, if not the constructor's; each queue
+	// has its own timestamp frequency.
+	UINT AddCpuScope(const std::string& name);
+	UINT AddGpuScope(const std::string& name, ID3D12CommandQueue* queue = nullptr);
+
+	// Size of the READBACK buffer each frame resource needs for ResolveGpu.
+	UINT64 ReadbackByteSize()const;
+
+	// Writes a header and then one row per completed frame.
+	bool OpenCsv(const std::string& filename);
+
+	// Call once the GPU is done with frame resource frameIndex, before building
+	// a new frame in it: reports the frame it last held and starts a new one.
+	// Returns true if a frame was reported.
+	bool BeginFrame(UINT frameIndex, ID3D12Resource* timestampReadback);
+
+	// Times of the frame the last BeginFrame reported.
+	UINT64 LastFrameNumber()const { return mLastFrameNumber; }
+	double LastCpuMs(UINT scope)const { return mLastCpuMs[scope]; }
+	double LastGpuMs(UINT scope)const { return mLastGpuMs[scope]; }
+
+	void BeginCpu(UINT scope);
+	void EndCpu(UINT scope);
+
+	// Every GPU scope must be written every frame, since ResolveGpu resolves
+	// all of them.
+	void BeginGpu(ID3D12GraphicsCommandList* cmdList, UINT scope);
+	void EndGpu(ID3D12GraphicsCommandList* cmdList, UINT scope);
+
+	// Record after the last EndGpu of the frame, in the last command list submitted.
+	void ResolveGpu(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* timestampReadback);
+
+	// Rolling averages in milliseconds over the last HistoryLength frames.
+	std::wstring Summary()const;
+
+private:
+	struct FrameTimes
+	{
+		UINT64 FrameNumber = 0;
+		bool Submitted = false;
+		std::vector<double> CpuMs;
+		std::vector<LARGE_INTEGER> CpuStart;
+	};
+
+	struct Scope
+	{
+		std::string Name;
+		std::vector<double> History;
+		double Sum = 0.0;
+
+		// GPU scopes only: the frequency of the queue they are timed on.
+		double GpuTicksPerMs = 0.0;
+	};
+
+	void AddSample(Scope& scope, double ms);
+	void WriteCsvRow(const FrameTimes& frame, const std::vector<double>& gpuMs);
+
+	static const UINT HistoryLength = 64;
+
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> mQueryHeap;
+
+	UINT mMaxGpuScopes = 0;
+	// Of the queue passed to the constructor.
+	double mGpuTicksPerMs = 0.0;
+	double mCpuTicksPerMs = 0.0;
+
+	std::vector<Scope> mCpuScopes;
+	std::vector<Scope> mGpuScopes;
+
+	// One per frame resource; mCurrFrame is the one being built.
+	std::vector<FrameTimes> mFrames;
+	UINT mCurrFrame = 0;
+	UINT64 mFrameCount = 0;
+	UINT mHistoryIndex = 0;
+	UINT mHistoryCount = 0;
+
+	UINT64 mLastFrameNumber = 0;
+	std::vector<double> mLastCpuMs;
+	std::vector<double> mLastGpuMs;
+
+	std::ofstream mCsv;
+};
+
+// Times the enclosing block with Profiler::BeginCpu/EndCpu.
+class ProfileCpuScope
+{
+public:
+	ProfileCpuScope(Profiler* profiler, UINT scope) : mProfiler(profiler), mScope(scope)
+	{
+		mProfiler->BeginCpu(mScope);
+	}
+	~ProfileCpuScope() { mProfiler->EndCpu(mScope); }
+
+	ProfileCpuScope(const ProfileCpuScope& rhs) = delete;
+	ProfileCpuScope& operator=(const ProfileCpuScope& rhs) = delete;
+
+private:
+	Profiler* mProfiler;
+	UINT mScope;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,64 @@
+//***************************************************************************************
+// RadixSort.h
+//
+// Stable LSD radix sort of values by an integer key, 8 bits per pass.  It is linear in
+// the number of values, and being stable, values with equal keys stay in the order they
+// came in.  Sorting last frame's order again with this frame's keys therefore costs one
+// check when nothing moved, and otherwise never swaps two equally deep surfaces back
+// and forth between frames.
+//***************************************************************************************
+
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <vector>
+#include <cstdint>
+
+template<typename T>
+struct RadixSortEntry
+{
+	std::uint32_t Key;
+	T Value;
+};
+
+// Sorts entries by the low keyBits bits of their keys, ascending.  scratch is the
+// second buffer of the passes, grown as needed; keep it around between calls.
+template<typename T>
+void RadixSort(std::vector<RadixSortEntry<T>>& entries, std::vector<RadixSortEntry<T>>& scratch, int keyBits)
+{
+	const size_t n = entries.size();
+
+	// Already in order, which is the common case for last frame's order.
+	size_t i = 1;
+	while(i < n && entries[i - 1].Key <= entries[i].Key)
+		++i;
+	if(i >= n)
+		return;
+
+	scratch.resize(n);
+	for(int shift = 0; shift < keyBits; shift += 8)
+	{
+		size_t offsets[256] = {};
+		for(const auto& e : entries)
+			++offsets[(e.Key >> shift) & 0xFF];
+
+		// Skip a pass where every key has the same digit.
+		if(offsets[(entries[0].Key >> shift) & 0xFF] == n)
+			continue;
+
+		size_t sum = 0;
+		for(size_t& offset : offsets)
+		{
+			size_t count = offset;
+			offset = sum;
+			sum += count;
+		}
+
+		for(const auto& e : entries)
+			scratch[offsets[(e.Key >> shift) & 0xFF]++] = e;
+
+		entries.swap(scratch);
+	}
+}
+
+#endif // RADIXSORT_H
@@ -0,0 +1,96 @@
+#include "RenderItemStore.h"
+
+using namespace DirectX;
+
+RenderItemStore::RenderItemStore(int frameResourceCount)
+	: mFrameResourceCount(frameResourceCount)
+{
+}
+
+void RenderItemStore::Reserve(UINT count)
+{
+	mWorld.reserve(count);
+	mTexTransform.reserve(count);
+	mMaterialIndex.reserve(count);
+	mInstanceOffset.reserve(count);
+	mMorph.reserve(count);
+	mFramesDirty.reserve(count);
+	mDirty.reserve(count);
+}
+
+RenderItemHandle RenderItemStore::Add(const XMFLOAT4X4& world, const XMFLOAT4X4& texTransform,
+	UINT materialIndex, UINT instanceOffset)
+{
+	RenderItemHandle h = (RenderItemHandle)mWorld.size();
+
+	mWorld.push_back(world);
+	mTexTransform.push_back(texTransform);
+	mMaterialIndex.push_back(materialIndex);
+	mInstanceOffset.push_back(instanceOffset);
+	mMorph.push_back(0.0f);
+	mFramesDirty.push_back(0);
+
+	MarkDirty(h);
+	return h;
+}
+
+void RenderItemStore::SetWorld(RenderItemHandle h, const XMFLOAT4X4& world)
+{
+	mWorld[h] = world;
+	MarkDirty(h);
+}
+
+void RenderItemStore::SetTexTransform(RenderItemHandle h, const XMFLOAT4X4& texTransform)
+{
+	mTexTransform[h] = texTransform;
+	MarkDirty(h);
+}
+
+void RenderItemStore::SetMaterialIndex(RenderItemHandle h, UINT materialIndex)
+{
+	mMaterialIndex[h] = materialIndex;
+	MarkDirty(h);
+}
+
+void RenderItemStore::SetMorph(RenderItemHandle h, float morph)
+{
+	if(mMorph[h] == morph)
+		return;
+
+	mMorph[h] = morph;
+	MarkDirty(h);
+}
+
+void RenderItemStore::UpdateObjectCB(UploadArray<ObjectConstants>& objectCB)
+{
+	// Items that still have frame resources to go stay on the list, in order.
+	size_t kept = 0;
+	for(size_t i = 0; i < mDirty.size(); ++i)
+	{
+		RenderItemHandle h = mDirty[i];
+
+		XMMATRIX world = XMLoadFloat4x4(&mWorld[h]);
+		XMMATRIX texTransform = XMLoadFloat4x4(&mTexTransform[h]);
+
+		ObjectConstants objConstants;
+		XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
+		XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+		objConstants.MaterialIndex = mMaterialIndex[h];
+		objConstants.InstanceOffset = mInstanceOffset[h];
+		objConstants.Morph = mMorph[h];
+
+		objectCB.CopyData(h, objConstants);
+
+		if(--mFramesDirty[h] > 0)
+			mDirty[kept++] = h;
+	}
+	mDirty.resize(kept);
+}
+
+void RenderItemStore::MarkDirty(RenderItemHandle h)
+{
+	// Already listed items only have their count restarted.
+	if(mFramesDirty[h] == 0)
+		mDirty.push_back(h);
+	mFramesDirty[h] = mFrameResourceCount;
+}
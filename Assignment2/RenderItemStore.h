@@ -0,0 +1,71 @@
+//***************************************************************************************
+// RenderItemStore.h
+//
+// The object constants of the render items, kept as dense arrays: world matrices,
+// texture transforms, material indices, instance offsets and terrain morph factors,
+// each indexed by the item's handle.  The handle is also the item's slot in the
+// ObjectCB of every frame resource, and stays valid for the life of the store.
+//
+// Items whose constants changed are kept on a dirty list until every frame resource
+// has been given them, so updating an ObjectCB visits only those items.
+//***************************************************************************************
+
+#ifndef RENDERITEMSTORE_H
+#define RENDERITEMSTORE_H
+
+#include "FrameResource.h"
+
+typedef UINT RenderItemHandle;
+
+class RenderItemStore
+{
+public:
+	explicit RenderItemStore(int frameResourceCount);
+	RenderItemStore(const RenderItemStore& rhs) = delete;
+	RenderItemStore& operator=(const RenderItemStore& rhs) = delete;
+	~RenderItemStore() = default;
+
+	void Reserve(UINT count);
+
+	// New items start out dirty.
+	RenderItemHandle Add(const DirectX::XMFLOAT4X4& world, const DirectX::XMFLOAT4X4& texTransform,
+		UINT materialIndex, UINT instanceOffset);
+
+	UINT Count()const { return (UINT)mWorld.size(); }
+
+	const DirectX::XMFLOAT4X4& World(RenderItemHandle h)const { return mWorld[h]; }
+	const DirectX::XMFLOAT4X4& TexTransform(RenderItemHandle h)const { return mTexTransform[h]; }
+	UINT MaterialIndex(RenderItemHandle h)const { return mMaterialIndex[h]; }
+
+	void SetWorld(RenderItemHandle h, const DirectX::XMFLOAT4X4& world);
+	void SetTexTransform(RenderItemHandle h, const DirectX::XMFLOAT4X4& texTransform);
+	void SetMaterialIndex(RenderItemHandle h, UINT materialIndex);
+
+	// Only marks the item dirty when the factor changes.
+	void SetMorph(RenderItemHandle h, float morph);
+
+	// Items still to be written to at least one frame resource.
+	UINT DirtyCount()const { return (UINT)mDirty.size(); }
+
+	// Writes the constants of the dirty items to objectCB, the ObjectCB of the
+	// frame resource being built, and counts that frame resource off.
+	void UpdateObjectCB(UploadArray<ObjectConstants>& objectCB);
+
+private:
+	void MarkDirty(RenderItemHandle h);
+
+	int mFrameResourceCount = 0;
+
+	std::vector<DirectX::XMFLOAT4X4> mWorld;
+	std::vector<DirectX::XMFLOAT4X4> mTexTransform;
+	std::vector<UINT> mMaterialIndex;
+	std::vector<UINT> mInstanceOffset;
+	std::vector<float> mMorph;
+
+	// Frame resources each item still has to be written to; non-zero exactly
+	// for the items on mDirty.
+	std::vector<int> mFramesDirty;
+	std::vector<RenderItemHandle> mDirty;
+};
+
+#endif // RENDERITEMSTORE_H
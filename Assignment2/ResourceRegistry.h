@@ -0,0 +1,100 @@
+//***************************************************************************************
+// ResourceRegistry.h
+//
+// Named resources (geometries, materials, textures, shaders, PSOs) kept in one dense
+// array, in the order they were added.  Names are for building the app: Add and Find
+// turn a name into a handle, the resource's index in the array, once; the frame loop
+// keeps the handles and never hashes a string.  Iterating visits the array in order.
+//
+// A handle is typed by what the registry holds, so a material handle can not index
+// the PSOs.  Handles stay valid for the life of the registry; adding a name that is
+// already there replaces its resource and keeps its handle.
+//***************************************************************************************
+
+#ifndef RESOURCEREGISTRY_H
+#define RESOURCEREGISTRY_H
+
+#include "../../Common/d3dUtil.h"
+
+template<typename T>
+struct RegistryHandle
+{
+	static const UINT InvalidIndex = 0xffffffff;
+
+	RegistryHandle() = default;
+	explicit RegistryHandle(UINT index) : Index(index) {}
+
+	bool IsValid()const { return Index != InvalidIndex; }
+
+	UINT Index = InvalidIndex;
+};
+
+template<typename T>
+class ResourceRegistry
+{
+public:
+	typedef RegistryHandle<T> Handle;
+
+	ResourceRegistry() = default;
+	ResourceRegistry(const ResourceRegistry& rhs) = delete;
+	ResourceRegistry& operator=(const ResourceRegistry& rhs) = delete;
+	~ResourceRegistry() = default;
+
+	Handle Add(const std::string& name, T resource)
+	{
+		auto it = mIndices.find(name);
+		if(it != mIndices.end())
+		{
+			mResources[it->second] = std::move(resource);
+			return Handle(it->second);
+		}
+
+		UINT index = (UINT)mResources.size();
+		mIndices.emplace(name, index);
+		mNames.push_back(name);
+		mResources.push_back(std::move(resource));
+		return Handle(index);
+	}
+
+	// An invalid handle if nothing goes by name.
+	Handle Find(const std::string& name)const
+	{
+		auto it = mIndices.find(name);
+		return it != mIndices.end() ? Handle(it->second) : Handle();
+	}
+
+	T& operator[](Handle h)
+	{
+		assert(h.IsValid() && h.Index < mResources.size());
+		return mResources[h.Index];
+	}
+
+	const T& operator[](Handle h)const
+	{
+		assert(h.IsValid() && h.Index < mResources.size());
+		return mResources[h.Index];
+	}
+
+	// By name, for building the app; throws std::out_of_range for an unknown
+	// name, like unordered_map::at.
+	T& At(const std::string& name) { return mResources[mIndices.at(name)]; }
+	const T& At(const std::string& name)const { return mResources[mIndices.at(name)]; }
+
+	const std::string& Name(Handle h)const { return mNames[h.Index]; }
+
+	UINT Count()const { return (UINT)mResources.size(); }
+
+	typename std::vector<T>::iterator begin() { return mResources.begin(); }
+	typename std::vector<T>::iterator end() { return mResources.end(); }
+	typename std::vector<T>::const_iterator begin()const { return mResources.begin(); }
+	typename std::vector<T>::const_iterator end()const { return mResources.end(); }
+
+private:
+	std::vector<T> mResources;
+	std::vector<std::string> mNames;
+
+	// Only used by Add, Find and At.
+	std::unordered_map<std::string, UINT> mIndices;
+};
+
+#endif // RESOURCEREGISTRY_H
@@ -0,0 +1,318 @@
+#include "SceneFile.h"
+#include "MappedFile.h"
+
+using namespace DirectX;
+
+namespace
+{
+	const UINT32 FileMagic = 0x314e4353; // "SCN1"
+	const UINT32 FileVersion = 1;
+
+	// 64-bit FNV-1a of the scene text.
+	UINT64 HashText(const std::string& text)
+	{
+		UINT64 hash = 14695981039346656037ull;
+		for(unsigned char c : text)
+		{
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	[[noreturn]] void ThrowSceneError(const std::string& message, const std::wstring& filename, int line)
+	{
+		throw DxException(E_INVALIDARG, AnsiToWString(message), filename, line);
+	}
+
+	// Reads "t x y z", "s x y z", "rx a", "ry a" and "rz a" (radians) up to the
+	// end of the line and multiplies them together in that order.
+	bool ReadTransform(std::istringstream& in, XMFLOAT4X4& result)
+	{
+		XMMATRIX m = XMMatrixIdentity();
+
+		std::string op;
+		while(in >> op)
+		{
+			float x = 0.0f, y = 0.0f, z = 0.0f;
+			if(op == "t" || op == "s")
+			{
+				if(!(in >> x >> y >> z))
+					return false;
+				m = m * (op == "t" ? XMMatrixTranslation(x, y, z) : XMMatrixScaling(x, y, z));
+			}
+			else if(op == "rx" || op == "ry" || op == "rz")
+			{
+				if(!(in >> x))
+					return false;
+				if(op == "rx")
+					m = m * XMMatrixRotationX(x);
+				else if(op == "ry")
+					m = m * XMMatrixRotationY(x);
+				else
+					m = m * XMMatrixRotationZ(x);
+			}
+			else
+				return false;
+		}
+
+		XMStoreFloat4x4(&result, m);
+		return true;
+	}
+}
+
+SceneFile::SceneFile()
+{
+}
+
+SceneFile::~SceneFile()
+{
+}
+
+void SceneFile::Load(const std::wstring& binaryFile, const std::wstring& sourceFile)
+{
+	std::string source;
+	bool haveSource = false;
+	if(!sourceFile.empty())
+	{
+		std::ifstream fin(sourceFile, std::ios::binary);
+		if(fin)
+		{
+			std::ostringstream ss;
+			ss << fin.rdbuf();
+			source = ss.str();
+			haveSource = true;
+		}
+	}
+
+	if(haveSource)
+	{
+		UINT64 sourceHash = HashText(source);
+		if(!Map(binaryFile) || mHeader->SourceHash != sourceHash)
+		{
+			mFile.reset();
+			mHeader = nullptr;
+			std::vector<BYTE> cooked = Cook(source, sourceHash, sourceFile);
+
+			// A binary that can not be written is only a missed cache: the
+			// scene is used from the cooked copy in memory instead, and cooked
+			// again on the next run.
+			if(!Write(binaryFile, cooked) || !Map(binaryFile))
+			{
+				OutputDebugStringW((L"SceneFile: could not write " + binaryFile +
+					L", using the scene text\n").c_str());
+				mCooked = std::move(cooked);
+				Bind(mCooked.data(), mCooked.size());
+			}
+		}
+	}
+
+	if(mHeader == nullptr && !Map(binaryFile))
+		throw DxException(E_FAIL, L"SceneFile::Load", binaryFile, 0);
+}
+
+const char* SceneFile::Name(UINT32 index)const
+{
+	assert(index < mHeader->NameCount);
+	return mNames + mNameOffsets[index];
+}
+
+std::vector<BYTE> SceneFile::Cook(const std::string& source, UINT64 sourceHash, const std::wstring& sourceFile)
+{
+	std::vector<SceneItem> items;
+	std::vector<InstanceData> instances;
+	std::vector<SceneSprite> sprites;
+
+	std::vector<std::string> names;
+	std::unordered_map<std::string, UINT32> nameIndices;
+	auto addName = [&names, &nameIndices](const std::string& name)
+	{
+		auto it = nameIndices.find(name);
+		if(it != nameIndices.end())
+			return it->second;
+
+		UINT32 index = (UINT32)names.size();
+		names.push_back(name);
+		nameIndices[name] = index;
+		return index;
+	};
+
+	std::istringstream lines(source);
+	std::string line;
+	int lineNumber = 0;
+	while(std::getline(lines, line))
+	{
+		++lineNumber;
+
+		size_t comment = line.find('#');
+		if(comment != std::string::npos)
+			line.resize(comment);
+
+		std::istringstream in(line);
+		std::string keyword;
+		if(!(in >> keyword))
+			continue;
+
+		if(keyword == "sprite")
+		{
+			SceneSprite sprite;
+			if(!(in >> sprite.Pos.x >> sprite.Pos.y >> sprite.Pos.z >> sprite.Size.x >> sprite.Size.y))
+				ThrowSceneError("sprite needs x y z width height", sourceFile, lineNumber);
+			sprites.push_back(sprite);
+			continue;
+		}
+
+		if(keyword == "item")
+		{
+			std::string layer, geometry, submesh, material;
+			if(!(in >> layer >> geometry >> submesh >> material))
+				ThrowSceneError("item needs a layer, geometry, submesh and material", sourceFile, lineNumber);
+
+			SceneItem item;
+			item.Layer = addName(layer);
+			item.Geometry = addName(geometry);
+			item.Submesh = addName(submesh);
+			item.Material = addName(material);
+			item.FirstInstance = (UINT32)instances.size();
+			items.push_back(item);
+			continue;
+		}
+
+		// The rest describe the last item.
+		if(items.empty())
+			ThrowSceneError("'" + keyword + "' before the first item", sourceFile, lineNumber);
+		SceneItem& item = items.back();
+
+		if(keyword == "world")
+		{
+			if(!ReadTransform(in, item.World))
+				ThrowSceneError("bad world transform", sourceFile, lineNumber);
+		}
+		else if(keyword == "tex")
+		{
+			if(!ReadTransform(in, item.TexTransform))
+				ThrowSceneError("bad texture transform", sourceFile, lineNumber);
+		}
+		else if(keyword == "instance")
+		{
+			InstanceData instance;
+			if(!ReadTransform(in, instance.World))
+				ThrowSceneError("bad instance transform", sourceFile, lineNumber);
+			instances.push_back(instance);
+			++item.InstanceCount;
+		}
+		else if(keyword == "topology")
+		{
+			std::string topology;
+			in >> topology;
+			if(topology == "triangles")
+				item.Topology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			else if(topology == "points")
+				item.Topology = D3D_PRIMITIVE_TOPOLOGY_POINTLIST;
+			else
+				ThrowSceneError("topology is triangles or points", sourceFile, lineNumber);
+		}
+		else
+			ThrowSceneError("unknown keyword '" + keyword + "'", sourceFile, lineNumber);
+	}
+
+	std::vector<UINT32> nameOffsets;
+	std::string nameChars;
+	for(auto& name : names)
+	{
+		nameOffsets.push_back((UINT32)nameChars.size());
+		nameChars.append(name.c_str(), name.size() + 1);
+	}
+
+	FileHeader header = {};
+	header.Magic = FileMagic;
+	header.Version = FileVersion;
+	header.SourceHash = sourceHash;
+	header.ItemCount = (UINT32)items.size();
+	header.InstanceCount = (UINT32)instances.size();
+	header.SpriteCount = (UINT32)sprites.size();
+	header.NameCount = (UINT32)names.size();
+	header.NameBytes = (UINT32)nameChars.size();
+
+	std::vector<BYTE> binary;
+	auto append = [&binary](const void* data, size_t byteSize)
+	{
+		const BYTE* bytes = reinterpret_cast<const BYTE*>(data);
+		binary.insert(binary.end(), bytes, bytes + byteSize);
+	};
+	append(&header, sizeof(header));
+	append(items.data(), items.size()*sizeof(SceneItem));
+	append(instances.data(), instances.size()*sizeof(InstanceData));
+	append(sprites.data(), sprites.size()*sizeof(SceneSprite));
+	append(nameOffsets.data(), nameOffsets.size()*sizeof(UINT32));
+	append(nameChars.data(), nameChars.size());
+	return binary;
+}
+
+bool SceneFile::Write(const std::wstring& binaryFile, const std::vector<BYTE>& binary)
+{
+	std::ofstream fout(binaryFile, std::ios::binary | std::ios::trunc);
+	fout.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+	fout.close();
+	return !fout.fail();
+}
+
+bool SceneFile::Map(const std::wstring& binaryFile)
+{
+	mFile = std::make_unique<MappedFile>(binaryFile);
+	if(!Bind(mFile->Data(), mFile->Size()))
+	{
+		mFile.reset();
+		return false;
+	}
+	return true;
+}
+
+bool SceneFile::Bind(const BYTE* data, UINT64 size)
+{
+	mHeader = nullptr;
+
+	const FileHeader* header = reinterpret_cast<const FileHeader*>(data);
+	if(data == nullptr || size < sizeof(FileHeader) ||
+		header->Magic != FileMagic || header->Version != FileVersion)
+		return false;
+
+	UINT64 itemsOffset = sizeof(FileHeader);
+	UINT64 instancesOffset = itemsOffset + (UINT64)header->ItemCount*sizeof(SceneItem);
+	UINT64 spritesOffset = instancesOffset + (UINT64)header->InstanceCount*sizeof(InstanceData);
+	UINT64 nameOffsetsOffset = spritesOffset + (UINT64)header->SpriteCount*sizeof(SceneSprite);
+	UINT64 namesOffset = nameOffsetsOffset + (UINT64)header->NameCount*sizeof(UINT32);
+	if(namesOffset + header->NameBytes != size)
+		return false;
+
+	const UINT32* nameOffsets = reinterpret_cast<const UINT32*>(data + nameOffsetsOffset);
+	const char* names = reinterpret_cast<const char*>(data + namesOffset);
+	const SceneItem* items = reinterpret_cast<const SceneItem*>(data + itemsOffset);
+
+	// Every name has to end inside the table, and every item has to name
+	// entries that exist.
+	if(header->NameBytes > 0 && names[header->NameBytes - 1] != '\0')
+		return false;
+	for(UINT32 i = 0; i < header->NameCount; ++i)
+	{
+		if(nameOffsets[i] >= header->NameBytes)
+			return false;
+	}
+	for(UINT32 i = 0; i < header->ItemCount; ++i)
+	{
+		const SceneItem& item = items[i];
+		if(item.Layer >= header->NameCount || item.Geometry >= header->NameCount ||
+			item.Submesh >= header->NameCount || item.Material >= header->NameCount ||
+			(UINT64)item.FirstInstance + item.InstanceCount > header->InstanceCount)
+			return false;
+	}
+
+	mHeader = header;
+	mItems = reinterpret_cast<const SceneItem*>(data + itemsOffset);
+	mInstances = reinterpret_cast<const InstanceData*>(data + instancesOffset);
+	mSprites = reinterpret_cast<const SceneSprite*>(data + spritesOffset);
+	mNameOffsets = reinterpret_cast<const UINT32*>(data + nameOffsetsOffset);
+	mNames = reinterpret_cast<const char*>(data + namesOffset);
+
+	return true;
+}
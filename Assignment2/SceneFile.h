@@ -0,0 +1,123 @@
+//***************************************************************************************
+// SceneFile.h
+//
+// The render items, instances and tree sprites of a scene, read from a file instead of
+// being built in code.  The app loads a cooked binary that is memory-mapped and used
+// in place: each section is an array the app copies from in one go, and the instance
+// and sprite records already have the layout of InstanceData and the tree sprite
+// vertices.
+//
+// Scenes are written in a text format (see Scenes/Castle.txt) and cooked to the binary
+// when they are loaded.  The binary keeps a hash of the text it was cooked from, so an
+// edited scene is recooked on the next run and a shipped binary needs no text at all.
+// Where the binary can not be written, the cooked scene is kept in memory instead.
+//
+// Items refer to layers, geometries, submeshes and materials by name; the app resolves
+// the names once, when it builds its render items.
+//***************************************************************************************
+
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include "../../Common/d3dUtil.h"
+#include "FrameResource.h"
+
+class MappedFile;
+
+// One render item.  InstanceCount > 0 makes it an instanced item, drawn with
+// the instances [FirstInstance, FirstInstance + InstanceCount); World is then
+// unused.
+struct SceneItem
+{
+	UINT32 Layer = 0;		// name indices
+	UINT32 Geometry = 0;
+	UINT32 Submesh = 0;
+	UINT32 Material = 0;
+
+	UINT32 Topology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	UINT32 FirstInstance = 0;
+	UINT32 InstanceCount = 0;
+	UINT32 ItemPad0 = 0;
+
+	DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+};
+
+// A tree billboard, laid out like the vertices of treeSpritesGeo.
+struct SceneSprite
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::XMFLOAT2 Size;
+};
+
+class SceneFile
+{
+public:
+	SceneFile();
+	SceneFile(const SceneFile& rhs) = delete;
+	SceneFile& operator=(const SceneFile& rhs) = delete;
+	~SceneFile();
+
+	// Maps binaryFile.  If sourceFile is not empty and exists, binaryFile is
+	// first (re)cooked from it unless it was cooked from the same text; if it
+	// can not be written, the scene is used from memory and a warning goes to
+	// the debugger output.  Throws a DxException for a malformed source,
+	// naming the line, or without a source, for a binary that does not fit
+	// its header.
+	void Load(const std::wstring& binaryFile, const std::wstring& sourceFile);
+
+	UINT ItemCount()const { return mHeader->ItemCount; }
+	const SceneItem* Items()const { return mItems; }
+
+	// MaterialIndex is 0 in the file; the instances take their item's material.
+	UINT InstanceCount()const { return mHeader->InstanceCount; }
+	const InstanceData* Instances()const { return mInstances; }
+
+	UINT SpriteCount()const { return mHeader->SpriteCount; }
+	const SceneSprite* Sprites()const { return mSprites; }
+
+	const char* Name(UINT32 index)const;
+
+private:
+	struct FileHeader
+	{
+		UINT32 Magic;
+		UINT32 Version;
+		UINT64 SourceHash;
+
+		UINT32 ItemCount;
+		UINT32 InstanceCount;
+		UINT32 SpriteCount;
+		UINT32 NameCount;
+		UINT32 NameBytes;
+		UINT32 HeaderPad0;
+	};
+
+	// Parses the text into the contents of a binary.
+	static std::vector<BYTE> Cook(const std::string& source, UINT64 sourceHash, const std::wstring& sourceFile);
+
+	// False if the file could not be written.
+	static bool Write(const std::wstring& binaryFile, const std::vector<BYTE>& binary);
+
+	// False if the file is missing or does not fit its header.
+	bool Map(const std::wstring& binaryFile);
+
+	// Points the sections into a binary, mapped or in memory.  False if it
+	// does not fit its header.
+	bool Bind(const BYTE* data, UINT64 size);
+
+	// The binary, when it is mapped from binaryFile.
+	std::unique_ptr<MappedFile> mFile;
+
+	// The binary, when it could not be written and was kept in memory.
+	std::vector<BYTE> mCooked;
+
+	const FileHeader* mHeader = nullptr;
+	const SceneItem* mItems = nullptr;
+	const InstanceData* mInstances = nullptr;
+	const SceneSprite* mSprites = nullptr;
+	const UINT32* mNameOffsets = nullptr;
+	const char* mNames = nullptr;
+};
+
+#endif // SCENEFILE_H
@@ -0,0 +1,147 @@
+#include "ShaderCache.h"
+#include <iomanip>
+
+namespace
+{
+	// 64-bit FNV-1a.
+	const UINT64 HashSeed = 14695981039346656037ull;
+
+	UINT64 HashBytes(UINT64 hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for(size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	UINT64 HashString(UINT64 hash, const std::string& s)
+	{
+		// Include the terminator so "ab"+"c" and "a"+"bc" differ.
+		return HashBytes(hash, s.c_str(), s.size() + 1);
+	}
+
+	bool ReadFile(const std::wstring& filename, std::string& contents)
+	{
+		std::ifstream fin(filename, std::ios::binary);
+		if(!fin)
+			return false;
+
+		std::ostringstream ss;
+		ss << fin.rdbuf();
+		contents = ss.str();
+		return true;
+	}
+
+	std::wstring DirectoryOf(const std::wstring& filename)
+	{
+		size_t slash = filename.find_last_of(L"\\/");
+		return slash == std::wstring::npos ? std::wstring() : filename.substr(0, slash + 1);
+	}
+}
+
+ShaderCache::ShaderCache(const std::wstring& cacheDir)
+	: mCacheDir(cacheDir)
+{
+	CreateDirectoryW(mCacheDir.c_str(), nullptr);
+}
+
+Microsoft::WRL::ComPtr<ID3DBlob> ShaderCache::Load(
+	const std::string& name,
+	const std::wstring& filename,
+	const D3D_SHADER_MACRO* defines,
+	const std::string& entrypoint,
+	const std::string& target)
+{
+	UINT64 key = HashSource(filename);
+	for(const D3D_SHADER_MACRO* define = defines; define != nullptr && define->Name != nullptr; ++define)
+	{
+		key = HashString(key, define->Name);
+		key = HashString(key, define->Definition != nullptr ? define->Definition : "");
+	}
+	key = HashString(key, entrypoint);
+	key = HashString(key, target);
+
+	// d3dUtil::CompileShader compiles debug builds without optimization.
+#if defined(DEBUG) || defined(_DEBUG)
+	key = HashString(key, "debug");
+#endif
+
+	std::wostringstream keyName;
+	keyName << std::hex << std::setw(16) << std::setfill(L'0') << key;
+
+	std::wstring prefix = mCacheDir + L"\\" + AnsiToWString(name) + L"_";
+	std::wstring cacheFile = prefix + keyName.str() + L".cso";
+
+	std::string bytecode;
+	if(ReadFile(cacheFile, bytecode) && !bytecode.empty())
+	{
+		Microsoft::WRL::ComPtr<ID3DBlob> blob;
+		ThrowIfFailed(D3DCreateBlob(bytecode.size(), &blob));
+		CopyMemory(blob->GetBufferPointer(), bytecode.data(), bytecode.size());
+
+		++mLoadedCount;
+		return blob;
+	}
+
+	// Stale: remove the older versions of this permutation before writing the new one.
+	WIN32_FIND_DATAW findData;
+	HANDLE find = FindFirstFileW((prefix + L"????????????????.cso").c_str(), &findData);
+	if(find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			DeleteFileW((mCacheDir + L"\\" + findData.cFileName).c_str());
+		} while(FindNextFileW(find, &findData));
+		FindClose(find);
+	}
+
+	Microsoft::WRL::ComPtr<ID3DBlob> blob = d3dUtil::CompileShader(filename, defines, entrypoint, target);
+	++mCompiledCount;
+
+	// The cache is only an optimization, so a failed write is not an error.
+	std::ofstream fout(cacheFile, std::ios::binary | std::ios::trunc);
+	fout.write(static_cast<const char*>(blob->GetBufferPointer()), blob->GetBufferSize());
+
+	return blob;
+}
+
+UINT64 ShaderCache::HashSource(const std::wstring& filename)
+{
+	auto it = mSourceHashes.find(filename);
+	if(it != mSourceHashes.end())
+		return it->second;
+
+	// Guards against a file that includes itself.
+	mSourceHashes[filename] = HashSeed;
+
+	std::string source;
+	if(!ReadFile(filename, source))
+		return HashSeed;
+
+	UINT64 hash = HashBytes(HashSeed, source.data(), source.size());
+
+	// Fold in the includes, which FXC resolves relative to the including file.
+	std::istringstream lines(source);
+	std::string line;
+	while(std::getline(lines, line))
+	{
+		size_t include = line.find("#include");
+		if(include == std::string::npos)
+			continue;
+
+		size_t open = line.find('"', include);
+		size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+		if(close == std::string::npos)
+			continue;
+
+		std::wstring includeFile = DirectoryOf(filename) + AnsiToWString(line.substr(open + 1, close - open - 1));
+		UINT64 includeHash = HashSource(includeFile);
+		hash = HashBytes(hash, &includeHash, sizeof(includeHash));
+	}
+
+	mSourceHashes[filename] = hash;
+	return hash;
+}
@@ -0,0 +1,56 @@
+//***************************************************************************************
+// ShaderCache.h
+//
+// Keeps compiled shader permutations on disk so FXC only runs for the ones whose
+// source changed.  Each permutation is stored as plain bytecode (.cso) in a file
+// named after the permutation and a hash of everything that goes into compiling it:
+// the source file and the files it #includes, the defines, the entry point, the
+// target and the compile flags.  A stale file simply has the wrong name and is
+// replaced when the permutation is recompiled.
+//
+// Running the app with -compileshaders compiles every permutation into the cache
+// and quits, without creating a window or a device.  The project runs it as a
+// post-build step so a fresh build starts without compiling; it exits non-zero
+// if a permutation fails, which fails the build.
+//***************************************************************************************
+
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include "../../Common/d3dUtil.h"
+
+class ShaderCache
+{
+public:
+	// cacheDir is created if it does not exist.
+	explicit ShaderCache(const std::wstring& cacheDir);
+	ShaderCache(const ShaderCache& rhs) = delete;
+	ShaderCache& operator=(const ShaderCache& rhs) = delete;
+	~ShaderCache() = default;
+
+	// Same arguments as d3dUtil::CompileShader, plus a name that is unique to
+	// the permutation.
+	Microsoft::WRL::ComPtr<ID3DBlob> Load(
+		const std::string& name,
+		const std::wstring& filename,
+		const D3D_SHADER_MACRO* defines,
+		const std::string& entrypoint,
+		const std::string& target);
+
+	UINT LoadedCount()const { return mLoadedCount; }
+	UINT CompiledCount()const { return mCompiledCount; }
+
+private:
+	// Hash of the file and, recursively, of every file it #includes with quotes.
+	UINT64 HashSource(const std::wstring& filename);
+
+	std::wstring mCacheDir;
+
+	// Source hashes are computed once per file, since most permutations share one.
+	std::unordered_map<std::wstring, UINT64> mSourceHashes;
+
+	UINT mLoadedCount = 0;
+	UINT mCompiledCount = 0;
+};
+
+#endif // SHADERCACHE_H
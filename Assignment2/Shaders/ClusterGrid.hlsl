@@ -0,0 +1,19 @@
+//***************************************************************************************
+// ClusterGrid.hlsl
+//
+// The view-space cluster grid the point and spot lights are binned into: the screen
+// cut into CLUSTER_GRID_X by CLUSTER_GRID_Y tiles, and the depth between the near
+// and far planes into CLUSTER_GRID_Z slices that grow exponentially.  Each cluster
+// has CLUSTER_MAX_LIGHTS slots in the light index list.  Must match ClusteredLights.h.
+//***************************************************************************************
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_MAX_LIGHTS 64
+
+// Cluster (x, y, z) in the light count and light index buffers, x fastest.
+uint ClusterIndex(uint3 cell)
+{
+	return (cell.z*CLUSTER_GRID_Y + cell.y)*CLUSTER_GRID_X + cell.x;
+}
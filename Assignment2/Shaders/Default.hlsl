@@ -22,6 +22,28 @@
 
 Texture2D    gDiffuseMap : register(t0);
 
+#ifdef DISPLACEMENT_MAP
+// Height field and normal map written by the GPU wave simulation (WaveSim.hlsl).
+Texture2D    gDisplacementMap : register(t1);
+Texture2D    gWaveNormalMap   : register(t2);
+#endif
+
+
+#ifdef INSTANCED
+struct InstanceData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint     MaterialIndex;
+	uint     InstPad0;
+	uint     InstPad1;
+	uint     InstPad2;
+};
+
+// Instances of the render item being drawn, indexed by SV_InstanceID.
+StructuredBuffer<InstanceData> gInstanceData : register(t0, space1);
+#endif
+
 
 SamplerState gsamPointWrap        : register(s0);
 SamplerState gsamPointClamp       : register(s1);
@@ -76,12 +98,24 @@ cbuffer cbMaterial : register(b2)
 	float4x4 gMatTransform;
 };
 
+#ifdef WAVE_STREAMS
+// The CPU water grid: slot 0 holds the static x/z and tex-coords, slot 1 the
+// per-frame height and the x/z of the normal.
+struct VertexIn
+{
+	float2 PosXZ    : POSITION;
+	float2 TexC     : TEXCOORD;
+	float  Height   : HEIGHT;
+	float2 NormalXZ : NORMAL;
+};
+#else
 struct VertexIn
 {
 	float3 PosL    : POSITION;
     float3 NormalL : NORMAL;
 	float2 TexC    : TEXCOORD;
 };
+#endif
 
 struct VertexOut
 {
@@ -91,22 +125,46 @@ struct VertexOut
 	float2 TexC    : TEXCOORD;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
 	VertexOut vout = (VertexOut)0.0f;
+
+#ifdef INSTANCED
+	float4x4 world = gInstanceData[instanceID].World;
+	float4x4 texTransform = gInstanceData[instanceID].TexTransform;
+#else
+	float4x4 world = gWorld;
+	float4x4 texTransform = gTexTransform;
+#endif
+
+#ifdef WAVE_STREAMS
+	// The wave normal always points up, so y is the positive root.
+	float3 posL = float3(vin.PosXZ.x, vin.Height, vin.PosXZ.y);
+	float3 normalL = float3(vin.NormalXZ.x,
+		sqrt(saturate(1.0f - dot(vin.NormalXZ, vin.NormalXZ))), vin.NormalXZ.y);
+#else
+	float3 posL = vin.PosL;
+	float3 normalL = vin.NormalL;
+#endif
+
+#ifdef DISPLACEMENT_MAP
+	// Sample the displacement map using non-transformed [0,1]^2 tex-coords.
+	posL.y += gDisplacementMap.SampleLevel(gsamPointClamp, vin.TexC, 0.0f).r;
+	normalL = gWaveNormalMap.SampleLevel(gsamPointClamp, vin.TexC, 0.0f).xyz;
+#endif
 	
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), world);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)world);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
 	
 	// Output vertex attributes for interpolation across triangle.
-	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
+	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), texTransform);
 	vout.TexC = mul(texC, gMatTransform).xy;
 
     return vout;
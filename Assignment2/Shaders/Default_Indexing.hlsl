@@ -1,5 +1,9 @@
 //***************************************************************************************
-// Default_Indexing.hlsl 
+// Default_Indexing.hlsl
+//
+// Default shader with bindless materials: the material of a draw (or of an instance)
+// is an index into a structured buffer, and its diffuse map an index into an array
+// of all the 2D textures, so a draw only has to change the object constants.
 //***************************************************************************************
 
 // Defaults for number of lights.
@@ -15,11 +19,17 @@
     #define NUM_SPOT_LIGHTS 0
 #endif
 
+// Set by the app from the number of 2D textures it loaded.
+#ifndef NUM_DIFFUSE_MAPS
+    #define NUM_DIFFUSE_MAPS 1
+#endif
+
 // Include structures and functions for lighting.
 #include "LightingUtil.hlsl"
+#include "ClusterGrid.hlsl"
 
 
-//step1: Instead of storing our material data in constant buffers, 
+//step1: Instead of storing our material data in constant buffers,
 //we will store it in a structured buffer. A structured buffer can be indexed in the shader program.
 
 struct MaterialData
@@ -34,14 +44,38 @@ struct MaterialData
 	uint     MatPad2;
 };
 
+struct InstanceData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint     MaterialIndex;
+	uint     InstPad0;
+	uint     InstPad1;
+	uint     InstPad2;
+};
+
 
 // An array of textures, which is only supported in shader model 5.1+.  Unlike Texture2DArray, the textures
 // in this array can be different sizes and formats, making it more flexible than texture arrays.
-Texture2D gDiffuseMap[4] : register(t0);
-
-// Put in space1, so the texture array does not overlap with these resources.  
-// The texture array will occupy registers t0, t1, ..., t3 in space0. 
-StructuredBuffer<MaterialData> gMaterialData : register(t0, space1);
+// Put in space2, so the array does not overlap with the displacement maps or the
+// tree sprite texture array in space0.
+Texture2D gDiffuseMap[NUM_DIFFUSE_MAPS] : register(t0, space2);
+
+// Put in space1, so the structured buffers do not overlap with the textures.
+StructuredBuffer<InstanceData> gInstanceData : register(t0, space1);
+StructuredBuffer<MaterialData> gMaterialData : register(t1, space1);
+
+// The point and spot lights, and the ones reaching each cluster as culled by
+// LightCull.hlsl; see ClusteredLights.h.
+StructuredBuffer<Light> gClusterLightData    : register(t2, space1);
+StructuredBuffer<uint>  gClusterLightCounts  : register(t3, space1);
+StructuredBuffer<uint>  gClusterLightIndices : register(t4, space1);
+
+#ifdef DISPLACEMENT_MAP
+// Height field and normal map written by the GPU wave simulation (WaveSim.hlsl).
+Texture2D    gDisplacementMap : register(t1);
+Texture2D    gWaveNormalMap   : register(t2);
+#endif
 
 
 SamplerState gsamPointWrap        : register(s0);
@@ -52,16 +86,18 @@ SamplerState gsamAnisotropicWrap  : register(s4);
 SamplerState gsamAnisotropicClamp : register(s5);
 
 
-//step2:  Add a MaterialIndex field to our object constant buffer to specify the index of the material to use for this draw call. 
+//step2:  Add a MaterialIndex field to our object constant buffer to specify the index of the material to use for this draw call.
 // Constant data that varies per frame.
 cbuffer cbPerObject : register(b0)
 {
     float4x4 gWorld;
 	float4x4 gTexTransform;
 	uint gMaterialIndex;
-	uint gObjPad0;
+	// First instance of an instanced draw in gInstanceData.
+	uint gInstanceOffset;
+	// Terrain chunks: how far to move the vertices to their MorphHeight.
+	float gMorph;
 	uint gObjPad1;
-	uint gObjPad2;
 };
 
 // Constant data that varies per material.
@@ -83,19 +119,62 @@ cbuffer cbPass : register(b1)
     float gDeltaTime;
     float4 gAmbientLight;
 
+	float4 gFogColor;
+	float gFogStart;
+	float gFogRange;
+	float2 cbPerObjectPad2;
+
     // Indices [0, NUM_DIR_LIGHTS) are directional lights;
     // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
     // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
     // are spot lights for a maximum of MaxLights per object.
     Light gLights[MaxLights];
+
+	// gClusterLightData is point lights up to gClusterPointLightCount and spot
+	// lights after.  A view depth z is in slice log2(z)*scale + bias.
+	uint  gClusterPointLightCount;
+	float gClusterSliceScale;
+	float gClusterSliceBias;
+	uint  cbPerObjectPad3;
 };
 
+#ifdef WAVE_STREAMS
+// The CPU water grid: slot 0 holds the static x/z and tex-coords, slot 1 the
+// per-frame height and the x/z of the normal.
+struct VertexIn
+{
+	float2 PosXZ    : POSITION;
+	float2 TexC     : TEXCOORD;
+	float  Height   : HEIGHT;
+	float2 NormalXZ : NORMAL;
+};
+#elif defined(TERRAIN)
+// TerrainVertex: MorphHeight is where the vertex is in the chunk's next
+// coarser level of detail.
+struct VertexIn
+{
+	float3 PosL        : POSITION;
+    float3 NormalL     : NORMAL;
+	float2 TexC        : TEXCOORD;
+	float  MorphHeight : MORPH;
+};
+#else
 struct VertexIn
 {
 	float3 PosL    : POSITION;
     float3 NormalL : NORMAL;
 	float2 TexC    : TEXCOORD;
 };
+#endif
+
+// The depth prepass only reads the position, and the morph height it moves by.
+struct DepthVertexIn
+{
+	float3 PosL        : POSITION;
+#ifdef TERRAIN
+	float  MorphHeight : MORPH;
+#endif
+};
 
 struct VertexOut
 {
@@ -103,49 +182,142 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
 	float2 TexC    : TEXCOORD;
+
+	// nointerpolation is used so the index is not interpolated
+	// across the triangle.
+	nointerpolation uint MatIndex : MATINDEX;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
 	VertexOut vout = (VertexOut)0.0f;
 
+#ifdef INSTANCED
+	InstanceData instData = gInstanceData[gInstanceOffset + instanceID];
+	float4x4 world = instData.World;
+	float4x4 texTransform = instData.TexTransform;
+	uint matIndex = instData.MaterialIndex;
+#else
+	float4x4 world = gWorld;
+	float4x4 texTransform = gTexTransform;
+	uint matIndex = gMaterialIndex;
+#endif
+
 	// step7: Fetch the material data.
-	MaterialData matData = gMaterialData[gMaterialIndex];
-	
-    // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+	MaterialData matData = gMaterialData[matIndex];
+	vout.MatIndex = matIndex;
+
+#ifdef WAVE_STREAMS
+	// The wave normal always points up, so y is the positive root.
+	precise float3 posL = float3(vin.PosXZ.x, vin.Height, vin.PosXZ.y);
+	float3 normalL = float3(vin.NormalXZ.x,
+		sqrt(saturate(1.0f - dot(vin.NormalXZ, vin.NormalXZ))), vin.NormalXZ.y);
+#else
+	precise float3 posL = vin.PosL;
+	float3 normalL = vin.NormalL;
+#endif
+
+#ifdef TERRAIN
+	posL.y = lerp(posL.y, vin.MorphHeight, gMorph);
+#endif
+
+#ifdef DISPLACEMENT_MAP
+	// Sample the displacement map using non-transformed [0,1]^2 tex-coords.
+	posL.y += gDisplacementMap.SampleLevel(gsamPointClamp, vin.TexC, 0.0f).r;
+	normalL = gWaveNormalMap.SampleLevel(gsamPointClamp, vin.TexC, 0.0f).xyz;
+#endif
+
+    // Transform to world space.  The position math is precise, so DepthVS
+    // computes bit for bit the same depths.
+    precise float4 posW = mul(float4(posL, 1.0f), world);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)world);
 
     // Transform to homogeneous clip space.
-    vout.PosH = mul(posW, gViewProj);
-	
+    precise float4 posH = mul(posW, gViewProj);
+    vout.PosH = posH;
+
 	// Output vertex attributes for interpolation across triangle.
-	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
+	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), texTransform);
 	vout.TexC = mul(texC, matData.MatTransform).xy;
-	
+
     return vout;
 }
 
-float4 PS(VertexOut pin) : SV_Target
+// Depth prepass: the position of VS and nothing else.  The opaque pass after it
+// tests with D3D12_COMPARISON_FUNC_EQUAL, so this has to do the same math.
+float4 DepthVS(DepthVertexIn vin, uint instanceID : SV_InstanceID) : SV_POSITION
+{
+#ifdef INSTANCED
+	float4x4 world = gInstanceData[gInstanceOffset + instanceID].World;
+#else
+	float4x4 world = gWorld;
+#endif
+
+	precise float3 posL = vin.PosL;
+
+#ifdef TERRAIN
+	posL.y = lerp(posL.y, vin.MorphHeight, gMorph);
+#endif
+
+	precise float4 posW = mul(float4(posL, 1.0f), world);
+	precise float4 posH = mul(posW, gViewProj);
+	return posH;
+}
+
+// The point and spot lights of the pixel's cluster.
+float3 ComputeClusteredLighting(float4 posH, Material mat, float3 pos, float3 normal, float3 toEye)
+{
+	// SV_POSITION is in pixels, and its w is the view depth.
+	uint2 tile = min(uint2(posH.xy*gInvRenderTargetSize*float2(CLUSTER_GRID_X, CLUSTER_GRID_Y)),
+		uint2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+	uint slice = min((uint)max(log2(posH.w)*gClusterSliceScale + gClusterSliceBias, 0.0f), CLUSTER_GRID_Z - 1);
+	uint cluster = ClusterIndex(uint3(tile, slice));
+
+	float3 result = 0.0f;
+
+	uint count = gClusterLightCounts[cluster];
+	for(uint k = 0; k < count; ++k)
+	{
+		uint i = gClusterLightIndices[cluster*CLUSTER_MAX_LIGHTS + k];
+		Light light = gClusterLightData[i];
+		if(i < gClusterPointLightCount)
+			result += ComputePointLight(light, mat, pos, normal, toEye);
+		else
+			result += ComputeSpotLight(light, mat, pos, normal, toEye);
+	}
+
+	return result;
+}
+
+float4 LitColor(VertexOut pin)
 {
 	// step 8: Fetch the material data.
-	MaterialData matData = gMaterialData[gMaterialIndex];
+	MaterialData matData = gMaterialData[pin.MatIndex];
 	float4 diffuseAlbedo = matData.DiffuseAlbedo;
 	float3 fresnelR0 = matData.FresnelR0;
 	float  roughness = matData.Roughness;
 	uint diffuseTexIndex = matData.DiffuseMapIndex;
 
 	// Dynamically look up the texture in the array.
-	diffuseAlbedo *= gDiffuseMap[diffuseTexIndex].Sample(gsamLinearWrap, pin.TexC);
-	
+	diffuseAlbedo *= gDiffuseMap[diffuseTexIndex].Sample(gsamAnisotropicWrap, pin.TexC);
+
+#ifdef ALPHA_TEST
+	// Discard pixel if texture alpha < 0.1.  We do this test as soon
+	// as possible in the shader so that we can potentially exit the
+	// shader early, thereby skipping the rest of the shader code.
+	clip(diffuseAlbedo.a - 0.1f);
+#endif
+
     // Interpolating normal can unnormalize it, so renormalize it.
     pin.NormalW = normalize(pin.NormalW);
 
-    // Vector from point being lit to eye. 
-    float3 toEyeW = normalize(gEyePosW - pin.PosW);
+    // Vector from point being lit to eye.
+	float3 toEyeW = gEyePosW - pin.PosW;
+	float distToEye = length(toEyeW);
+	toEyeW /= distToEye; // normalize
 
     // Light terms.
     float4 ambient = gAmbientLight*diffuseAlbedo;
@@ -155,13 +327,47 @@ float4 PS(VertexOut pin) : SV_Target
     float3 shadowFactor = 1.0f;
     float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
         pin.NormalW, toEyeW, shadowFactor);
+    directLight.rgb += ComputeClusteredLighting(pin.PosH, mat, pin.PosW, pin.NormalW, toEyeW);
 
     float4 litColor = ambient + directLight;
 
+#ifdef FOG
+	float fogAmount = saturate((distToEye - gFogStart) / gFogRange);
+	litColor = lerp(litColor, gFogColor, fogAmount);
+#endif
+
     // Common convention to take alpha from diffuse albedo.
     litColor.a = diffuseAlbedo.a;
 
     return litColor;
 }
 
+float4 PS(VertexOut pin) : SV_Target
+{
+	return LitColor(pin);
+}
+
+// Weighted blended OIT, see WeightedOit.h.  Accum is blended ONE, ONE and
+// Revealage ZERO, INV_SRC_COLOR.
+struct OitPixelOut
+{
+	float4 Accum     : SV_Target0;
+	float  Revealage : SV_Target1;
+};
+
+OitPixelOut OitPS(VertexOut pin)
+{
+	float4 color = LitColor(pin);
+
+	// Equation (7) of the paper: nearer surfaces weigh more, and the clamp
+	// keeps the sums inside half float range.  SV_POSITION.w is the view depth.
+	float z = pin.PosH.w;
+	float weight = color.a*clamp(10.0f / (1.0e-5f + pow(z / 5.0f, 2.0f) + pow(z / 200.0f, 6.0f)), 1.0e-2f, 3.0e3f);
+
+	OitPixelOut pout;
+	pout.Accum = float4(color.rgb*color.a, color.a)*weight;
+	pout.Revealage = color.a;
+	return pout;
+}
+
 
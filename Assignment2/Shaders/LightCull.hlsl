@@ -0,0 +1,126 @@
+//***************************************************************************************
+// LightCull.hlsl
+//
+// CullLightsCS(): One thread group per cluster of ClusterGrid.hlsl.  Tests every point
+//     and spot light against the cluster's view-space box and writes the ones that
+//     reach it, in light order, to the cluster's slots of gClusterLightIndices and
+//     their number to gClusterLightCounts.  See ClusteredLights.h.
+//***************************************************************************************
+
+#include "LightingUtil.hlsl"
+#include "ClusterGrid.hlsl"
+
+cbuffer cbLightCull : register(b0)
+{
+	float4x4 gView;
+	// 1/Proj[0][0] and 1/Proj[1][1]: the view-space x and y of the screen's
+	// right and top edges at z = 1.
+	float2 gInvProjScale;
+	float  gNearZ;
+	float  gFarZ;
+	uint   gLightCount;
+	uint   gLightCullPad0;
+	uint   gLightCullPad1;
+	uint   gLightCullPad2;
+};
+
+StructuredBuffer<Light> gLights : register(t0);
+
+RWStructuredBuffer<uint> gClusterLightCounts  : register(u0);
+RWStructuredBuffer<uint> gClusterLightIndices : register(u1);
+
+#define N 64
+
+// One bit per thread, for the lights of the block being tested.
+groupshared uint gHitMask[N / 32];
+groupshared uint gHitCount;
+
+// View-space box around the cluster: the tile's corner rays cut by the
+// slice's near and far planes.
+void ClusterBounds(uint3 cell, out float3 boxMin, out float3 boxMax)
+{
+	float2 tileMin = float2(cell.xy) / float2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	float2 tileMax = float2(cell.xy + 1) / float2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+
+	// The tile's rays at z = 1; the tile rows go down the screen.
+	float2 rayMin = float2(2.0f*tileMin.x - 1.0f, 1.0f - 2.0f*tileMax.y)*gInvProjScale;
+	float2 rayMax = float2(2.0f*tileMax.x - 1.0f, 1.0f - 2.0f*tileMin.y)*gInvProjScale;
+
+	float zNear = gNearZ*pow(gFarZ / gNearZ, (float)cell.z / CLUSTER_GRID_Z);
+	float zFar = gNearZ*pow(gFarZ / gNearZ, (float)(cell.z + 1) / CLUSTER_GRID_Z);
+
+	boxMin = float3(min(rayMin*zNear, rayMin*zFar), zNear);
+	boxMax = float3(max(rayMax*zNear, rayMax*zFar), zFar);
+}
+
+bool SphereIntersectsBox(float3 center, float radius, float3 boxMin, float3 boxMax)
+{
+	float3 d = max(max(boxMin - center, center - boxMax), 0.0f);
+	return dot(d, d) <= radius*radius;
+}
+
+[numthreads(N, 1, 1)]
+void CullLightsCS(int3 groupID : SV_GroupID,
+                  int3 groupThreadID : SV_GroupThreadID)
+{
+	uint cluster = ClusterIndex(groupID);
+	uint t = groupThreadID.x;
+
+	float3 boxMin, boxMax;
+	ClusterBounds(groupID, boxMin, boxMax);
+
+	if(t == 0)
+		gHitCount = 0;
+
+	// N lights at a time, one per thread.
+	for(uint base = 0; base < gLightCount; base += N)
+	{
+		if(t < N / 32)
+			gHitMask[t] = 0;
+		GroupMemoryBarrierWithGroupSync();
+
+		// A spot light is tested by the sphere around its whole range.
+		uint i = base + t;
+		bool hit = false;
+		if(i < gLightCount)
+		{
+			Light light = gLights[i];
+			float3 posV = mul(float4(light.Position, 1.0f), gView).xyz;
+			hit = SphereIntersectsBox(posV, light.FalloffEnd, boxMin, boxMax);
+		}
+
+		if(hit)
+			InterlockedOr(gHitMask[t / 32], 1u << (t % 32));
+		GroupMemoryBarrierWithGroupSync();
+
+		// The block's hits go after the earlier ones, ranked by the hits of
+		// the threads before them, so the list is in light order and the same
+		// lights are dropped every frame when a cluster overflows.
+		if(hit)
+		{
+			uint below = countbits(gHitMask[t / 32] & ((1u << (t % 32)) - 1));
+			for(uint w = 0; w < t / 32; ++w)
+				below += countbits(gHitMask[w]);
+
+			uint slot = gHitCount + below;
+			if(slot < CLUSTER_MAX_LIGHTS)
+				gClusterLightIndices[cluster*CLUSTER_MAX_LIGHTS + slot] = i;
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if(t == 0)
+		{
+			[unroll]
+			for(uint w = 0; w < N / 32; ++w)
+				gHitCount += countbits(gHitMask[w]);
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		// The same for the whole group, so the barriers stay uniform.
+		if(gHitCount >= CLUSTER_MAX_LIGHTS)
+			break;
+	}
+
+	if(t == 0)
+		gClusterLightCounts[cluster] = min(gHitCount, CLUSTER_MAX_LIGHTS);
+}
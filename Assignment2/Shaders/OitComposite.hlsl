@@ -0,0 +1,35 @@
+//***************************************************************************************
+// OitComposite.hlsl
+//
+// Blends the weighted blended OIT targets over the back buffer; see WeightedOit.h.
+// Drawn as one triangle over the whole screen.
+//***************************************************************************************
+
+Texture2D gAccum     : register(t0);
+Texture2D gRevealage : register(t1);
+
+float4 VS(uint vertexID : SV_VertexID) : SV_POSITION
+{
+	// (-1, 1), (3, 1), (-1, -3): covers the screen, clipped to it.
+	float2 uv = float2((vertexID << 1) & 2, vertexID & 2);
+	return float4(uv.x*2.0f - 1.0f, 1.0f - uv.y*2.0f, 0.0f, 1.0f);
+}
+
+float4 PS(float4 posH : SV_POSITION) : SV_Target
+{
+	int3 texel = int3(posH.xy, 0);
+
+	// Nothing blended was drawn over this pixel.
+	float revealage = gRevealage.Load(texel).r;
+	clip(0.9999f - revealage);
+
+	float4 accum = gAccum.Load(texel);
+
+	// Many bright surfaces can overflow the half floats; keep their hue.
+	if(isinf(max(abs(accum.r), max(abs(accum.g), abs(accum.b)))))
+		accum.rgb = accum.a;
+
+	// Blended with SRC_ALPHA, INV_SRC_ALPHA.
+	float3 averageColor = accum.rgb / max(accum.a, 1.0e-5f);
+	return float4(averageColor, 1.0f - revealage);
+}
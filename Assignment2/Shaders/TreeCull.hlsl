@@ -0,0 +1,111 @@
+//***************************************************************************************
+// TreeCull.hlsl
+//
+// CullTreesCS(): Culls the trees against the view frustum and the distance LOD,
+//     appending the ones left to gVisibleTrees and counting them into the
+//     instance count of the DrawInstanced arguments in gDrawArgs.  See GpuTrees.h.
+//***************************************************************************************
+
+struct Tree
+{
+	float3 PosW;
+	float2 SizeW;
+};
+
+struct VisibleTree
+{
+	float3 PosW;
+	float2 SizeW;
+	uint   Slice;
+};
+
+cbuffer cbCull : register(b0)
+{
+	float4 gFrustumPlanes[6];
+	float3 gEyePosW;
+	uint   gTreeCount;
+	float  gLodStart;
+	float  gLodEnd;
+	uint   gCullFrustum;
+	uint   gCullPad0;
+};
+
+StructuredBuffer<Tree> gTrees : register(t0);
+
+RWStructuredBuffer<VisibleTree> gVisibleTrees : register(u0);
+
+// D3D12_DRAW_ARGUMENTS; the instance count is at byte 4.
+RWByteAddressBuffer gDrawArgs : register(u1);
+
+#define N 64
+
+groupshared uint gGroupCount;
+groupshared uint gGroupBase;
+
+// Uniform in [0, 1) and fixed per tree.
+float TreeHash(uint i)
+{
+	i ^= i >> 16;
+	i *= 0x7feb352d;
+	i ^= i >> 15;
+	i *= 0x846ca68b;
+	i ^= i >> 16;
+	return (i & 0x00ffffff) / 16777216.0f;
+}
+
+bool IsVisible(uint i, Tree tree)
+{
+	// The billboard turns about y, so a sphere around its center bounds it
+	// whichever way it faces.
+	float radius = 0.5f*length(tree.SizeW);
+
+	if(gCullFrustum != 0)
+	{
+		[unroll]
+		for(int p = 0; p < 6; ++p)
+		{
+			if(dot(gFrustumPlanes[p].xyz, tree.PosW) + gFrustumPlanes[p].w < -radius)
+				return false;
+		}
+	}
+
+	// Past gLodStart the trees go in hash order, the last ones at gLodEnd.
+	float dist = distance(tree.PosW, gEyePosW) - radius;
+	float drop = saturate((dist - gLodStart) / (gLodEnd - gLodStart));
+	return TreeHash(i) >= drop;
+}
+
+[numthreads(N, 1, 1)]
+void CullTreesCS(int3 groupThreadID : SV_GroupThreadID,
+                 int3 dispatchThreadID : SV_DispatchThreadID)
+{
+	uint i = dispatchThreadID.x;
+
+	if(groupThreadID.x == 0)
+		gGroupCount = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Threads past the last tree still have to reach the barriers.
+	Tree tree = gTrees[min(i, gTreeCount - 1)];
+	bool visible = i < gTreeCount && IsVisible(i, tree);
+
+	// Count the group's trees in shared memory, so the draw arguments take
+	// one atomic per group instead of one per tree.
+	uint local = 0;
+	if(visible)
+		InterlockedAdd(gGroupCount, 1, local);
+	GroupMemoryBarrierWithGroupSync();
+
+	if(groupThreadID.x == 0)
+		gDrawArgs.InterlockedAdd(4, gGroupCount, gGroupBase);
+	GroupMemoryBarrierWithGroupSync();
+
+	if(visible)
+	{
+		VisibleTree v;
+		v.PosW = tree.PosW;
+		v.SizeW = tree.SizeW;
+		v.Slice = i % 3;
+		gVisibleTrees[gGroupBase + local] = v;
+	}
+}
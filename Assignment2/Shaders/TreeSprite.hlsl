@@ -20,6 +20,21 @@
 //step5
 Texture2DArray gTreeMapArray : register(t0);
 
+struct MaterialData
+{
+	float4   DiffuseAlbedo;
+	float3   FresnelR0;
+	float    Roughness;
+	float4x4 MatTransform;
+	uint     DiffuseMapIndex;
+	uint     MatPad0;
+	uint     MatPad1;
+	uint     MatPad2;
+};
+
+// Shared with Default_Indexing.hlsl; the sprites only need their own material.
+StructuredBuffer<MaterialData> gMaterialData : register(t1, space1);
+
 //you can use dynamic indexing as well. Pay attention how we changed the sampler!
 //Texture2D gTreeMapArray[3] : register(t0);
 
@@ -36,6 +51,10 @@ cbuffer cbPerObject : register(b0)
 {
     float4x4 gWorld;
 	float4x4 gTexTransform;
+	uint gMaterialIndex;
+	uint gInstanceOffset;
+	float gMorph;
+	uint gObjPad1;
 };
 
 // Constant data that varies per material.
@@ -69,112 +88,74 @@ cbuffer cbPass : register(b1)
     Light gLights[MaxLights];
 };
 
-cbuffer cbMaterial : register(b2)
-{
-	float4   gDiffuseAlbedo;
-    float3   gFresnelR0;
-    float    gRoughness;
-	float4x4 gMatTransform;
-};
  
-struct VertexIn
+// Written by CullTreesCS in TreeCull.hlsl; bound in place of the instance buffer.
+struct VisibleTree
 {
-	float3 PosW  : POSITION;
-	float2 SizeW : SIZE;
+	float3 PosW;
+	float2 SizeW;
+	uint   Slice;
 };
 
-struct VertexOut
-{
-	float3 CenterW : POSITION;
-	float2 SizeW   : SIZE;
-};
+StructuredBuffer<VisibleTree> gVisibleTrees : register(t0, space1);
 
-struct GeoOut
+struct VertexOut
 {
 	float4 PosH    : SV_POSITION;
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
     float2 TexC    : TEXCOORD;
-    uint   PrimID  : SV_PrimitiveID;
+    nointerpolation uint Slice : SLICE;
 };
 
-VertexOut VS(VertexIn vin)
+//step4
+// Each instance is one visible tree, drawn as a 4 vertex triangle strip quad
+// that is built here instead of in a geometry shader.
+VertexOut VS(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
 {
-	VertexOut vout;
-
-	// Just pass data over to geometry shader.
-	vout.CenterW = vin.PosW;
-	vout.SizeW   = vin.SizeW;
+	VisibleTree tree = gVisibleTrees[instanceID];
 
-	return vout;
-}
- 
-//step4
- // We expand each point into a quad (4 vertices), so the maximum number of vertices
- // we output per geometry shader invocation is 4.
-[maxvertexcount(4)]
-void GS(point VertexOut gin[1], //PrimitiveType InputVertexType InputName[NumElements]-> one vertex for a point, two for aline, threefor atriangle, four for line with adjacency, and six for a triangle with adjacency.
-        uint primID : SV_PrimitiveID, //inout StreamOutputObject<OutputVertexType>
-        inout TriangleStream<GeoOut> triStream)  //OutputName
-{	
 	//
 	// Compute the local coordinate system of the sprite relative to the world
 	// space such that the billboard is aligned with the y-axis and faces the eye.
 	//
 
 	float3 up = float3(0.0f, 1.0f, 0.0f);
-	float3 look = gEyePosW - gin[0].CenterW;
+	float3 look = gEyePosW - tree.PosW;
 	look.y = 0.0f; // y-axis aligned, so project to xz-plane
 	look = normalize(look);
 	float3 right = cross(up, look);
 
 	//
-	// Compute triangle strip vertices (quad) in world space.
+	// Corners in strip order: right bottom, right top, left bottom, left top.
 	//
-	float halfWidth  = 0.5f*gin[0].SizeW.x;
-	float halfHeight = 0.5f*gin[0].SizeW.y;
-	
-	float4 v[4];
-	v[0] = float4(gin[0].CenterW + halfWidth*right - halfHeight*up, 1.0f);
-	v[1] = float4(gin[0].CenterW + halfWidth*right + halfHeight*up, 1.0f);
-	v[2] = float4(gin[0].CenterW - halfWidth*right - halfHeight*up, 1.0f);
-	v[3] = float4(gin[0].CenterW - halfWidth*right + halfHeight*up, 1.0f);
+	float halfWidth  = 0.5f*tree.SizeW.x;
+	float halfHeight = 0.5f*tree.SizeW.y;
 
-	//
-	// Transform quad vertices to world space and output 
-	// them as a triangle strip.
-	//
-	
-	float2 texC[4] = 
-	{
-		float2(0.0f, 1.0f),
-		float2(0.0f, 0.0f),
-		float2(1.0f, 1.0f),
-		float2(1.0f, 0.0f)
-	};
-	
-	GeoOut gout;
-	[unroll]
-	for(int i = 0; i < 4; ++i)
-	{
-		gout.PosH     = mul(v[i], gViewProj);
-		gout.PosW     = v[i].xyz;
-		gout.NormalW  = look;
-		gout.TexC     = texC[i];
-		gout.PrimID   = primID;
-		
-		triStream.Append(gout);
-	}
+	float sideX = vertexID < 2 ? 1.0f : -1.0f;
+	float sideY = (vertexID & 1) != 0 ? 1.0f : -1.0f;
+	float3 posW = tree.PosW + sideX*halfWidth*right + sideY*halfHeight*up;
+
+	VertexOut vout;
+	vout.PosH    = mul(float4(posW, 1.0f), gViewProj);
+	vout.PosW    = posW;
+	vout.NormalW = look;
+	vout.TexC    = float2(vertexID >> 1, 1 - (vertexID & 1));
+	vout.Slice   = tree.Slice;
+
+	return vout;
 }
 
 //step6
-float4 PS(GeoOut pin) : SV_Target
+float4 PS(VertexOut pin) : SV_Target
 {
-	float3 uvw = float3(pin.TexC, pin.PrimID%3);
-    float4 diffuseAlbedo = gTreeMapArray.Sample(gsamAnisotropicWrap, uvw) * gDiffuseAlbedo;
+	MaterialData matData = gMaterialData[gMaterialIndex];
+
+	float3 uvw = float3(pin.TexC, pin.Slice);
+    float4 diffuseAlbedo = gTreeMapArray.Sample(gsamAnisotropicWrap, uvw) * matData.DiffuseAlbedo;
 
     //using dynamic indexing
-    //float4 diffuseAlbedo = gTreeMapArray[pin.PrimID % 3].Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+    //float4 diffuseAlbedo = gTreeMapArray[pin.Slice].Sample(gsamAnisotropicWrap, pin.TexC) * matData.DiffuseAlbedo;
 
 	
 #ifdef ALPHA_TEST
@@ -195,8 +176,8 @@ float4 PS(GeoOut pin) : SV_Target
     // Light terms.
     float4 ambient = gAmbientLight*diffuseAlbedo;
 
-    const float shininess = 1.0f - gRoughness;
-    Material mat = { diffuseAlbedo, gFresnelR0, shininess };
+    const float shininess = 1.0f - matData.Roughness;
+    Material mat = { diffuseAlbedo, matData.FresnelR0, shininess };
     float3 shadowFactor = 1.0f;
     float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
         pin.NormalW, toEyeW, shadowFactor);
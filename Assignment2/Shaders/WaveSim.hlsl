@@ -0,0 +1,107 @@
+//***************************************************************************************
+// WaveSim.hlsl
+//
+// UpdateWavesCS(): Solves 2D wave equation using the compute shader.
+// DisturbWavesCS(): Runs one thread to disturb a grid height and its
+//     neighbors to generate a wave.
+// WaveNormalsCS(): Computes the normal and x-axis tangent of the current
+//     solution using a finite difference scheme.
+//***************************************************************************************
+
+// For updating the simulation.
+cbuffer cbUpdateSettings : register(b0)
+{
+	float gWaveConstant0;
+	float gWaveConstant1;
+	float gWaveConstant2;
+
+	float gDisturbMag;
+	int2 gDisturbIndex;
+
+	int2 gGridSize;
+	float gSpatialStep;
+};
+
+RWTexture2D<float> gPrevSolInput : register(u0);
+RWTexture2D<float> gCurrSolInput : register(u1);
+RWTexture2D<float> gOutput       : register(u2);
+
+RWTexture2D<float4> gNormalOutput  : register(u3);
+RWTexture2D<float4> gTangentOutput : register(u4);
+
+bool IsInterior(int x, int y)
+{
+	return x > 0 && y > 0 && x < gGridSize.x - 1 && y < gGridSize.y - 1;
+}
+
+[numthreads(16, 16, 1)]
+void UpdateWavesCS(int3 dispatchThreadID : SV_DispatchThreadID)
+{
+	int x = dispatchThreadID.x;
+	int y = dispatchThreadID.y;
+
+	// Only update interior points; we use zero boundary conditions.
+	if(!IsInterior(x, y))
+		return;
+
+	gOutput[int2(x,y)] =
+		gWaveConstant0 * gPrevSolInput[int2(x,y)].r +
+		gWaveConstant1 * gCurrSolInput[int2(x,y)].r +
+		gWaveConstant2 *(
+			gCurrSolInput[int2(x,y+1)].r +
+			gCurrSolInput[int2(x,y-1)].r +
+			gCurrSolInput[int2(x+1,y)].r +
+			gCurrSolInput[int2(x-1,y)].r);
+}
+
+[numthreads(1, 1, 1)]
+void DisturbWavesCS(int3 groupThreadID : SV_GroupThreadID,
+                    int3 dispatchThreadID : SV_DispatchThreadID)
+{
+	// We do not need to do bounds checking because:
+	//	 *out-of-bounds reads return 0, which works for us--it just means the boundary of
+	//    our water simulation is clamped to 0 in local space.
+	//   *out-of-bounds writes are a no-op.
+
+	int x = gDisturbIndex.x;
+	int y = gDisturbIndex.y;
+
+	float halfMag = 0.5f*gDisturbMag;
+
+	// Buffer is RW so operator += is well defined.
+	gOutput[int2(x,y)]   += gDisturbMag;
+	gOutput[int2(x+1,y)] += halfMag;
+	gOutput[int2(x-1,y)] += halfMag;
+	gOutput[int2(x,y+1)] += halfMag;
+	gOutput[int2(x,y-1)] += halfMag;
+}
+
+[numthreads(16, 16, 1)]
+void WaveNormalsCS(int3 dispatchThreadID : SV_DispatchThreadID)
+{
+	int x = dispatchThreadID.x;
+	int y = dispatchThreadID.y;
+
+	if(x >= gGridSize.x || y >= gGridSize.y)
+		return;
+
+	if(!IsInterior(x, y))
+	{
+		gNormalOutput[int2(x,y)]  = float4(0.0f, 1.0f, 0.0f, 0.0f);
+		gTangentOutput[int2(x,y)] = float4(1.0f, 0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	// Note x indexes the grid columns and y the rows, and our +z axis goes "down"
+	// to keep consistent with the row indices going down.
+	float l = gCurrSolInput[int2(x-1,y)].r;
+	float r = gCurrSolInput[int2(x+1,y)].r;
+	float t = gCurrSolInput[int2(x,y-1)].r;
+	float b = gCurrSolInput[int2(x,y+1)].r;
+
+	float3 n = normalize(float3(-r+l, 2.0f*gSpatialStep, b-t));
+	float3 tangent = normalize(float3(2.0f*gSpatialStep, r-l, 0.0f));
+
+	gNormalOutput[int2(x,y)]  = float4(n, 0.0f);
+	gTangentOutput[int2(x,y)] = float4(tangent, 0.0f);
+}
@@ -0,0 +1,68 @@
+#include "StaticGeometryBuilder.h"
+
+using namespace DirectX;
+
+void StaticGeometryBuilder::AddMesh(const std::string& submeshName,
+	const std::vector<Vertex>& vertices, const std::vector<std::uint16_t>& indices)
+{
+	assert(mSubmeshes.find(submeshName) == mSubmeshes.end());
+	assert(vertices.size() <= 0x00010000);
+
+	SubmeshGeometry submesh;
+	submesh.IndexCount = (UINT)indices.size();
+	submesh.StartIndexLocation = (UINT)mIndices.size();
+	submesh.BaseVertexLocation = (INT)mVertices.size();
+	BoundingBox::CreateFromPoints(submesh.Bounds, vertices.size(), &vertices[0].Pos, sizeof(Vertex));
+
+	mVertices.insert(mVertices.end(), vertices.begin(), vertices.end());
+	mIndices.insert(mIndices.end(), indices.begin(), indices.end());
+
+	mSubmeshes[submeshName] = submesh;
+}
+
+void StaticGeometryBuilder::AddMesh(const std::string& submeshName, const GeometryGenerator::MeshData& mesh)
+{
+	std::vector<Vertex> vertices(mesh.Vertices.size());
+	for(size_t i = 0; i < mesh.Vertices.size(); ++i)
+	{
+		vertices[i].Pos = mesh.Vertices[i].Position;
+		vertices[i].Normal = mesh.Vertices[i].Normal;
+		vertices[i].TexC = mesh.Vertices[i].TexC;
+	}
+
+	// GetIndices16 is not const.
+	GeometryGenerator::MeshData copy = mesh;
+	AddMesh(submeshName, vertices, copy.GetIndices16());
+}
+
+std::unique_ptr<MeshGeometry> StaticGeometryBuilder::Build(const std::string& name,
+	ID3D12Device* device, ID3D12GraphicsCommandList* cmdList)
+{
+	const UINT vbByteSize = (UINT)mVertices.size() * sizeof(Vertex);
+	const UINT ibByteSize = (UINT)mIndices.size() * sizeof(std::uint16_t);
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = name;
+
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), mVertices.data(), vbByteSize);
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), mIndices.data(), ibByteSize);
+
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(device,
+		cmdList, mVertices.data(), vbByteSize, geo->VertexBufferUploader);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(device,
+		cmdList, mIndices.data(), ibByteSize, geo->IndexBufferUploader);
+
+	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+
+	for(auto& e : mSubmeshes)
+		geo->DrawArgs[e.first] = e.second;
+
+	return geo;
+}
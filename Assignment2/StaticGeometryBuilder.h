@@ -0,0 +1,41 @@
+//***************************************************************************************
+// StaticGeometryBuilder.h
+//
+// Packs static meshes into one MeshGeometry: a single default-heap vertex buffer and
+// index buffer, with each mesh a submesh in DrawArgs.  The meshes share the Vertex
+// format and keep their own 16-bit indices, offset by BaseVertexLocation, so draws
+// of different meshes need no vertex or index buffer rebinds.
+//***************************************************************************************
+
+#ifndef STATICGEOMETRYBUILDER_H
+#define STATICGEOMETRYBUILDER_H
+
+#include "../../Common/d3dUtil.h"
+#include "../../Common/GeometryGenerator.h"
+#include "FrameResource.h"
+
+class StaticGeometryBuilder
+{
+public:
+	StaticGeometryBuilder() = default;
+	StaticGeometryBuilder(const StaticGeometryBuilder& rhs) = delete;
+	StaticGeometryBuilder& operator=(const StaticGeometryBuilder& rhs) = delete;
+	~StaticGeometryBuilder() = default;
+
+	// Appends a mesh, drawn with DrawArgs[submeshName] of the built geometry.
+	void AddMesh(const std::string& submeshName,
+		const std::vector<Vertex>& vertices, const std::vector<std::uint16_t>& indices);
+	void AddMesh(const std::string& submeshName, const GeometryGenerator::MeshData& mesh);
+
+	// Records the copies of everything added into cmdList.  The upload buffers
+	// are in the returned geometry, which has to outlive their execution.
+	std::unique_ptr<MeshGeometry> Build(const std::string& name,
+		ID3D12Device* device, ID3D12GraphicsCommandList* cmdList);
+
+private:
+	std::vector<Vertex> mVertices;
+	std::vector<std::uint16_t> mIndices;
+	std::unordered_map<std::string, SubmeshGeometry> mSubmeshes;
+};
+
+#endif // STATICGEOMETRYBUILDER_H
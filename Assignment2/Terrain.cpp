@@ -0,0 +1,243 @@
+//***************************************************************************************
+// Terrain.cpp
+//***************************************************************************************
+
+#include "Terrain.h"
+#include "../../Common/MathHelper.h"
+
+using namespace DirectX;
+
+Terrain::Terrain(const std::function<float(float, float)>& height,
+	float minX, float minZ, float cellSize, UINT chunkCells, UINT chunksX, UINT chunksZ)
+	: mMinX(minX), mMinZ(minZ), mCellSize(cellSize),
+	mChunkCells(chunkCells), mChunksX(chunksX), mChunksZ(chunksZ),
+	mCellsX(chunkCells*chunksX), mCellsZ(chunkCells*chunksZ)
+{
+	assert(chunkCells % (1 << (LodCount - 1)) == 0);
+	assert(chunksX > 0 && chunksZ > 0);
+
+	const UINT rowSize = mCellsX + 1;
+	mHeights.resize((size_t)rowSize*(mCellsZ + 1));
+	mNormals.resize(mHeights.size());
+
+	for(UINT z = 0; z <= mCellsZ; ++z)
+	{
+		for(UINT x = 0; x <= mCellsX; ++x)
+			mHeights[(size_t)z*rowSize + x] = height(mMinX + x*mCellSize, mMinZ + z*mCellSize);
+	}
+
+	// n = (-dh/dx, 1, -dh/dz), by central differences inside the table and
+	// one-sided ones on its edges.
+	for(int z = 0; z <= (int)mCellsZ; ++z)
+	{
+		for(int x = 0; x <= (int)mCellsX; ++x)
+		{
+			int x0 = (std::max)(x - 1, 0), x1 = (std::min)(x + 1, (int)mCellsX);
+			int z0 = (std::max)(z - 1, 0), z1 = (std::min)(z + 1, (int)mCellsZ);
+
+			XMFLOAT3 n(
+				-(TableHeight(x1, z) - TableHeight(x0, z)) / ((x1 - x0)*mCellSize),
+				1.0f,
+				-(TableHeight(x, z1) - TableHeight(x, z0)) / ((z1 - z0)*mCellSize));
+			XMStoreFloat3(&mNormals[(size_t)z*rowSize + x], XMVector3Normalize(XMLoadFloat3(&n)));
+		}
+	}
+}
+
+std::string Terrain::ChunkSubmeshName(UINT i, UINT lod)
+{
+	std::string name = "chunk" + std::to_string(i);
+	if(lod > 0)
+		name += ".lod" + std::to_string(lod);
+	return name;
+}
+
+float Terrain::TableHeight(int cellX, int cellZ)const
+{
+	return mHeights[(size_t)cellZ*(mCellsX + 1) + cellX];
+}
+
+float Terrain::GetHeight(float x, float z)const
+{
+	float fx = MathHelper::Clamp((x - mMinX) / mCellSize, 0.0f, (float)mCellsX);
+	float fz = MathHelper::Clamp((z - mMinZ) / mCellSize, 0.0f, (float)mCellsZ);
+	int ix = (std::min)((int)fx, (int)mCellsX - 1);
+	int iz = (std::min)((int)fz, (int)mCellsZ - 1);
+	float tx = fx - ix;
+	float tz = fz - iz;
+
+	float h0 = TableHeight(ix, iz) + tx*(TableHeight(ix + 1, iz) - TableHeight(ix, iz));
+	float h1 = TableHeight(ix, iz + 1) + tx*(TableHeight(ix + 1, iz + 1) - TableHeight(ix, iz + 1));
+	return h0 + tz*(h1 - h0);
+}
+
+XMFLOAT3 Terrain::GetNormal(float x, float z)const
+{
+	float fx = MathHelper::Clamp((x - mMinX) / mCellSize, 0.0f, (float)mCellsX);
+	float fz = MathHelper::Clamp((z - mMinZ) / mCellSize, 0.0f, (float)mCellsZ);
+	int ix = (std::min)((int)fx, (int)mCellsX - 1);
+	int iz = (std::min)((int)fz, (int)mCellsZ - 1);
+	float tx = fx - ix;
+	float tz = fz - iz;
+
+	const UINT rowSize = mCellsX + 1;
+	const XMFLOAT3* row0 = &mNormals[(size_t)iz*rowSize + ix];
+	const XMFLOAT3* row1 = row0 + rowSize;
+
+	XMVECTOR n0 = XMVectorLerp(XMLoadFloat3(&row0[0]), XMLoadFloat3(&row0[1]), tx);
+	XMVECTOR n1 = XMVectorLerp(XMLoadFloat3(&row1[0]), XMLoadFloat3(&row1[1]), tx);
+
+	XMFLOAT3 n;
+	XMStoreFloat3(&n, XMVector3Normalize(XMVectorLerp(n0, n1, tz)));
+	return n;
+}
+
+void Terrain::BuildChunkLod(UINT chunkX, UINT chunkZ, UINT lod, float texRepeat,
+	std::vector<TerrainVertex>& vertices, std::vector<std::uint16_t>& indices)const
+{
+	const int step = 1 << lod;
+	const int n = (int)mChunkCells / step;
+	const int baseX = (int)(chunkX*mChunkCells);
+	const int baseZ = (int)(chunkZ*mChunkCells);
+
+	// Table height of vertex (i, j) of this level.
+	auto height = [&](int i, int j) { return TableHeight(baseX + i*step, baseZ + j*step); };
+
+	auto makeVertex = [&](int i, int j)
+	{
+		int cellX = baseX + i*step;
+		int cellZ = baseZ + j*step;
+
+		TerrainVertex v;
+		v.Pos = XMFLOAT3(mMinX + cellX*mCellSize, TableHeight(cellX, cellZ), mMinZ + cellZ*mCellSize);
+		v.Normal = mNormals[(size_t)cellZ*(mCellsX + 1) + cellX];
+		v.TexC = XMFLOAT2((v.Pos.x - mMinX) / texRepeat, (v.Pos.z - mMinZ) / texRepeat);
+
+		// Where the vertex is in the next level, which only has the even
+		// vertices of this one: on a coarse edge, or on the diagonal of a
+		// coarse quad, which runs the same way as the quads below.
+		v.MorphHeight = v.Pos.y;
+		if(lod + 1 < LodCount)
+		{
+			bool oddI = (i & 1) != 0;
+			bool oddJ = (j & 1) != 0;
+			if(oddI && oddJ)
+				v.MorphHeight = 0.5f*(height(i + 1, j - 1) + height(i - 1, j + 1));
+			else if(oddI)
+				v.MorphHeight = 0.5f*(height(i - 1, j) + height(i + 1, j));
+			else if(oddJ)
+				v.MorphHeight = 0.5f*(height(i, j - 1) + height(i, j + 1));
+		}
+		return v;
+	};
+
+	const int rowSize = n + 1;
+	for(int j = 0; j <= n; ++j)
+	{
+		for(int i = 0; i <= n; ++i)
+			vertices.push_back(makeVertex(i, j));
+	}
+
+	// Quad (i, j) is split along its (i + 1, j) to (i, j + 1) diagonal.
+	for(int j = 0; j < n; ++j)
+	{
+		for(int i = 0; i < n; ++i)
+		{
+			std::uint16_t a = (std::uint16_t)(j*rowSize + i);
+			std::uint16_t b = (std::uint16_t)(a + 1);
+			std::uint16_t c = (std::uint16_t)(a + rowSize);
+			std::uint16_t d = (std::uint16_t)(c + 1);
+
+			indices.push_back(a); indices.push_back(c); indices.push_back(b);
+			indices.push_back(b); indices.push_back(c); indices.push_back(d);
+		}
+	}
+
+	// The skirt is deep enough to cover the height a coarsest level quad can
+	// be off by on this terrain's slopes.
+	const float skirtDepth = mCellSize*(1 << (LodCount - 1));
+
+	// left and right are the top edge vertices as seen from outside the chunk.
+	auto addSkirtQuad = [&](std::uint16_t left, std::uint16_t right)
+	{
+		std::uint16_t bottom = (std::uint16_t)vertices.size();
+		for(std::uint16_t top : { left, right })
+		{
+			TerrainVertex v = vertices[top];
+			v.Pos.y -= skirtDepth;
+			v.MorphHeight -= skirtDepth;
+			vertices.push_back(v);
+		}
+
+		indices.push_back(left); indices.push_back(right); indices.push_back(bottom);
+		indices.push_back(right); indices.push_back((std::uint16_t)(bottom + 1)); indices.push_back(bottom);
+	};
+
+	auto index = [rowSize](int i, int j) { return (std::uint16_t)(j*rowSize + i); };
+	for(int k = 0; k < n; ++k)
+	{
+		addSkirtQuad(index(k, 0), index(k + 1, 0));		// -z side
+		addSkirtQuad(index(k + 1, n), index(k, n));		// +z side
+		addSkirtQuad(index(0, k + 1), index(0, k));		// -x side
+		addSkirtQuad(index(n, k), index(n, k + 1));		// +x side
+	}
+}
+
+std::unique_ptr<MeshGeometry> Terrain::BuildGeometry(const std::string& name, float texRepeat,
+	ID3D12Device* device, ID3D12GraphicsCommandList* cmdList)const
+{
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = name;
+
+	std::vector<TerrainVertex> vertices;
+	std::vector<std::uint16_t> indices;
+	std::vector<TerrainVertex> chunkVertices;
+	std::vector<std::uint16_t> chunkIndices;
+
+	for(UINT z = 0; z < mChunksZ; ++z)
+	{
+		for(UINT x = 0; x < mChunksX; ++x)
+		{
+			for(UINT lod = 0; lod < LodCount; ++lod)
+			{
+				chunkVertices.clear();
+				chunkIndices.clear();
+				BuildChunkLod(x, z, lod, texRepeat, chunkVertices, chunkIndices);
+				assert(chunkVertices.size() <= 0x00010000);
+
+				SubmeshGeometry submesh;
+				submesh.IndexCount = (UINT)chunkIndices.size();
+				submesh.StartIndexLocation = (UINT)indices.size();
+				submesh.BaseVertexLocation = (INT)vertices.size();
+				BoundingBox::CreateFromPoints(submesh.Bounds, chunkVertices.size(),
+					&chunkVertices[0].Pos, sizeof(TerrainVertex));
+				geo->DrawArgs[ChunkSubmeshName(z*mChunksX + x, lod)] = submesh;
+
+				vertices.insert(vertices.end(), chunkVertices.begin(), chunkVertices.end());
+				indices.insert(indices.end(), chunkIndices.begin(), chunkIndices.end());
+			}
+		}
+	}
+
+	const UINT vbByteSize = (UINT)vertices.size() * sizeof(TerrainVertex);
+	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(device,
+		cmdList, vertices.data(), vbByteSize, geo->VertexBufferUploader);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(device,
+		cmdList, indices.data(), ibByteSize, geo->IndexBufferUploader);
+
+	geo->VertexByteStride = sizeof(TerrainVertex);
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+
+	return geo;
+}
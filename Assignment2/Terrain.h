@@ -0,0 +1,86 @@
+//***************************************************************************************
+// Terrain.h
+//
+// Height field terrain split into square chunks, each drawn and culled on its own.
+// The heights are sampled once into a table at every CellSize, which the meshes are
+// built from and the CPU queries (GetHeight, GetNormal) read, so neither evaluates the
+// height function again.
+//
+// Every chunk has LodCount levels of detail, each with half the vertices per side of
+// the one before.  A vertex also carries the height it has in the next coarser level,
+// and the vertex shader moves it there by the chunk's morph factor, so a chunk can
+// change levels once it is fully morphed without anything popping.  A skirt hangs
+// down from each chunk's edges and hides the cracks between neighbours at different
+// levels or morph factors.
+//***************************************************************************************
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "../../Common/d3dUtil.h"
+#include <functional>
+
+// Layout of the terrain vertex buffer; mTerrainInputLayout in the app.
+struct TerrainVertex
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::XMFLOAT3 Normal;
+	DirectX::XMFLOAT2 TexC;
+	float MorphHeight;
+};
+
+class Terrain
+{
+public:
+	static const UINT LodCount = 3;
+
+	// Samples height(x, z) over chunksX by chunksZ chunks of chunkCells by
+	// chunkCells cells, with the terrain's minimum corner at (minX, minZ).
+	// chunkCells has to be a multiple of 1 << (LodCount - 1).
+	Terrain(const std::function<float(float, float)>& height,
+		float minX, float minZ, float cellSize, UINT chunkCells, UINT chunksX, UINT chunksZ);
+	Terrain(const Terrain& rhs) = delete;
+	Terrain& operator=(const Terrain& rhs) = delete;
+	~Terrain() = default;
+
+	float MinX()const { return mMinX; }
+	float MinZ()const { return mMinZ; }
+	float Width()const { return mCellSize*mCellsX; }
+	float Depth()const { return mCellSize*mCellsZ; }
+
+	UINT ChunkCount()const { return mChunksX*mChunksZ; }
+
+	// Submesh of chunk i at level of detail lod in the built geometry;
+	// the coarser levels follow the "NAME.lodN" naming of the static meshes.
+	static std::string ChunkSubmeshName(UINT i, UINT lod);
+
+	// Bilinear in the table; outside the terrain the edge is extended.
+	float GetHeight(float x, float z)const;
+	DirectX::XMFLOAT3 GetNormal(float x, float z)const;
+
+	// Records the copies of every chunk's meshes into cmdList.  The texture
+	// repeats every texRepeat units.  The upload buffers are in the returned
+	// geometry, which has to outlive their execution.
+	std::unique_ptr<MeshGeometry> BuildGeometry(const std::string& name, float texRepeat,
+		ID3D12Device* device, ID3D12GraphicsCommandList* cmdList)const;
+
+private:
+	float TableHeight(int cellX, int cellZ)const;
+	void BuildChunkLod(UINT chunkX, UINT chunkZ, UINT lod, float texRepeat,
+		std::vector<TerrainVertex>& vertices, std::vector<std::uint16_t>& indices)const;
+
+	float mMinX = 0.0f;
+	float mMinZ = 0.0f;
+	float mCellSize = 1.0f;
+	UINT mChunkCells = 0;
+	UINT mChunksX = 0;
+	UINT mChunksZ = 0;
+	UINT mCellsX = 0;
+	UINT mCellsZ = 0;
+
+	// (mCellsX + 1)*(mCellsZ + 1) samples, x fastest.
+	std::vector<float> mHeights;
+	std::vector<DirectX::XMFLOAT3> mNormals;
+};
+
+#endif // TERRAIN_H
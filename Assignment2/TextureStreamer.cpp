@@ -0,0 +1,490 @@
+#include "TextureStreamer.h"
+#include "MappedFile.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	//
+	// The parts of the DDS format the streamer reads.
+	//
+
+	const UINT32 DdsMagic = 0x20534444; // "DDS "
+
+	struct DdsPixelFormat
+	{
+		UINT32 Size;
+		UINT32 Flags;
+		UINT32 FourCC;
+		UINT32 RGBBitCount;
+		UINT32 RBitMask;
+		UINT32 GBitMask;
+		UINT32 BBitMask;
+		UINT32 ABitMask;
+	};
+
+	struct DdsHeader
+	{
+		UINT32 Size;
+		UINT32 Flags;
+		UINT32 Height;
+		UINT32 Width;
+		UINT32 PitchOrLinearSize;
+		UINT32 Depth;
+		UINT32 MipMapCount;
+		UINT32 Reserved1[11];
+		DdsPixelFormat PixelFormat;
+		UINT32 Caps;
+		UINT32 Caps2;
+		UINT32 Caps3;
+		UINT32 Caps4;
+		UINT32 Reserved2;
+	};
+
+	struct DdsHeaderDxt10
+	{
+		UINT32 DxgiFormat;
+		UINT32 ResourceDimension;
+		UINT32 MiscFlag;
+		UINT32 ArraySize;
+		UINT32 MiscFlags2;
+	};
+
+	const UINT32 DdpfFourCC = 0x4;
+	const UINT32 DdpfRGB = 0x40;
+	const UINT32 DdsCaps2Cubemap = 0x200;
+	const UINT32 DdsCaps2Volume = 0x200000;
+	const UINT32 DdsDimensionTexture2D = 3;
+
+	constexpr UINT32 MakeFourCC(char a, char b, char c, char d)
+	{
+		return (UINT32)(BYTE)a | ((UINT32)(BYTE)b << 8) | ((UINT32)(BYTE)c << 16) | ((UINT32)(BYTE)d << 24);
+	}
+
+	DXGI_FORMAT LegacyFormat(const DdsPixelFormat& pf)
+	{
+		if(pf.Flags & DdpfFourCC)
+		{
+			switch(pf.FourCC)
+			{
+			case MakeFourCC('D', 'X', 'T', '1'): return DXGI_FORMAT_BC1_UNORM;
+			case MakeFourCC('D', 'X', 'T', '2'):
+			case MakeFourCC('D', 'X', 'T', '3'): return DXGI_FORMAT_BC2_UNORM;
+			case MakeFourCC('D', 'X', 'T', '4'):
+			case MakeFourCC('D', 'X', 'T', '5'): return DXGI_FORMAT_BC3_UNORM;
+			case MakeFourCC('A', 'T', 'I', '1'):
+			case MakeFourCC('B', 'C', '4', 'U'): return DXGI_FORMAT_BC4_UNORM;
+			case MakeFourCC('A', 'T', 'I', '2'):
+			case MakeFourCC('B', 'C', '5', 'U'): return DXGI_FORMAT_BC5_UNORM;
+			}
+		}
+		else if((pf.Flags & DdpfRGB) && pf.RGBBitCount == 32)
+		{
+			if(pf.RBitMask == 0x000000ff && pf.GBitMask == 0x0000ff00 && pf.BBitMask == 0x00ff0000)
+				return DXGI_FORMAT_R8G8B8A8_UNORM;
+			if(pf.RBitMask == 0x00ff0000 && pf.GBitMask == 0x0000ff00 && pf.BBitMask == 0x000000ff)
+				return pf.ABitMask != 0 ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+		}
+
+		return DXGI_FORMAT_UNKNOWN;
+	}
+
+	// Bytes per 4x4 block for the block-compressed formats, 0 for the others.
+	UINT BlockBytes(DXGI_FORMAT format)
+	{
+		switch(format)
+		{
+		case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_UNORM: case DXGI_FORMAT_BC4_SNORM:
+			return 8;
+		case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_UNORM: case DXGI_FORMAT_BC5_SNORM:
+		case DXGI_FORMAT_BC6H_UF16: case DXGI_FORMAT_BC6H_SF16:
+		case DXGI_FORMAT_BC7_UNORM: case DXGI_FORMAT_BC7_UNORM_SRGB:
+			return 16;
+		default:
+			return 0;
+		}
+	}
+
+	bool IsSupported(DXGI_FORMAT format)
+	{
+		switch(format)
+		{
+		case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+			return true;
+		default:
+			return BlockBytes(format) != 0;
+		}
+	}
+
+	// Row size and row count of a mip as it is packed in the file.
+	void SurfaceInfo(DXGI_FORMAT format, UINT width, UINT height, UINT64& rowBytes, UINT& numRows)
+	{
+		UINT blockBytes = BlockBytes(format);
+		if(blockBytes != 0)
+		{
+			rowBytes = (UINT64)(std::max)(1u, (width + 3) / 4) * blockBytes;
+			numRows = (std::max)(1u, (height + 3) / 4);
+		}
+		else
+		{
+			rowBytes = (UINT64)width * 4;
+			numRows = height;
+		}
+	}
+}
+
+TextureStreamer::TextureStreamer(ID3D12Device* device, UINT slotCount, UINT frameCount)
+	: mDevice(device), mSlotCount(slotCount), mFrameVersions(frameCount, 0)
+{
+	D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+	queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	ThrowIfFailed(device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mCopyQueue)));
+
+	ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&mCopyAlloc)));
+	ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY,
+		mCopyAlloc.Get(), nullptr, IID_PPV_ARGS(&mCopyList)));
+	ThrowIfFailed(mCopyList->Close());
+
+	ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
+	mFenceEvent = CreateEventEx(nullptr, nullptr, false, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+
+	D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+	heapDesc.NumDescriptors = slotCount;
+	heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mSrvHeap)));
+	mSrvDescriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+	// Alpha is 0 in the array placeholder, so alpha-tested sprites stay hidden.
+	mPlaceholder = CreatePlaceholder(1, 0xff808080);
+	mPlaceholderArray = CreatePlaceholder(1, 0x00808080);
+
+	for(UINT slot = 0; slot < mSlotCount; ++slot)
+		CreateSrv(mPlaceholder.Get(), false, slot);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	mTasks.wait();
+	WaitForFence(mFenceValue);
+
+	if(mFenceEvent != nullptr)
+		CloseHandle(mFenceEvent);
+}
+
+void TextureStreamer::Load(UINT slot, Texture* texture, bool isArray)
+{
+	assert(slot < mSlotCount);
+
+	CreateSrv(isArray ? mPlaceholderArray.Get() : mPlaceholder.Get(), isArray, slot);
+	++mVersion;
+	++mPendingCount;
+
+	mTasks.run([this, slot, texture, isArray]()
+	{
+		PendingTexture pending;
+		pending.Slot = slot;
+		pending.Tex = texture;
+		pending.IsArray = isArray;
+
+		// An exception must not leave the task: task_group::wait would rethrow
+		// it in the destructor, and the texture would never be counted.
+		bool prepared = false;
+		try
+		{
+			prepared = Prepare(pending);
+		}
+		catch(DxException& e)
+		{
+			OutputDebugStringW((L"TextureStreamer: " + e.ToString() + L"\n").c_str());
+		}
+		catch(std::exception& e)
+		{
+			OutputDebugStringA((std::string("TextureStreamer: ") + e.what() + "\n").c_str());
+		}
+
+		if(!prepared)
+		{
+			OutputDebugStringW((L"TextureStreamer: could not load " + texture->Filename + L"\n").c_str());
+			pending.Resource = nullptr;
+			pending.Upload = nullptr;
+		}
+
+		// A failed texture is still handed over, so the main thread counts it.
+		std::lock_guard<std::mutex> lock(mReadyMutex);
+		mReady.push_back(std::move(pending));
+	});
+}
+
+void TextureStreamer::Update()
+{
+	// Swap in the batch the copy queue has finished.
+	if(mBatchFence != 0 && mFence->GetCompletedValue() >= mBatchFence)
+	{
+		for(auto& e : mInFlight)
+		{
+			CreateSrv(e.Resource.Get(), e.IsArray, e.Slot);
+			e.Tex->Resource = e.Resource;
+			--mPendingCount;
+		}
+		mInFlight.clear();
+		mBatchFence = 0;
+		++mVersion;
+	}
+
+	if(mBatchFence != 0)
+		return;
+
+	std::vector<PendingTexture> ready;
+	{
+		std::lock_guard<std::mutex> lock(mReadyMutex);
+		ready.swap(mReady);
+	}
+
+	if(!ready.empty())
+		Submit(ready);
+}
+
+void TextureStreamer::UpdateFrameTable(UINT frameIndex, D3D12_CPU_DESCRIPTOR_HANDLE table)
+{
+	if(mFrameVersions[frameIndex] == mVersion)
+		return;
+
+	mDevice->CopyDescriptorsSimple(mSlotCount, table,
+		mSrvHeap->GetCPUDescriptorHandleForHeapStart(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	mFrameVersions[frameIndex] = mVersion;
+}
+
+void TextureStreamer::Flush()
+{
+	mTasks.wait();
+
+	// Each Update either swaps in the batch in flight or submits the next one.
+	for(;;)
+	{
+		Update();
+		if(mBatchFence == 0)
+			break;
+		WaitForFence(mBatchFence);
+	}
+}
+
+bool TextureStreamer::Prepare(PendingTexture& pending)
+{
+	MappedFile file(pending.Tex->Filename);
+	const BYTE* data = file.Data();
+	size_t size = file.Size();
+	if(data == nullptr || size < sizeof(UINT32) + sizeof(DdsHeader))
+		return false;
+
+	if(*reinterpret_cast<const UINT32*>(data) != DdsMagic)
+		return false;
+
+	const DdsHeader* header = reinterpret_cast<const DdsHeader*>(data + sizeof(UINT32));
+	size_t offset = sizeof(UINT32) + sizeof(DdsHeader);
+
+	if(header->Caps2 & (DdsCaps2Cubemap | DdsCaps2Volume))
+		return false;
+
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+	UINT arraySize = 1;
+	if((header->PixelFormat.Flags & DdpfFourCC) && header->PixelFormat.FourCC == MakeFourCC('D', 'X', '1', '0'))
+	{
+		if(size < offset + sizeof(DdsHeaderDxt10))
+			return false;
+
+		const DdsHeaderDxt10* dxt10 = reinterpret_cast<const DdsHeaderDxt10*>(data + offset);
+		offset += sizeof(DdsHeaderDxt10);
+
+		if(dxt10->ResourceDimension != DdsDimensionTexture2D)
+			return false;
+
+		format = (DXGI_FORMAT)dxt10->DxgiFormat;
+		arraySize = (std::max)(1u, (UINT)dxt10->ArraySize);
+	}
+	else
+	{
+		format = LegacyFormat(header->PixelFormat);
+	}
+
+	if(!IsSupported(format))
+		return false;
+
+	UINT width = header->Width;
+	UINT height = header->Height;
+	UINT mipCount = (std::max)(1u, (UINT)header->MipMapCount);
+
+	// Create the texture in the common state: the copy queue promotes it to a
+	// copy destination, and the direct queue to a shader resource.
+	CD3DX12_RESOURCE_DESC texDesc = CD3DX12_RESOURCE_DESC::Tex2D(format, width, height, (UINT16)arraySize, (UINT16)mipCount);
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&pending.Resource)));
+
+	UINT subresourceCount = arraySize*mipCount;
+	pending.Layouts.resize(subresourceCount);
+	std::vector<UINT> numRows(subresourceCount);
+	std::vector<UINT64> rowSizes(subresourceCount);
+	UINT64 uploadSize = 0;
+	mDevice->GetCopyableFootprints(&texDesc, 0, subresourceCount, 0,
+		pending.Layouts.data(), numRows.data(), rowSizes.data(), &uploadSize);
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(uploadSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&pending.Upload)));
+
+	BYTE* mapped = nullptr;
+	ThrowIfFailed(pending.Upload->Map(0, nullptr, reinterpret_cast<void**>(&mapped)));
+
+	// The file stores each array slice with its mips, which is also the
+	// subresource order.
+	bool fits = true;
+	for(UINT i = 0; i < subresourceCount && fits; ++i)
+	{
+		UINT mip = i % mipCount;
+		UINT64 rowBytes = 0;
+		UINT rows = 0;
+		SurfaceInfo(format, (std::max)(1u, width >> mip), (std::max)(1u, height >> mip), rowBytes, rows);
+
+		if(offset + rowBytes*rows > size)
+		{
+			fits = false;
+			break;
+		}
+
+		const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& layout = pending.Layouts[i];
+		for(UINT row = 0; row < rows; ++row)
+		{
+			CopyMemory(mapped + layout.Offset + (UINT64)row*layout.Footprint.RowPitch,
+				data + offset + row*rowBytes, (size_t)rowBytes);
+		}
+		offset += (size_t)(rowBytes*rows);
+	}
+
+	pending.Upload->Unmap(0, nullptr);
+	return fits;
+}
+
+ComPtr<ID3D12Resource> TextureStreamer::CreatePlaceholder(UINT arraySize, UINT32 rgba)
+{
+	ComPtr<ID3D12Resource> texture;
+	CD3DX12_RESOURCE_DESC texDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1, (UINT16)arraySize, 1);
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&texture)));
+
+	std::vector<PendingTexture> batch(1);
+	PendingTexture& pending = batch[0];
+	pending.Resource = texture;
+	pending.Layouts.resize(arraySize);
+
+	UINT64 uploadSize = 0;
+	mDevice->GetCopyableFootprints(&texDesc, 0, arraySize, 0, pending.Layouts.data(), nullptr, nullptr, &uploadSize);
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(uploadSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&pending.Upload)));
+
+	BYTE* mapped = nullptr;
+	ThrowIfFailed(pending.Upload->Map(0, nullptr, reinterpret_cast<void**>(&mapped)));
+	for(auto& layout : pending.Layouts)
+		CopyMemory(mapped + layout.Offset, &rgba, sizeof(rgba));
+	pending.Upload->Unmap(0, nullptr);
+
+	// Only made in the constructor, so the copy can be waited on right away.
+	Submit(batch);
+	WaitForFence(mBatchFence);
+	mInFlight.clear();
+	mBatchFence = 0;
+
+	return texture;
+}
+
+void TextureStreamer::CreateSrv(ID3D12Resource* resource, bool isArray, UINT slot)
+{
+	D3D12_RESOURCE_DESC desc = resource->GetDesc();
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = desc.Format;
+	if(isArray)
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.MipLevels = -1;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = desc.DepthOrArraySize;
+	}
+	else
+	{
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = -1;
+	}
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE handle(mSrvHeap->GetCPUDescriptorHandleForHeapStart(), slot, mSrvDescriptorSize);
+	mDevice->CreateShaderResourceView(resource, &srvDesc, handle);
+}
+
+void TextureStreamer::Submit(std::vector<PendingTexture>& textures)
+{
+	ThrowIfFailed(mCopyAlloc->Reset());
+	ThrowIfFailed(mCopyList->Reset(mCopyAlloc.Get(), nullptr));
+
+	for(auto& e : textures)
+	{
+		if(e.Resource == nullptr)
+		{
+			--mPendingCount;
+			continue;
+		}
+
+		for(UINT i = 0; i < (UINT)e.Layouts.size(); ++i)
+		{
+			CD3DX12_TEXTURE_COPY_LOCATION dst(e.Resource.Get(), i);
+			CD3DX12_TEXTURE_COPY_LOCATION src(e.Upload.Get(), e.Layouts[i]);
+			mCopyList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+		}
+		mInFlight.push_back(std::move(e));
+	}
+
+	ThrowIfFailed(mCopyList->Close());
+	ID3D12CommandList* cmdsLists[] = { mCopyList.Get() };
+	mCopyQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+
+	ThrowIfFailed(mCopyQueue->Signal(mFence.Get(), ++mFenceValue));
+	mBatchFence = mFenceValue;
+}
+
+void TextureStreamer::WaitForFence(UINT64 value)
+{
+	if(mFence->GetCompletedValue() < value)
+	{
+		ThrowIfFailed(mFence->SetEventOnCompletion(value, mFenceEvent));
+		WaitForSingleObject(mFenceEvent, INFINITE);
+	}
+}
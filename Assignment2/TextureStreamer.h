@@ -0,0 +1,114 @@
+//***************************************************************************************
+// TextureStreamer.h
+//
+// Loads DDS textures in the background so the first frame does not wait for them.
+// Each file is memory-mapped and parsed on a worker thread, which also creates the
+// texture and fills its upload buffer; the main thread then records the copies on
+// a copy queue.  Until its copies have completed, a texture's SRV slot shows a
+// 1x1 placeholder.
+//
+// The SRVs are kept in a CPU-only heap and copied into a shader-visible table per
+// frame resource, so a slot is never rewritten while an earlier frame that reads it
+// may still be on the GPU.
+//
+// Supports 2D textures and texture arrays in the BC1-BC7 and 32-bit RGBA/BGRA
+// formats, with legacy or DX10 headers.  A file that fails to load, or whose
+// resources cannot be created, keeps its placeholder and is reported to the
+// debugger output.
+//***************************************************************************************
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include "../../Common/d3dUtil.h"
+#include <ppl.h>
+#include <mutex>
+
+class TextureStreamer
+{
+public:
+	TextureStreamer(ID3D12Device* device, UINT slotCount, UINT frameCount);
+	TextureStreamer(const TextureStreamer& rhs) = delete;
+	TextureStreamer& operator=(const TextureStreamer& rhs) = delete;
+	~TextureStreamer();
+
+	UINT SlotCount()const { return mSlotCount; }
+
+	// Starts loading texture->Filename into SRV slot; texture->Resource is set
+	// once it is in.  Until then the slot shows mid grey, or for an array a
+	// transparent texel.
+	void Load(UINT slot, Texture* texture, bool isArray);
+
+	// Main thread, once per frame: uploads the textures read since the last
+	// call and swaps in the ones whose copies have completed.
+	void Update();
+
+	// Copies the SRVs into the shader-visible table of frame resource
+	// frameIndex if they changed since it was last written.  Call once the GPU
+	// is done with that frame resource.
+	void UpdateFrameTable(UINT frameIndex, D3D12_CPU_DESCRIPTOR_HANDLE table);
+
+	// Blocks until every texture loaded so far is in.
+	void Flush();
+
+	// Textures not yet swapped in.
+	UINT PendingCount()const { return mPendingCount; }
+
+private:
+	struct PendingTexture
+	{
+		UINT Slot = 0;
+		Texture* Tex = nullptr;
+		bool IsArray = false;
+
+		Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Upload;
+		std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> Layouts;
+	};
+
+	// Worker thread: fills in Resource, Upload and Layouts.  Returns false for
+	// a file it cannot read; a device call that fails throws.
+	bool Prepare(PendingTexture& pending);
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreatePlaceholder(UINT arraySize, UINT32 rgba);
+	void CreateSrv(ID3D12Resource* resource, bool isArray, UINT slot);
+	void Submit(std::vector<PendingTexture>& textures);
+	void WaitForFence(UINT64 value);
+
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mCopyQueue;
+	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mCopyAlloc;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mCopyList;
+	Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+	UINT64 mFenceValue = 0;
+	HANDLE mFenceEvent = nullptr;
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mPlaceholder;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mPlaceholderArray;
+
+	// CPU-only: the current SRV of every slot.
+	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mSrvHeap;
+	UINT mSrvDescriptorSize = 0;
+	UINT mSlotCount = 0;
+
+	// Bumped whenever a slot changes; each frame table remembers the version
+	// it was written at.
+	UINT64 mVersion = 1;
+	std::vector<UINT64> mFrameVersions;
+
+	concurrency::task_group mTasks;
+
+	// Read by the workers, waiting for the copy queue.
+	std::mutex mReadyMutex;
+	std::vector<PendingTexture> mReady;
+
+	// The one batch of copies on the copy queue, done at mBatchFence.  The
+	// allocator is only reset once it is done.
+	std::vector<PendingTexture> mInFlight;
+	UINT64 mBatchFence = 0;
+
+	UINT mPendingCount = 0;
+};
+
+#endif // TEXTURESTREAMER_H
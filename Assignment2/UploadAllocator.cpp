@@ -0,0 +1,82 @@
+//***************************************************************************************
+// UploadAllocator.cpp
+//***************************************************************************************
+
+#include "UploadAllocator.h"
+
+UploadAllocator::UploadAllocator(ID3D12Device* device, UINT64 pageByteSize)
+	: mDevice(device), mPageByteSize(pageByteSize)
+{
+	mPages.push_back(CreatePage(mPageByteSize));
+}
+
+UploadAllocator::~UploadAllocator()
+{
+	for(Page& page : mPages)
+		page.Resource->Unmap(0, nullptr);
+}
+
+UploadAllocator::Page UploadAllocator::CreatePage(UINT64 byteSize)
+{
+	Page page;
+	page.ByteSize = byteSize;
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&page.Resource)));
+
+	// Mapped until the allocator goes away.  The CPU only writes, so no range
+	// is read.
+	CD3DX12_RANGE readRange(0, 0);
+	ThrowIfFailed(page.Resource->Map(0, &readRange, reinterpret_cast<void**>(&page.Cpu)));
+	page.Gpu = page.Resource->GetGPUVirtualAddress();
+
+	return page;
+}
+
+UploadAllocator::Allocation UploadAllocator::Allocate(UINT64 byteSize, UINT64 alignment)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	UINT64 offset = (mOffset + alignment - 1) & ~(alignment - 1);
+	if(offset + byteSize > mPages[mPage].ByteSize)
+	{
+		// Pages are 64 KB aligned, so the start of the next one is aligned
+		// enough.  A page a Reset left behind is reused if the allocation fits.
+		++mPage;
+		if(mPage == mPages.size() || mPages[mPage].ByteSize < byteSize)
+			mPages.insert(mPages.begin() + mPage, CreatePage((std::max)(mPageByteSize, byteSize)));
+		offset = 0;
+	}
+
+	mOffset = offset + byteSize;
+
+	Allocation a;
+	a.Cpu = mPages[mPage].Cpu + offset;
+	a.Gpu = mPages[mPage].Gpu + offset;
+	return a;
+}
+
+void UploadAllocator::KeepAllocations()
+{
+	mKeptPage = mPage;
+	mKeptOffset = mOffset;
+}
+
+void UploadAllocator::Reset()
+{
+	mPage = mKeptPage;
+	mOffset = mKeptOffset;
+}
+
+UINT64 UploadAllocator::ReservedByteSize()const
+{
+	UINT64 byteSize = 0;
+	for(const Page& page : mPages)
+		byteSize += page.ByteSize;
+	return byteSize;
+}
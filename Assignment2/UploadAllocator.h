@@ -0,0 +1,124 @@
+//***************************************************************************************
+// UploadAllocator.h
+//
+// Linear allocator over upload heap buffers that stay mapped for their whole life.
+// Allocations are aligned sub-ranges of a page, handed out one after the other; one
+// that does not fit in the current page goes to the next page, made if there is none
+// (an allocation bigger than a page gets a page of its size).  Reset starts handing
+// out the same memory again, keeping the pages, so once a frame's allocations have
+// been seen no upload buffer is created again.
+//
+// Each frame resource has one: its GPU is done with the memory by the time the frame
+// resource is reused, which is when it is Reset.  Allocations made before
+// KeepAllocations survive Reset, for data that is only rewritten when it changes.
+// Not thread safe.
+//***************************************************************************************
+
+#ifndef UPLOADALLOCATOR_H
+#define UPLOADALLOCATOR_H
+
+#include "../../Common/d3dUtil.h"
+
+class UploadAllocator
+{
+public:
+	struct Allocation
+	{
+		BYTE* Cpu = nullptr;
+		D3D12_GPU_VIRTUAL_ADDRESS Gpu = 0;
+	};
+
+	UploadAllocator(ID3D12Device* device, UINT64 pageByteSize);
+	UploadAllocator(const UploadAllocator& rhs) = delete;
+	UploadAllocator& operator=(const UploadAllocator& rhs) = delete;
+	~UploadAllocator();
+
+	// alignment is a power of two; the default suits constant buffers, which
+	// need the most.
+	Allocation Allocate(UINT64 byteSize, UINT64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+
+	// Makes the allocations so far survive Reset.
+	void KeepAllocations();
+
+	// Frees every allocation made since KeepAllocations.  Only call once the
+	// GPU is done reading them.
+	void Reset();
+
+	UINT PageCount()const { return (UINT)mPages.size(); }
+	UINT64 ReservedByteSize()const;
+
+private:
+	struct Page
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+		BYTE* Cpu = nullptr;
+		D3D12_GPU_VIRTUAL_ADDRESS Gpu = 0;
+		UINT64 ByteSize = 0;
+	};
+
+	Page CreatePage(UINT64 byteSize);
+
+	ID3D12Device* mDevice = nullptr;
+	UINT64 mPageByteSize = 0;
+
+	std::vector<Page> mPages;
+
+	// Where the next allocation goes, and where Reset goes back to.
+	size_t mPage = 0;
+	UINT64 mOffset = 0;
+	size_t mKeptPage = 0;
+	UINT64 mKeptOffset = 0;
+};
+
+// An array of T in an UploadAllocator allocation, written like UploadBuffer<T>:
+// the elements of a constant buffer array are each padded to 256 bytes, so each
+// can be bound as a constant buffer of its own.
+template<typename T>
+class UploadArray
+{
+public:
+	UploadArray() = default;
+
+	UploadArray(UploadAllocator& allocator, UINT elementCount, bool isConstantBuffer)
+		: mElementCount(elementCount)
+	{
+		mElementByteSize = isConstantBuffer ? d3dUtil::CalcConstantBufferByteSize(sizeof(T)) : sizeof(T);
+
+		// Root descriptors can not point at nothing, so an empty array still
+		// gets an element.
+		UploadAllocator::Allocation a = allocator.Allocate((UINT64)mElementByteSize*(std::max)(elementCount, 1u));
+		mMappedData = a.Cpu;
+		mGpuAddress = a.Gpu;
+	}
+
+	static UINT64 ByteSize(UINT elementCount, bool isConstantBuffer)
+	{
+		UINT elementByteSize = isConstantBuffer ? d3dUtil::CalcConstantBufferByteSize(sizeof(T)) : sizeof(T);
+		return (UINT64)elementByteSize*(std::max)(elementCount, 1u);
+	}
+
+	void CopyData(int elementIndex, const T& data)
+	{
+		memcpy(&mMappedData[(size_t)elementIndex*mElementByteSize], &data, sizeof(T));
+	}
+
+	// The elements, for writing in bulk; only for arrays that are not
+	// constant buffers, whose elements are packed.
+	T* Data()const { return reinterpret_cast<T*>(mMappedData); }
+
+	D3D12_GPU_VIRTUAL_ADDRESS GpuAddress(UINT elementIndex = 0)const
+	{
+		return mGpuAddress + (UINT64)elementIndex*mElementByteSize;
+	}
+
+	UINT ElementCount()const { return mElementCount; }
+	UINT ElementByteSize()const { return mElementByteSize; }
+
+private:
+	BYTE* mMappedData = nullptr;
+	D3D12_GPU_VIRTUAL_ADDRESS mGpuAddress = 0;
+	UINT mElementByteSize = 0;
+	UINT mElementCount = 0;
+};
+
+#endif // UPLOADALLOCATOR_H
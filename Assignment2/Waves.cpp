@@ -4,9 +4,12 @@
 
 #include "Waves.h"
 #include <ppl.h>
+#include <intrin.h>
+#include <immintrin.h>
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
 
 using namespace DirectX;
 
@@ -27,32 +30,37 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mK2 = (4.0f - 8.0f*e) / d;
     mK3 = (2.0f*e) / d;
 
-    mPrevSolution.resize(m*n);
-    mCurrSolution.resize(m*n);
-    mNormals.resize(m*n);
-    mTangentX.resize(m*n);
+    // Generate grid heights in system memory.  The x/z coordinates follow from
+    // the grid index, see Position().
 
-    // Generate grid vertices in system memory.
+    mOriginX = -(n - 1)*dx*0.5f;
+    mOriginZ = (m - 1)*dx*0.5f;
 
-    float halfWidth = (n - 1)*dx*0.5f;
-    float halfDepth = (m - 1)*dx*0.5f;
-    for(int i = 0; i < m; ++i)
-    {
-        float z = halfDepth - i*dx;
-        for(int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j*dx;
+    mPrevSolution.assign(m*n, -3.0f);
+    mCurrSolution.assign(m*n, -3.0f);
+    mNormalX.assign(m*n, 0.0f);
+    mNormalY.assign(m*n, 1.0f);
+    mNormalZ.assign(m*n, 0.0f);
+    mTangentXX.assign(m*n, 1.0f);
+    mTangentXY.assign(m*n, 0.0f);
 
-            mPrevSolution[i*n + j] = XMFLOAT3(x, -3.0f, z);
-            mCurrSolution[i*n + j] = XMFLOAT3(x, -3.0f, z);
-            mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
-            mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
-        }
-    }
+	// The water starts out flat, so every tile starts asleep.
+	mTileRows = (m + TileSize - 1) / TileSize;
+	mTileCols = (n + TileSize - 1) / TileSize;
+	mTileAwake.assign(mTileRows*mTileCols, 0);
+	mTileQuietSteps.assign(mTileRows*mTileCols, 0);
+	mTileChanged.assign(mTileRows*mTileCols, 0);
+	mTileDelta.assign(mTileRows*mTileCols, 0.0f);
+	mVisitTiles.reserve(mTileRows*mTileCols);
+
+    SetSolver(BestSolver());
+
+    ViewSimulation();
 }
 
 Waves::~Waves()
 {
+	SetAsync(false);
 }
 
 int Waves::RowCount()const
@@ -85,72 +93,624 @@ float Waves::Depth()const
 	return mNumRows*mSpatialStep;
 }
 
+float Waves::SpatialStep()const
+{
+	return mSpatialStep;
+}
+
+Waves::Solver Waves::BestSolver()
+{
+	int info[4];
+
+	// The AVX kernels only use float instructions, and no FMA, which would
+	// round differently from the other solvers.  They need AVX and OS
+	// support for saving the YMM registers.
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if(!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+		return Solver::SSE;
+
+	return Solver::AVX;
+}
+
+void Waves::SetSolver(Solver solver)
+{
+	// Never pick a kernel the CPU can not run.
+	if(solver == Solver::AVX && BestSolver() != Solver::AVX)
+		solver = Solver::SSE;
+
+	mSolver = solver;
+}
+
+void Waves::SetMaxSubsteps(int maxSubsteps)
+{
+	// The worker reads the cap without locking.
+	assert(maxSubsteps > 0 && !IsAsync());
+
+	mMaxSubsteps = maxSubsteps;
+}
+
+void Waves::SetAsync(bool async)
+{
+	if(async == IsAsync())
+		return;
+
+	if(async)
+	{
+		CopySimulation(mSurface[0]);
+		mFront = 0;
+		mSurfaceReady = false;
+		mPendingTime = 0.0f;
+		mQuit = false;
+		ViewSurface(mSurface[mFront]);
+
+		mWorker = std::thread(&Waves::WorkerMain, this);
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+		mWake.notify_one();
+		mWorker.join();
+
+		// The worker is gone, so the simulation arrays are ours again.
+		for(auto& d : mPendingDisturbances)
+			ApplyDisturbance(d.I, d.J, d.Magnitude);
+		mPendingDisturbances.clear();
+
+		ViewSimulation();
+	}
+}
+
 void Waves::Update(float dt)
 {
-	static float t = 0;
+	if(!IsAsync())
+	{
+		Advance(dt);
+
+		// The solution buffers were swapped.
+		ViewSimulation();
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mPendingTime += dt;
+
+	// Pick up the newest surface the worker published.
+	if(mSurfaceReady)
+	{
+		mFront = 1 - mFront;
+		mSurfaceReady = false;
+		ViewSurface(mSurface[mFront]);
+	}
 
+	mWake.notify_one();
+}
+
+int Waves::Advance(float dt)
+{
 	// Accumulate time.
-	t += dt;
+	mAccumTime += dt;
 
 	// Only update the simulation at the specified time step.
-	if( t >= mTimeStep )
+	int steps = 0;
+	for(; steps < mMaxSubsteps && mAccumTime >= mTimeStep; ++steps)
+	{
+		Step();
+		mAccumTime -= mTimeStep;
+	}
+
+	// Hit the cap: drop the backlog rather than falling further behind.
+	if(mAccumTime >= mTimeStep)
+		mAccumTime = 0.0f;
+
+	if(steps == 0)
+		return 0;
+
+	//
+	// Compute normals using finite difference scheme.  Only the last step
+	// is ever looked at, so this runs once per Advance.  The normals on a
+	// tile's edges read the next tile's heights, so the tiles around the
+	// changed ones are redone too.
+	//
+	mVisitTiles.clear();
+	for(int t = 0; t < mTileRows*mTileCols; ++t)
+	{
+		if(NearMarkedTile(t, mTileChanged))
+			mVisitTiles.push_back(t);
+	}
+
+	concurrency::parallel_for(0, (int)mVisitTiles.size(), [this](int k)
+	{
+		ComputeNormalsTile(mVisitTiles[k]);
+	});
+
+	std::fill(mTileChanged.begin(), mTileChanged.end(), (unsigned char)0);
+
+	return steps;
+}
+
+void Waves::Step()
+{
+	// The awake tiles, and the sleeping ones next to them that a wave can
+	// reach this step.
+	mVisitTiles.clear();
+	for(int t = 0; t < mTileRows*mTileCols; ++t)
 	{
-		// Only update interior points; we use zero boundary conditions.
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows-1; ++i)
+		if(NearMarkedTile(t, mTileAwake))
+			mVisitTiles.push_back(t);
+	}
+
+	concurrency::parallel_for(0, (int)mVisitTiles.size(), [this](int k)
+	{
+		int t = mVisitTiles[k];
+		mTileDelta[t] = UpdateTile(t);
+	});
+
+	for(int t : mVisitTiles)
+	{
+		mTileChanged[t] = 1;
+
+		if(mTileDelta[t] > SleepThreshold)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-
-				mPrevSolution[i*mNumCols+j].y = 
-					mK1*mPrevSolution[i*mNumCols+j].y +
-					mK2*mCurrSolution[i*mNumCols+j].y +
-					mK3*(mCurrSolution[(i+1)*mNumCols+j].y + 
-					     mCurrSolution[(i-1)*mNumCols+j].y + 
-					     mCurrSolution[i*mNumCols+j+1].y + 
-						 mCurrSolution[i*mNumCols+j-1].y);
-			}
-		});
+			mTileAwake[t] = 1;
+			mTileQuietSteps[t] = 0;
+		}
+		else if(mTileAwake[t] && ++mTileQuietSteps[t] >= StepsToSleep)
+			mTileAwake[t] = 0;
+
+		// Asleep after the step, so both buffers get its new heights.
+		if(!mTileAwake[t])
+			SettleTile(t);
+	}
+
+	// We just overwrote the previous buffer with the new data, so
+	// this data needs to become the current solution and the old
+	// current solution becomes the new previous solution.
+	std::swap(mPrevSolution, mCurrSolution);
+}
+
+void Waves::TileInterior(int t, int& i0, int& i1, int& j0, int& j1)const
+{
+	// Only update interior points; we use zero boundary conditions.
+	int ti = t / mTileCols;
+	int tj = t % mTileCols;
+	i0 = (std::max)(ti*TileSize, 1);
+	i1 = (std::min)((ti + 1)*TileSize, mNumRows - 1);
+	j0 = (std::max)(tj*TileSize, 1);
+	j1 = (std::min)((tj + 1)*TileSize, mNumCols - 1);
+}
+
+bool Waves::NearMarkedTile(int t, const std::vector<unsigned char>& marks)const
+{
+	int ti = t / mTileCols;
+	int tj = t % mTileCols;
+
+	for(int i = (std::max)(ti - 1, 0); i <= (std::min)(ti + 1, mTileRows - 1); ++i)
+	{
+		for(int j = (std::max)(tj - 1, 0); j <= (std::min)(tj + 1, mTileCols - 1); ++j)
+		{
+			if(marks[i*mTileCols + j])
+				return true;
+		}
+	}
+	return false;
+}
 
-		// We just overwrote the previous buffer with the new data, so
-		// this data needs to become the current solution and the old
-		// current solution becomes the new previous solution.
-		std::swap(mPrevSolution, mCurrSolution);
+void Waves::WakeTileAt(int i, int j)
+{
+	// Changed too, so the normals follow even if no step runs before the
+	// next Advance is done.
+	int t = (i / TileSize)*mTileCols + j / TileSize;
+	mTileAwake[t] = 1;
+	mTileQuietSteps[t] = 0;
+	mTileChanged[t] = 1;
+}
 
-		t = 0.0f; // reset time
+float Waves::UpdateTile(int t)
+{
+	int i0, i1, j0, j1;
+	TileInterior(t, i0, i1, j0, j1);
 
-		//
-		// Compute normals using finite difference scheme.
-		//
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows - 1; ++i)
+	float maxDelta = 0.0f;
+	for(int i = i0; i < i1; ++i)
+	{
+		float rowDelta;
+		switch(mSolver)
+		{
+		case Solver::AVX: rowDelta = UpdateRowAVX(i, j0, j1); break;
+		case Solver::SSE:  rowDelta = UpdateRowSSE(i, j0, j1);  break;
+		default:           rowDelta = UpdateRow(i, j0, j1);     break;
+		}
+		maxDelta = (std::max)(maxDelta, rowDelta);
+	}
+	return maxDelta;
+}
+
+void Waves::SettleTile(int t)
+{
+	// Called between the stencil and the swap, when mPrevSolution holds the
+	// new heights.
+	int i0, i1, j0, j1;
+	TileInterior(t, i0, i1, j0, j1);
+
+	for(int i = i0; i < i1; ++i)
+	{
+		std::copy(mPrevSolution.begin() + i*mNumCols + j0, mPrevSolution.begin() + i*mNumCols + j1,
+			mCurrSolution.begin() + i*mNumCols + j0);
+	}
+}
+
+void Waves::ComputeNormalsTile(int t)
+{
+	int i0, i1, j0, j1;
+	TileInterior(t, i0, i1, j0, j1);
+
+	for(int i = i0; i < i1; ++i)
+	{
+		switch(mSolver)
+		{
+		case Solver::AVX: ComputeNormalsRowAVX(i, j0, j1); break;
+		case Solver::SSE:  ComputeNormalsRowSSE(i, j0, j1);  break;
+		default:           ComputeNormalsRow(i, j0, j1);     break;
+		}
+	}
+}
+
+void Waves::WorkerMain()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	std::vector<Disturbance> disturbances;
+
+	for(;;)
+	{
+		mWake.wait(lock, [this]()
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				float l = mCurrSolution[i*mNumCols+j-1].y;
-				float r = mCurrSolution[i*mNumCols+j+1].y;
-				float t = mCurrSolution[(i-1)*mNumCols+j].y;
-				float b = mCurrSolution[(i+1)*mNumCols+j].y;
-				mNormals[i*mNumCols+j].x = -r+l;
-				mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
-				mNormals[i*mNumCols+j].z = b-t;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
-				XMStoreFloat3(&mNormals[i*mNumCols+j], n);
-
-				mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
-				XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
-			}
+			return mQuit || mPendingTime > 0.0f || !mPendingDisturbances.empty();
 		});
+
+		if(mQuit)
+			return;
+
+		float dt = mPendingTime;
+		mPendingTime = 0.0f;
+		disturbances.swap(mPendingDisturbances);
+		mPendingDisturbances.clear();
+
+		lock.unlock();
+
+		for(auto& d : disturbances)
+			ApplyDisturbance(d.I, d.J, d.Magnitude);
+
+		bool changed = Advance(dt) > 0 || !disturbances.empty();
+
+		lock.lock();
+
+		if(!changed)
+			continue;
+
+		// Claim the back surface: with mSurfaceReady cleared the client will
+		// not swap, so it can be filled without holding the lock.
+		int back = 1 - mFront;
+		mSurfaceReady = false;
+
+		lock.unlock();
+		CopySimulation(mSurface[back]);
+		lock.lock();
+
+		mSurfaceReady = true;
+	}
+}
+
+void Waves::ViewSimulation()
+{
+	mRead.Height = mCurrSolution.data();
+	mRead.NormalX = mNormalX.data();
+	mRead.NormalY = mNormalY.data();
+	mRead.NormalZ = mNormalZ.data();
+	mRead.TangentXX = mTangentXX.data();
+	mRead.TangentXY = mTangentXY.data();
+}
+
+void Waves::ViewSurface(const Surface& s)
+{
+	mRead.Height = s.Height.data();
+	mRead.NormalX = s.NormalX.data();
+	mRead.NormalY = s.NormalY.data();
+	mRead.NormalZ = s.NormalZ.data();
+	mRead.TangentXX = s.TangentXX.data();
+	mRead.TangentXY = s.TangentXY.data();
+}
+
+void Waves::CopySimulation(Surface& s)const
+{
+	// Same sizes every time, so after the first copy this never allocates and
+	// the data() pointers the client may hold stay put.
+	s.Height = mCurrSolution;
+	s.NormalX = mNormalX;
+	s.NormalY = mNormalY;
+	s.NormalZ = mNormalZ;
+	s.TangentXX = mTangentXX;
+	s.TangentXY = mTangentXY;
+}
+
+//
+// Stencil kernels.  They all evaluate
+//   prev = k1*prev + k2*curr + k3*(down + up + right + left)
+// in the same order, so every solver produces the same results.
+//
+// After this update we will be discarding the old previous buffer, so overwrite
+// that buffer with the new update.  Note how we can do this inplace (read/write
+// to same element) because we won't need prev_ij again and the assignment happens last.
+//
+// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+// Moreover, our +z axis goes "down"; this is just to
+// keep consistent with our row indices going down.
+//
+
+float Waves::UpdateRow(int i, int j0, int j1)
+{
+	float* prev = &mPrevSolution[i*mNumCols];
+	const float* curr = &mCurrSolution[i*mNumCols];
+	const float* up = curr - mNumCols;
+	const float* down = curr + mNumCols;
+
+	float maxDelta = 0.0f;
+	for(int j = j0; j < j1; ++j)
+	{
+		float h =
+			mK1*prev[j] +
+			mK2*curr[j] +
+			mK3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+		maxDelta = (std::max)(maxDelta, fabsf(h - curr[j]));
+		prev[j] = h;
+	}
+	return maxDelta;
+}
+
+float Waves::UpdateRowSSE(int i, int j0, int j1)
+{
+	float* prev = &mPrevSolution[i*mNumCols];
+	const float* curr = &mCurrSolution[i*mNumCols];
+	const float* up = curr - mNumCols;
+	const float* down = curr + mNumCols;
+
+	const __m128 k1 = _mm_set1_ps(mK1);
+	const __m128 k2 = _mm_set1_ps(mK2);
+	const __m128 k3 = _mm_set1_ps(mK3);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 vMaxDelta = _mm_setzero_ps();
+
+	int j = j0;
+	for(; j + 4 <= j1; j += 4)
+	{
+		__m128 c = _mm_loadu_ps(curr + j);
+
+		__m128 sum = _mm_add_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j + 1));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j - 1));
+
+		__m128 h = _mm_add_ps(
+			_mm_mul_ps(k1, _mm_loadu_ps(prev + j)),
+			_mm_mul_ps(k2, c));
+		h = _mm_add_ps(h, _mm_mul_ps(k3, sum));
+
+		vMaxDelta = _mm_max_ps(vMaxDelta, _mm_and_ps(_mm_sub_ps(h, c), absMask));
+		_mm_storeu_ps(prev + j, h);
+	}
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, vMaxDelta);
+	float maxDelta = (std::max)((std::max)(lanes[0], lanes[1]), (std::max)(lanes[2], lanes[3]));
+
+	// Remainder of the row.
+	for(; j < j1; ++j)
+	{
+		float h =
+			mK1*prev[j] +
+			mK2*curr[j] +
+			mK3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+		maxDelta = (std::max)(maxDelta, fabsf(h - curr[j]));
+		prev[j] = h;
+	}
+	return maxDelta;
+}
+
+float Waves::UpdateRowAVX(int i, int j0, int j1)
+{
+	float* prev = &mPrevSolution[i*mNumCols];
+	const float* curr = &mCurrSolution[i*mNumCols];
+	const float* up = curr - mNumCols;
+	const float* down = curr + mNumCols;
+
+	const __m256 k1 = _mm256_set1_ps(mK1);
+	const __m256 k2 = _mm256_set1_ps(mK2);
+	const __m256 k3 = _mm256_set1_ps(mK3);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 vMaxDelta = _mm256_setzero_ps();
+
+	int j = j0;
+	for(; j + 8 <= j1; j += 8)
+	{
+		__m256 c = _mm256_loadu_ps(curr + j);
+
+		__m256 sum = _mm256_add_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j + 1));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j - 1));
+
+		__m256 h = _mm256_add_ps(
+			_mm256_mul_ps(k1, _mm256_loadu_ps(prev + j)),
+			_mm256_mul_ps(k2, c));
+		h = _mm256_add_ps(h, _mm256_mul_ps(k3, sum));
+
+		vMaxDelta = _mm256_max_ps(vMaxDelta, _mm256_and_ps(_mm256_sub_ps(h, c), absMask));
+		_mm256_storeu_ps(prev + j, h);
+	}
+
+	float lanes[8];
+	_mm256_storeu_ps(lanes, vMaxDelta);
+	float maxDelta = *std::max_element(lanes, lanes + 8);
+
+	// Remainder of the row.
+	for(; j < j1; ++j)
+	{
+		float h =
+			mK1*prev[j] +
+			mK2*curr[j] +
+			mK3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+		maxDelta = (std::max)(maxDelta, fabsf(h - curr[j]));
+		prev[j] = h;
+	}
+	return maxDelta;
+}
+
+//
+// Normal/tangent kernels.  n = normalize(l - r, 2dx, b - t) and
+// T = normalize(2dx, r - l, 0).
+//
+
+void Waves::ComputeNormalsRow(int i, int j0, int j1)
+{
+	const float* curr = &mCurrSolution[i*mNumCols];
+	const float* top = curr - mNumCols;
+	const float* bottom = curr + mNumCols;
+
+	const float twoDx = 2.0f*mSpatialStep;
+
+	for(int j = j0; j < j1; ++j)
+	{
+		float l = curr[j-1];
+		float r = curr[j+1];
+		float t = top[j];
+		float b = bottom[j];
+
+		float nx = l - r;
+		float nz = b - t;
+		float invLen = 1.0f / sqrtf(nx*nx + twoDx*twoDx + nz*nz);
+		mNormalX[i*mNumCols+j] = nx*invLen;
+		mNormalY[i*mNumCols+j] = twoDx*invLen;
+		mNormalZ[i*mNumCols+j] = nz*invLen;
+
+		float ty = r - l;
+		float invTLen = 1.0f / sqrtf(twoDx*twoDx + ty*ty);
+		mTangentXX[i*mNumCols+j] = twoDx*invTLen;
+		mTangentXY[i*mNumCols+j] = ty*invTLen;
+	}
+}
+
+void Waves::ComputeNormalsRowSSE(int i, int j0, int j1)
+{
+	const int row = i*mNumCols;
+	const float* curr = &mCurrSolution[row];
+	const float* top = curr - mNumCols;
+	const float* bottom = curr + mNumCols;
+
+	const float twoDx = 2.0f*mSpatialStep;
+	const __m128 vTwoDx = _mm_set1_ps(twoDx);
+	const __m128 vTwoDxSq = _mm_set1_ps(twoDx*twoDx);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	int j = j0;
+	for(; j + 4 <= j1; j += 4)
+	{
+		__m128 l = _mm_loadu_ps(curr + j - 1);
+		__m128 r = _mm_loadu_ps(curr + j + 1);
+		__m128 t = _mm_loadu_ps(top + j);
+		__m128 b = _mm_loadu_ps(bottom + j);
+
+		__m128 nx = _mm_sub_ps(l, r);
+		__m128 nz = _mm_sub_ps(b, t);
+		__m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), vTwoDxSq), _mm_mul_ps(nz, nz));
+		__m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(lenSq));
+		_mm_storeu_ps(&mNormalX[row + j], _mm_mul_ps(nx, invLen));
+		_mm_storeu_ps(&mNormalY[row + j], _mm_mul_ps(vTwoDx, invLen));
+		_mm_storeu_ps(&mNormalZ[row + j], _mm_mul_ps(nz, invLen));
+
+		__m128 ty = _mm_sub_ps(r, l);
+		__m128 invTLen = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(vTwoDxSq, _mm_mul_ps(ty, ty))));
+		_mm_storeu_ps(&mTangentXX[row + j], _mm_mul_ps(vTwoDx, invTLen));
+		_mm_storeu_ps(&mTangentXY[row + j], _mm_mul_ps(ty, invTLen));
+	}
+
+	// Remainder of the row.
+	for(; j < j1; ++j)
+	{
+		float l = curr[j-1];
+		float r = curr[j+1];
+		float t = top[j];
+		float b = bottom[j];
+
+		float nx = l - r;
+		float nz = b - t;
+		float invLen = 1.0f / sqrtf(nx*nx + twoDx*twoDx + nz*nz);
+		mNormalX[row+j] = nx*invLen;
+		mNormalY[row+j] = twoDx*invLen;
+		mNormalZ[row+j] = nz*invLen;
+
+		float ty = r - l;
+		float invTLen = 1.0f / sqrtf(twoDx*twoDx + ty*ty);
+		mTangentXX[row+j] = twoDx*invTLen;
+		mTangentXY[row+j] = ty*invTLen;
+	}
+}
+
+void Waves::ComputeNormalsRowAVX(int i, int j0, int j1)
+{
+	const int row = i*mNumCols;
+	const float* curr = &mCurrSolution[row];
+	const float* top = curr - mNumCols;
+	const float* bottom = curr + mNumCols;
+
+	const float twoDx = 2.0f*mSpatialStep;
+	const __m256 vTwoDx = _mm256_set1_ps(twoDx);
+	const __m256 vTwoDxSq = _mm256_set1_ps(twoDx*twoDx);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	int j = j0;
+	for(; j + 8 <= j1; j += 8)
+	{
+		__m256 l = _mm256_loadu_ps(curr + j - 1);
+		__m256 r = _mm256_loadu_ps(curr + j + 1);
+		__m256 t = _mm256_loadu_ps(top + j);
+		__m256 b = _mm256_loadu_ps(bottom + j);
+
+		__m256 nx = _mm256_sub_ps(l, r);
+		__m256 nz = _mm256_sub_ps(b, t);
+		__m256 lenSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), vTwoDxSq), _mm256_mul_ps(nz, nz));
+		__m256 invLen = _mm256_div_ps(one, _mm256_sqrt_ps(lenSq));
+		_mm256_storeu_ps(&mNormalX[row + j], _mm256_mul_ps(nx, invLen));
+		_mm256_storeu_ps(&mNormalY[row + j], _mm256_mul_ps(vTwoDx, invLen));
+		_mm256_storeu_ps(&mNormalZ[row + j], _mm256_mul_ps(nz, invLen));
+
+		__m256 ty = _mm256_sub_ps(r, l);
+		__m256 invTLen = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(vTwoDxSq, _mm256_mul_ps(ty, ty))));
+		_mm256_storeu_ps(&mTangentXX[row + j], _mm256_mul_ps(vTwoDx, invTLen));
+		_mm256_storeu_ps(&mTangentXY[row + j], _mm256_mul_ps(ty, invTLen));
+	}
+
+	// Remainder of the row.
+	for(; j < j1; ++j)
+	{
+		float l = curr[j-1];
+		float r = curr[j+1];
+		float t = top[j];
+		float b = bottom[j];
+
+		float nx = l - r;
+		float nz = b - t;
+		float invLen = 1.0f / sqrtf(nx*nx + twoDx*twoDx + nz*nz);
+		mNormalX[row+j] = nx*invLen;
+		mNormalY[row+j] = twoDx*invLen;
+		mNormalZ[row+j] = nz*invLen;
+
+		float ty = r - l;
+		float invTLen = 1.0f / sqrtf(twoDx*twoDx + ty*ty);
+		mTangentXX[row+j] = twoDx*invTLen;
+		mTangentXY[row+j] = ty*invTLen;
 	}
 }
 
@@ -160,13 +720,34 @@ void Waves::Disturb(int i, int j, float magnitude)
 	assert(i > 1 && i < mNumRows-2);
 	assert(j > 1 && j < mNumCols-2);
 
+	if(IsAsync())
+	{
+		// Applied by the worker before its next step.
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPendingDisturbances.push_back({ i, j, magnitude });
+		mWake.notify_one();
+		return;
+	}
+
+	ApplyDisturbance(i, j, magnitude);
+}
+
+void Waves::ApplyDisturbance(int i, int j, float magnitude)
+{
 	float halfMag = 0.5f*magnitude;
 
 	// Disturb the ijth vertex height and its neighbors.
-	mCurrSolution[i*mNumCols+j].y     += magnitude;
-	mCurrSolution[i*mNumCols+j+1].y   += halfMag;
-	mCurrSolution[i*mNumCols+j-1].y   += halfMag;
-	mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
-	mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+	mCurrSolution[i*mNumCols+j]     += magnitude;
+	mCurrSolution[i*mNumCols+j+1]   += halfMag;
+	mCurrSolution[i*mNumCols+j-1]   += halfMag;
+	mCurrSolution[(i+1)*mNumCols+j] += halfMag;
+	mCurrSolution[(i-1)*mNumCols+j] += halfMag;
+
+	// The points can straddle a tile edge.
+	WakeTileAt(i, j);
+	WakeTileAt(i, j+1);
+	WakeTileAt(i, j-1);
+	WakeTileAt(i+1, j);
+	WakeTileAt(i-1, j);
 }
 	
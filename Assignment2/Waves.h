@@ -4,17 +4,42 @@
 // Performs the calculations for the wave simulation.  After the simulation has been
 // updated, the client must copy the current solution into vertex buffers for rendering.
 // This class only does the calculations, it does not do any drawing.
+//
+// The grid is stored as structure-of-arrays: only the heights are simulated, and the
+// x/z coordinates of a grid point are worked out from its index.
+//
+// The simulation advances in fixed time steps, taking as many (up to a cap) as the
+// accumulated time allows.  In async mode the steps run on a worker thread, and the
+// accessors read the last surface the worker published.
+//
+// The grid is split into TileSize by TileSize tiles, which fall asleep once their
+// water has stayed still for StepsToSleep steps.  A step only updates the awake
+// tiles and the ones next to them, which a wave can spread to, and the normals are
+// only recomputed where the heights changed; a calm grid costs next to nothing.
+// Disturb wakes the tiles it touches.
 //***************************************************************************************
 
 #ifndef WAVES_H
 #define WAVES_H
 
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <DirectXMath.h>
 
 class Waves
 {
 public:
+	// Kernels used for the stencil and the normal/tangent pass.  All of them
+	// split the rows over concurrency::parallel_for.
+	enum class Solver
+	{
+		Scalar = 0,
+		SSE,
+		AVX
+	};
+
     Waves(int m, int n, float dx, float dt, float speed, float damping);
     Waves(const Waves& rhs) = delete;
     Waves& operator=(const Waves& rhs) = delete;
@@ -26,19 +51,112 @@ public:
 	int TriangleCount()const;
 	float Width()const;
 	float Depth()const;
+	float SpatialStep()const;
 
 	// Returns the solution at the ith grid point.
-    const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+	DirectX::XMFLOAT3 Position(int i)const
+	{
+		return DirectX::XMFLOAT3(
+			mOriginX + (i % mNumCols)*mSpatialStep,
+			mRead.Height[i],
+			mOriginZ - (i / mNumCols)*mSpatialStep);
+	}
+
+	// Returns the solution height at the ith grid point.
+	float Height(int i)const { return mRead.Height[i]; }
 
 	// Returns the solution normal at the ith grid point.
-    const DirectX::XMFLOAT3& Normal(int i)const { return mNormals[i]; }
+	DirectX::XMFLOAT3 Normal(int i)const
+	{
+		return DirectX::XMFLOAT3(mRead.NormalX[i], mRead.NormalY[i], mRead.NormalZ[i]);
+	}
 
 	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
-    const DirectX::XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
+	DirectX::XMFLOAT3 TangentX(int i)const
+	{
+		return DirectX::XMFLOAT3(mRead.TangentXX[i], mRead.TangentXY[i], 0.0f);
+	}
+
+	// Fastest solver the CPU supports.
+	static Solver BestSolver();
+
+	Solver GetSolver()const { return mSolver; }
+	void SetSolver(Solver solver);
+
+	// Most time steps one Update may take; any time left over after that is
+	// dropped so a slow frame can not make the next one slower still.  Set it
+	// before going async.
+	int GetMaxSubsteps()const { return mMaxSubsteps; }
+	void SetMaxSubsteps(int maxSubsteps);
+
+	// Runs the simulation on a worker thread.  Update then only hands the
+	// elapsed time to the worker and picks up the newest published surface.
+	bool IsAsync()const { return mWorker.joinable(); }
+	void SetAsync(bool async);
 
 	void Update(float dt);
 	void Disturb(int i, int j, float magnitude);
 
+private:
+	// What the accessors read: the simulation arrays themselves, or in async
+	// mode the front surface.
+	struct SurfaceView
+	{
+		const float* Height = nullptr;
+		const float* NormalX = nullptr;
+		const float* NormalY = nullptr;
+		const float* NormalZ = nullptr;
+		const float* TangentXX = nullptr;
+		const float* TangentXY = nullptr;
+	};
+
+	// Copy of the current solution handed from the worker to the client.
+	struct Surface
+	{
+		std::vector<float> Height;
+		std::vector<float> NormalX;
+		std::vector<float> NormalY;
+		std::vector<float> NormalZ;
+		std::vector<float> TangentXX;
+		std::vector<float> TangentXY;
+	};
+
+	struct Disturbance
+	{
+		int I;
+		int J;
+		float Magnitude;
+	};
+
+	// Runs the fixed steps that fit in the accumulated time, then the normals.
+	int Advance(float dt);
+	void Step();
+	void ApplyDisturbance(int i, int j, float magnitude);
+
+	void ViewSimulation();
+	void ViewSurface(const Surface& s);
+	void CopySimulation(Surface& s)const;
+
+	void WorkerMain();
+
+	// Tile t's grid points that are simulated: rows [i0, i1), columns [j0, j1).
+	void TileInterior(int t, int& i0, int& i1, int& j0, int& j1)const;
+	bool NearMarkedTile(int t, const std::vector<unsigned char>& marks)const;
+	void WakeTileAt(int i, int j);
+	float UpdateTile(int t);
+	void SettleTile(int t);
+	void ComputeNormalsTile(int t);
+
+	// The row kernels work on columns [j0, j1) of row i.  The stencil ones
+	// return the largest height change they made.
+	float UpdateRow(int i, int j0, int j1);
+	float UpdateRowSSE(int i, int j0, int j1);
+	float UpdateRowAVX(int i, int j0, int j1);
+
+	void ComputeNormalsRow(int i, int j0, int j1);
+	void ComputeNormalsRowSSE(int i, int j0, int j1);
+	void ComputeNormalsRowAVX(int i, int j0, int j1);
+
 private:
     int mNumRows = 0;
     int mNumCols = 0;
@@ -54,10 +172,67 @@ private:
     float mTimeStep = 0.0f;
     float mSpatialStep = 0.0f;
 
-    std::vector<DirectX::XMFLOAT3> mPrevSolution;
-    std::vector<DirectX::XMFLOAT3> mCurrSolution;
-    std::vector<DirectX::XMFLOAT3> mNormals;
-    std::vector<DirectX::XMFLOAT3> mTangentX;
+	// Simulated time not yet consumed by a step.
+	float mAccumTime = 0.0f;
+	int mMaxSubsteps = 4;
+
+	// x of column 0 and z of row 0.
+	float mOriginX = 0.0f;
+	float mOriginZ = 0.0f;
+
+	Solver mSolver = Solver::Scalar;
+
+	// Heights only; see Position().
+    std::vector<float> mPrevSolution;
+    std::vector<float> mCurrSolution;
+
+    std::vector<float> mNormalX;
+    std::vector<float> mNormalY;
+    std::vector<float> mNormalZ;
+
+	// The z component of the x-axis tangent is always zero.
+    std::vector<float> mTangentXX;
+    std::vector<float> mTangentXY;
+
+	SurfaceView mRead;
+
+	//
+	// Tiles, row-major.  A sleeping tile has the same heights in both solution
+	// buffers, so skipping its steps leaves it unchanged.
+	//
+	static const int TileSize = 32;
+	static const int StepsToSleep = 30;
+	static constexpr float SleepThreshold = 1.0e-4f;
+
+	int mTileRows = 0;
+	int mTileCols = 0;
+	std::vector<unsigned char> mTileAwake;
+	std::vector<int> mTileQuietSteps;
+
+	// Tiles whose heights a step changed since the normals were last computed.
+	std::vector<unsigned char> mTileChanged;
+
+	// Per step scratch: the tiles to visit and the largest change in each.
+	std::vector<int> mVisitTiles;
+	std::vector<float> mTileDelta;
+
+	//
+	// Async mode.  The worker owns the simulation arrays; everything below
+	// mMutex is shared with it.
+	//
+	std::thread mWorker;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+
+	bool mQuit = false;
+	float mPendingTime = 0.0f;
+	std::vector<Disturbance> mPendingDisturbances;
+
+	// The client reads mSurface[mFront]; the worker fills the other one and
+	// sets mSurfaceReady, and the next Update swaps them.
+	Surface mSurface[2];
+	int mFront = 0;
+	bool mSurfaceReady = false;
 };
 
-#endif // WAVES_H
\ No newline at end of file
+#endif // WAVES_H
@@ -9,6 +9,26 @@
 #include "../../Common/Camera.h"
 #include "FrameResource.h"
 #include "Waves.h"
+#include "GpuWaves.h"
+#include "GpuTrees.h"
+#include "Profiler.h"
+#include "ShaderCache.h"
+#include "PipelineCache.h"
+#include "StaticGeometryBuilder.h"
+#include "TextureStreamer.h"
+#include "SceneFile.h"
+#include "RenderItemStore.h"
+#include "Terrain.h"
+#include "WeightedOit.h"
+#include "ClusteredLights.h"
+#include "RadixSort.h"
+#include "ResourceRegistry.h"
+#include <ppl.h>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -17,8 +37,34 @@ using namespace DirectX::PackedVector;
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "D3D12.lib")
 
+// Most frame resources the app can cycle through; the number actually in
+// flight is set per run, see TreeBillboardsApp::SetFramesInFlight.
 const int gNumFrameResources = 3;
 
+// How far the water can rise above or sink below its rest height, for culling.
+const float gWaveBoundsHeight = 5.0f;
+
+// Levels of detail.  A mesh with coarser versions has them as the submeshes
+// "NAME.lod1", "NAME.lod2".  An item drops to level n + 1 when its screen size,
+// the fraction of the screen height its bounding sphere covers, falls below
+// gLodScreenSizes[n], and only comes back once it is gLodHysteresis times that
+// size, so an item sitting on a threshold does not pop between the two.
+const int gMaxLods = 3;
+const float gLodScreenSizes[gMaxLods - 1] = { 0.15f, 0.05f };
+const float gLodHysteresis = 1.25f;
+
+// Benchmark frames that are run but not measured, so the first frames in
+// flight and the initial uploads do not count.
+const int gBenchmarkWarmupFrames = 16;
+
+// A point or spot light of the clustered lights, whose strength flickers
+// around Base.Strength.
+struct Torch
+{
+	Light Base;
+	float Phase = 0.0f;
+};
+
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
 struct RenderItem
@@ -26,43 +72,184 @@ struct RenderItem
 	RenderItem() = default;
 	RenderItem(const RenderItem& rhs) = delete;
 
-    // World matrix of the shape that describes the object's local space
-    // relative to the world space, which defines the position, orientation,
-    // and scale of the object in the world.
-    XMFLOAT4X4 World = MathHelper::Identity4x4();
-
-	XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
-
-	// Dirty flag indicating the object data has changed and we need to update the constant buffer.
-	// Because we have an object cbuffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify obect data we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = gNumFrameResources;
-
-	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
-	UINT ObjCBIndex = -1;
+	// The item's world matrix, texture transform and the rest of its object
+	// constants in mRitemStore; also its ObjectCB index.
+	RenderItemHandle Handle = 0;
 
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
 
+	// Geo's index in mGeometries, for the sort keys.
+	UINT GeoSortId = 0;
+
     // Primitive topology.
     D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 
-    // DrawIndexedInstanced parameters.
+    // DrawIndexedInstanced parameters, of the current level of detail.  An
+    // instanced item draws each of its InstanceRanges from Lods instead.
     UINT IndexCount = 0;
     UINT StartIndexLocation = 0;
     int BaseVertexLocation = 0;
+
+	// The draw parameters of each level of detail, finest first.  Lod is the
+	// one UpdateInstanceData picked, and copied into the parameters above.
+	struct LodArgs
+	{
+		UINT IndexCount;
+		UINT StartIndexLocation;
+		int BaseVertexLocation;
+	};
+	LodArgs Lods[gMaxLods];
+	UINT LodCount = 1;
+	UINT Lod = 0;
+
+	// A terrain chunk, whose vertices morph toward the next level.
+	bool Geomorph = false;
+
+	// Non-zero for an instanced item: its World/TexTransform are then unused
+	// and each instance carries its own.  The instances are
+	// mInstances[InstanceBufferOffset, InstanceBufferOffset + InstanceCount),
+	// uploaded to the same range of the frame's InstanceBuffer.
+	UINT InstanceCount = 0;
+	UINT InstanceBufferOffset = 0;
+
+	// A blended instanced item, whose visible instances are written back to
+	// front; the order is kept in mInstanceOrder from frame to frame.
+	bool SortInstances = false;
+
+	// Local-space bounds of the submesh; each instance (or the item itself)
+	// is culled by them transformed to world space.
+	BoundingBox Bounds;
+
+	// Set by UpdateInstanceData: false when the item, or every one of its
+	// instances, is outside the camera frustum.
+	bool Visible = true;
+
+	// Instances that passed the frustum test this frame, packed at the start
+	// of the item's InstanceBuffer range.
+	UINT VisibleInstanceCount = 0;
+
+	// The visible instances as runs that share a level of detail, each drawn
+	// with that level's submesh.  First is relative to InstanceBufferOffset.
+	// Rebuilt by UpdateInstanceData every frame.
+	struct InstanceRange
+	{
+		UINT Lod;
+		UINT First;
+		UINT Count;
+	};
+	std::vector<InstanceRange> InstanceRanges;
+
+	// Local point whose view depth orders the item within its layer: the
+	// center of its bounds, and for an instanced item the centroid of its
+	// instances.
+	XMFLOAT3 SortCenter = { 0.0f, 0.0f, 0.0f };
+
+	// Layer, geometry, material and depth packed so that sorting a layer by it
+	// groups draws that share state; rebuilt every frame by SortRenderItems.
+	UINT64 SortKey = 0;
+
+	// View depth of SortCenter over the far plane, in 24 bits; orders the
+	// depth prepass front to back.
+	UINT SortDepth = 0;
+};
+
+// Input assembler state a command list last had bound, so consecutive render
+// items that share a geometry or topology do not set it again.
+struct DrawState
+{
+	MeshGeometry* Geo = nullptr;
+	D3D12_PRIMITIVE_TOPOLOGY Topology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+
+	// Where the instance root SRV points.
+	D3D12_GPU_VIRTUAL_ADDRESS Instances = 0;
 };
 
 enum class RenderLayer : int
 {
 	Opaque = 0,
+	OpaqueInstanced,
+	Terrain,
 	Transparent,
+	TransparentInstanced,
 	AlphaTested,
-	AlphaTestedTreeSprites,
+	AlphaTestedTreeSprites,	// drawn by mGpuTrees; only its profiler scopes are used
+	GpuWaves,
+	CpuWaves,
+	Count
+};
+
+// Names of the render layers in the profiler output.
+const char* const gRenderLayerNames[(int)RenderLayer::Count] =
+{
+	"Opaque",
+	"OpaqueInstanced",
+	"Terrain",
+	"Transparent",
+	"TransparentInstanced",
+	"AlphaTested",
+	"AlphaTestedTreeSprites",
+	"GpuWaves",
+	"CpuWaves"
+};
+
+// Groups of render layers recorded in parallel, each into its own command
+// list.  They are submitted in this order, which is also the draw order.
+enum class DrawPass : int
+{
+	DepthPrepass = 0,	// depth of Opaque, OpaqueInstanced, Terrain
+	Opaque,			// Opaque, OpaqueInstanced, Terrain
+	AlphaTested,	// AlphaTested, AlphaTestedTreeSprites
+	Waves,			// GpuWaves or CpuWaves
+	Transparent,	// Transparent, TransparentInstanced
 	Count
 };
 
+// Layers whose depth the DepthPrepass pass lays down, with their PSOs in there
+// and in the Opaque pass after it.
+const RenderLayer gDepthPrepassLayers[] = { RenderLayer::Opaque, RenderLayer::OpaqueInstanced, RenderLayer::Terrain };
+const char* const gDepthOnlyPsoNames[] = { "opaqueDepthOnly", "opaqueInstancedDepthOnly", "terrainDepthOnly" };
+const char* const gDepthEqualPsoNames[] = { "opaqueDepthEqual", "opaqueInstancedDepthEqual", "terrainDepthEqual" };
+const int gDepthPrepassLayerCount = _countof(gDepthPrepassLayers);
+
+// In the order of the materials' DiffuseSrvHeapIndex; the 2D textures
+// come first.
+struct SceneTexture
+{
+	const char* Name;
+	const wchar_t* Filename;
+	bool IsArray;
+};
+
+const SceneTexture gSceneTextures[] =
+{
+	{ "grassTex", L"../../Textures/grass.dds", false },
+	{ "grasswallTex", L"../../Textures/grasswall.dds", false },
+	{ "waterTex", L"../../Textures/water1.dds", false },
+	{ "bricksTex", L"../../Textures/bricks.dds", false },
+	{ "bricks2Tex", L"../../Textures/bricks2.dds", false },
+	{ "bricks3Tex", L"../../Textures/bricks3.dds", false },
+	{ "iceTex", L"../../Textures/ice.dds", false },
+	{ "tileTex", L"../../Textures/tile.dds", false },
+	{ "sandTex", L"../../Textures/sand.dds", false },
+	{ "checkboardTex", L"../../Textures/checkboard.dds", false },
+	{ "shinyTex", L"../../Textures/shiny.dds", false },
+	{ "treeArrayTex", L"../../Textures/treeArray.dds", true },
+};
+
+// Everything but the tree sprite array goes in the diffuse map array, whose
+// size the shaders are compiled with.
+UINT DiffuseMapCount()
+{
+	UINT count = 0;
+	for(const SceneTexture& t : gSceneTextures)
+	{
+		if(!t.IsArray)
+			++count;
+	}
+	return count;
+}
+
 class TreeBillboardsApp : public D3DApp
 {
 public:
@@ -73,7 +260,64 @@ public:
 
     virtual bool Initialize()override;
 
+	// Compiles every shader permutation, whatever the options, into the
+	// shader cache without a window or a device.  Errors go to stderr.
+	// Returns false if a permutation fails to compile.
+	bool CompileShaderPermutations();
+
+	// Frames the CPU may work ahead of the GPU, in [1, gNumFrameResources];
+	// also the most frames the swap chain queues.  Fewer lowers latency, more
+	// keeps the GPU busier.  Call before Initialize.
+	void SetFramesInFlight(int count);
+
+	// Writes the profiler times of every frame to a CSV file.  Call before Initialize.
+	void SetProfileCsv(const std::string& filename) { mProfileCsvFile = filename; }
+
+	// Renders frameCount frames with a fixed time step along a scripted camera
+	// path, writes the CPU and GPU frame time statistics to reportFile and
+	// quits.  Call before Initialize.
+	void SetBenchmark(int frameCount, const std::string& reportFile);
+
+	// Seed for MathHelper::Rand, so the wave disturbances and the extra trees
+	// repeat from run to run.  Call before Initialize.
+	void SetRandomSeed(unsigned int seed) { mRandomSeed = seed; }
+
+	// Scene to load: a text scene, cooked to a .scene file next to it, or an
+	// already cooked .scene.  Call before Initialize.
+	void SetScene(const std::wstring& filename) { mSceneFile = filename; }
+
+	// Scene size knobs, for benchmarking.  Call before Initialize.
+	void SetWaveGridSize(int rows, int cols);
+	void SetInstanceCopies(int copies);
+	void SetTreeCount(int count);
+	void SetTerrainScale(int scale);
+	void SetTorchCount(int count);
+
+	// Also free the CPU copies of the geometry once it is on the GPU; nothing
+	// in the app reads them.  Call before Initialize.
+	void SetReleaseCpuGeometry(bool release) { mReleaseCpuGeometry = release; }
+
+	// Draw every mesh at its finest level of detail, for comparison.
+	void SetLodEnabled(bool enabled) { mLodEnabled = enabled; }
+
+	// Lay down the depth of the opaque layers first, so their lit pass only
+	// shades the visible pixel; otherwise they are drawn front to back.
+	void SetDepthPrepassEnabled(bool enabled) { mDepthPrepassEnabled = enabled; }
+
+	// Draw the blended layers and the water with weighted blended OIT, see
+	// WeightedOit.h, instead of sorted back to front.  Call before Initialize.
+	void SetWeightedOitEnabled(bool enabled) { mWeightedOitEnabled = enabled; }
+
+	// Run the culls and the GPU waves step on a compute queue, overlapping the
+	// graphics queue, instead of in order on the graphics queue.  Call before
+	// Initialize.
+	void SetAsyncComputeEnabled(bool enabled) { mAsyncComputeEnabled = enabled; }
+
 private:
+	typedef RegistryHandle<ComPtr<ID3D12PipelineState>> PsoHandle;
+	typedef RegistryHandle<std::unique_ptr<Material>> MaterialHandle;
+
+	virtual void CreateRtvAndDsvDescriptorHeaps()override;
     virtual void OnResize()override;
     virtual void Update(const GameTimer& gt)override;
     virtual void Draw(const GameTimer& gt)override;
@@ -83,78 +327,286 @@ private:
     virtual void OnMouseMove(WPARAM btnState, int x, int y)override;
 
     void OnKeyboardInput(const GameTimer& gt);
+	void UpdateBenchmarkCamera();
+	void RecordBenchmarkFrame();
+	void WriteBenchmarkReport();
 	//void UpdateCamera(const GameTimer& gt);
 	void AnimateMaterials(const GameTimer& gt);
 	void UpdateObjectCBs(const GameTimer& gt);
-	void UpdateMaterialCBs(const GameTimer& gt);
+	void UpdateInstanceData(const GameTimer& gt);
+	void UpdateMaterialBuffer(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
+	void UpdateTorches(const GameTimer& gt);
 	void UpdateWaves(const GameTimer& gt); 
+	UINT PickLod(UINT current, UINT lodCount, float screenSize)const;
+	void SelectLod(RenderItem& ri, float screenSize);
+	float LodMorph(const RenderItem& ri, float screenSize)const;
+	void SortRenderItems();
+	void SortInstancesBackToFront(const RenderItem& ri);
 
 	void LoadTextures();
     void BuildRootSignature();
+	void BuildWavesRootSignature();
+	void BuildTreeCullRootSignature();
+	void BuildOitRootSignature();
+	void BuildLightCullRootSignature();
 	void BuildDescriptorHeaps();
+	CD3DX12_CPU_DESCRIPTOR_HANDLE TextureTableCpu(int frameIndex)const;
+	CD3DX12_GPU_DESCRIPTOR_HANDLE TextureTableGpu(int frameIndex)const;
     void BuildShadersAndInputLayouts();
+	void LoadShaders(ShaderCache& shaderCache, bool allPermutations);
 
-    void BuildLandGeometry();
+	void BuildStaticGeometry();
+	void BuildTerrain();
     void BuildWavesGeometry();
-	void BuildBoxGeometry();
-	void BuildGrassWallGeometry();
-	void BuildWedgeGeometry();
-	void BuildSphereGeometry();
-	void BuildCylinderGeometry();
-	void BuildConeGeometry();
-	void BuildPyramidGeometry();
-	void BuildPrismGeometry();
-
-
-	void BuildTreeSpritesGeometry();
-	void BuildDiamondGeometry();
+	void BuildTrees();
+	void BuildTorches();
 
     void BuildPSOs();
+	void ResolveFrameHandles();
+	ID3D12PipelineState* Pso(PsoHandle h)const { return mPSOs[h].Get(); }
     void BuildFrameResources();
     void BuildMaterials();
+	void LoadScene();
     void BuildRenderItems();
-    void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
+	void CreateWaitableSwapChain();
+	void ReleaseStagingResources();
+	void BuildProfiler();
+	void DrawLayer(ID3D12GraphicsCommandList* cmdList, DrawState& state, RenderLayer layer);
+	void DrawTreeSprites(ID3D12GraphicsCommandList* cmdList, DrawState& state);
+	void RecordDrawPass(DrawPass pass, ID3D12GraphicsCommandList* cmdList);
+    void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, DrawState& state, const std::vector<RenderItem*>& ritems);
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
-    float GetHillsHeight(float x, float z)const;
-    XMFLOAT3 GetHillsNormal(float x, float z)const;
+    float GetLandHeight(float x, float z)const;
 
 private:
 
     std::vector<std::unique_ptr<FrameResource>> mFrameResources;
     FrameResource* mCurrFrameResource = nullptr;
     int mCurrFrameResourceIndex = 0;
+	int mNumFramesInFlight = gNumFrameResources;
+
+	// Signalled by the frame resource fence; made once instead of every wait.
+	HANDLE mFenceEvent = nullptr;
+
+	// Signalled by the swap chain when it can queue another frame.
+	HANDLE mFrameLatencyWaitable = nullptr;
+
+	// The culls and the GPU waves step of a frame go to mComputeQueue, which
+	// signals mComputeFence when they are done; the graphics queue waits for
+	// that before the passes that read their results.  The waves step in turn
+	// waits on mFence for mWavesReadFenceValue, when the last frame's Waves
+	// pass is done reading the maps it rewrites.
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mComputeQueue;
+	Microsoft::WRL::ComPtr<ID3D12Fence> mComputeFence;
+	UINT64 mComputeFenceValue = 0;
+	UINT64 mWavesReadFenceValue = 0;
+
+	std::unique_ptr<Profiler> mProfiler;
+	std::string mProfileCsvFile;
+
+	// The profiler summary is appended to this in the window caption.
+	std::wstring mBaseCaption;
+	float mProfileCaptionTime = 0.0f;
+
+	// Profiler scope ids.  A layer that is never drawn in this run (one of the
+	// two waves layers) gets no scope.
+	UINT mUpdateScope = 0;
+	UINT mDrawScope = 0;
+	UINT mUpdateObjectCBsScope = 0;
+	UINT mUpdateInstanceDataScope = 0;
+	UINT mUpdateMaterialBufferScope = 0;
+	UINT mUpdateWavesScope = 0;
+	UINT mWavesUpdateScope = 0;
+	UINT mGpuFrameScope = 0;
+	UINT mGpuWavesSimScope = 0;
+	UINT mGpuTreeCullScope = 0;
+	UINT mDepthPrepassCpuScope = 0;
+	UINT mDepthPrepassGpuScope = 0;
+	UINT mOitCompositeScope = 0;
+	UINT mGpuLightCullScope = 0;
+	UINT mLayerCpuScopes[(int)RenderLayer::Count];
+	UINT mLayerGpuScopes[(int)RenderLayer::Count];
+
+	// Benchmark mode is on when mBenchmarkFrames > 0.  The samples are the
+	// CPU (Update + Draw) and GPU frame times in milliseconds.
+	int mBenchmarkFrames = 0;
+	std::string mBenchmarkReportFile;
+	std::vector<double> mBenchmarkCpuMs;
+	std::vector<double> mBenchmarkGpuMs;
+	float mBenchmarkStartTime = 0.0f;
+
+	unsigned int mRandomSeed = 1;
+
+	bool mReleaseCpuGeometry = false;
+
+	bool mLodEnabled = true;
+
+	bool mDepthPrepassEnabled = true;
+
+	bool mWeightedOitEnabled = false;
+
+	bool mAsyncComputeEnabled = true;
+
+	// Scene size; the defaults are the regular scene.
+	int mWaveRows = 305;
+	int mWaveCols = 150;
+	int mInstanceCopies = 1;
+	int mTreeCount = 0;	// 0 is the scene's trees
+	int mTerrainScale = 1;	// times the chunks along each side
+	int mTorchCount = 256;
+
+	// Time the scene animates by: the timer normally, a fixed step when
+	// benchmarking so every run renders the same frames.
+	float mSimTime = 0.0f;
+	float mSimDeltaTime = 0.0f;
 
     UINT mCbvSrvDescriptorSize = 0;
 
     ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mWavesRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mTreeCullRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mOitRootSignature = nullptr;
+	ComPtr<ID3D12RootSignature> mLightCullRootSignature = nullptr;
 
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
 
-	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
-	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
-	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
-	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
-	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
+	ResourceRegistry<std::unique_ptr<MeshGeometry>> mGeometries;
+	ResourceRegistry<std::unique_ptr<Material>> mMaterials;
+	ResourceRegistry<std::unique_ptr<Texture>> mTextures;
+
+	// Loads the textures in the background.  Each frame resource has its own
+	// table of texture SRVs at the start of the SRV heap.
+	std::unique_ptr<TextureStreamer> mTextureStreamer;
+
+	// 2D textures at the start of each texture table, all bound as one array
+	// that the materials index into.  The string is the NUM_DIFFUSE_MAPS
+	// shader define.
+	UINT mNumDiffuseMaps = 0;
+	std::string mNumDiffuseMapsDefine;
+	ResourceRegistry<ComPtr<ID3DBlob>> mShaders;
+	ResourceRegistry<ComPtr<ID3D12PipelineState>> mPSOs;
+
+	// What the frame loop binds, looked up by name once by ResolveFrameHandles.
+	// A PSO this configuration does not build keeps an invalid handle.  The
+	// pairs are indexed by whether the pass draws into the OIT targets.
+	PsoHandle mOpaquePso;
+	PsoHandle mOpaqueInstancedPso;
+	PsoHandle mTerrainPso;
+	PsoHandle mDepthOnlyPsos[gDepthPrepassLayerCount];
+	PsoHandle mDepthEqualPsos[gDepthPrepassLayerCount];
+	PsoHandle mAlphaTestedPso;
+	PsoHandle mTreeSpritesPso;
+	PsoHandle mTreeCullPso;
+	PsoHandle mLightCullPso;
+	PsoHandle mWavesUpdatePso;
+	PsoHandle mWavesDisturbPso;
+	PsoHandle mWavesNormalsPso;
+	PsoHandle mWavesRenderPsos[2];
+	PsoHandle mWavesCpuPsos[2];
+	PsoHandle mTransparentPsos[2];
+	PsoHandle mTransparentInstancedPsos[2];
+	PsoHandle mOitCompositePso;
+	MaterialHandle mWaterMat;
+	MaterialHandle mTreeSpritesMat;
+
+	// Driver-compiled PSOs from earlier runs; saved on exit.
+	std::unique_ptr<PipelineCache> mPipelineCache;
 
     std::vector<D3D12_INPUT_ELEMENT_DESC> mStdInputLayout;
-	std::vector<D3D12_INPUT_ELEMENT_DESC> mTreeSpriteInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mWavesInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mTerrainInputLayout;
+
+	// Position only, for the depth prepass; the terrain's also has the morph height.
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mDepthInputLayout;
+	std::vector<D3D12_INPUT_ELEMENT_DESC> mTerrainDepthInputLayout;
 
     RenderItem* mWavesRitem = nullptr;
 
-	// List of all the render items.
-	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+	// The scene, mapped while the geometry and render items are built from it.
+	std::wstring mSceneFile = L"Scenes\\Castle.txt";
+	std::unique_ptr<SceneFile> mScene;
+
+	// List of all the render items, with their draw arguments.  Allocated once,
+	// so the pointers to them stay valid.  Their object constants are kept
+	// apart in mRitemStore.
+	std::vector<RenderItem> mAllRitems;
+	std::unique_ptr<RenderItemStore> mRitemStore;
+
+	// The instances of all instanced render items, back to back.
+	std::vector<InstanceData> mInstances;
+	UINT mInstanceCount = 0;
+
+	// Order UpdateInstanceData writes each item's instances in, as indices
+	// into its range; changed only for the items with SortInstances.
+	std::vector<UINT> mInstanceOrder;
+
+	// Level of detail of each of mInstances, kept from frame to frame for
+	// the hysteresis.
+	std::vector<UINT> mInstanceLods;
+
+	// The visible instances of the item UpdateInstanceData is on, as indices
+	// into its range; reused so that it does not allocate per frame.
+	std::vector<UINT> mVisibleInstances;
+
+	// Reused by the back to front sorts, so they do not allocate per frame.
+	std::vector<RadixSortEntry<UINT>> mInstanceSortEntries;
+	std::vector<RadixSortEntry<UINT>> mInstanceSortScratch;
+	std::vector<RadixSortEntry<RenderItem*>> mLayerSortEntries;
+	std::vector<RadixSortEntry<RenderItem*>> mLayerSortScratch;
 
 	// Render items divided by PSO.
 	std::vector<RenderItem*> mRitemLayer[(int)RenderLayer::Count];
 
+	// The items of gDepthPrepassLayers again, front to back for the prepass.
+	std::vector<RenderItem*> mDepthPrepassRitems[gDepthPrepassLayerCount];
+
+	// Simulate the water with the compute shader; otherwise the CPU Waves
+	// solution is copied into the dynamic WavesVB every frame.
+	bool mUseGpuWaves = true;
+
+	// Run the CPU Waves on their own thread, so frame time does not include the
+	// simulation.
+	bool mUseAsyncWaves = true;
+
 	std::unique_ptr<Waves> mWaves;
+	std::unique_ptr<GpuWaves> mGpuWaves;
+
+	// The tree billboards, culled and drawn on the GPU.  Their object constants
+	// (only the material is read) are mTreeSpritesObject in mRitemStore.
+	std::unique_ptr<GpuTrees> mGpuTrees;
+	RenderItemHandle mTreeSpritesObject = 0;
+
+	// The land.  Its chunks are render items in the Terrain layer; the height
+	// table also answers the app's ground queries.
+	std::unique_ptr<Terrain> mTerrain;
+
+	// Only made with mWeightedOitEnabled.  Its render targets follow the swap
+	// chain's in the RTV heap.
+	std::unique_ptr<WeightedOit> mOit;
+
+	// Torches around the castle, lit through the light clusters; the point
+	// lights come first, mTorchPointCount of them.
+	std::unique_ptr<ClusteredLights> mClusteredLights;
+	std::vector<Torch> mTorches;
+	UINT mTorchPointCount = 0;
+
+	// Second vertex stream of the CPU waves; points at this frame's WavesVB.
+	D3D12_VERTEX_BUFFER_VIEW mWavesDynamicVBView = {};
 
     PassConstants mMainPassCB;
 
+	// Swap chain flags for both creating and resizing it; they must match.
+	static const UINT SwapChainFlags =
+		DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH | DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
 	Camera mCamera;
+
+	// View-space camera frustum, rebuilt when the projection changes.
+	BoundingFrustum mCamFrustum;
+	bool mFrustumCullingEnabled = true;
     POINT mLastMousePos;
 };
 
@@ -169,6 +621,110 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
     try
     {
         TreeBillboardsApp theApp(hInstance);
+
+		// -frames N           frames in flight, see SetFramesInFlight
+		// -profile file.csv   per frame profiler times, see SetProfileCsv
+		// -benchmark N [-report file.txt]   see SetBenchmark
+		// -seed S             see SetRandomSeed
+		// -waves ROWS COLS    see SetWaveGridSize
+		// -instances K        see SetInstanceCopies
+		// -trees N            see SetTreeCount
+		// -terrain K          see SetTerrainScale
+		// -torches N          see SetTorchCount
+		// -scene file         see SetScene
+		// -compileshaders     compile every shader permutation and quit, see ShaderCache.h
+		// -releasecpugeometry see SetReleaseCpuGeometry
+		// -nolod              see SetLodEnabled
+		// -noprepass          see SetDepthPrepassEnabled
+		// -oit                see SetWeightedOitEnabled
+		// -noasynccompute     see SetAsyncComputeEnabled
+		std::istringstream args(cmdLine);
+		std::string arg;
+		int benchmarkFrames = 0;
+		std::string benchmarkReport = "benchmark.txt";
+		bool compileShadersOnly = false;
+		while(args >> arg)
+		{
+			if(arg == "-frames")
+			{
+				int count = 0;
+				if(args >> count)
+					theApp.SetFramesInFlight(count);
+			}
+			else if(arg == "-profile")
+			{
+				std::string filename;
+				if(args >> filename)
+					theApp.SetProfileCsv(filename);
+			}
+			else if(arg == "-compileshaders")
+				compileShadersOnly = true;
+			else if(arg == "-releasecpugeometry")
+				theApp.SetReleaseCpuGeometry(true);
+			else if(arg == "-nolod")
+				theApp.SetLodEnabled(false);
+			else if(arg == "-noprepass")
+				theApp.SetDepthPrepassEnabled(false);
+			else if(arg == "-oit")
+				theApp.SetWeightedOitEnabled(true);
+			else if(arg == "-noasynccompute")
+				theApp.SetAsyncComputeEnabled(false);
+			else if(arg == "-benchmark")
+				args >> benchmarkFrames;
+			else if(arg == "-report")
+				args >> benchmarkReport;
+			else if(arg == "-seed")
+			{
+				unsigned int seed = 0;
+				if(args >> seed)
+					theApp.SetRandomSeed(seed);
+			}
+			else if(arg == "-waves")
+			{
+				int rows = 0, cols = 0;
+				if(args >> rows >> cols)
+					theApp.SetWaveGridSize(rows, cols);
+			}
+			else if(arg == "-instances")
+			{
+				int copies = 0;
+				if(args >> copies)
+					theApp.SetInstanceCopies(copies);
+			}
+			else if(arg == "-trees")
+			{
+				int count = 0;
+				if(args >> count)
+					theApp.SetTreeCount(count);
+			}
+			else if(arg == "-terrain")
+			{
+				int scale = 0;
+				if(args >> scale)
+					theApp.SetTerrainScale(scale);
+			}
+			else if(arg == "-torches")
+			{
+				int count = 0;
+				if(args >> count)
+					theApp.SetTorchCount(count);
+			}
+			else if(arg == "-scene")
+			{
+				std::string filename;
+				if(args >> filename)
+					theApp.SetScene(AnsiToWString(filename));
+			}
+		}
+
+		// The post-build step: no window, no device and no message box, so it
+		// runs on a build machine without a GPU, and a failure fails the build.
+		if(compileShadersOnly)
+			return theApp.CompileShaderPermutations() ? 0 : 1;
+
+		if(benchmarkFrames > 0)
+			theApp.SetBenchmark(benchmarkFrames, benchmarkReport);
+
         if(!theApp.Initialize())
             return 0;
 
@@ -190,6 +746,61 @@ TreeBillboardsApp::~TreeBillboardsApp()
 {
     if(md3dDevice != nullptr)
         FlushCommandQueue();
+
+	if(mPipelineCache != nullptr)
+		mPipelineCache->Save();
+
+	if(mFenceEvent != nullptr)
+		CloseHandle(mFenceEvent);
+
+	if(mFrameLatencyWaitable != nullptr)
+		CloseHandle(mFrameLatencyWaitable);
+}
+
+void TreeBillboardsApp::SetFramesInFlight(int count)
+{
+	assert(mFrameResources.empty());
+	mNumFramesInFlight = MathHelper::Clamp(count, 1, gNumFrameResources);
+}
+
+void TreeBillboardsApp::SetBenchmark(int frameCount, const std::string& reportFile)
+{
+	assert(mFrameResources.empty());
+	mBenchmarkFrames = (std::max)(frameCount, 0);
+	mBenchmarkReportFile = reportFile;
+}
+
+void TreeBillboardsApp::SetWaveGridSize(int rows, int cols)
+{
+	assert(mFrameResources.empty());
+
+	// The disturbances are kept 4 cells away from the edges.
+	mWaveRows = (std::max)(rows, 10);
+	mWaveCols = (std::max)(cols, 10);
+}
+
+void TreeBillboardsApp::SetInstanceCopies(int copies)
+{
+	assert(mFrameResources.empty());
+	mInstanceCopies = (std::max)(copies, 1);
+}
+
+void TreeBillboardsApp::SetTreeCount(int count)
+{
+	assert(mFrameResources.empty());
+	mTreeCount = (std::max)(count, 1);
+}
+
+void TreeBillboardsApp::SetTerrainScale(int scale)
+{
+	assert(mFrameResources.empty());
+	mTerrainScale = (std::max)(scale, 1);
+}
+
+void TreeBillboardsApp::SetTorchCount(int count)
+{
+	assert(mFrameResources.empty());
+	mTorchCount = (std::max)(count, 0);
 }
 
 bool TreeBillboardsApp::Initialize()
@@ -197,6 +808,20 @@ bool TreeBillboardsApp::Initialize()
     if(!D3DApp::Initialize())
         return false;
 
+	mFenceEvent = CreateEventEx(nullptr, nullptr, false, EVENT_ALL_ACCESS);
+	if(mFenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+
+	if(mAsyncComputeEnabled)
+	{
+		D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+		queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+		ThrowIfFailed(md3dDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mComputeQueue)));
+
+		ThrowIfFailed(md3dDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mComputeFence)));
+	}
+
     // Reset the command list to prep for initialization commands.
     ThrowIfFailed(mCommandList->Reset(mDirectCmdListAlloc.Get(), nullptr));
 
@@ -204,36 +829,48 @@ bool TreeBillboardsApp::Initialize()
 	// so we have to query this information.
     mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
-    mWaves = std::make_unique<Waves>(305, 150, 1.0f, 0.03f, 4.0f, 0.2f);
+	// Before anything random is built.
+	srand(mRandomSeed);
+
+	if(mUseGpuWaves)
+		mGpuWaves = std::make_unique<GpuWaves>(md3dDevice.Get(), mCommandList.Get(), mWaveRows, mWaveCols, 1.0f, 0.03f, 4.0f, 0.2f);
+	else
+	{
+		mWaves = std::make_unique<Waves>(mWaveRows, mWaveCols, 1.0f, 0.03f, 4.0f, 0.2f);
+		mWaves->SetAsync(mUseAsyncWaves);
+	}
 	mCamera.SetPosition(-0.0f, 40.0f, -100.0f);
 
+	if(mWeightedOitEnabled)
+		mOit = std::make_unique<WeightedOit>(md3dDevice.Get(), mClientWidth, mClientHeight);
+
+	mClusteredLights = std::make_unique<ClusteredLights>(md3dDevice.Get(), mNumFramesInFlight);
 
 	LoadTextures();
     BuildRootSignature();
+	BuildWavesRootSignature();
+	BuildTreeCullRootSignature();
+	if(mWeightedOitEnabled)
+		BuildOitRootSignature();
+	BuildLightCullRootSignature();
 	BuildDescriptorHeaps();
     BuildShadersAndInputLayouts();
 
-    BuildLandGeometry();
+	LoadScene();
+	BuildStaticGeometry();
+	BuildTerrain();
     BuildWavesGeometry();
-	BuildBoxGeometry();
-	BuildWedgeGeometry();
-	BuildSphereGeometry();
-	BuildCylinderGeometry();
-	BuildConeGeometry();
-	BuildPyramidGeometry();
-	BuildDiamondGeometry();
-	BuildPrismGeometry();
-
-	BuildGrassWallGeometry();
-
-
-	BuildTreeSpritesGeometry();
+	BuildTrees();
+	BuildTorches();
 
 
 	BuildMaterials();
     BuildRenderItems();
+	mScene.reset();
+	BuildProfiler();
     BuildFrameResources();
     BuildPSOs();
+	ResolveFrameHandles();
 
     // Execute the initialization commands.
     ThrowIfFailed(mCommandList->Close());
@@ -243,46 +880,303 @@ bool TreeBillboardsApp::Initialize()
     // Wait until initialization is complete.
     FlushCommandQueue();
 
+	ReleaseStagingResources();
+
+	// A benchmark measures the scene, not the loading.
+	if(mBenchmarkFrames > 0)
+		mTextureStreamer->Flush();
+
     return true;
 }
+
+void TreeBillboardsApp::ReleaseStagingResources()
+{
+	// The initialization copies have executed, so the upload heaps they read
+	// from are no longer needed.
+	UINT64 uploadBytes = 0;
+	UINT64 cpuBytes = 0;
+
+	auto releaseBuffer = [&uploadBytes](ComPtr<ID3D12Resource>& buffer)
+	{
+		if(buffer != nullptr)
+		{
+			uploadBytes += buffer->GetDesc().Width;
+			buffer = nullptr;
+		}
+	};
+
+	auto releaseBlob = [&cpuBytes](ComPtr<ID3DBlob>& blob)
+	{
+		if(blob != nullptr)
+		{
+			cpuBytes += blob->GetBufferSize();
+			blob = nullptr;
+		}
+	};
+
+	for(auto& geo : mGeometries)
+	{
+		releaseBuffer(geo->VertexBufferUploader);
+		releaseBuffer(geo->IndexBufferUploader);
+
+		if(mReleaseCpuGeometry)
+		{
+			releaseBlob(geo->VertexBufferCPU);
+			releaseBlob(geo->IndexBufferCPU);
+		}
+	}
+
+	if(mGpuWaves != nullptr)
+		uploadBytes += mGpuWaves->ReleaseUploadBuffers();
+
+	uploadBytes += mGpuTrees->ReleaseUploadBuffers();
+
+	std::ostringstream out;
+	out << "Released " << uploadBytes / 1024 << " KB of upload heaps";
+	if(mReleaseCpuGeometry)
+		out << " and " << cpuBytes / 1024 << " KB of CPU geometry";
+	out << " after initialization.\n";
+	OutputDebugStringA(out.str().c_str());
+}
  
+void TreeBillboardsApp::CreateWaitableSwapChain()
+{
+	// Same swap chain as D3DApp::CreateSwapChain, plus a frame latency waitable
+	// object.  The flag can not be added by ResizeBuffers, so the one D3DApp
+	// made is replaced.
+	mSwapChain.Reset();
+
+	DXGI_SWAP_CHAIN_DESC sd;
+	sd.BufferDesc.Width = mClientWidth;
+	sd.BufferDesc.Height = mClientHeight;
+	sd.BufferDesc.RefreshRate.Numerator = 60;
+	sd.BufferDesc.RefreshRate.Denominator = 1;
+	sd.BufferDesc.Format = mBackBufferFormat;
+	sd.BufferDesc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
+	sd.BufferDesc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
+	sd.SampleDesc.Count = 1;
+	sd.SampleDesc.Quality = 0;
+	sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	sd.BufferCount = SwapChainBufferCount;
+	sd.OutputWindow = mhMainWnd;
+	sd.Windowed = true;
+	sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+	sd.Flags = SwapChainFlags;
+
+	// Note: Swap chain uses queue to perform flush.
+	ThrowIfFailed(mdxgiFactory->CreateSwapChain(mCommandQueue.Get(), &sd, mSwapChain.GetAddressOf()));
+
+	ComPtr<IDXGISwapChain2> swapChain2;
+	ThrowIfFailed(mSwapChain.As(&swapChain2));
+	ThrowIfFailed(swapChain2->SetMaximumFrameLatency(mNumFramesInFlight));
+
+	if(mFrameLatencyWaitable != nullptr)
+		CloseHandle(mFrameLatencyWaitable);
+	mFrameLatencyWaitable = swapChain2->GetFrameLatencyWaitableObject();
+}
+
+void TreeBillboardsApp::CreateRtvAndDsvDescriptorHeaps()
+{
+	// Room for the OIT targets after the swap chain buffers, whether they are
+	// used or not; D3DApp calls this before Initialize gets to the options.
+	D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc;
+	rtvHeapDesc.NumDescriptors = SwapChainBufferCount + WeightedOit::RtvCount;
+	rtvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
+	rtvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	rtvHeapDesc.NodeMask = 0;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(
+		&rtvHeapDesc, IID_PPV_ARGS(mRtvHeap.GetAddressOf())));
+
+	D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc;
+	dsvHeapDesc.NumDescriptors = 1;
+	dsvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+	dsvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	dsvHeapDesc.NodeMask = 0;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(
+		&dsvHeapDesc, IID_PPV_ARGS(mDsvHeap.GetAddressOf())));
+}
+
 void TreeBillboardsApp::OnResize()
 {
-    D3DApp::OnResize();
+	// D3DApp::OnResize would resize the swap chain without the waitable flag,
+	// which fails, so its work is done here with matching flags.
+	assert(md3dDevice);
+	assert(mSwapChain);
+	assert(mDirectCmdListAlloc);
+
+	// D3DApp creates its own swap chain on start up and when MSAA is toggled,
+	// then calls this.
+	DXGI_SWAP_CHAIN_DESC swapChainDesc;
+	ThrowIfFailed(mSwapChain->GetDesc(&swapChainDesc));
+	if(swapChainDesc.Flags != SwapChainFlags)
+		CreateWaitableSwapChain();
+
+	// Flush before changing any resources.
+	FlushCommandQueue();
+
+	ThrowIfFailed(mCommandList->Reset(mDirectCmdListAlloc.Get(), nullptr));
+
+	// Release the previous resources we will be recreating.
+	for(int i = 0; i < SwapChainBufferCount; ++i)
+		mSwapChainBuffer[i].Reset();
+	mDepthStencilBuffer.Reset();
+
+	// Resize the swap chain.
+	ThrowIfFailed(mSwapChain->ResizeBuffers(
+		SwapChainBufferCount,
+		mClientWidth, mClientHeight,
+		mBackBufferFormat,
+		SwapChainFlags));
+
+	mCurrBackBuffer = 0;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHeapHandle(mRtvHeap->GetCPUDescriptorHandleForHeapStart());
+	for(UINT i = 0; i < SwapChainBufferCount; i++)
+	{
+		ThrowIfFailed(mSwapChain->GetBuffer(i, IID_PPV_ARGS(&mSwapChainBuffer[i])));
+		md3dDevice->CreateRenderTargetView(mSwapChainBuffer[i].Get(), nullptr, rtvHeapHandle);
+		rtvHeapHandle.Offset(1, mRtvDescriptorSize);
+	}
+
+	// Create the depth/stencil buffer and view.
+	D3D12_RESOURCE_DESC depthStencilDesc;
+	depthStencilDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	depthStencilDesc.Alignment = 0;
+	depthStencilDesc.Width = mClientWidth;
+	depthStencilDesc.Height = mClientHeight;
+	depthStencilDesc.DepthOrArraySize = 1;
+	depthStencilDesc.MipLevels = 1;
+	depthStencilDesc.Format = mDepthStencilFormat;
+	depthStencilDesc.SampleDesc.Count = 1;
+	depthStencilDesc.SampleDesc.Quality = 0;
+	depthStencilDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	depthStencilDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+
+	D3D12_CLEAR_VALUE optClear;
+	optClear.Format = mDepthStencilFormat;
+	optClear.DepthStencil.Depth = 1.0f;
+	optClear.DepthStencil.Stencil = 0;
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&depthStencilDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		&optClear,
+		IID_PPV_ARGS(mDepthStencilBuffer.GetAddressOf())));
+
+	md3dDevice->CreateDepthStencilView(mDepthStencilBuffer.Get(), nullptr, DepthStencilView());
+
+	if(mOit != nullptr)
+		mOit->OnResize(mClientWidth, mClientHeight);
+
+	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mDepthStencilBuffer.Get(),
+		D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_DEPTH_WRITE));
+
+	ThrowIfFailed(mCommandList->Close());
+	ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
+	mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+
+	// Wait until resize is complete.
+	FlushCommandQueue();
+
+	mScreenViewport.TopLeftX = 0;
+	mScreenViewport.TopLeftY = 0;
+	mScreenViewport.Width = static_cast<float>(mClientWidth);
+	mScreenViewport.Height = static_cast<float>(mClientHeight);
+	mScreenViewport.MinDepth = 0.0f;
+	mScreenViewport.MaxDepth = 1.0f;
+
+	mScissorRect = { 0, 0, mClientWidth, mClientHeight };
 
     // The window resized, so update the aspect ratio and recompute the projection matrix.
     XMMATRIX P = XMMatrixPerspectiveFovLH(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
 	mCamera.SetLens(0.25f * MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
+
+	BoundingFrustum::CreateFromMatrix(mCamFrustum, mCamera.GetProj());
 }
 
 void TreeBillboardsApp::Update(const GameTimer& gt)
 {
-    OnKeyboardInput(gt);
+	if(mBenchmarkFrames > 0)
+	{
+		mSimDeltaTime = 1.0f / 60.0f;
+		mSimTime += mSimDeltaTime;
+		UpdateBenchmarkCamera();
+	}
+	else
+	{
+		mSimDeltaTime = gt.DeltaTime();
+		mSimTime = gt.TotalTime();
+		OnKeyboardInput(gt);
+	}
 	//UpdateCamera(gt);
 
+	// Wait until the swap chain has room for another frame, so the frame is
+	// built from the newest input instead of sitting in the present queue.
+	// The timeout keeps a lost present from hanging the app.
+	WaitForSingleObjectEx(mFrameLatencyWaitable, 1000, true);
+
     // Cycle through the circular frame resource array.
-    mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % gNumFrameResources;
+    mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % mNumFramesInFlight;
     mCurrFrameResource = mFrameResources[mCurrFrameResourceIndex].get();
 
     // Has the GPU finished processing the commands of the current frame resource?
     // If not, wait until the GPU has completed commands up to this fence point.
     if(mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence)
     {
-        HANDLE eventHandle = CreateEventEx(nullptr, nullptr, false, EVENT_ALL_ACCESS);
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
-        WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
+        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, mFenceEvent));
+        WaitForSingleObject(mFenceEvent, INFINITE);
     }
 
+	// The GPU is done with the frame resource, so its per-frame upload memory
+	// can be handed out again.
+	mCurrFrameResource->BeginFrame();
+
+	// Swap in the textures that have arrived; this frame resource's table is
+	// no longer read by the GPU, so it can be rewritten.
+	mTextureStreamer->Update();
+	mTextureStreamer->UpdateFrameTable(mCurrFrameResourceIndex, TextureTableCpu(mCurrFrameResourceIndex));
+
+	// The GPU is done with this frame resource, so its timestamps can be read.
+	if(mProfiler->BeginFrame(mCurrFrameResourceIndex, mCurrFrameResource->TimestampReadback.Get()) &&
+		mBenchmarkFrames > 0)
+		RecordBenchmarkFrame();
+
+	// D3DApp::CalculateFrameStats puts the fps after the caption once a second.
+	if(mTimer.TotalTime() - mProfileCaptionTime >= 1.0f)
+	{
+		mProfileCaptionTime = mTimer.TotalTime();
+		mMainWndCaption = mBaseCaption + mProfiler->Summary();
+	}
+
+	ProfileCpuScope updateScope(mProfiler.get(), mUpdateScope);
+
 	AnimateMaterials(gt);
-	UpdateObjectCBs(gt);
-	UpdateMaterialCBs(gt);
+	{
+		ProfileCpuScope scope(mProfiler.get(), mUpdateObjectCBsScope);
+		UpdateObjectCBs(gt);
+	}
+	{
+		ProfileCpuScope scope(mProfiler.get(), mUpdateInstanceDataScope);
+		UpdateInstanceData(gt);
+	}
+	{
+		ProfileCpuScope scope(mProfiler.get(), mUpdateMaterialBufferScope);
+		UpdateMaterialBuffer(gt);
+	}
 	UpdateMainPassCB(gt);
-    UpdateWaves(gt);
+	UpdateTorches(gt);
+	{
+		ProfileCpuScope scope(mProfiler.get(), mUpdateWavesScope);
+		UpdateWaves(gt);
+	}
+	SortRenderItems();
 }
 
 void TreeBillboardsApp::Draw(const GameTimer& gt)
 {
+	ProfileCpuScope drawScope(mProfiler.get(), mDrawScope);
+
     auto cmdListAlloc = mCurrFrameResource->CmdListAlloc;
 
     // Reuse the memory associated with command recording.
@@ -291,10 +1185,9 @@ void TreeBillboardsApp::Draw(const GameTimer& gt)
 
     // A command list can be reset after it has been added to the command queue via ExecuteCommandList.
     // Reusing the command list reuses memory.
-    ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get()));
+    ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), Pso(mOpaquePso)));
 
-    mCommandList->RSSetViewports(1, &mScreenViewport);
-    mCommandList->RSSetScissorRects(1, &mScissorRect);
+	mProfiler->BeginGpu(mCommandList.Get(), mGpuFrameScope);
 
     // Indicate a state transition on the resource usage.
 	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
@@ -304,38 +1197,98 @@ void TreeBillboardsApp::Draw(const GameTimer& gt)
     mCommandList->ClearRenderTargetView(CurrentBackBufferView(), (float*)&mMainPassCB.FogColor, 0, nullptr);
     mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
-    // Specify the buffers we are going to render to.
-    mCommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
+	if(mWeightedOitEnabled)
+		mOit->Clear(mCommandList.Get());
 
-	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
-	mCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+    // Done recording the commands that come before the draws.
+    ThrowIfFailed(mCommandList->Close());
 
-	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
+	// The culls and the waves step, recorded into the compute lists one after
+	// the other from the one allocator.
+	auto computeCmdListAlloc = mCurrFrameResource->ComputeCmdListAlloc;
+	ThrowIfFailed(computeCmdListAlloc->Reset());
 
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+	ID3D12GraphicsCommandList* cullCmdList = mCurrFrameResource->CullCmdList.Get();
+	ThrowIfFailed(cullCmdList->Reset(computeCmdListAlloc.Get(), nullptr));
 
-    DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	// Fills in the visible trees and the arguments the AlphaTested pass draws
+	// them with.
+	mProfiler->BeginGpu(cullCmdList, mGpuTreeCullScope);
+	mGpuTrees->Cull(cullCmdList, mCurrFrameResourceIndex, mTreeCullRootSignature.Get(), Pso(mTreeCullPso),
+		XMMatrixMultiply(mCamera.GetView(), mCamera.GetProj()), mCamera.GetPosition3f(), mFrustumCullingEnabled);
+	mProfiler->EndGpu(cullCmdList, mGpuTreeCullScope);
 
-	mCommandList->SetPipelineState(mPSOs["alphaTested"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::AlphaTested]);
+	// Bins the torches into the clusters the lit pixel shaders read them from.
+	mProfiler->BeginGpu(cullCmdList, mGpuLightCullScope);
+	mClusteredLights->Cull(cullCmdList, mCurrFrameResourceIndex, mLightCullRootSignature.Get(), Pso(mLightCullPso),
+		mCurrFrameResource->LightBuffer.GpuAddress(), (UINT)mTorches.size(),
+		mCamera.GetView(), mCamera.GetProj(), mCamera.GetNearZ(), mCamera.GetFarZ());
+	mProfiler->EndGpu(cullCmdList, mGpuLightCullScope);
 
-	mCommandList->SetPipelineState(mPSOs["treeSprites"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites]);
+	ThrowIfFailed(cullCmdList->Close());
 
-	mCommandList->SetPipelineState(mPSOs["transparent"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Transparent]);
+	ID3D12GraphicsCommandList* wavesCmdList = mCurrFrameResource->WavesCmdList.Get();
+	ThrowIfFailed(wavesCmdList->Reset(computeCmdListAlloc.Get(), nullptr));
 
-    // Indicate a state transition on the resource usage.
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+	if(mUseGpuWaves)
+	{
+		ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+		wavesCmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
-    // Done recording commands.
-    ThrowIfFailed(mCommandList->Close());
+		mProfiler->BeginGpu(wavesCmdList, mGpuWavesSimScope);
+		mGpuWaves->Update(mSimDeltaTime, wavesCmdList, mWavesRootSignature.Get(),
+			Pso(mWavesUpdatePso), Pso(mWavesDisturbPso), Pso(mWavesNormalsPso));
+		mProfiler->EndGpu(wavesCmdList, mGpuWavesSimScope);
+	}
 
-    // Add the command list to the queue for execution.
-    ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
-    mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+	ThrowIfFailed(wavesCmdList->Close());
+
+	// The passes only read the scene, so they can be recorded at the same time.
+	concurrency::parallel_for(0, (int)DrawPass::Count, [&](int pass)
+	{
+		RecordDrawPass((DrawPass)pass, mCurrFrameResource->DrawCmdLists[pass].Get());
+	});
+
+	auto drawCmdList = [this](DrawPass pass) -> ID3D12CommandList*
+	{
+		return mCurrFrameResource->DrawCmdLists[(int)pass].Get();
+	};
+
+	if(mAsyncComputeEnabled)
+	{
+		// The culls only write this frame resource's buffers, which the CPU has
+		// already waited out, so they start at once and overlap whatever the
+		// graphics queue still has of the last frame.
+		ID3D12CommandList* cullLists[] = { cullCmdList };
+		mComputeQueue->ExecuteCommandLists(_countof(cullLists), cullLists);
+
+		// The waves step rewrites the maps the last frame's Waves pass reads.
+		ID3D12CommandList* wavesLists[] = { wavesCmdList };
+		mComputeQueue->Wait(mFence.Get(), mWavesReadFenceValue);
+		mComputeQueue->ExecuteCommandLists(_countof(wavesLists), wavesLists);
+		mComputeQueue->Signal(mComputeFence.Get(), ++mComputeFenceValue);
+
+		// The depth prepass reads none of it, so it overlaps the compute work too.
+		ID3D12CommandList* prepassLists[] = { mCommandList.Get(), drawCmdList(DrawPass::DepthPrepass) };
+		mCommandQueue->ExecuteCommandLists(_countof(prepassLists), prepassLists);
+		mCommandQueue->Wait(mComputeFence.Get(), mComputeFenceValue);
+	}
+	else
+	{
+		ID3D12CommandList* prepassLists[] = { mCommandList.Get(), cullCmdList, wavesCmdList, drawCmdList(DrawPass::DepthPrepass) };
+		mCommandQueue->ExecuteCommandLists(_countof(prepassLists), prepassLists);
+	}
+
+	ID3D12CommandList* sceneLists[] = { drawCmdList(DrawPass::Opaque), drawCmdList(DrawPass::AlphaTested), drawCmdList(DrawPass::Waves) };
+	mCommandQueue->ExecuteCommandLists(_countof(sceneLists), sceneLists);
+
+	// The Waves pass is the last to read the wave maps; the next frame's waves
+	// step can start once this is signalled.
+	mWavesReadFenceValue = ++mCurrentFence;
+	mCommandQueue->Signal(mFence.Get(), mWavesReadFenceValue);
+
+	ID3D12CommandList* transparentLists[] = { drawCmdList(DrawPass::Transparent) };
+	mCommandQueue->ExecuteCommandLists(_countof(transparentLists), transparentLists);
 
     // Swap the back and front buffers
     ThrowIfFailed(mSwapChain->Present(0, 0));
@@ -365,6 +1318,10 @@ void TreeBillboardsApp::OnMouseUp(WPARAM btnState, int x, int y)
 
 void TreeBillboardsApp::OnMouseMove(WPARAM btnState, int x, int y)
 {
+	// The benchmark camera follows its own path.
+	if(mBenchmarkFrames > 0)
+		return;
+
     if((btnState & MK_LBUTTON) != 0)
     {
         // Make each pixel correspond to a quarter of a degree.
@@ -402,19 +1359,115 @@ void TreeBillboardsApp::OnKeyboardInput(const GameTimer& gt)
 	if (GetAsyncKeyState('D') & 0x8000)
 		mCamera.Strafe(20.0f * dt);
 
+	// Keep the camera above the land.
+	XMFLOAT3 eyePos = mCamera.GetPosition3f();
+	float minHeight = mTerrain->GetHeight(eyePos.x, eyePos.z) + 2.0f;
+	if(eyePos.y < minHeight)
+		mCamera.SetPosition(eyePos.x, minHeight, eyePos.z);
+
+	mCamera.UpdateViewMatrix();
+}
+
+void TreeBillboardsApp::UpdateBenchmarkCamera()
+{
+	// Circle the castle once every 20 seconds of simulated time, so every
+	// side of the scene, the water and the trees come into view.
+	const float period = 20.0f;
+	const float radius = 150.0f;
+	float angle = MathHelper::Pi*2.0f*fmodf(mSimTime, period) / period;
+
+	XMFLOAT3 target(0.0f, 0.0f, -55.0f);
+	XMFLOAT3 pos(target.x + radius*sinf(angle), 60.0f, target.z - radius*cosf(angle));
+	mCamera.LookAt(pos, target, XMFLOAT3(0.0f, 1.0f, 0.0f));
 	mCamera.UpdateViewMatrix();
 }
+
+void TreeBillboardsApp::RecordBenchmarkFrame()
+{
+	if(mProfiler->LastFrameNumber() < gBenchmarkWarmupFrames)
+		return;
+
+	if(mBenchmarkCpuMs.empty())
+		mBenchmarkStartTime = mTimer.TotalTime();
+
+	mBenchmarkCpuMs.push_back(mProfiler->LastCpuMs(mUpdateScope) + mProfiler->LastCpuMs(mDrawScope));
+	mBenchmarkGpuMs.push_back(mProfiler->LastGpuMs(mGpuFrameScope));
+
+	if((int)mBenchmarkCpuMs.size() == mBenchmarkFrames)
+	{
+		WriteBenchmarkReport();
+		PostQuitMessage(0);
+	}
+}
+
+void TreeBillboardsApp::WriteBenchmarkReport()
+{
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(3);
+
+	out << "frames " << mBenchmarkCpuMs.size() << " after " << gBenchmarkWarmupFrames << " warmup"
+		<< ", seed " << mRandomSeed << ", frames in flight " << mNumFramesInFlight
+		<< ", " << mClientWidth << "x" << mClientHeight << "\n";
+	out << "waves " << mWaveRows << "x" << mWaveCols << (mUseGpuWaves ? " gpu" : " cpu")
+		<< ", instances " << mInstanceCount << " (" << mInstanceCopies << " copies)"
+		<< ", trees " << mTreeCount << ", terrain chunks " << mTerrain->ChunkCount()
+		<< ", torches " << mTorches.size()
+		<< (mLodEnabled ? ", lod" : ", no lod")
+		<< (mDepthPrepassEnabled ? ", depth prepass" : ", no depth prepass")
+		<< (mWeightedOitEnabled ? ", weighted oit" : ", sorted transparency")
+		<< (mAsyncComputeEnabled ? ", async compute" : ", no async compute") << "\n";
+
+	// More pages than frames in flight means a frame outgrew its first page.
+	UINT uploadPages = 0;
+	UINT64 uploadBytes = 0;
+	for(const auto& frameResource : mFrameResources)
+	{
+		uploadPages += frameResource->Allocator->PageCount();
+		uploadBytes += frameResource->Allocator->ReservedByteSize();
+	}
+	out << "upload pages " << uploadPages << ", " << uploadBytes / 1024 << " KB\n";
+	out << "            avg       p50       p99       max\n";
+
+	auto writeRow = [&out](const char* name, std::vector<double> ms)
+	{
+		std::sort(ms.begin(), ms.end());
+
+		double sum = 0.0;
+		for(double t : ms)
+			sum += t;
+
+		auto percentile = [&ms](double p) { return ms[(std::min)(ms.size() - 1, (size_t)(p*ms.size()))]; };
+
+		out << name
+			<< std::setw(10) << sum / ms.size()
+			<< std::setw(10) << percentile(0.50)
+			<< std::setw(10) << percentile(0.99)
+			<< std::setw(10) << ms.back() << "\n";
+	};
+	writeRow("cpu ms", mBenchmarkCpuMs);
+	writeRow("gpu ms", mBenchmarkGpuMs);
+
+	// Wall time between the first and the last measured frame.
+	float seconds = mTimer.TotalTime() - mBenchmarkStartTime;
+	if(seconds > 0.0f)
+		out << "fps " << (mBenchmarkCpuMs.size() - 1) / seconds << "\n";
+
+	std::ofstream file(mBenchmarkReportFile, std::ios::out | std::ios::trunc);
+	file << out.str();
+
+	OutputDebugStringA(out.str().c_str());
+}
  
 void TreeBillboardsApp::AnimateMaterials(const GameTimer& gt)
 {
 	// Scroll the water material texture coordinates.
-	auto waterMat = mMaterials["water"].get();
+	auto waterMat = mMaterials[mWaterMat].get();
 
 	float& tu = waterMat->MatTransform(3, 0);
 	float& tv = waterMat->MatTransform(3, 1);
 
-	tu += 0.1f * gt.DeltaTime();
-	tv += 0.02f * gt.DeltaTime();
+	tu += 0.1f * mSimDeltaTime;
+	tv += 0.02f * mSimDeltaTime;
 
 	if(tu >= 1.0f)
 		tu -= 1.0f;
@@ -431,47 +1484,182 @@ void TreeBillboardsApp::AnimateMaterials(const GameTimer& gt)
 
 void TreeBillboardsApp::UpdateObjectCBs(const GameTimer& gt)
 {
-	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
+	// Only the items whose constants changed in the last gNumFrameResources
+	// frames are visited.
+	mRitemStore->UpdateObjectCB(mCurrFrameResource->ObjectCB);
+}
+
+void TreeBillboardsApp::UpdateInstanceData(const GameTimer& gt)
+{
+	XMMATRIX view = mCamera.GetView();
+	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+
+	// Test everything in world space, so the frustum is transformed once.
+	BoundingFrustum worldFrustum;
+	mCamFrustum.Transform(worldFrustum, invView);
+
+	// Screen size of a bounding sphere is its radius over its distance, scaled
+	// by the projection so that it is a fraction of the screen height.
+	XMVECTOR eyePos = mCamera.GetPosition();
+	float projScale = XMVectorGetY(mCamera.GetProj().r[1]);
+	auto screenSize = [eyePos, projScale](const BoundingBox& worldBounds)
+	{
+		float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&worldBounds.Extents)));
+		float dist = XMVectorGetX(XMVector3Length(XMLoadFloat3(&worldBounds.Center) - eyePos));
+		return radius*projScale / (std::max)(dist, 1.0f);
+	};
+
+	auto& currInstanceBuffer = mCurrFrameResource->InstanceBuffer;
 	for(auto& e : mAllRitems)
 	{
-		// Only update the cbuffer data if the constants have changed.  
-		// This needs to be tracked per frame resource.
-		if(e->NumFramesDirty > 0)
+		if(e.InstanceCount == 0)
 		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+			BoundingBox worldBounds;
+			e.Bounds.Transform(worldBounds, XMLoadFloat4x4(&mRitemStore->World(e.Handle)));
+
+			e.Visible = !mFrustumCullingEnabled ||
+				worldFrustum.Contains(worldBounds) != DirectX::DISJOINT;
+			if(e.Visible)
+			{
+				float size = screenSize(worldBounds);
+				SelectLod(e, size);
+				if(e.Geomorph)
+					mRitemStore->SetMorph(e.Handle, LodMorph(e, size));
+			}
+			continue;
+		}
 
-			ObjectConstants objConstants;
-			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
-			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+		// The visible set changes with the camera, so the instances are
+		// written every frame, packed at the start of the item's range.
+		// Blended instances are written back to front, unless OIT blends them.
+		bool keepOrder = e.SortInstances && !mWeightedOitEnabled;
+		if(keepOrder)
+			SortInstancesBackToFront(e);
+
+		const UINT* order = mInstanceOrder.data() + e.InstanceBufferOffset;
+		UINT* lods = mInstanceLods.data() + e.InstanceBufferOffset;
+		UINT lodCounts[gMaxLods] = {};
+		mVisibleInstances.clear();
+		for(UINT k = 0; k < e.InstanceCount; ++k)
+		{
+			UINT j = order[k];
+			const InstanceData& inst = mInstances[e.InstanceBufferOffset + j];
 
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
+			BoundingBox worldBounds;
+			e.Bounds.Transform(worldBounds, XMLoadFloat4x4(&inst.World));
+			if(mFrustumCullingEnabled && worldFrustum.Contains(worldBounds) == DirectX::DISJOINT)
+				continue;
 
-			// Next FrameResource need to be updated too.
-			e->NumFramesDirty--;
+			lods[j] = e.LodCount > 1 ? PickLod(lods[j], e.LodCount, screenSize(worldBounds)) : 0;
+			++lodCounts[lods[j]];
+			mVisibleInstances.push_back(j);
 		}
-	}
-}
 
-void TreeBillboardsApp::UpdateMaterialCBs(const GameTimer& gt)
-{
-	auto currMaterialCB = mCurrFrameResource->MaterialCB.get();
+		e.VisibleInstanceCount = (UINT)mVisibleInstances.size();
+		e.Visible = e.VisibleInstanceCount > 0;
+
+		// Each level's instances get a range of their own, drawn with its
+		// submesh.  Instances written back to front keep their order, so they
+		// are split into a range wherever the level changes instead.
+		e.InstanceRanges.clear();
+		UINT cursors[gMaxLods] = {};
+		if(keepOrder)
+		{
+			for(UINT k = 0; k < e.VisibleInstanceCount; ++k)
+			{
+				UINT lod = lods[mVisibleInstances[k]];
+				if(e.InstanceRanges.empty() || e.InstanceRanges.back().Lod != lod)
+					e.InstanceRanges.push_back({ lod, k, 0 });
+				++e.InstanceRanges.back().Count;
+			}
+		}
+		else
+		{
+			UINT first = 0;
+			for(UINT lod = 0; lod < e.LodCount; ++lod)
+			{
+				cursors[lod] = first;
+				if(lodCounts[lod] > 0)
+					e.InstanceRanges.push_back({ lod, first, lodCounts[lod] });
+				first += lodCounts[lod];
+			}
+		}
+
+		for(UINT k = 0; k < e.VisibleInstanceCount; ++k)
+		{
+			UINT j = mVisibleInstances[k];
+			const InstanceData& inst = mInstances[e.InstanceBufferOffset + j];
+
+			InstanceData instData;
+			XMStoreFloat4x4(&instData.World, XMMatrixTranspose(XMLoadFloat4x4(&inst.World)));
+			XMStoreFloat4x4(&instData.TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&inst.TexTransform)));
+			instData.MaterialIndex = inst.MaterialIndex;
+
+			UINT slot = keepOrder ? k : cursors[lods[j]]++;
+			currInstanceBuffer.CopyData(e.InstanceBufferOffset + slot, instData);
+		}
+	}
+}
+
+UINT TreeBillboardsApp::PickLod(UINT current, UINT lodCount, float screenSize)const
+{
+	if(!mLodEnabled)
+		return 0;
+
+	// Coarser while below the current level's threshold; finer only once
+	// past the finer level's threshold by the hysteresis margin.
+	UINT lod = current;
+	while(lod + 1 < lodCount && screenSize < gLodScreenSizes[lod])
+		++lod;
+	while(lod > 0 && screenSize > gLodScreenSizes[lod - 1]*gLodHysteresis)
+		--lod;
+	return lod;
+}
+
+void TreeBillboardsApp::SelectLod(RenderItem& ri, float screenSize)
+{
+	UINT lod = PickLod(ri.Lod, ri.LodCount, screenSize);
+
+	ri.Lod = lod;
+	ri.IndexCount = ri.Lods[lod].IndexCount;
+	ri.StartIndexLocation = ri.Lods[lod].StartIndexLocation;
+	ri.BaseVertexLocation = ri.Lods[lod].BaseVertexLocation;
+}
+
+float TreeBillboardsApp::LodMorph(const RenderItem& ri, float screenSize)const
+{
+	if(!mLodEnabled || ri.Lod + 1 >= ri.LodCount)
+		return 0.0f;
+
+	// Fully morphed at and below the size SelectLod brings the item back from
+	// the next level at, so changing levels either way never moves a vertex.
+	// The morph starts at twice that size, below the finer level's threshold,
+	// so a chunk arrives from the finer level unmorphed.
+	float end = gLodScreenSizes[ri.Lod]*gLodHysteresis;
+	float start = 2.0f*end;
+	return MathHelper::Clamp((start - screenSize) / (start - end), 0.0f, 1.0f);
+}
+
+void TreeBillboardsApp::UpdateMaterialBuffer(const GameTimer& gt)
+{
+	auto& currMaterialBuffer = mCurrFrameResource->MaterialBuffer;
 	for(auto& e : mMaterials)
 	{
 		// Only update the cbuffer data if the constants have changed.  If the cbuffer
 		// data changes, it needs to be updated for each FrameResource.
-		Material* mat = e.second.get();
+		Material* mat = e.get();
 		if(mat->NumFramesDirty > 0)
 		{
 			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
 
-			MaterialConstants matConstants;
-			matConstants.DiffuseAlbedo = mat->DiffuseAlbedo;
-			matConstants.FresnelR0 = mat->FresnelR0;
-			matConstants.Roughness = mat->Roughness;
-			XMStoreFloat4x4(&matConstants.MatTransform, XMMatrixTranspose(matTransform));
+			MaterialData matData;
+			matData.DiffuseAlbedo = mat->DiffuseAlbedo;
+			matData.FresnelR0 = mat->FresnelR0;
+			matData.Roughness = mat->Roughness;
+			XMStoreFloat4x4(&matData.MatTransform, XMMatrixTranspose(matTransform));
+			matData.DiffuseMapIndex = mat->DiffuseSrvHeapIndex;
 
-			currMaterialCB->CopyData(mat->MatCBIndex, matConstants);
+			currMaterialBuffer.CopyData(mat->MatCBIndex, matData);
 
 			// Next FrameResource need to be updated too.
 			mat->NumFramesDirty--;
@@ -501,8 +1689,8 @@ void TreeBillboardsApp::UpdateMainPassCB(const GameTimer& gt)
 	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
 	mMainPassCB.NearZ = 1.0f;
 	mMainPassCB.FarZ = 1000.0f;
-	mMainPassCB.TotalTime = gt.TotalTime();
-	mMainPassCB.DeltaTime = gt.DeltaTime();
+	mMainPassCB.TotalTime = mSimTime;
+	mMainPassCB.DeltaTime = mSimDeltaTime;
 	mMainPassCB.AmbientLight = { 0.97f, 0.98f, 0.06f, 1.0f };
 
 	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
@@ -514,15 +1702,53 @@ void TreeBillboardsApp::UpdateMainPassCB(const GameTimer& gt)
 	mMainPassCB.Lights[1].Strength = { 1.0f, 1.0f, 1.0f };
 	mMainPassCB.Lights[1].Position = { 24.0f, 33.0f, 40.5f };
 
-	auto currPassCB = mCurrFrameResource->PassCB.get();
-	currPassCB->CopyData(0, mMainPassCB);
+	mMainPassCB.ClusterPointLightCount = mTorchPointCount;
+	ClusteredLights::SliceConstants(mCamera.GetNearZ(), mCamera.GetFarZ(),
+		mMainPassCB.ClusterSliceScale, mMainPassCB.ClusterSliceBias);
+
+	auto& currPassCB = mCurrFrameResource->PassCB;
+	currPassCB.CopyData(0, mMainPassCB);
+}
+
+void TreeBillboardsApp::UpdateTorches(const GameTimer& gt)
+{
+	auto& currLightBuffer = mCurrFrameResource->LightBuffer;
+	for(size_t i = 0; i < mTorches.size(); ++i)
+	{
+		const Torch& torch = mTorches[i];
+
+		// Two sines that do not repeat together, so the torches do not pulse.
+		float flicker = 0.85f + 0.15f*sinf(7.0f*mSimTime + torch.Phase)*sinf(13.0f*mSimTime + 1.7f*torch.Phase);
+
+		Light light = torch.Base;
+		XMStoreFloat3(&light.Strength, flicker*XMLoadFloat3(&torch.Base.Strength));
+		currLightBuffer.CopyData((int)i, light);
+	}
 }
 
 void TreeBillboardsApp::UpdateWaves(const GameTimer& gt)
 {
 	// Every quarter second, generate a random wave.
 	static float t_base = 0.0f;
-	if((mTimer.TotalTime() - t_base) >= 0.25f)
+	if(mUseGpuWaves)
+	{
+		// The simulation itself is recorded into the command list in Draw.
+		if((mSimTime - t_base) >= 0.25f)
+		{
+			t_base += 0.25f;
+
+			int i = MathHelper::Rand(4, mGpuWaves->RowCount() - 5);
+			int j = MathHelper::Rand(4, mGpuWaves->ColumnCount() - 5);
+
+			float r = MathHelper::RandF(0.2f, 0.5f);
+
+			mGpuWaves->Disturb(i, j, r);
+		}
+
+		return;
+	}
+
+	if((mSimTime - t_base) >= 0.25f)
 	{
 		t_base += 0.25f;
 
@@ -535,152 +1761,198 @@ void TreeBillboardsApp::UpdateWaves(const GameTimer& gt)
 	}
 
 	// Update the wave simulation.
-	mWaves->Update(gt.DeltaTime());
+	{
+		ProfileCpuScope scope(mProfiler.get(), mWavesUpdateScope);
+		mWaves->Update(mSimDeltaTime);
+	}
 
-	// Update the wave vertex buffer with the new solution.
-	auto currWavesVB = mCurrFrameResource->WavesVB.get();
-	for(int i = 0; i < mWaves->VertexCount(); ++i)
+	// Update the wave vertex buffer with the new solution.  Only the heights and
+	// normals change, and they are written straight into the mapped upload heap,
+	// a block of rows per task.  Each vertex is built in a register and stored
+	// whole so the write-combined memory is only ever written sequentially.
+	auto& currWavesVB = mCurrFrameResource->WavesVB;
+	WaveDynamicVertex* wavesVB = currWavesVB.Data();
+
+	const int vertexCount = mWaves->VertexCount();
+	const int verticesPerChunk = 16*mWaves->ColumnCount();
+
+	concurrency::parallel_for(0, (vertexCount + verticesPerChunk - 1) / verticesPerChunk, [&](int chunk)
+	{
+		int end = (std::min)(vertexCount, (chunk + 1)*verticesPerChunk);
+		for(int k = chunk*verticesPerChunk; k < end; ++k)
+		{
+			XMFLOAT3 n = mWaves->Normal(k);
+
+			WaveDynamicVertex v;
+			v.Height = mWaves->Height(k);
+			v.NormalXZ = PackedVector::XMSHORTN2(n.x, n.z);
+
+			wavesVB[k] = v;
+		}
+	});
+
+	// Point the second stream of the wave renderitem at the current frame VB.
+	mWavesDynamicVBView.BufferLocation = currWavesVB.GpuAddress();
+	mWavesDynamicVBView.StrideInBytes = sizeof(WaveDynamicVertex);
+	mWavesDynamicVBView.SizeInBytes = vertexCount*sizeof(WaveDynamicVertex);
+}
+
+// View depth of posW over the far plane, in 24 bits; 0 is at the eye.
+static UINT QuantizedViewDepth(FXMVECTOR posW, CXMMATRIX view, float farZ)
+{
+	float viewZ = XMVectorGetZ(XMVector3Transform(posW, view));
+	return (UINT)(MathHelper::Clamp(viewZ / farZ, 0.0f, 1.0f) * 0xFFFFFF);
+}
+
+void TreeBillboardsApp::SortRenderItems()
+{
+	//
+	// Key layout, most significant first:
+	//   [63..56] render layer, which selects the PSO
+	//   grouped:       [55..40] geometry  [39..24] material  [23..0] depth, near first
+	//   front to back: [55..32] depth, near first  [31..16] geometry  [15..0] material
+	// Blended layers have to be drawn back to front, so they are radix sorted on
+	// depth alone, far first, starting from last frame's order; with OIT they
+	// need no order and are grouped.  The prepass layers go front to back, to
+	// save overdraw, unless the prepass already does that for them.  Everywhere
+	// else matching state is grouped and ties go front to back.
+	//
+	XMMATRIX view = mCamera.GetView();
+	float farZ = mCamera.GetFarZ();
+
+	for(int layer = 0; layer < (int)RenderLayer::Count; ++layer)
+	{
+		bool backToFront = !mWeightedOitEnabled && (layer == (int)RenderLayer::Transparent ||
+			layer == (int)RenderLayer::TransparentInstanced);
+
+		bool frontToBack = !mDepthPrepassEnabled &&
+			std::find(std::begin(gDepthPrepassLayers), std::end(gDepthPrepassLayers), (RenderLayer)layer) != std::end(gDepthPrepassLayers);
+
+		for(auto ri : mRitemLayer[layer])
+		{
+			XMVECTOR centerW = XMVector3Transform(XMLoadFloat3(&ri->SortCenter), XMLoadFloat4x4(&mRitemStore->World(ri->Handle)));
+			UINT64 depth = QuantizedViewDepth(centerW, view, farZ);
+			ri->SortDepth = (UINT)depth;
+
+			UINT64 geo = ri->GeoSortId & 0xFFFF;
+			UINT64 mat = ri->Mat->MatCBIndex & 0xFFFF;
+
+			ri->SortKey = (UINT64)layer << 56;
+			if(frontToBack)
+				ri->SortKey |= (depth << 32) | (geo << 16) | mat;
+			else
+				ri->SortKey |= (geo << 40) | (mat << 24) | depth;
+		}
+
+		if(!backToFront)
+		{
+			std::sort(mRitemLayer[layer].begin(), mRitemLayer[layer].end(),
+				[](const RenderItem* a, const RenderItem* b) { return a->SortKey < b->SortKey; });
+			continue;
+		}
+
+		auto& items = mRitemLayer[layer];
+		mLayerSortEntries.resize(items.size());
+		for(size_t i = 0; i < items.size(); ++i)
+			mLayerSortEntries[i] = { 0xFFFFFF - items[i]->SortDepth, items[i] };
+
+		RadixSort(mLayerSortEntries, mLayerSortScratch, 24);
+
+		for(size_t i = 0; i < items.size(); ++i)
+			items[i] = mLayerSortEntries[i].Value;
+	}
+
+	if(!mDepthPrepassEnabled)
+		return;
+
+	// Only the geometry changes between prepass draws, so depth alone orders them.
+	for(int k = 0; k < gDepthPrepassLayerCount; ++k)
 	{
-		Vertex v;
+		auto& items = mDepthPrepassRitems[k];
+		items = mRitemLayer[(int)gDepthPrepassLayers[k]];
+
+		std::sort(items.begin(), items.end(),
+			[](const RenderItem* a, const RenderItem* b) { return a->SortDepth < b->SortDepth; });
+	}
+}
 
-		v.Pos = mWaves->Position(i);
-		v.Normal = mWaves->Normal(i);
-		
-		// Derive tex-coords from position by 
-		// mapping [-w/2,w/2] --> [0,1]
-		v.TexC.x = 0.5f + (v.Pos.x) / mWaves->Width();
-		v.TexC.y = 0.5f - v.Pos.z / mWaves->Depth();
+void TreeBillboardsApp::SortInstancesBackToFront(const RenderItem& ri)
+{
+	// Far first, by the center of each instance's bounds.  Sorting last
+	// frame's order again usually finds it still sorted.
+	XMMATRIX view = mCamera.GetView();
+	float farZ = mCamera.GetFarZ();
+	XMVECTOR centerL = XMLoadFloat3(&ri.Bounds.Center);
 
-		currWavesVB->CopyData(i, v);
+	UINT* order = mInstanceOrder.data() + ri.InstanceBufferOffset;
+	mInstanceSortEntries.resize(ri.InstanceCount);
+	for(UINT k = 0; k < ri.InstanceCount; ++k)
+	{
+		const InstanceData& inst = mInstances[ri.InstanceBufferOffset + order[k]];
+		XMVECTOR centerW = XMVector3Transform(centerL, XMLoadFloat4x4(&inst.World));
+		mInstanceSortEntries[k] = { 0xFFFFFF - QuantizedViewDepth(centerW, view, farZ), order[k] };
 	}
 
-	// Set the dynamic VB of the wave renderitem to the current frame VB.
-	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
+	RadixSort(mInstanceSortEntries, mInstanceSortScratch, 24);
+
+	for(UINT k = 0; k < ri.InstanceCount; ++k)
+		order[k] = mInstanceSortEntries[k].Value;
 }
 
 void TreeBillboardsApp::LoadTextures()
 {
-	auto grassTex = std::make_unique<Texture>();
-	grassTex->Name = "grassTex";
-	grassTex->Filename = L"../../Textures/grass.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), grassTex->Filename.c_str(),
-		grassTex->Resource, grassTex->UploadHeap));
-
-	auto grasswallTex = std::make_unique<Texture>();
-	grasswallTex->Name = "grasswallTex";
-	grasswallTex->Filename = L"../../Textures/grasswall.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), grasswallTex->Filename.c_str(),
-		grasswallTex->Resource, grasswallTex->UploadHeap));
-
-
-	auto waterTex = std::make_unique<Texture>();
-	waterTex->Name = "waterTex";
-	waterTex->Filename = L"../../Textures/water1.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), waterTex->Filename.c_str(),
-		waterTex->Resource, waterTex->UploadHeap));
-
-
-	auto bricksTex = std::make_unique<Texture>();
-	bricksTex->Name = "bricksTex";
-	bricksTex->Filename = L"../../Textures/bricks.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), bricksTex->Filename.c_str(),
-		bricksTex->Resource, bricksTex->UploadHeap));
-
-	auto WedgeTex = std::make_unique<Texture>();
-	WedgeTex->Name = "bricks2Tex";
-	WedgeTex->Filename = L"../../Textures/bricks2.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), WedgeTex->Filename.c_str(),
-		WedgeTex->Resource, WedgeTex->UploadHeap));
-
-	auto cylinderTex = std::make_unique<Texture>();
-	cylinderTex->Name = "bricks3Tex";
-	cylinderTex->Filename = L"../../Textures/bricks3.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), cylinderTex->Filename.c_str(),
-		cylinderTex->Resource, cylinderTex->UploadHeap));
-
-	auto sphereTex = std::make_unique<Texture>();
-	sphereTex->Name = "iceTex";
-	sphereTex->Filename = L"../../Textures/ice.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), sphereTex->Filename.c_str(),
-		sphereTex->Resource, sphereTex->UploadHeap));
-
-	auto coneTex = std::make_unique<Texture>();
-	coneTex->Name = "tileTex";
-	coneTex->Filename = L"../../Textures/tile.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), coneTex->Filename.c_str(),
-		coneTex->Resource, coneTex->UploadHeap));
-
-	auto pyramidTex = std::make_unique<Texture>();
-	pyramidTex->Name = "sandTex";
-	pyramidTex->Filename = L"../../Textures/sand.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), pyramidTex->Filename.c_str(),
-		pyramidTex->Resource, pyramidTex->UploadHeap));
-
-	auto PrismTex = std::make_unique<Texture>();
-	PrismTex->Name = "checkboardTex";
-	PrismTex->Filename = L"../../Textures/checkboard.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), PrismTex->Filename.c_str(),
-		PrismTex->Resource, PrismTex->UploadHeap));
-
-	auto DiamondTex = std::make_unique<Texture>();
-	DiamondTex->Name = "shinyTex";
-	DiamondTex->Filename = L"../../Textures/shiny.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), DiamondTex->Filename.c_str(),
-		DiamondTex->Resource, DiamondTex->UploadHeap));
-
-	auto treeArrayTex = std::make_unique<Texture>();
-	treeArrayTex->Name = "treeArrayTex";
-	treeArrayTex->Filename = L"../../Textures/treeArray.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), treeArrayTex->Filename.c_str(),
-		treeArrayTex->Resource, treeArrayTex->UploadHeap));
-
-	mTextures[grassTex->Name] = std::move(grassTex);
-	mTextures[grasswallTex->Name] = std::move(grasswallTex);
-
-	mTextures[waterTex->Name] = std::move(waterTex);
-	mTextures[bricksTex->Name] = std::move(bricksTex);
-	mTextures[WedgeTex->Name] = std::move(WedgeTex);
-	mTextures[cylinderTex->Name] = std::move(cylinderTex);
-	mTextures[sphereTex->Name] = std::move(sphereTex);
-	mTextures[coneTex->Name] = std::move(coneTex);
-	mTextures[pyramidTex->Name] = std::move(pyramidTex);
-	mTextures[PrismTex->Name] = std::move(PrismTex);
-	mTextures[DiamondTex->Name] = std::move(DiamondTex);
-
-
-	mTextures[treeArrayTex->Name] = std::move(treeArrayTex);
+	const UINT textureCount = _countof(gSceneTextures);
+	mTextureStreamer = std::make_unique<TextureStreamer>(md3dDevice.Get(), textureCount, gNumFrameResources);
+
+	for(UINT i = 0; i < textureCount; ++i)
+	{
+		auto tex = std::make_unique<Texture>();
+		tex->Name = gSceneTextures[i].Name;
+		tex->Filename = gSceneTextures[i].Filename;
+
+		mTextureStreamer->Load(i, tex.get(), gSceneTextures[i].IsArray);
+
+		mTextures.Add(gSceneTextures[i].Name, std::move(tex));
+	}
+	mNumDiffuseMaps = DiffuseMapCount();
+	mNumDiffuseMapsDefine = std::to_string(mNumDiffuseMaps);
 }
 
 void TreeBillboardsApp::BuildRootSignature()
 {
+	// All the 2D diffuse maps (t0.., space2).
 	CD3DX12_DESCRIPTOR_RANGE texTable;
-	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, mNumDiffuseMaps, 0, 2);
+
+	// GPU wave height, normal and tangent maps (t1..t3).
+	CD3DX12_DESCRIPTOR_RANGE displacementMapTable;
+	displacementMapTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 1);
+
+	// Tree sprite texture array (t0).
+	CD3DX12_DESCRIPTOR_RANGE treeTexTable;
+	treeTexTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
 
     // Root parameter can be a table, root descriptor or root constants.
-    CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+    CD3DX12_ROOT_PARAMETER slotRootParameter[10];
 
 	// Perfomance TIP: Order from most frequent to least frequent.
-	slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
-    slotRootParameter[1].InitAsConstantBufferView(0);
-    slotRootParameter[2].InitAsConstantBufferView(1);
-    slotRootParameter[3].InitAsConstantBufferView(2);
+    slotRootParameter[0].InitAsConstantBufferView(0);
+    slotRootParameter[1].InitAsConstantBufferView(1);
+	slotRootParameter[2].InitAsShaderResourceView(1, 1);
+	slotRootParameter[3].InitAsShaderResourceView(0, 1, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[4].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[5].InitAsDescriptorTable(1, &displacementMapTable, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[6].InitAsDescriptorTable(1, &treeTexTable, D3D12_SHADER_VISIBILITY_PIXEL);
+
+	// The clustered lights, their counts and their indices (t2..t4, space1).
+	slotRootParameter[7].InitAsShaderResourceView(2, 1, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[8].InitAsShaderResourceView(3, 1, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[9].InitAsShaderResourceView(4, 1, D3D12_SHADER_VISIBILITY_PIXEL);
 
 	auto staticSamplers = GetStaticSamplers();
 
     // A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(10, slotRootParameter,
 		(UINT)staticSamplers.size(), staticSamplers.data(),
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -703,123 +1975,215 @@ void TreeBillboardsApp::BuildRootSignature()
         IID_PPV_ARGS(mRootSignature.GetAddressOf())));
 }
 
-void TreeBillboardsApp::BuildDescriptorHeaps()
+void TreeBillboardsApp::BuildWavesRootSignature()
 {
-	//
-	// Create the SRV heap.
-	//
-	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = 12;
-	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
+	CD3DX12_DESCRIPTOR_RANGE uavTable0;
+	uavTable0.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
 
-	//
-	// Fill out the heap with actual descriptors.
-	//
-	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+	CD3DX12_DESCRIPTOR_RANGE uavTable1;
+	uavTable1.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 1);
+
+	CD3DX12_DESCRIPTOR_RANGE uavTable2;
+	uavTable2.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 2);
+
+	// Normal and tangent maps (u3, u4).
+	CD3DX12_DESCRIPTOR_RANGE uavTable3;
+	uavTable3.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 3);
+
+	// Root parameter can be a table, root descriptor or root constants.
+	CD3DX12_ROOT_PARAMETER slotRootParameter[5];
+
+	// Perfomance TIP: Order from most frequent to least frequent.
+	slotRootParameter[0].InitAsConstants(9, 0);
+	slotRootParameter[1].InitAsDescriptorTable(1, &uavTable0);
+	slotRootParameter[2].InitAsDescriptorTable(1, &uavTable1);
+	slotRootParameter[3].InitAsDescriptorTable(1, &uavTable2);
+	slotRootParameter[4].InitAsDescriptorTable(1, &uavTable3);
+
+	// A root signature is an array of root parameters.
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(5, slotRootParameter,
+		0, nullptr,
+		D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
+
+	if(errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
 
-	auto grassTex = mTextures["grassTex"]->Resource;
-	auto grasswallTex = mTextures["grasswallTex"]->Resource;
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mWavesRootSignature.GetAddressOf())));
+}
 
-	auto waterTex = mTextures["waterTex"]->Resource;
-	auto bricksTex = mTextures["bricksTex"]->Resource;
-	auto bricks2Tex = mTextures["bricks2Tex"]->Resource;
-	auto bricks3Tex = mTextures["bricks3Tex"]->Resource;
+void TreeBillboardsApp::BuildTreeCullRootSignature()
+{
+	// Everything is a root argument, so the pass needs no descriptor heap.
+	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
 
-	auto iceTex = mTextures["iceTex"]->Resource;
-	auto tileTex = mTextures["tileTex"]->Resource;
-	auto sandTex = mTextures["sandTex"]->Resource;
-	auto checkboardTex = mTextures["checkboardTex"]->Resource;
-	auto shinyTex = mTextures["shinyTex"]->Resource;
+	slotRootParameter[0].InitAsConstants(32, 0);	// cbCull
+	slotRootParameter[1].InitAsShaderResourceView(0);
+	slotRootParameter[2].InitAsUnorderedAccessView(0);
+	slotRootParameter[3].InitAsUnorderedAccessView(1);
 
-	auto treeArrayTex = mTextures["treeArrayTex"]->Resource;
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+		0, nullptr,
+		D3D12_ROOT_SIGNATURE_FLAG_NONE);
 
-	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Format = grassTex->GetDesc().Format;
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MostDetailedMip = 0;
-	srvDesc.Texture2D.MipLevels = -1;
-	md3dDevice->CreateShaderResourceView(grassTex.Get(), &srvDesc, hDescriptor);
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
 
-	srvDesc.Format = grasswallTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(grasswallTex.Get(), &srvDesc, hDescriptor);
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	if(errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
 
-	srvDesc.Format = waterTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(waterTex.Get(), &srvDesc, hDescriptor);
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mTreeCullRootSignature.GetAddressOf())));
+}
 
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+void TreeBillboardsApp::BuildOitRootSignature()
+{
+	// The accumulation and revealage targets (t0, t1), read with Load.
+	CD3DX12_DESCRIPTOR_RANGE oitTable;
+	oitTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, WeightedOit::SrvCount, 0);
 
-	srvDesc.Format = bricksTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(bricksTex.Get(), &srvDesc, hDescriptor);
+	CD3DX12_ROOT_PARAMETER slotRootParameter[1];
+	slotRootParameter[0].InitAsDescriptorTable(1, &oitTable, D3D12_SHADER_VISIBILITY_PIXEL);
 
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(1, slotRootParameter,
+		0, nullptr,
+		D3D12_ROOT_SIGNATURE_FLAG_NONE);
 
-	srvDesc.Format = bricks2Tex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(bricks2Tex.Get(), &srvDesc, hDescriptor);
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
 
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	if(errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
 
-	srvDesc.Format = bricks3Tex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(bricks3Tex.Get(), &srvDesc, hDescriptor);
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mOitRootSignature.GetAddressOf())));
+}
 
-	//	next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+void TreeBillboardsApp::BuildLightCullRootSignature()
+{
+	// Root descriptors only, so no descriptor table.
+	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
 
-	srvDesc.Format = iceTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(iceTex.Get(), &srvDesc, hDescriptor);
+	slotRootParameter[0].InitAsConstants(24, 0);	// cbLightCull
+	slotRootParameter[1].InitAsShaderResourceView(0);
+	slotRootParameter[2].InitAsUnorderedAccessView(0);
+	slotRootParameter[3].InitAsUnorderedAccessView(1);
 
-	//	next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+		0, nullptr,
+		D3D12_ROOT_SIGNATURE_FLAG_NONE);
 
-	srvDesc.Format = tileTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(tileTex.Get(), &srvDesc, hDescriptor);
+	ComPtr<ID3DBlob> serializedRootSig = nullptr;
+	ComPtr<ID3DBlob> errorBlob = nullptr;
+	HRESULT hr = D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1,
+		serializedRootSig.GetAddressOf(), errorBlob.GetAddressOf());
 
-	//	next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	if(errorBlob != nullptr)
+	{
+		::OutputDebugStringA((char*)errorBlob->GetBufferPointer());
+	}
+	ThrowIfFailed(hr);
 
-	srvDesc.Format = sandTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(sandTex.Get(), &srvDesc, hDescriptor);
+	ThrowIfFailed(md3dDevice->CreateRootSignature(
+		0,
+		serializedRootSig->GetBufferPointer(),
+		serializedRootSig->GetBufferSize(),
+		IID_PPV_ARGS(mLightCullRootSignature.GetAddressOf())));
+}
 
-	//	next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+void TreeBillboardsApp::BuildDescriptorHeaps()
+{
+	// One texture table per frame resource, which the streamer fills in, then
+	// the wave simulation descriptors, then the OIT targets.
+	const UINT textureDescriptors = gNumFrameResources*mTextureStreamer->SlotCount();
+	const UINT wavesDescriptors = mUseGpuWaves ? mGpuWaves->DescriptorCount() : 0;
+	const UINT oitDescriptors = mWeightedOitEnabled ? WeightedOit::SrvCount : 0;
 
-	srvDesc.Format = checkboardTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(checkboardTex.Get(), &srvDesc, hDescriptor);
+	//
+	// Create the SRV heap.
+	//
+	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
+	srvHeapDesc.NumDescriptors = textureDescriptors + wavesDescriptors + oitDescriptors;
+	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
 
-	//	next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	for(int i = 0; i < gNumFrameResources; ++i)
+		mTextureStreamer->UpdateFrameTable(i, TextureTableCpu(i));
 
-	srvDesc.Format = shinyTex->GetDesc().Format;
-	md3dDevice->CreateShaderResourceView(shinyTex.Get(), &srvDesc, hDescriptor);
+	if(mUseGpuWaves)
+	{
+		mGpuWaves->BuildDescriptors(
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), textureDescriptors, mCbvSrvDescriptorSize),
+			CD3DX12_GPU_DESCRIPTOR_HANDLE(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), textureDescriptors, mCbvSrvDescriptorSize),
+			mCbvSrvDescriptorSize);
+	}
 
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+	if(mWeightedOitEnabled)
+	{
+		const UINT oitOffset = textureDescriptors + wavesDescriptors;
+		mOit->BuildDescriptors(
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), oitOffset, mCbvSrvDescriptorSize),
+			CD3DX12_GPU_DESCRIPTOR_HANDLE(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart(), oitOffset, mCbvSrvDescriptorSize),
+			CD3DX12_CPU_DESCRIPTOR_HANDLE(mRtvHeap->GetCPUDescriptorHandleForHeapStart(), SwapChainBufferCount, mRtvDescriptorSize),
+			mCbvSrvDescriptorSize,
+			mRtvDescriptorSize);
+	}
+}
 
-	auto desc = treeArrayTex->GetDesc();
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
-	srvDesc.Format = treeArrayTex->GetDesc().Format;
-	srvDesc.Texture2DArray.MostDetailedMip = 0;
-	srvDesc.Texture2DArray.MipLevels = -1;
-	srvDesc.Texture2DArray.FirstArraySlice = 0;
-	srvDesc.Texture2DArray.ArraySize = treeArrayTex->GetDesc().DepthOrArraySize;
-	md3dDevice->CreateShaderResourceView(treeArrayTex.Get(), &srvDesc, hDescriptor);
+CD3DX12_CPU_DESCRIPTOR_HANDLE TreeBillboardsApp::TextureTableCpu(int frameIndex)const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart(),
+		frameIndex*mTextureStreamer->SlotCount(), mCbvSrvDescriptorSize);
+}
 
+CD3DX12_GPU_DESCRIPTOR_HANDLE TreeBillboardsApp::TextureTableGpu(int frameIndex)const
+{
+	return CD3DX12_GPU_DESCRIPTOR_HANDLE(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart(),
+		frameIndex*mTextureStreamer->SlotCount(), mCbvSrvDescriptorSize);
 }
 
-void TreeBillboardsApp::BuildShadersAndInputLayouts()
+void TreeBillboardsApp::LoadShaders(ShaderCache& shaderCache, bool allPermutations)
 {
+	const char* numDiffuseMaps = mNumDiffuseMapsDefine.c_str();
+
+	const D3D_SHADER_MACRO standardDefines[] =
+	{
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
+		NULL, NULL
+	};
+
 	const D3D_SHADER_MACRO defines[] =
 	{
 		"FOG", "1",
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
 		NULL, NULL
 	};
 
@@ -827,666 +2191,318 @@ void TreeBillboardsApp::BuildShadersAndInputLayouts()
 	{
 		"FOG", "1",
 		"ALPHA_TEST", "1",
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
 		NULL, NULL
 	};
 
-	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_1");
-	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", defines, "PS", "ps_5_1");
-	mShaders["alphaTestedPS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", alphaTestDefines, "PS", "ps_5_1");
-	
-	mShaders["treeSpriteVS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "VS", "vs_5_1");
-	mShaders["treeSpriteGS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "GS", "gs_5_1");
-	mShaders["treeSpritePS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", alphaTestDefines, "PS", "ps_5_1");
-
-    mStdInputLayout =
-    {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    };
-
-	mTreeSpriteInputLayout =
+	const D3D_SHADER_MACRO instancedDefines[] =
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "SIZE", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		"INSTANCED", "1",
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
+		NULL, NULL
 	};
-}
-
-void TreeBillboardsApp::BuildLandGeometry()
-{
-    GeometryGenerator geoGen;
-    GeometryGenerator::MeshData grid = geoGen.CreateGrid(200.0f, 160.0f, 50, 50);
 
-    //
-    // Extract the vertex elements we are interested and apply the height function to
-    // each vertex.  In addition, color the vertices based on their height so we have
-    // sandy looking beaches, grassy low hills, and snow mountain peaks.
-    //
-	int j = 0;
-	int k = 0;
-    std::vector<Vertex> vertices(grid.Vertices.size());
-    for(size_t i = 0; i < grid.Vertices.size(); ++i)
-    {
+	const D3D_SHADER_MACRO terrainDefines[] =
+	{
+		"TERRAIN", "1",
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
+		NULL, NULL
+	};
 
-        auto& p = grid.Vertices[i].Position;
-		vertices[i].Pos.x = -p.z;
-		vertices[i].Pos.z = p.x - 55.f;
+	const D3D_SHADER_MACRO wavesDefines[] =
+	{
+		"DISPLACEMENT_MAP", "1",
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
+		NULL, NULL
+	};
 
+	const D3D_SHADER_MACRO wavesCpuDefines[] =
+	{
+		"WAVE_STREAMS", "1",
+		"NUM_DIFFUSE_MAPS", numDiffuseMaps,
+		NULL, NULL
+	};
 
-		if (i > grid.Vertices.size()/16*3 +31  && i < grid.Vertices.size() / 16 *13 -28)
+	// Names the permutation that failed; the compiler's own messages go to
+	// the debugger.
+	auto load = [&](const char* name, const wchar_t* filename, const D3D_SHADER_MACRO* defines,
+		const char* entrypoint, const char* target)
+	{
+		try
 		{
-
-			vertices[i].Pos.y = 0;
+			mShaders.Add(name, shaderCache.Load(name, filename, defines, entrypoint, target));
 		}
-		else
-
-			vertices[i].Pos.y= -8;
-
-        vertices[i].Normal = GetHillsNormal(p.x, p.z);
-		vertices[i].TexC = grid.Vertices[i].TexC;
-    }
-
-    const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-    std::vector<std::uint16_t> indices = grid.GetIndices16();
-    const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "landGeo";
+		catch(DxException&)
+		{
+			std::string message = std::string("failed to compile ") + name + "\n";
+			std::cerr << message;
+			OutputDebugStringA(message.c_str());
+			throw;
+		}
+	};
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	load("standardVS", L"Shaders\\Default_Indexing.hlsl", standardDefines, "VS", "vs_5_1");
+	load("instancedVS", L"Shaders\\Default_Indexing.hlsl", instancedDefines, "VS", "vs_5_1");
+	load("terrainVS", L"Shaders\\Default_Indexing.hlsl", terrainDefines, "VS", "vs_5_1");
+	load("depthVS", L"Shaders\\Default_Indexing.hlsl", standardDefines, "DepthVS", "vs_5_1");
+	load("depthInstancedVS", L"Shaders\\Default_Indexing.hlsl", instancedDefines, "DepthVS", "vs_5_1");
+	load("depthTerrainVS", L"Shaders\\Default_Indexing.hlsl", terrainDefines, "DepthVS", "vs_5_1");
+	load("opaquePS", L"Shaders\\Default_Indexing.hlsl", defines, "PS", "ps_5_1");
+	load("alphaTestedPS", L"Shaders\\Default_Indexing.hlsl", alphaTestDefines, "PS", "ps_5_1");
+	
+	load("treeSpriteVS", L"Shaders\\TreeSprite.hlsl", nullptr, "VS", "vs_5_1");
+	load("treeSpritePS", L"Shaders\\TreeSprite.hlsl", alphaTestDefines, "PS", "ps_5_1");
+	load("treeCullCS", L"Shaders\\TreeCull.hlsl", nullptr, "CullTreesCS", "cs_5_1");
+	load("lightCullCS", L"Shaders\\LightCull.hlsl", nullptr, "CullLightsCS", "cs_5_1");
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	if(mUseGpuWaves || allPermutations)
+	{
+		load("wavesVS", L"Shaders\\Default_Indexing.hlsl", wavesDefines, "VS", "vs_5_1");
+		load("wavesUpdateCS", L"Shaders\\WaveSim.hlsl", nullptr, "UpdateWavesCS", "cs_5_1");
+		load("wavesDisturbCS", L"Shaders\\WaveSim.hlsl", nullptr, "DisturbWavesCS", "cs_5_1");
+		load("wavesNormalsCS", L"Shaders\\WaveSim.hlsl", nullptr, "WaveNormalsCS", "cs_5_1");
+	}
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+	if(!mUseGpuWaves || allPermutations)
+	{
+		load("wavesCpuVS", L"Shaders\\Default_Indexing.hlsl", wavesCpuDefines, "VS", "vs_5_1");
+	}
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+	if(mWeightedOitEnabled || allPermutations)
+	{
+		load("oitPS", L"Shaders\\Default_Indexing.hlsl", defines, "OitPS", "ps_5_1");
+		load("oitCompositeVS", L"Shaders\\OitComposite.hlsl", nullptr, "VS", "vs_5_1");
+		load("oitCompositePS", L"Shaders\\OitComposite.hlsl", nullptr, "PS", "ps_5_1");
+	}
+}
 
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
+bool TreeBillboardsApp::CompileShaderPermutations()
+{
+	mNumDiffuseMaps = DiffuseMapCount();
+	mNumDiffuseMapsDefine = std::to_string(mNumDiffuseMaps);
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
+	try
+	{
+		ShaderCache shaderCache(L"Shaders\\Cache");
+		LoadShaders(shaderCache, true);
 
-	geo->DrawArgs["grid"] = submesh;
+		std::cout << "Shader permutations: " << shaderCache.CompiledCount() << " compiled, "
+			<< shaderCache.LoadedCount() << " up to date" << std::endl;
+	}
+	catch(DxException& e)
+	{
+		std::wcerr << e.ToString() << std::endl;
+		OutputDebugStringW((e.ToString() + L"\n").c_str());
+		return false;
+	}
 
-	mGeometries["landGeo"] = std::move(geo);
+	return true;
 }
 
-void TreeBillboardsApp::BuildWavesGeometry()
+void TreeBillboardsApp::BuildShadersAndInputLayouts()
 {
-    std::vector<std::uint16_t> indices(3 * mWaves->TriangleCount()); // 3 indices per face
-	assert(mWaves->VertexCount() < 0x0000ffff);
+	// Permutations compiled by an earlier run are loaded from the cache.
+	ShaderCache shaderCache(L"Shaders\\Cache");
+	LoadShaders(shaderCache, false);
 
-    // Iterate over each quad.
-    int m = mWaves->RowCount();
-    int n = mWaves->ColumnCount();
-    int k = 0;
-    for(int i = 0; i < m - 1; ++i)
+    mStdInputLayout =
     {
-        for(int j = 0; j < n - 1; ++j)
-        {
-            indices[k] = i*n + j;
-            indices[k + 1] = i*n + j + 1;
-            indices[k + 2] = (i + 1)*n + j;
-
-            indices[k + 3] = (i + 1)*n + j;
-            indices[k + 4] = i*n + j + 1;
-            indices[k + 5] = (i + 1)*n + j + 1;
-
-            k += 6; // next quad
-        }
-    }
-
-	UINT vbByteSize = mWaves->VertexCount()*sizeof(Vertex);
-	UINT ibByteSize = (UINT)indices.size()*sizeof(std::uint16_t);
+        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
 
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "waterGeo";
+	mTerrainInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "MORPH", 0, DXGI_FORMAT_R32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 
-	// Set dynamically.
-	geo->VertexBufferCPU = nullptr;
-	geo->VertexBufferGPU = nullptr;
+	// The strides come from the vertex buffer views, so these read the
+	// positions out of Vertex and TerrainVertex.
+	mDepthInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["grid"] = submesh;
-
-	mGeometries["waterGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildBoxGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3);
-
-	std::vector<Vertex> vertices(box.Vertices.size());
-	for (size_t i = 0; i < box.Vertices.size(); ++i)
-	{
-		auto& p = box.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = box.Vertices[i].Normal;
-		vertices[i].TexC = box.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = box.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "boxGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["box"] = submesh;
-
-	mGeometries["boxGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildGrassWallGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.5f, 1.0f, 3);
-
-	std::vector<Vertex> vertices(box.Vertices.size());
-	for (size_t i = 0; i < box.Vertices.size(); ++i)
-	{
-		auto& p = box.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = box.Vertices[i].Normal;
-		vertices[i].TexC = box.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = box.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "grasswallGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["grasswall"] = submesh;
-
-	mGeometries["grasswallGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildWedgeGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData wedge = geoGen.CreateWedge(1.0f, 1.0f, 1.0f, 3);
-
-	std::vector<Vertex> vertices(wedge.Vertices.size());
-	for (size_t i = 0; i < wedge.Vertices.size(); ++i)
-	{
-		auto& p = wedge.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = wedge.Vertices[i].Normal;
-		vertices[i].TexC = wedge.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = wedge.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "wedgeGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["wedge"] = submesh;
-
-	mGeometries["wedgeGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildSphereGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(1.0f, 20, 20);
-
-	std::vector<Vertex> vertices(sphere.Vertices.size());
-	for (size_t i = 0; i < sphere.Vertices.size(); ++i)
+	mTerrainDepthInputLayout =
 	{
-		auto& p = sphere.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = sphere.Vertices[i].Normal;
-		vertices[i].TexC = sphere.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = sphere.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "sphereGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["sphere"] = submesh;
-
-	mGeometries["sphereGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildCylinderGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData cylinder = geoGen.CreateCylinder(1.5f, 1.5f, 6.0f, 20, 20);
-
-	std::vector<Vertex> vertices(cylinder.Vertices.size());
-	for (size_t i = 0; i < cylinder.Vertices.size(); ++i)
-	{
-		auto& p = cylinder.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = cylinder.Vertices[i].Normal;
-		vertices[i].TexC = cylinder.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = cylinder.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "cylinderGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["cylinder"] = submesh;
-
-	mGeometries["cylinderGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildConeGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData cone = geoGen.CreateCone(2.0f, 0.0f, 6.0f, 20, 20);
-
-	std::vector<Vertex> vertices(cone.Vertices.size());
-	for (size_t i = 0; i < cone.Vertices.size(); ++i)
-	{
-		auto& p = cone.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = cone.Vertices[i].Normal;
-		vertices[i].TexC = cone.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = cone.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "coneGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["cone"] = submesh;
-
-	mGeometries["coneGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildPyramidGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData Pyramid = geoGen.CreatePyramid(1.0f, 0.0f, 1.0f, 4, 20);
-
-	std::vector<Vertex> vertices(Pyramid.Vertices.size());
-	for (size_t i = 0; i < Pyramid.Vertices.size(); ++i)
-	{
-		auto& p = Pyramid.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = Pyramid.Vertices[i].Normal;
-		vertices[i].TexC = Pyramid.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = Pyramid.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "pyramidGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["pyramid"] = submesh;
-
-	mGeometries["pyramidGeo"] = std::move(geo);
-}
-
-void TreeBillboardsApp::BuildPrismGeometry()
-{
-
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData Prism = geoGen.CreateCylinder(1.0f, 1.0f, 1.0f, 3, 20);
-
-	std::vector<Vertex> vertices(Prism.Vertices.size());
-	for (size_t i = 0; i < Prism.Vertices.size(); ++i)
-	{
-		auto& p = Prism.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = Prism.Vertices[i].Normal;
-		vertices[i].TexC = Prism.Vertices[i].TexC;
-	}
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = Prism.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "prismGeo";
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
-
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["prism"] = submesh;
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "MORPH", 0, DXGI_FORMAT_R32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 
-	mGeometries["prismGeo"] = std::move(geo);
+	// Slot 0 is WaveStaticVertex, slot 1 is WaveDynamicVertex.
+	mWavesInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "HEIGHT", 0, DXGI_FORMAT_R32_FLOAT, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 1, 4, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 }
 
-void TreeBillboardsApp::BuildTreeSpritesGeometry()
+void TreeBillboardsApp::BuildStaticGeometry()
 {
-	//step5
-	struct TreeSpriteVertex
+	// Everything drawn with the standard vertex format shares one vertex and
+	// index buffer; the terrain, the trees and the waves have buffers of their own.
+	StaticGeometryBuilder builder;
+
+	GeometryGenerator geoGen;
+	builder.AddMesh("box", geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3));
+	builder.AddMesh("grasswall", geoGen.CreateBox(1.0f, 1.5f, 1.0f, 3));
+	builder.AddMesh("wedge", geoGen.CreateWedge(1.0f, 1.0f, 1.0f, 3));
+
+	// The round meshes come in gMaxLods tessellations, finest first.  The
+	// sides of a cylinder or cone are flat along their height, so their
+	// coarser levels drop most of the stacks.
+	struct Tessellation
 	{
-		XMFLOAT3 Pos;
-		XMFLOAT2 Size;
+		UINT Slices;
+		UINT Stacks;
 	};
-	static const int treeCount = 24;
-	std::array<TreeSpriteVertex, treeCount> vertices;
-	for(UINT i = 0; i < treeCount; i++)
+	const Tessellation sphereLods[gMaxLods] = { { 20, 20 }, { 12, 12 }, { 6, 6 } };
+	const Tessellation sideLods[gMaxLods] = { { 20, 20 }, { 12, 6 }, { 6, 1 } };
+
+	for(int lod = 0; lod < gMaxLods; ++lod)
 	{
-		if(i<3)
-			vertices[i].Pos = XMFLOAT3(15.0f, 8.0f, -10.0f - i * 10.0f);
-		else if (i >= 3 && i < 6)
-		{
-			vertices[i].Pos = XMFLOAT3(-15.0f, 8.0f, -10.0f - (i-3) * 10.0f);
+		std::string suffix = lod == 0 ? "" : ".lod" + std::to_string(lod);
+		const Tessellation& sphere = sphereLods[lod];
+		const Tessellation& side = sideLods[lod];
 
-		}
-		else if (i >= 6 && i < 13)
-		{
-			if (i >= 11)
-			{
-				vertices[i].Pos = XMFLOAT3(-45.0f, 8.0f, -140.0f + ((i - 7) * 20));
-			}
-			else{
-				vertices[i].Pos = XMFLOAT3(-45.0f, 8.0f, -140.0f + ((i - 6) * 20));
+		builder.AddMesh("sphere" + suffix, geoGen.CreateSphere(1.0f, sphere.Slices, sphere.Stacks));
+		builder.AddMesh("cylinder" + suffix, geoGen.CreateCylinder(1.5f, 1.5f, 6.0f, side.Slices, side.Stacks));
+		builder.AddMesh("cone" + suffix, geoGen.CreateCone(2.0f, 0.0f, 6.0f, side.Slices, side.Stacks));
+	}
 
-			}
-		}
-		else if (i >= 13 && i < 20)
-		{
-			vertices[i].Pos = XMFLOAT3(45.0f, 8.0f, -140.0f + ((i-13) * 20));
-		}
+	builder.AddMesh("pyramid", geoGen.CreatePyramid(1.0f, 0.0f, 1.0f, 4, 20));
+	builder.AddMesh("prism", geoGen.CreateCylinder(1.0f, 1.0f, 1.0f, 3, 20));
+	builder.AddMesh("diamond", geoGen.CreateDiamond(2.0f, 1.0f, 2.0f, 1.0f, 20, 20));
 
-		else if (i >= 20 && i <= 21)
-		{
-			vertices[i].Pos = XMFLOAT3(35.0f - ((i - 20) * 20), 8.0f, -150.0f );
-		}
+	mGeometries.Add("staticGeo", builder.Build("staticGeo", md3dDevice.Get(), mCommandList.Get()));
+}
+
+void TreeBillboardsApp::BuildTerrain()
+{
+	// 32 unit chunks of 4 unit cells, centered on the castle; the default is
+	// the 160 by 200 units the land always covered, rounded up to chunks.
+	const float cellSize = 4.0f;
+	const UINT chunkCells = 8;
+	const UINT chunksX = 5*mTerrainScale;
+	const UINT chunksZ = 7*mTerrainScale;
+	const float chunkSize = cellSize*chunkCells;
+
+	mTerrain = std::make_unique<Terrain>(
+		[this](float x, float z) { return GetLandHeight(x, z); },
+		-0.5f*chunksX*chunkSize, -55.0f - 0.5f*chunksZ*chunkSize,
+		cellSize, chunkCells, chunksX, chunksZ);
+
+	// The grass repeats every 40 units, as it did five times over the old land.
+	mGeometries.Add("terrainGeo", mTerrain->BuildGeometry("terrainGeo", 40.0f, md3dDevice.Get(), mCommandList.Get()));
+}
 
-		else if (i >= 22 && i <= 23)
+void TreeBillboardsApp::BuildWavesGeometry()
+{
+	if(mUseGpuWaves)
+	{
+		// The grid is static; the vertex shader displaces it by the GPU solution.
+		GeometryGenerator geoGen;
+		GeometryGenerator::MeshData grid = geoGen.CreateGrid(
+			(mGpuWaves->ColumnCount() - 1)*mGpuWaves->SpatialStep(),
+			(mGpuWaves->RowCount() - 1)*mGpuWaves->SpatialStep(),
+			mGpuWaves->RowCount(), mGpuWaves->ColumnCount());
+
+		std::vector<Vertex> vertices(grid.Vertices.size());
+		for(size_t i = 0; i < grid.Vertices.size(); ++i)
 		{
-			vertices[i].Pos = XMFLOAT3(-35.0f + ((i - 22) * 20), 8.0f, -150.0f);
+			vertices[i].Pos = grid.Vertices[i].Position;
+			vertices[i].Pos.y = -3.0f;
+			vertices[i].Normal = grid.Vertices[i].Normal;
+			vertices[i].TexC = grid.Vertices[i].TexC;
 		}
 
-		vertices[i].Size = XMFLOAT2(20.0f, 20.0f);
-	}
+		// 32-bit indices so the grid is not limited to 65536 vertices.
+		std::vector<std::uint32_t> indices = grid.Indices32;
 
-	std::array<std::uint16_t, treeCount> indices =
-	{
-		0, 1, 2, 3, 4, 5, 6, 7, 
-		8, 9, 11, 12, 13, 14, 15,
-		16, 17, 18, 19, 20, 21, 22, 23
-	};
+		UINT vbByteSize = (UINT)vertices.size()*sizeof(Vertex);
+		UINT ibByteSize = (UINT)indices.size()*sizeof(std::uint32_t);
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(TreeSpriteVertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+		auto geo = std::make_unique<MeshGeometry>();
+		geo->Name = "waterGeo";
 
-	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "treeSpritesGeo";
+		ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+		CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+		ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+		CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+		geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+			mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+			mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+		geo->VertexByteStride = sizeof(Vertex);
+		geo->VertexBufferByteSize = vbByteSize;
+		geo->IndexFormat = DXGI_FORMAT_R32_UINT;
+		geo->IndexBufferByteSize = ibByteSize;
 
-	geo->VertexByteStride = sizeof(TreeSpriteVertex);
-	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
+		SubmeshGeometry submesh;
+		submesh.IndexCount = (UINT)indices.size();
+		submesh.StartIndexLocation = 0;
+		submesh.BaseVertexLocation = 0;
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
+		// The vertex shader moves the flat grid up and down; leave room for the crests.
+		BoundingBox::CreateFromPoints(submesh.Bounds, vertices.size(), &vertices[0].Pos, sizeof(Vertex));
+		submesh.Bounds.Extents.y += gWaveBoundsHeight;
 
-	geo->DrawArgs["points"] = submesh;
+		geo->DrawArgs["grid"] = submesh;
 
-	mGeometries["treeSpritesGeo"] = std::move(geo);
-}
+		mGeometries.Add("waterGeo", std::move(geo));
+		return;
+	}
 
-void TreeBillboardsApp::BuildDiamondGeometry()
-{
+	// 32-bit indices so the grid is not limited to 65536 vertices.
+    std::vector<std::uint32_t> indices(3 * mWaves->TriangleCount()); // 3 indices per face
 
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData Diamond = geoGen.CreateDiamond(2.0f, 1.0f, 2.0f, 1.0f, 20,  20);
+    // Iterate over each quad.
+    int m = mWaves->RowCount();
+    int n = mWaves->ColumnCount();
+    int k = 0;
+    for(int i = 0; i < m - 1; ++i)
+    {
+        for(int j = 0; j < n - 1; ++j)
+        {
+            indices[k] = i*n + j;
+            indices[k + 1] = i*n + j + 1;
+            indices[k + 2] = (i + 1)*n + j;
+
+            indices[k + 3] = (i + 1)*n + j;
+            indices[k + 4] = i*n + j + 1;
+            indices[k + 5] = (i + 1)*n + j + 1;
+
+            k += 6; // next quad
+        }
+    }
 
-	std::vector<Vertex> vertices(Diamond.Vertices.size());
-	for (size_t i = 0; i < Diamond.Vertices.size(); ++i)
+	// The static stream: x/z never change and the tex-coords are derived
+	// from position by mapping [-w/2,w/2] --> [0,1].  The heights and normals
+	// go in the dynamic stream, see UpdateWaves.
+	std::vector<WaveStaticVertex> vertices(mWaves->VertexCount());
+	for(int i = 0; i < mWaves->VertexCount(); ++i)
 	{
-		auto& p = Diamond.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Normal = Diamond.Vertices[i].Normal;
-		vertices[i].TexC = Diamond.Vertices[i].TexC;
+		XMFLOAT3 p = mWaves->Position(i);
+		vertices[i].PosXZ = XMFLOAT2(p.x, p.z);
+		vertices[i].TexC.x = 0.5f + p.x / mWaves->Width();
+		vertices[i].TexC.y = 0.5f - p.z / mWaves->Depth();
 	}
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = Diamond.GetIndices16();
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	UINT vbByteSize = mWaves->VertexCount()*sizeof(WaveStaticVertex);
+	UINT ibByteSize = (UINT)indices.size()*sizeof(std::uint32_t);
 
 	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "diamondGeo";
+	geo->Name = "waterGeo";
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
 	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
@@ -1500,9 +2516,9 @@ void TreeBillboardsApp::BuildDiamondGeometry()
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexByteStride = sizeof(WaveStaticVertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
 	SubmeshGeometry submesh;
@@ -1510,13 +2526,90 @@ void TreeBillboardsApp::BuildDiamondGeometry()
 	submesh.StartIndexLocation = 0;
 	submesh.BaseVertexLocation = 0;
 
-	geo->DrawArgs["diamond"] = submesh;
+	// The grid is centered on the origin; the heights come from the dynamic stream.
+	submesh.Bounds = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f),
+		XMFLOAT3(0.5f*mWaves->Width(), gWaveBoundsHeight, 0.5f*mWaves->Depth()));
+
+	geo->DrawArgs["grid"] = submesh;
+
+	mGeometries.Add("waterGeo", std::move(geo));
+}
+
+void TreeBillboardsApp::BuildTrees()
+{
+	//step5
+	static_assert(sizeof(GpuTrees::Tree) == sizeof(SceneSprite), "the scene sprites are the trees");
+
+	const UINT treeCount = mScene->SpriteCount();
+	const GpuTrees::Tree* sceneTrees = reinterpret_cast<const GpuTrees::Tree*>(mScene->Sprites());
+	std::vector<GpuTrees::Tree> trees(sceneTrees, sceneTrees + treeCount);
+
+	if(mTreeCount == 0)
+		mTreeCount = (int)treeCount;
+
+	// More trees than the scene has are scattered over the land around the
+	// castle; fewer drop the last ones.
+	for(int i = (int)treeCount; i < mTreeCount; ++i)
+	{
+		GpuTrees::Tree t;
+		float x = MathHelper::RandF(-80.0f, 80.0f);
+		float z = MathHelper::RandF(-155.0f, 45.0f);
+		t.Pos = XMFLOAT3(x, mTerrain->GetHeight(x, z) + 8.0f, z);
+		t.Size = XMFLOAT2(20.0f, 20.0f);
+		trees.push_back(t);
+	}
+	trees.resize(mTreeCount);
+
+	mGpuTrees = std::make_unique<GpuTrees>(md3dDevice.Get(), mCommandList.Get(), trees.data(), (UINT)trees.size(), mNumFramesInFlight);
+}
+
+void TreeBillboardsApp::BuildTorches()
+{
+	// Scattered over the castle plateau: torches on poles, and every fourth
+	// a lantern hung higher up that shines down.  The point lights go first.
+	const UINT spotCount = mTorchCount / 4;
+	mTorchPointCount = mTorchCount - spotCount;
+
+	mTorches.resize(mTorchCount);
+	for(UINT i = 0; i < (UINT)mTorchCount; ++i)
+	{
+		float x = MathHelper::RandF(-44.0f, 44.0f);
+		float z = MathHelper::RandF(-150.0f, 50.0f);
+		float ground = mTerrain->GetHeight(x, z);
 
-	mGeometries["diamondGeo"] = std::move(geo);
+		Torch& torch = mTorches[i];
+		torch.Phase = MathHelper::RandF(0.0f, 2.0f*MathHelper::Pi);
+		if(i < mTorchPointCount)
+		{
+			torch.Base.Strength = { 2.0f, 1.1f, 0.4f };
+			torch.Base.Position = { x, ground + 3.0f, z };
+			torch.Base.FalloffStart = 1.0f;
+			torch.Base.FalloffEnd = 12.0f;
+		}
+		else
+		{
+			torch.Base.Strength = { 2.5f, 1.6f, 0.8f };
+			torch.Base.Position = { x, ground + 10.0f, z };
+			torch.Base.Direction = { 0.0f, -1.0f, 0.0f };
+			torch.Base.FalloffStart = 2.0f;
+			torch.Base.FalloffEnd = 18.0f;
+			torch.Base.SpotPower = 4.0f;
+		}
+	}
 }
 
 void TreeBillboardsApp::BuildPSOs()
 {
+	// Debug and release shaders differ, so each keeps its own file next to the
+	// shader cache.
+	ComPtr<IDXGIAdapter1> adapter;
+	ThrowIfFailed(mdxgiFactory->EnumAdapterByLuid(md3dDevice->GetAdapterLuid(), IID_PPV_ARGS(&adapter)));
+#if defined(DEBUG) || defined(_DEBUG)
+	mPipelineCache = std::make_unique<PipelineCache>(md3dDevice.Get(), adapter.Get(), L"Shaders\\Cache\\PipelinesDebug.bin");
+#else
+	mPipelineCache = std::make_unique<PipelineCache>(md3dDevice.Get(), adapter.Get(), L"Shaders\\Cache\\Pipelines.bin");
+#endif
+
     D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc;
 
 	//
@@ -1527,13 +2620,13 @@ void TreeBillboardsApp::BuildPSOs()
 	opaquePsoDesc.pRootSignature = mRootSignature.Get();
 	opaquePsoDesc.VS = 
 	{ 
-		reinterpret_cast<BYTE*>(mShaders["standardVS"]->GetBufferPointer()), 
-		mShaders["standardVS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(mShaders.At("standardVS")->GetBufferPointer()), 
+		mShaders.At("standardVS")->GetBufferSize()
 	};
 	opaquePsoDesc.PS = 
 	{ 
-		reinterpret_cast<BYTE*>(mShaders["opaquePS"]->GetBufferPointer()),
-		mShaders["opaquePS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(mShaders.At("opaquePS")->GetBufferPointer()),
+		mShaders.At("opaquePS")->GetBufferSize()
 	};
 	opaquePsoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
 	opaquePsoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
@@ -1550,7 +2643,65 @@ void TreeBillboardsApp::BuildPSOs()
 	opaquePsoDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
 	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
 	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
-    ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaque"])));
+    mPSOs.Add("opaque", mPipelineCache->CreateGraphicsPipeline("opaque", opaquePsoDesc));
+
+	D3D12_SHADER_BYTECODE instancedVS =
+	{
+		reinterpret_cast<BYTE*>(mShaders.At("instancedVS")->GetBufferPointer()),
+		mShaders.At("instancedVS")->GetBufferSize()
+	};
+
+	//
+	// PSO for instanced opaque objects.
+	//
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueInstancedPsoDesc = opaquePsoDesc;
+	opaqueInstancedPsoDesc.VS = instancedVS;
+	mPSOs.Add("opaqueInstanced", mPipelineCache->CreateGraphicsPipeline("opaqueInstanced", opaqueInstancedPsoDesc));
+
+	//
+	// PSO for the terrain chunks.
+	//
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC terrainPsoDesc = opaquePsoDesc;
+	terrainPsoDesc.InputLayout = { mTerrainInputLayout.data(), (UINT)mTerrainInputLayout.size() };
+	terrainPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders.At("terrainVS")->GetBufferPointer()),
+		mShaders.At("terrainVS")->GetBufferSize()
+	};
+	mPSOs.Add("terrain", mPipelineCache->CreateGraphicsPipeline("terrain", terrainPsoDesc));
+
+	//
+	// PSOs for the depth prepass of the opaque layers, and for their lit pass
+	// after it, which only shades the pixels whose depth the prepass kept.
+	//
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC* litPsoDescs[gDepthPrepassLayerCount] =
+	{
+		&opaquePsoDesc, &opaqueInstancedPsoDesc, &terrainPsoDesc
+	};
+	const char* depthVSNames[gDepthPrepassLayerCount] = { "depthVS", "depthInstancedVS", "depthTerrainVS" };
+
+	for(int k = 0; k < gDepthPrepassLayerCount; ++k)
+	{
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC depthOnlyPsoDesc = *litPsoDescs[k];
+		if(gDepthPrepassLayers[k] == RenderLayer::Terrain)
+			depthOnlyPsoDesc.InputLayout = { mTerrainDepthInputLayout.data(), (UINT)mTerrainDepthInputLayout.size() };
+		else
+			depthOnlyPsoDesc.InputLayout = { mDepthInputLayout.data(), (UINT)mDepthInputLayout.size() };
+		depthOnlyPsoDesc.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At(depthVSNames[k])->GetBufferPointer()),
+			mShaders.At(depthVSNames[k])->GetBufferSize()
+		};
+		depthOnlyPsoDesc.PS = { nullptr, 0 };
+		depthOnlyPsoDesc.NumRenderTargets = 0;
+		depthOnlyPsoDesc.RTVFormats[0] = DXGI_FORMAT_UNKNOWN;
+		mPSOs.Add(gDepthOnlyPsoNames[k], mPipelineCache->CreateGraphicsPipeline(gDepthOnlyPsoNames[k], depthOnlyPsoDesc));
+
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC depthEqualPsoDesc = *litPsoDescs[k];
+		depthEqualPsoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_EQUAL;
+		depthEqualPsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+		mPSOs.Add(gDepthEqualPsoNames[k], mPipelineCache->CreateGraphicsPipeline(gDepthEqualPsoNames[k], depthEqualPsoDesc));
+	}
 
 	//
 	// PSO for transparent objects
@@ -1573,7 +2724,79 @@ void TreeBillboardsApp::BuildPSOs()
 	//transparentPsoDesc.BlendState.AlphaToCoverageEnable = true;
 
 	transparentPsoDesc.BlendState.RenderTarget[0] = transparencyBlendDesc;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&transparentPsoDesc, IID_PPV_ARGS(&mPSOs["transparent"])));
+	mPSOs.Add("transparent", mPipelineCache->CreateGraphicsPipeline("transparent", transparentPsoDesc));
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC transparentInstancedPsoDesc = transparentPsoDesc;
+	transparentInstancedPsoDesc.VS = instancedVS;
+	mPSOs.Add("transparentInstanced", mPipelineCache->CreateGraphicsPipeline("transparentInstanced", transparentInstancedPsoDesc));
+
+	//
+	// Weighted blended OIT versions of the blended PSOs, see WeightedOit.h.
+	// They draw into the OIT targets and leave the depth alone, so the order
+	// their surfaces come in does not matter.
+	//
+	auto oitPsoDesc = [this](D3D12_GRAPHICS_PIPELINE_STATE_DESC desc)
+	{
+		desc.PS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("oitPS")->GetBufferPointer()),
+			mShaders.At("oitPS")->GetBufferSize()
+		};
+		desc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+
+		desc.BlendState.IndependentBlendEnable = true;
+
+		D3D12_RENDER_TARGET_BLEND_DESC& accum = desc.BlendState.RenderTarget[0];
+		accum.BlendEnable = true;
+		accum.SrcBlend = D3D12_BLEND_ONE;
+		accum.DestBlend = D3D12_BLEND_ONE;
+		accum.BlendOp = D3D12_BLEND_OP_ADD;
+		accum.SrcBlendAlpha = D3D12_BLEND_ONE;
+		accum.DestBlendAlpha = D3D12_BLEND_ONE;
+		accum.BlendOpAlpha = D3D12_BLEND_OP_ADD;
+		accum.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+
+		D3D12_RENDER_TARGET_BLEND_DESC& revealage = desc.BlendState.RenderTarget[1];
+		revealage = accum;
+		revealage.SrcBlend = D3D12_BLEND_ZERO;
+		revealage.DestBlend = D3D12_BLEND_INV_SRC_COLOR;
+		revealage.SrcBlendAlpha = D3D12_BLEND_ZERO;
+		revealage.DestBlendAlpha = D3D12_BLEND_INV_SRC_ALPHA;
+		revealage.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_RED;
+
+		desc.NumRenderTargets = WeightedOit::RtvCount;
+		desc.RTVFormats[0] = WeightedOit::AccumFormat;
+		desc.RTVFormats[1] = WeightedOit::RevealageFormat;
+		return desc;
+	};
+
+	if(mWeightedOitEnabled)
+	{
+		mPSOs.Add("transparentOit", mPipelineCache->CreateGraphicsPipeline("transparentOit", oitPsoDesc(transparentPsoDesc)));
+		mPSOs.Add("transparentInstancedOit", mPipelineCache->CreateGraphicsPipeline("transparentInstancedOit", oitPsoDesc(transparentInstancedPsoDesc)));
+
+		//
+		// PSO for blending the OIT targets over the back buffer
+		//
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC oitCompositePsoDesc = transparentPsoDesc;
+		oitCompositePsoDesc.InputLayout = { nullptr, 0 };
+		oitCompositePsoDesc.pRootSignature = mOitRootSignature.Get();
+		oitCompositePsoDesc.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("oitCompositeVS")->GetBufferPointer()),
+			mShaders.At("oitCompositeVS")->GetBufferSize()
+		};
+		oitCompositePsoDesc.PS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("oitCompositePS")->GetBufferPointer()),
+			mShaders.At("oitCompositePS")->GetBufferSize()
+		};
+		oitCompositePsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+		oitCompositePsoDesc.DepthStencilState.DepthEnable = false;
+		oitCompositePsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+		oitCompositePsoDesc.DSVFormat = DXGI_FORMAT_UNKNOWN;
+		mPSOs.Add("oitComposite", mPipelineCache->CreateGraphicsPipeline("oitComposite", oitCompositePsoDesc));
+	}
 
 	//
 	// PSO for alpha tested objects
@@ -1582,11 +2805,11 @@ void TreeBillboardsApp::BuildPSOs()
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC alphaTestedPsoDesc = opaquePsoDesc;
 	alphaTestedPsoDesc.PS = 
 	{ 
-		reinterpret_cast<BYTE*>(mShaders["alphaTestedPS"]->GetBufferPointer()),
-		mShaders["alphaTestedPS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(mShaders.At("alphaTestedPS")->GetBufferPointer()),
+		mShaders.At("alphaTestedPS")->GetBufferSize()
 	};
 	alphaTestedPsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&alphaTestedPsoDesc, IID_PPV_ARGS(&mPSOs["alphaTested"])));
+	mPSOs.Add("alphaTested", mPipelineCache->CreateGraphicsPipeline("alphaTested", alphaTestedPsoDesc));
 
 	//
 	// PSO for tree sprites
@@ -1594,33 +2817,218 @@ void TreeBillboardsApp::BuildPSOs()
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC treeSpritePsoDesc = opaquePsoDesc;
 	treeSpritePsoDesc.VS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpriteVS"]->GetBufferPointer()),
-		mShaders["treeSpriteVS"]->GetBufferSize()
-	};
-	treeSpritePsoDesc.GS =
-	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpriteGS"]->GetBufferPointer()),
-		mShaders["treeSpriteGS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(mShaders.At("treeSpriteVS")->GetBufferPointer()),
+		mShaders.At("treeSpriteVS")->GetBufferSize()
 	};
 	treeSpritePsoDesc.PS =
 	{
-		reinterpret_cast<BYTE*>(mShaders["treeSpritePS"]->GetBufferPointer()),
-		mShaders["treeSpritePS"]->GetBufferSize()
+		reinterpret_cast<BYTE*>(mShaders.At("treeSpritePS")->GetBufferPointer()),
+		mShaders.At("treeSpritePS")->GetBufferSize()
 	};
 	//step1
-	treeSpritePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_POINT;
-	treeSpritePsoDesc.InputLayout = { mTreeSpriteInputLayout.data(), (UINT)mTreeSpriteInputLayout.size() };
+	// The vertex shader makes the quads from SV_VertexID, so there is no input.
+	treeSpritePsoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	treeSpritePsoDesc.InputLayout = { nullptr, 0 };
 	treeSpritePsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
 
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&treeSpritePsoDesc, IID_PPV_ARGS(&mPSOs["treeSprites"])));
+	mPSOs.Add("treeSprites", mPipelineCache->CreateGraphicsPipeline("treeSprites", treeSpritePsoDesc));
+
+	//
+	// PSO for culling the trees
+	//
+	D3D12_COMPUTE_PIPELINE_STATE_DESC treeCullPSO = {};
+	treeCullPSO.pRootSignature = mTreeCullRootSignature.Get();
+	treeCullPSO.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders.At("treeCullCS")->GetBufferPointer()),
+		mShaders.At("treeCullCS")->GetBufferSize()
+	};
+	treeCullPSO.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	mPSOs.Add("treeCull", mPipelineCache->CreateComputePipeline("treeCull", treeCullPSO));
+
+	//
+	// PSO for binning the lights into clusters
+	//
+	D3D12_COMPUTE_PIPELINE_STATE_DESC lightCullPSO = {};
+	lightCullPSO.pRootSignature = mLightCullRootSignature.Get();
+	lightCullPSO.CS =
+	{
+		reinterpret_cast<BYTE*>(mShaders.At("lightCullCS")->GetBufferPointer()),
+		mShaders.At("lightCullCS")->GetBufferSize()
+	};
+	lightCullPSO.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	mPSOs.Add("lightCull", mPipelineCache->CreateComputePipeline("lightCull", lightCullPSO));
+
+	if(mUseGpuWaves)
+	{
+		//
+		// PSO for drawing the GPU waves
+		//
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC wavesRenderPSO = transparentPsoDesc;
+		wavesRenderPSO.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("wavesVS")->GetBufferPointer()),
+			mShaders.At("wavesVS")->GetBufferSize()
+		};
+		mPSOs.Add("wavesRender", mPipelineCache->CreateGraphicsPipeline("wavesRender", wavesRenderPSO));
+		if(mWeightedOitEnabled)
+			mPSOs.Add("wavesRenderOit", mPipelineCache->CreateGraphicsPipeline("wavesRenderOit", oitPsoDesc(wavesRenderPSO)));
+
+		//
+		// PSO for disturbing waves
+		//
+		D3D12_COMPUTE_PIPELINE_STATE_DESC wavesDisturbPSO = {};
+		wavesDisturbPSO.pRootSignature = mWavesRootSignature.Get();
+		wavesDisturbPSO.CS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("wavesDisturbCS")->GetBufferPointer()),
+			mShaders.At("wavesDisturbCS")->GetBufferSize()
+		};
+		wavesDisturbPSO.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+		mPSOs.Add("wavesDisturb", mPipelineCache->CreateComputePipeline("wavesDisturb", wavesDisturbPSO));
+
+		//
+		// PSO for updating waves
+		//
+		D3D12_COMPUTE_PIPELINE_STATE_DESC wavesUpdatePSO = {};
+		wavesUpdatePSO.pRootSignature = mWavesRootSignature.Get();
+		wavesUpdatePSO.CS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("wavesUpdateCS")->GetBufferPointer()),
+			mShaders.At("wavesUpdateCS")->GetBufferSize()
+		};
+		wavesUpdatePSO.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+		mPSOs.Add("wavesUpdate", mPipelineCache->CreateComputePipeline("wavesUpdate", wavesUpdatePSO));
+
+		//
+		// PSO for the wave normals and tangents
+		//
+		D3D12_COMPUTE_PIPELINE_STATE_DESC wavesNormalsPSO = {};
+		wavesNormalsPSO.pRootSignature = mWavesRootSignature.Get();
+		wavesNormalsPSO.CS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("wavesNormalsCS")->GetBufferPointer()),
+			mShaders.At("wavesNormalsCS")->GetBufferSize()
+		};
+		wavesNormalsPSO.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+		mPSOs.Add("wavesNormals", mPipelineCache->CreateComputePipeline("wavesNormals", wavesNormalsPSO));
+	}
+	else
+	{
+		//
+		// PSO for drawing the two-stream CPU waves
+		//
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC wavesCpuPSO = transparentPsoDesc;
+		wavesCpuPSO.InputLayout = { mWavesInputLayout.data(), (UINT)mWavesInputLayout.size() };
+		wavesCpuPSO.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders.At("wavesCpuVS")->GetBufferPointer()),
+			mShaders.At("wavesCpuVS")->GetBufferSize()
+		};
+		mPSOs.Add("wavesCpu", mPipelineCache->CreateGraphicsPipeline("wavesCpu", wavesCpuPSO));
+		if(mWeightedOitEnabled)
+			mPSOs.Add("wavesCpuOit", mPipelineCache->CreateGraphicsPipeline("wavesCpuOit", oitPsoDesc(wavesCpuPSO)));
+	}
+}
+
+void TreeBillboardsApp::ResolveFrameHandles()
+{
+	mOpaquePso = mPSOs.Find("opaque");
+	mOpaqueInstancedPso = mPSOs.Find("opaqueInstanced");
+	mTerrainPso = mPSOs.Find("terrain");
+	for(int k = 0; k < gDepthPrepassLayerCount; ++k)
+	{
+		mDepthOnlyPsos[k] = mPSOs.Find(gDepthOnlyPsoNames[k]);
+		mDepthEqualPsos[k] = mPSOs.Find(gDepthEqualPsoNames[k]);
+	}
+	mAlphaTestedPso = mPSOs.Find("alphaTested");
+	mTreeSpritesPso = mPSOs.Find("treeSprites");
+	mTreeCullPso = mPSOs.Find("treeCull");
+	mLightCullPso = mPSOs.Find("lightCull");
+	mWavesUpdatePso = mPSOs.Find("wavesUpdate");
+	mWavesDisturbPso = mPSOs.Find("wavesDisturb");
+	mWavesNormalsPso = mPSOs.Find("wavesNormals");
+	mWavesRenderPsos[0] = mPSOs.Find("wavesRender");
+	mWavesRenderPsos[1] = mPSOs.Find("wavesRenderOit");
+	mWavesCpuPsos[0] = mPSOs.Find("wavesCpu");
+	mWavesCpuPsos[1] = mPSOs.Find("wavesCpuOit");
+	mTransparentPsos[0] = mPSOs.Find("transparent");
+	mTransparentPsos[1] = mPSOs.Find("transparentOit");
+	mTransparentInstancedPsos[0] = mPSOs.Find("transparentInstanced");
+	mTransparentInstancedPsos[1] = mPSOs.Find("transparentInstancedOit");
+	mOitCompositePso = mPSOs.Find("oitComposite");
+
+	mWaterMat = mMaterials.Find("water");
+	mTreeSpritesMat = mMaterials.Find("treeSprites");
+}
+
+void TreeBillboardsApp::BuildProfiler()
+{
+	// The frame, the GPU wave simulation, the tree culling, the light culling,
+	// the depth prepass, the OIT composite and one per layer.  The simulation
+	// and the culls are timed on the compute queue with async compute, and
+	// the frame scope only covers the graphics queue.
+	mProfiler = std::make_unique<Profiler>(md3dDevice.Get(), mCommandQueue.Get(),
+		mNumFramesInFlight, 6 + (UINT)RenderLayer::Count);
+
+	mUpdateScope = mProfiler->AddCpuScope("Update");
+	mDrawScope = mProfiler->AddCpuScope("Draw");
+	mUpdateObjectCBsScope = mProfiler->AddCpuScope("UpdateObjectCBs");
+	mUpdateInstanceDataScope = mProfiler->AddCpuScope("UpdateInstanceData");
+	mUpdateMaterialBufferScope = mProfiler->AddCpuScope("UpdateMaterialBuffer");
+	mUpdateWavesScope = mProfiler->AddCpuScope("UpdateWaves");
+	mWavesUpdateScope = mProfiler->AddCpuScope("Waves::Update");
+
+	mGpuFrameScope = mProfiler->AddGpuScope("Frame");
+	if(mUseGpuWaves)
+		mGpuWavesSimScope = mProfiler->AddGpuScope("WavesSim", mComputeQueue.Get());
+	mGpuTreeCullScope = mProfiler->AddGpuScope("TreeCull", mComputeQueue.Get());
+	mGpuLightCullScope = mProfiler->AddGpuScope("LightCull", mComputeQueue.Get());
+	mDepthPrepassCpuScope = mProfiler->AddCpuScope("DrawDepthPrepass");
+	mDepthPrepassGpuScope = mProfiler->AddGpuScope("DrawDepthPrepass");
+	if(mWeightedOitEnabled)
+		mOitCompositeScope = mProfiler->AddGpuScope("OitComposite");
+
+	for(int layer = 0; layer < (int)RenderLayer::Count; ++layer)
+	{
+		RenderLayer unusedWaves = mUseGpuWaves ? RenderLayer::CpuWaves : RenderLayer::GpuWaves;
+		if(layer == (int)unusedWaves)
+		{
+			mLayerCpuScopes[layer] = mLayerGpuScopes[layer] = (UINT)-1;
+			continue;
+		}
+
+		std::string name = std::string("Draw") + gRenderLayerNames[layer];
+		mLayerCpuScopes[layer] = mProfiler->AddCpuScope(name);
+		mLayerGpuScopes[layer] = mProfiler->AddGpuScope(name);
+	}
+
+	if(!mProfileCsvFile.empty() && !mProfiler->OpenCsv(mProfileCsvFile))
+		::OutputDebugStringA(("Could not open " + mProfileCsvFile + "\n").c_str());
+
+	mBaseCaption = mMainWndCaption;
 }
 
 void TreeBillboardsApp::BuildFrameResources()
 {
-    for(int i = 0; i < gNumFrameResources; ++i)
+	// Dirty counters still count down from gNumFrameResources, which with
+	// fewer frame resources only updates some of them more than once.
+    for(int i = 0; i < mNumFramesInFlight; ++i)
     {
-        mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(), mWaves->VertexCount()));
+		// The GPU waves never touch a dynamic vertex buffer.
+		if(mUseGpuWaves)
+		{
+			mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
+				(UINT)DrawPass::Count, mProfiler->ReadbackByteSize(), 1, mRitemStore->Count(), mInstanceCount, mMaterials.Count(), (UINT)mTorches.size()));
+		}
+		else
+		{
+			mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
+				(UINT)DrawPass::Count, mProfiler->ReadbackByteSize(), 1, mRitemStore->Count(), mInstanceCount, mMaterials.Count(), (UINT)mTorches.size(), mWaves->VertexCount()));
+		}
+
+		mFrameResources.back()->BuildComputeCommandLists(md3dDevice.Get(),
+			mAsyncComputeEnabled ? D3D12_COMMAND_LIST_TYPE_COMPUTE : D3D12_COMMAND_LIST_TYPE_DIRECT);
     }
 }
 
@@ -1731,730 +3139,433 @@ void TreeBillboardsApp::BuildMaterials()
 
 
 
-	mMaterials["grass"] = std::move(grass);
-	mMaterials["grass2"] = std::move(grasswall);
+	mMaterials.Add("grass", std::move(grass));
+	mMaterials.Add("grass2", std::move(grasswall));
+
+	mMaterials.Add("water", std::move(water));
+	mMaterials.Add("bricks", std::move(bricks));
+	mMaterials.Add("bricks2", std::move(wedge));
+	mMaterials.Add("bricks3", std::move(cylinder));
+	mMaterials.Add("ice", std::move(sphere));
+	mMaterials.Add("tile", std::move(cone));
+	mMaterials.Add("sand", std::move(pyramid));
+	mMaterials.Add("checkboard", std::move(prism));
+	mMaterials.Add("shiny", std::move(diamond));
+	mMaterials.Add("treeSprites", std::move(treeSprites));
 
-	mMaterials["water"] = std::move(water);
-	mMaterials["bricks"] = std::move(bricks);
-	mMaterials["bricks2"] = std::move(wedge);
-	mMaterials["bricks3"] = std::move(cylinder);
-	mMaterials["ice"] = std::move(sphere);
-	mMaterials["tile"] = std::move(cone);
-	mMaterials["sand"] = std::move(pyramid);
-	mMaterials["checkboard"] = std::move(prism);
-	mMaterials["shiny"] = std::move(diamond);
-	mMaterials["treeSprites"] = std::move(treeSprites);
+}
 
+void TreeBillboardsApp::LoadScene()
+{
+	// A text scene is cooked to a .scene file next to it; a .scene is used as is.
+	std::wstring binaryFile = mSceneFile;
+	std::wstring sourceFile = mSceneFile;
+	size_t dot = mSceneFile.find_last_of(L'.');
+	if(dot != std::wstring::npos && mSceneFile.compare(dot, std::wstring::npos, L".scene") == 0)
+		sourceFile.clear();
+	else
+		binaryFile = mSceneFile.substr(0, dot) + L".scene";
+
+	mScene = std::make_unique<SceneFile>();
+	mScene->Load(binaryFile, sourceFile);
 }
 
 void TreeBillboardsApp::BuildRenderItems()
 {
-	UINT objCBIndex = 0;
+	auto sceneError = [this](const std::string& message)
+	{
+		return DxException(E_INVALIDARG, AnsiToWString(message), mSceneFile, 0);
+	};
 
-	//build unique Items
-    auto wavesRitem = std::make_unique<RenderItem>();
-    wavesRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&wavesRitem->TexTransform,XMMatrixScaling(5.0f, 5.0f, 1.0f));
-	wavesRitem->ObjCBIndex = objCBIndex++;
-	wavesRitem->Mat = mMaterials["water"].get();
-	wavesRitem->Geo = mGeometries["waterGeo"].get();
-	wavesRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wavesRitem->IndexCount = wavesRitem->Geo->DrawArgs["grid"].IndexCount;
-	wavesRitem->StartIndexLocation = wavesRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	wavesRitem->BaseVertexLocation = wavesRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
+	auto findLayer = [this, &sceneError](const std::string& name)
+	{
+		// The scene does not know which waves the app simulates.
+		if(name == "Waves")
+			return mUseGpuWaves ? RenderLayer::GpuWaves : RenderLayer::CpuWaves;
+
+		// Filled by the app, with meshes of their own vertex formats.
+		if(name == gRenderLayerNames[(int)RenderLayer::Terrain] ||
+			name == gRenderLayerNames[(int)RenderLayer::AlphaTestedTreeSprites])
+			throw sceneError("layer " + name + " can not have scene items");
+
+		for(int i = 0; i < (int)RenderLayer::Count; ++i)
+		{
+			if(name == gRenderLayerNames[i])
+				return (RenderLayer)i;
+		}
+		throw sceneError("unknown layer " + name);
+	};
 
-    mWavesRitem = wavesRitem.get();
+	const UINT itemCount = mScene->ItemCount();
+	const SceneItem* sceneItems = mScene->Items();
+	const InstanceData* sceneInstances = mScene->Instances();
 
-	mRitemLayer[(int)RenderLayer::Transparent].push_back(wavesRitem.get());
+	// The scene's items, then the terrain chunks.
+	const UINT chunkCount = mTerrain->ChunkCount();
+	mAllRitems = std::vector<RenderItem>(itemCount + chunkCount);
+	mRitemStore = std::make_unique<RenderItemStore>(gNumFrameResources);
+	mRitemStore->Reserve(itemCount + chunkCount + 1);
 
-    auto gridRitem = std::make_unique<RenderItem>();
-    gridRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&gridRitem->TexTransform, XMMatrixScaling(5.0f, 5.0f, 1.0f) );
-	gridRitem->ObjCBIndex = objCBIndex++;
-	gridRitem->Mat = mMaterials["grass"].get();
-	gridRitem->Geo = mGeometries["landGeo"].get();
-	gridRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-    gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
-    gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-    gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
+	// The instances are copied a whole item at a time.  When the scene is
+	// scaled up for benchmarking, each copy of an item's instances is moved
+	// side by side along x.
+	mInstances.resize((size_t)mScene->InstanceCount()*mInstanceCopies);
+	mInstanceCount = 0;
 
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gridRitem.get());
+	for(UINT i = 0; i < itemCount; ++i)
+	{
+		const SceneItem& item = sceneItems[i];
+		RenderItem& ri = mAllRitems[i];
+
+		std::string geoName = mScene->Name(item.Geometry);
+		std::string submeshName = mScene->Name(item.Submesh);
+		std::string matName = mScene->Name(item.Material);
+
+		auto geo = mGeometries.Find(geoName);
+		if(!geo.IsValid())
+			throw sceneError("unknown geometry " + geoName);
+		MeshGeometry* mesh = mGeometries[geo].get();
+		auto submesh = mesh->DrawArgs.find(submeshName);
+		if(submesh == mesh->DrawArgs.end())
+			throw sceneError("unknown submesh " + geoName + " " + submeshName);
+		auto mat = mMaterials.Find(matName);
+		if(!mat.IsValid())
+			throw sceneError("unknown material " + matName);
+
+		RenderLayer layer = findLayer(mScene->Name(item.Layer));
+
+		ri.Mat = mMaterials[mat].get();
+		ri.Geo = mesh;
+		ri.GeoSortId = geo.Index;
+		ri.PrimitiveType = (D3D12_PRIMITIVE_TOPOLOGY)item.Topology;
+		ri.IndexCount = submesh->second.IndexCount;
+		ri.StartIndexLocation = submesh->second.StartIndexLocation;
+		ri.BaseVertexLocation = submesh->second.BaseVertexLocation;
+		ri.Bounds = submesh->second.Bounds;
+
+		// The coarser levels of detail, where the mesh has them.  The finest
+		// level's bounds are kept for culling.
+		ri.Lods[0] = { ri.IndexCount, ri.StartIndexLocation, ri.BaseVertexLocation };
+		for(ri.LodCount = 1; ri.LodCount < gMaxLods; ++ri.LodCount)
+		{
+			auto lod = mesh->DrawArgs.find(submeshName + ".lod" + std::to_string(ri.LodCount));
+			if(lod == mesh->DrawArgs.end())
+				break;
+			ri.Lods[ri.LodCount] = { lod->second.IndexCount, lod->second.StartIndexLocation, lod->second.BaseVertexLocation };
+		}
 
+		ri.InstanceBufferOffset = mInstanceCount;
+		ri.InstanceCount = item.InstanceCount*mInstanceCopies;
+		mInstanceCount += ri.InstanceCount;
 
-	auto CenterRoom = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&CenterRoom->World, XMMatrixTranslation(0.0f , 0.5f, 0.5f) * XMMatrixScaling(35.0f, 30.0f,35.0f));
-	CenterRoom->ObjCBIndex = objCBIndex++;
-	CenterRoom->Mat = mMaterials["bricks"].get();
-	CenterRoom->Geo = mGeometries["boxGeo"].get();
-	CenterRoom->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	CenterRoom->IndexCount = CenterRoom->Geo->DrawArgs["box"].IndexCount;
-	CenterRoom->StartIndexLocation = CenterRoom->Geo->DrawArgs["box"].StartIndexLocation;
-	CenterRoom->BaseVertexLocation = CenterRoom->Geo->DrawArgs["box"].BaseVertexLocation;
+		ri.Handle = mRitemStore->Add(item.World, item.TexTransform, ri.Mat->MatCBIndex, ri.InstanceBufferOffset);
 
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(CenterRoom.get());
+		InstanceData* instances = mInstances.data() + ri.InstanceBufferOffset;
+		for(int copy = 0; copy < mInstanceCopies && item.InstanceCount > 0; ++copy)
+		{
+			InstanceData* dst = instances + (size_t)copy*item.InstanceCount;
+			CopyMemory(dst, sceneInstances + item.FirstInstance, item.InstanceCount*sizeof(InstanceData));
 
+			float offsetX = (copy % 2 == 1 ? 250.0f : -250.0f)*((copy + 1) / 2);
+			for(UINT j = 0; j < item.InstanceCount; ++j)
+			{
+				dst[j].World(3, 0) += offsetX;
+				dst[j].MaterialIndex = ri.Mat->MatCBIndex;
+			}
+		}
 
-    mAllRitems.push_back(std::move(wavesRitem));
-    mAllRitems.push_back(std::move(gridRitem));
-	mAllRitems.push_back(std::move(CenterRoom));
+		ri.SortInstances = ri.InstanceCount > 0 &&
+			(layer == RenderLayer::Transparent || layer == RenderLayer::TransparentInstanced);
 
+		if(ri.InstanceCount > 0)
+		{
+			XMVECTOR center = XMVectorZero();
+			for(UINT j = 0; j < ri.InstanceCount; ++j)
+				center += XMLoadFloat4x4(&instances[j].World).r[3];
+			center /= (float)ri.InstanceCount;
+			XMStoreFloat3(&ri.SortCenter, center);
+		}
+		else
+		{
+			// Transformed by the item's world matrix when it is sorted.
+			ri.SortCenter = ri.Bounds.Center;
+		}
 
+		if(layer == RenderLayer::GpuWaves || layer == RenderLayer::CpuWaves)
+			mWavesRitem = &ri;
+		mRitemLayer[(int)layer].push_back(&ri);
+	}
 
+	if(mWavesRitem == nullptr)
+		throw sceneError("the scene has no Waves item");
 
-	//walls
-	for (int k = 0; k < 2; k++)
+	// Every item starts with its instances in scene order, at the finest level.
+	mInstanceOrder.resize(mInstanceCount);
+	mInstanceLods.assign(mInstanceCount, 0);
+	for(const RenderItem& ri : mAllRitems)
 	{
-		auto SideWall = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&SideWall->World, XMMatrixTranslation(-6.0f +12*k, 0.5f, 0.0f) * XMMatrixScaling(4.0f, 12.0f, 84.0f));
-		SideWall->ObjCBIndex = objCBIndex++;
-		SideWall->Mat = mMaterials["bricks"].get();
-		SideWall->Geo = mGeometries["boxGeo"].get();
-		SideWall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		SideWall->IndexCount = SideWall->Geo->DrawArgs["box"].IndexCount;
-		SideWall->StartIndexLocation = SideWall->Geo->DrawArgs["box"].StartIndexLocation;
-		SideWall->BaseVertexLocation = SideWall->Geo->DrawArgs["box"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(SideWall.get());
-		mAllRitems.push_back(std::move(SideWall));
+		for(UINT j = 0; j < ri.InstanceCount; ++j)
+			mInstanceOrder[ri.InstanceBufferOffset + j] = j;
 	}
 
+	auto terrainGeoHandle = mGeometries.Find("terrainGeo");
+	MeshGeometry* terrainGeo = mGeometries[terrainGeoHandle].get();
+	Material* grass = mMaterials.At("grass").get();
+
+	for(UINT i = 0; i < chunkCount; ++i)
+	{
+		RenderItem& ri = mAllRitems[itemCount + i];
+
+		ri.Mat = grass;
+		ri.Geo = terrainGeo;
+		ri.GeoSortId = terrainGeoHandle.Index;
+		ri.Geomorph = true;
 
+		// The chunks are built in place, so their bounds are world space.
+		ri.Bounds = terrainGeo->DrawArgs.at(Terrain::ChunkSubmeshName(i, 0)).Bounds;
+		ri.SortCenter = ri.Bounds.Center;
 
+		ri.LodCount = Terrain::LodCount;
+		for(UINT lod = 0; lod < Terrain::LodCount; ++lod)
+		{
+			const SubmeshGeometry& submesh = terrainGeo->DrawArgs.at(Terrain::ChunkSubmeshName(i, lod));
+			ri.Lods[lod] = { submesh.IndexCount, submesh.StartIndexLocation, submesh.BaseVertexLocation };
+		}
+		ri.IndexCount = ri.Lods[0].IndexCount;
+		ri.StartIndexLocation = ri.Lods[0].StartIndexLocation;
+		ri.BaseVertexLocation = ri.Lods[0].BaseVertexLocation;
 
-	auto BackWall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&BackWall->World, XMMatrixTranslation(0.0f, 0.5f, 10.0f) * XMMatrixScaling(45.0f, 12.0f, 4.0f));
-	BackWall->ObjCBIndex = objCBIndex++;
-	BackWall->Mat = mMaterials["bricks"].get();
-	BackWall->Geo = mGeometries["boxGeo"].get();
-	BackWall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	BackWall->IndexCount = BackWall->Geo->DrawArgs["box"].IndexCount;
-	BackWall->StartIndexLocation = BackWall->Geo->DrawArgs["box"].StartIndexLocation;
-	BackWall->BaseVertexLocation = BackWall->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(BackWall.get());
-	mAllRitems.push_back(std::move(BackWall));
-
-	auto FrontLeftWall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&FrontLeftWall->World, XMMatrixTranslation(-1.0f, 0.5f, -10.0f) * XMMatrixScaling(15.0f, 12.0f, 4.0f));
-	FrontLeftWall->ObjCBIndex = objCBIndex++;
-	FrontLeftWall->Mat = mMaterials["bricks"].get();
-	FrontLeftWall->Geo = mGeometries["boxGeo"].get();
-	FrontLeftWall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	FrontLeftWall->IndexCount = FrontLeftWall->Geo->DrawArgs["box"].IndexCount;
-	FrontLeftWall->StartIndexLocation = FrontLeftWall->Geo->DrawArgs["box"].StartIndexLocation;
-	FrontLeftWall->BaseVertexLocation = FrontLeftWall->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(FrontLeftWall.get());
-	mAllRitems.push_back(std::move(FrontLeftWall));
-
-	auto FrontRightWall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&FrontRightWall->World, XMMatrixTranslation(1.00f, 0.5f, -10.0f) * XMMatrixScaling(15.0f, 12.0f, 4.0f));
-	FrontRightWall->ObjCBIndex = objCBIndex++;
-	FrontRightWall->Mat = mMaterials["bricks"].get();
-	FrontRightWall->Geo = mGeometries["boxGeo"].get();
-	FrontRightWall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	FrontRightWall->IndexCount = FrontRightWall->Geo->DrawArgs["box"].IndexCount;
-	FrontRightWall->StartIndexLocation = FrontRightWall->Geo->DrawArgs["box"].StartIndexLocation;
-	FrontRightWall->BaseVertexLocation = FrontRightWall->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(FrontRightWall.get());
-	mAllRitems.push_back(std::move(FrontRightWall));
-
-	//Side WallWedges
-	for(int j =1; j >-2; j=j-2)
-	for (int i = 0; i < 10; i++)
-	{
-		auto borders = std::make_unique<RenderItem>();
-		auto dersbor = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&borders->World, XMMatrixTranslation(-12.5f*j, 3.5f, -10.0f+i*2) * XMMatrixScaling(2.0f, 4.0f, 4.0f));
-		XMStoreFloat4x4(&dersbor->World, XMMatrixTranslation(12.5f*j, 3.5f, -9.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(3.1416));
-
-		borders->ObjCBIndex = objCBIndex++;
-		borders->Mat = mMaterials["bricks2"].get();
-		borders->Geo = mGeometries["wedgeGeo"].get();
-		borders->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		borders->IndexCount = borders->Geo->DrawArgs["wedge"].IndexCount;
-		borders->StartIndexLocation = borders->Geo->DrawArgs["wedge"].StartIndexLocation;
-		borders->BaseVertexLocation = borders->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(borders.get());
-		mAllRitems.push_back(std::move(borders));
-
-		dersbor->ObjCBIndex = objCBIndex++;
-		dersbor->Mat = mMaterials["bricks2"].get();
-		dersbor->Geo = mGeometries["wedgeGeo"].get();
-		dersbor->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		dersbor->IndexCount = dersbor->Geo->DrawArgs["wedge"].IndexCount;
-		dersbor->StartIndexLocation = dersbor->Geo->DrawArgs["wedge"].StartIndexLocation;
-		dersbor->BaseVertexLocation = dersbor->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(dersbor.get());
-		mAllRitems.push_back(std::move(dersbor));
+		ri.Handle = mRitemStore->Add(MathHelper::Identity4x4(), MathHelper::Identity4x4(), grass->MatCBIndex, 0);
+		mRitemLayer[(int)RenderLayer::Terrain].push_back(&ri);
 	}
 
-	//BackWAll Wedges
+	// The trees are not render items, but the sprite shaders still read their
+	// material from the object constants.
+	mTreeSpritesObject = mRitemStore->Add(MathHelper::Identity4x4(), MathHelper::Identity4x4(),
+		mMaterials.At("treeSprites")->MatCBIndex, 0);
+}
 
-	for (int i = 0; i < 6; i++)
+void TreeBillboardsApp::RecordDrawPass(DrawPass pass, ID3D12GraphicsCommandList* cmdList)
+{
+	// Runs on a worker thread: only reads app state, and only uses its own
+	// allocator and command list.
+	auto cmdListAlloc = mCurrFrameResource->DrawCmdListAllocs[(int)pass];
+	ThrowIfFailed(cmdListAlloc->Reset());
+	ThrowIfFailed(cmdList->Reset(cmdListAlloc.Get(), nullptr));
+
+	// A command list starts with no state set, so each pass binds everything.
+	cmdList->RSSetViewports(1, &mScreenViewport);
+	cmdList->RSSetScissorRects(1, &mScissorRect);
+
+	D3D12_CPU_DESCRIPTOR_HANDLE backBufferView = CurrentBackBufferView();
+	D3D12_CPU_DESCRIPTOR_HANDLE depthStencilView = DepthStencilView();
+
+	// With OIT the blended passes draw into its targets instead.
+	const bool oit = mWeightedOitEnabled && (pass == DrawPass::Waves || pass == DrawPass::Transparent);
+	if(oit)
 	{
-		auto borders = std::make_unique<RenderItem>();
-		auto dersbor = std::make_unique<RenderItem>();
+		D3D12_CPU_DESCRIPTOR_HANDLE oitTargets = mOit->Rtv();
+		cmdList->OMSetRenderTargets(WeightedOit::RtvCount, &oitTargets, true, &depthStencilView);
+	}
+	else
+		cmdList->OMSetRenderTargets(1, &backBufferView, true, &depthStencilView);
+
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+	cmdList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
-		XMStoreFloat4x4(&borders->World, XMMatrixTranslation(20.5f, 3.5f, -6.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(-3.1416 / 2));
-		XMStoreFloat4x4(&dersbor->World, XMMatrixTranslation(-20.5f, 3.5f, -5.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(3.1416/2));
+	cmdList->SetGraphicsRootSignature(mRootSignature.Get());
 
-		borders->ObjCBIndex = objCBIndex++;
-		borders->Mat = mMaterials["bricks2"].get();
-		borders->Geo = mGeometries["wedgeGeo"].get();
-		borders->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		borders->IndexCount = borders->Geo->DrawArgs["wedge"].IndexCount;
-		borders->StartIndexLocation = borders->Geo->DrawArgs["wedge"].StartIndexLocation;
-		borders->BaseVertexLocation = borders->Geo->DrawArgs["wedge"].BaseVertexLocation;
+	cmdList->SetGraphicsRootConstantBufferView(1, mCurrFrameResource->PassCB.GpuAddress());
 
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(borders.get());
-		mAllRitems.push_back(std::move(borders));
+	// Bind all the materials, instances and diffuse maps once; the draws then
+	// only change the object constants.
+	cmdList->SetGraphicsRootShaderResourceView(2, mCurrFrameResource->MaterialBuffer.GpuAddress());
 
-		dersbor->ObjCBIndex = objCBIndex++;
-		dersbor->Mat = mMaterials["bricks2"].get();
-		dersbor->Geo = mGeometries["wedgeGeo"].get();
-		dersbor->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		dersbor->IndexCount = dersbor->Geo->DrawArgs["wedge"].IndexCount;
-		dersbor->StartIndexLocation = dersbor->Geo->DrawArgs["wedge"].StartIndexLocation;
-		dersbor->BaseVertexLocation = dersbor->Geo->DrawArgs["wedge"].BaseVertexLocation;
+	cmdList->SetGraphicsRootShaderResourceView(3, mCurrFrameResource->InstanceBuffer.GpuAddress());
 
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(dersbor.get());
-		mAllRitems.push_back(std::move(dersbor));
-	}
-	//FrontWall Wedges
-	for (int i = 0; i < 2; i++)
-	{
-		auto borders = std::make_unique<RenderItem>();
-		auto dersbor = std::make_unique<RenderItem>();
-
-		XMStoreFloat4x4(&borders->World, XMMatrixTranslation(-20.5f, 3.5f, -6.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(-3.1416 / 2));
-		XMStoreFloat4x4(&dersbor->World, XMMatrixTranslation(20.5f, 3.5f, 3.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(3.1416 / 2));
-
-		borders->ObjCBIndex = objCBIndex++;
-		borders->Mat = mMaterials["bricks2"].get();
-		borders->Geo = mGeometries["wedgeGeo"].get();
-		borders->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		borders->IndexCount = borders->Geo->DrawArgs["wedge"].IndexCount;
-		borders->StartIndexLocation = borders->Geo->DrawArgs["wedge"].StartIndexLocation;
-		borders->BaseVertexLocation = borders->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(borders.get());
-		mAllRitems.push_back(std::move(borders));
-
-		dersbor->ObjCBIndex = objCBIndex++;
-		dersbor->Mat = mMaterials["bricks2"].get();
-		dersbor->Geo = mGeometries["wedgeGeo"].get();
-		dersbor->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		dersbor->IndexCount = dersbor->Geo->DrawArgs["wedge"].IndexCount;
-		dersbor->StartIndexLocation = dersbor->Geo->DrawArgs["wedge"].StartIndexLocation;
-		dersbor->BaseVertexLocation = dersbor->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(dersbor.get());
-		mAllRitems.push_back(std::move(dersbor));
-	}
-	for (int i = 0; i < 2; i++)
-	{
-		auto borders = std::make_unique<RenderItem>();
-		auto dersbor = std::make_unique<RenderItem>();
-
-		XMStoreFloat4x4(&borders->World, XMMatrixTranslation(-20.5f, 3.5f, 3.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(-3.1416 / 2));
-		XMStoreFloat4x4(&dersbor->World, XMMatrixTranslation(20.5f, 3.5f, -6.0f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(3.1416 / 2));
-
-		borders->ObjCBIndex = objCBIndex++;
-		borders->Mat = mMaterials["bricks2"].get();
-		borders->Geo = mGeometries["wedgeGeo"].get();
-		borders->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		borders->IndexCount = borders->Geo->DrawArgs["wedge"].IndexCount;
-		borders->StartIndexLocation = borders->Geo->DrawArgs["wedge"].StartIndexLocation;
-		borders->BaseVertexLocation = borders->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(borders.get());
-		mAllRitems.push_back(std::move(borders));
-
-		dersbor->ObjCBIndex = objCBIndex++;
-		dersbor->Mat = mMaterials["bricks2"].get();
-		dersbor->Geo = mGeometries["wedgeGeo"].get();
-		dersbor->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		dersbor->IndexCount = dersbor->Geo->DrawArgs["wedge"].IndexCount;
-		dersbor->StartIndexLocation = dersbor->Geo->DrawArgs["wedge"].StartIndexLocation;
-		dersbor->BaseVertexLocation = dersbor->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(dersbor.get());
-		mAllRitems.push_back(std::move(dersbor));
-	}
+	CD3DX12_GPU_DESCRIPTOR_HANDLE textureTable = TextureTableGpu(mCurrFrameResourceIndex);
+	cmdList->SetGraphicsRootDescriptorTable(4, textureTable);
 
-	//Corners
+	cmdList->SetGraphicsRootShaderResourceView(7, mCurrFrameResource->LightBuffer.GpuAddress());
+	cmdList->SetGraphicsRootShaderResourceView(8, mClusteredLights->ClusterLightCounts(mCurrFrameResourceIndex));
+	cmdList->SetGraphicsRootShaderResourceView(9, mClusteredLights->ClusterLightIndices(mCurrFrameResourceIndex));
 
-	for (int j = 0; j < 2; j++)
+	DrawState state;
+	state.Instances = mCurrFrameResource->InstanceBuffer.GpuAddress();
+
+	switch(pass)
+	{
+	case DrawPass::DepthPrepass:
 	{
-		for (int i = 0; i < 2; i++)
+		if(!mDepthPrepassEnabled)
+			break;
+
+		// Depth only, so no render target.
+		cmdList->OMSetRenderTargets(0, nullptr, false, &depthStencilView);
+
+		ProfileCpuScope cpuScope(mProfiler.get(), mDepthPrepassCpuScope);
+		mProfiler->BeginGpu(cmdList, mDepthPrepassGpuScope);
+		for(int k = 0; k < gDepthPrepassLayerCount; ++k)
 		{
-			auto Cylinder = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&Cylinder->World, XMMatrixTranslation(8.00f - 16 * j, 3.0f, -13.5f + 27 * i)* XMMatrixScaling(3.0f, 3.0f, 3.0f));
-			Cylinder->ObjCBIndex = objCBIndex++;
-			Cylinder->Mat = mMaterials["bricks3"].get();
-			Cylinder->Geo = mGeometries["cylinderGeo"].get();
-			Cylinder->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			Cylinder->IndexCount = Cylinder->Geo->DrawArgs["cylinder"].IndexCount;
-			Cylinder->StartIndexLocation = Cylinder->Geo->DrawArgs["cylinder"].StartIndexLocation;
-			Cylinder->BaseVertexLocation = Cylinder->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(Cylinder.get());
-			mAllRitems.push_back(std::move(Cylinder));
-
-			auto Cone = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&Cone->World, XMMatrixTranslation(8.00f - 16 * j, 12.0f, -13.5f + 27 * i) * XMMatrixScaling(3.0f, 2.0f, 3.0f));
-			Cone->ObjCBIndex = objCBIndex++;
-			Cone->Mat = mMaterials["tile"].get();
-			Cone->Geo = mGeometries["coneGeo"].get();
-			Cone->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			Cone->IndexCount = Cone->Geo->DrawArgs["cone"].IndexCount;
-			Cone->StartIndexLocation = Cone->Geo->DrawArgs["cone"].StartIndexLocation;
-			Cone->BaseVertexLocation = Cone->Geo->DrawArgs["cone"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(Cone.get());
-			mAllRitems.push_back(std::move(Cone));
-
-			auto SphereRitem = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&SphereRitem->World, XMMatrixTranslation(8.00f - 16 * j, 11.0f, -13.5f + 27 * i)* XMMatrixScaling(3.0f , 3.0f, 3.0f));
-			SphereRitem->ObjCBIndex = objCBIndex++;
-			SphereRitem->Mat = mMaterials["ice"].get();
-			SphereRitem->Geo = mGeometries["sphereGeo"].get();
-			SphereRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			SphereRitem->IndexCount = SphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-			SphereRitem->StartIndexLocation = SphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-			SphereRitem->BaseVertexLocation = SphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-
-			mRitemLayer[(int)RenderLayer::Transparent].push_back(SphereRitem.get());
-			mAllRitems.push_back(std::move(SphereRitem));
+			cmdList->SetPipelineState(Pso(mDepthOnlyPsos[k]));
+			DrawRenderItems(cmdList, state, mDepthPrepassRitems[k]);
 		}
-
+		mProfiler->EndGpu(cmdList, mDepthPrepassGpuScope);
+		break;
 	}
 
-	//center Wedges
+	case DrawPass::Opaque:
+		cmdList->SetPipelineState(Pso(mDepthPrepassEnabled ? mDepthEqualPsos[0] : mOpaquePso));
+		DrawLayer(cmdList, state, RenderLayer::Opaque);
+
+		cmdList->SetPipelineState(Pso(mDepthPrepassEnabled ? mDepthEqualPsos[1] : mOpaqueInstancedPso));
+		DrawLayer(cmdList, state, RenderLayer::OpaqueInstanced);
+
+		cmdList->SetPipelineState(Pso(mDepthPrepassEnabled ? mDepthEqualPsos[2] : mTerrainPso));
+		DrawLayer(cmdList, state, RenderLayer::Terrain);
+		break;
+
+	case DrawPass::AlphaTested:
+	{
+		cmdList->SetPipelineState(Pso(mAlphaTestedPso));
+		DrawLayer(cmdList, state, RenderLayer::AlphaTested);
+
+		CD3DX12_GPU_DESCRIPTOR_HANDLE treeTex(textureTable);
+		treeTex.Offset(mMaterials[mTreeSpritesMat]->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
+
+		cmdList->SetPipelineState(Pso(mTreeSpritesPso));
+		cmdList->SetGraphicsRootDescriptorTable(6, treeTex);
+		DrawTreeSprites(cmdList, state);
+		break;
+	}
 
-	for (int j = 0; j <2; j ++)
-		for (int i = 0; i < 4; i++)
+	case DrawPass::Waves:
+		if(mUseGpuWaves)
 		{
-			auto borders = std::make_unique<RenderItem>();
-			auto dersbor = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&borders->World, XMMatrixTranslation(0.5f +16.5f*j, 8.0f, -3.5f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f)* XMMatrixRotationY(-3.1416/ 2));
-			XMStoreFloat4x4(&dersbor->World, XMMatrixTranslation(-0.5f-16.5f*j, 8.0f, 2.5f - i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(3.1416/2));
-
-			borders->ObjCBIndex = objCBIndex++;
-			borders->Mat = mMaterials["bricks2"].get();
-			borders->Geo = mGeometries["wedgeGeo"].get();
-			borders->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			borders->IndexCount = borders->Geo->DrawArgs["wedge"].IndexCount;
-			borders->StartIndexLocation = borders->Geo->DrawArgs["wedge"].StartIndexLocation;
-			borders->BaseVertexLocation = borders->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(borders.get());
-			mAllRitems.push_back(std::move(borders));
-
-			dersbor->ObjCBIndex = objCBIndex++;
-			dersbor->Mat = mMaterials["bricks2"].get();
-			dersbor->Geo = mGeometries["wedgeGeo"].get();
-			dersbor->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			dersbor->IndexCount = dersbor->Geo->DrawArgs["wedge"].IndexCount;
-			dersbor->StartIndexLocation = dersbor->Geo->DrawArgs["wedge"].StartIndexLocation;
-			dersbor->BaseVertexLocation = dersbor->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(dersbor.get());
-			mAllRitems.push_back(std::move(dersbor));
+			cmdList->SetPipelineState(Pso(mWavesRenderPsos[oit]));
+			cmdList->SetGraphicsRootDescriptorTable(5, mGpuWaves->DisplacementMap());
+			DrawLayer(cmdList, state, RenderLayer::GpuWaves);
 		}
-
-	for (int j = 0; j < 2; j++)
-		for (int i = 0; i < 4; i++)
+		else
 		{
-			auto borders = std::make_unique<RenderItem>();
-			auto dersbor = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&borders->World, XMMatrixTranslation(-8.5f + 16.5f * j, 8.0f, 0.5f + i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f));
-			XMStoreFloat4x4(&dersbor->World, XMMatrixTranslation(8.5f - 16.5f * j, 8.0f, -1.5f - i * 2) * XMMatrixScaling(2.0f, 4.0f, 4.0f) * XMMatrixRotationY(3.1416 ));
-
-			borders->ObjCBIndex = objCBIndex++;
-			borders->Mat = mMaterials["bricks2"].get();
-			borders->Geo = mGeometries["wedgeGeo"].get();
-			borders->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			borders->IndexCount = borders->Geo->DrawArgs["wedge"].IndexCount;
-			borders->StartIndexLocation = borders->Geo->DrawArgs["wedge"].StartIndexLocation;
-			borders->BaseVertexLocation = borders->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(borders.get());
-			mAllRitems.push_back(std::move(borders));
-
-			dersbor->ObjCBIndex = objCBIndex++;
-			dersbor->Mat = mMaterials["bricks2"].get();
-			dersbor->Geo = mGeometries["wedgeGeo"].get();
-			dersbor->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			dersbor->IndexCount = dersbor->Geo->DrawArgs["wedge"].IndexCount;
-			dersbor->StartIndexLocation = dersbor->Geo->DrawArgs["wedge"].StartIndexLocation;
-			dersbor->BaseVertexLocation = dersbor->Geo->DrawArgs["wedge"].BaseVertexLocation;
-
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(dersbor.get());
-			mAllRitems.push_back(std::move(dersbor));
+			// DrawRenderItems only binds slot 0, the static stream.
+			cmdList->SetPipelineState(Pso(mWavesCpuPsos[oit]));
+			cmdList->IASetVertexBuffers(1, 1, &mWavesDynamicVBView);
+			DrawLayer(cmdList, state, RenderLayer::CpuWaves);
 		}
+		break;
+
+	case DrawPass::Transparent:
+		cmdList->SetPipelineState(Pso(mTransparentPsos[oit]));
+		DrawLayer(cmdList, state, RenderLayer::Transparent);
+
+		cmdList->SetPipelineState(Pso(mTransparentInstancedPsos[oit]));
+		DrawLayer(cmdList, state, RenderLayer::TransparentInstanced);
 
-	auto CenterPyramid = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&CenterPyramid->World, XMMatrixTranslation(0.0f, 2.5f, 1.2f) * XMMatrixScaling(15.0f, 15.0f, 15.0f));
-	CenterPyramid->ObjCBIndex = objCBIndex++;
-	CenterPyramid->Mat = mMaterials["sand"].get();
-	CenterPyramid->Geo = mGeometries["pyramidGeo"].get();
-	CenterPyramid->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	CenterPyramid->IndexCount = CenterPyramid->Geo->DrawArgs["pyramid"].IndexCount;
-	CenterPyramid->StartIndexLocation = CenterPyramid->Geo->DrawArgs["pyramid"].StartIndexLocation;
-	CenterPyramid->BaseVertexLocation = CenterPyramid->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(CenterPyramid.get());
-	mAllRitems.push_back(std::move(CenterPyramid));
-
-	//Gate
-	for (int i = 0; i < 2; i++)
-	{
-		float Additional;
-		float Additional2;
-
-		if (i == 1)
+		// Everything blended is in the OIT targets by now, the water included.
+		if(oit)
 		{
-			Additional = -10.0f;
-			Additional2 = -25.0f;
-		}
-		else {
-			Additional = 0.0f;
-			Additional2 = 0.0f;
+			mProfiler->BeginGpu(cmdList, mOitCompositeScope);
+			cmdList->SetPipelineState(Pso(mOitCompositePso));
+			mOit->Composite(cmdList, mOitRootSignature.Get(), backBufferView);
+			mProfiler->EndGpu(cmdList, mOitCompositeScope);
 		}
 
-		auto GatePrism = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&GatePrism->World, XMMatrixTranslation(1.9f, 0.5f , -4.0f +Additional)* XMMatrixScaling(5.0f, 20.0f, 10.0f) );
-		GatePrism->ObjCBIndex = objCBIndex++;
-		GatePrism->Mat = mMaterials["checkboard"].get();
-		GatePrism->Geo = mGeometries["prismGeo"].get();
-		GatePrism->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		GatePrism->IndexCount = GatePrism->Geo->DrawArgs["prism"].IndexCount;
-		GatePrism->StartIndexLocation = GatePrism->Geo->DrawArgs["prism"].StartIndexLocation;
-		GatePrism->BaseVertexLocation = GatePrism->Geo->DrawArgs["prism"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(GatePrism.get());
-		mAllRitems.push_back(std::move(GatePrism));
-
-		auto GatePrism2 = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&GatePrism2->World, XMMatrixTranslation(1.9f, 0.5f, 4.0f - Additional)* XMMatrixScaling(5.0f, 20.0f, 10.0f)* XMMatrixRotationY(3.1416));
-		GatePrism2->ObjCBIndex = objCBIndex++;
-		GatePrism2->Mat = mMaterials["checkboard"].get();
-		GatePrism2->Geo = mGeometries["prismGeo"].get();
-		GatePrism2->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		GatePrism2->IndexCount = GatePrism2->Geo->DrawArgs["prism"].IndexCount;
-		GatePrism2->StartIndexLocation = GatePrism2->Geo->DrawArgs["prism"].StartIndexLocation;
-		GatePrism2->BaseVertexLocation = GatePrism2->Geo->DrawArgs["prism"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(GatePrism2.get());
-		mAllRitems.push_back(std::move(GatePrism2));
-
-		auto GatePrism3 = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&GatePrism3->World, XMMatrixTranslation(4.5, 0.0f, -4.0f + Additional)* XMMatrixScaling(5.0f, 30.0f, 10.0f)* XMMatrixRotationZ(3.1416 / 2));
-		GatePrism3->ObjCBIndex = objCBIndex++;
-		GatePrism3->Mat = mMaterials["checkboard"].get();
-		GatePrism3->Geo = mGeometries["prismGeo"].get();
-		GatePrism3->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		GatePrism3->IndexCount = GatePrism3->Geo->DrawArgs["prism"].IndexCount;
-		GatePrism3->StartIndexLocation = GatePrism3->Geo->DrawArgs["prism"].StartIndexLocation;
-		GatePrism3->BaseVertexLocation = GatePrism3->Geo->DrawArgs["prism"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(GatePrism3.get());
-		mAllRitems.push_back(std::move(GatePrism3));
-
-		auto middleStairs = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&middleStairs->World, XMMatrixTranslation(0.0f, 0.5f, -10.0f + Additional2)* XMMatrixScaling(15.0f, 2.0f, 4.0f));
-		middleStairs->ObjCBIndex = objCBIndex++;
-		middleStairs->Mat = mMaterials["bricks"].get();
-		middleStairs->Geo = mGeometries["boxGeo"].get();
-		middleStairs->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		middleStairs->IndexCount = middleStairs->Geo->DrawArgs["box"].IndexCount;
-		middleStairs->StartIndexLocation = middleStairs->Geo->DrawArgs["box"].StartIndexLocation;
-		middleStairs->BaseVertexLocation = middleStairs->Geo->DrawArgs["box"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(middleStairs.get());
-		mAllRitems.push_back(std::move(middleStairs));
-
-		auto frontStairs = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&frontStairs->World, XMMatrixTranslation(0.0f, 0.5f, -11.0f + Additional2)* XMMatrixScaling(15.0f, 2.0f, 4.0f));
-		frontStairs->ObjCBIndex = objCBIndex++;
-		frontStairs->Mat = mMaterials["bricks2"].get();
-		frontStairs->Geo = mGeometries["wedgeGeo"].get();
-		frontStairs->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		frontStairs->IndexCount = frontStairs->Geo->DrawArgs["wedge"].IndexCount;
-		frontStairs->StartIndexLocation = frontStairs->Geo->DrawArgs["wedge"].StartIndexLocation;
-		frontStairs->BaseVertexLocation = frontStairs->Geo->DrawArgs["wedge"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(frontStairs.get());
-		mAllRitems.push_back(std::move(frontStairs));
-
-		auto BackStairs = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&BackStairs->World, XMMatrixTranslation(0.0f, 0.5f, 9.0f - Additional2)* XMMatrixScaling(15.0f, 2.0f, 4.0f)* XMMatrixRotationY(3.1416));
-		BackStairs->ObjCBIndex = objCBIndex++;
-		BackStairs->Mat = mMaterials["bricks2"].get();
-		BackStairs->Geo = mGeometries["wedgeGeo"].get();
-		BackStairs->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		BackStairs->IndexCount = BackStairs->Geo->DrawArgs["wedge"].IndexCount;
-		BackStairs->StartIndexLocation = BackStairs->Geo->DrawArgs["wedge"].StartIndexLocation;
-		BackStairs->BaseVertexLocation = BackStairs->Geo->DrawArgs["wedge"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(BackStairs.get());
-		mAllRitems.push_back(std::move(BackStairs));
+		// Last pass submitted, so it hands the back buffer to Present.
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
 
+		// ...and ends the frame's GPU timings.
+		mProfiler->EndGpu(cmdList, mGpuFrameScope);
+		mProfiler->ResolveGpu(cmdList, mCurrFrameResource->TimestampReadback.Get());
+		break;
 	}
 
-	//maze
-	auto Leftgrasswall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Leftgrasswall->World, XMMatrixTranslation(7.5f, 0.75f, 0.9f ) * XMMatrixScaling(5.0f, 12.0f, 100.0f) * XMMatrixRotationY(3.1416));
-	Leftgrasswall->ObjCBIndex = objCBIndex++;
-	Leftgrasswall->Mat = mMaterials["grass2"].get();
-	Leftgrasswall->Geo = mGeometries["grasswallGeo"].get();
-	Leftgrasswall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Leftgrasswall->IndexCount = Leftgrasswall->Geo->DrawArgs["grasswall"].IndexCount;
-	Leftgrasswall->StartIndexLocation = Leftgrasswall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Leftgrasswall->BaseVertexLocation = Leftgrasswall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Leftgrasswall.get());
-	mAllRitems.push_back(std::move(Leftgrasswall));
-
-	auto Rigthgrasswall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Rigthgrasswall->World, XMMatrixTranslation(-7.5f, 0.75f, 0.9f)* XMMatrixScaling(5.0f, 12.0f, 100.0f)* XMMatrixRotationY(3.1416));
-	Rigthgrasswall->ObjCBIndex = objCBIndex++;
-	Rigthgrasswall->Mat = mMaterials["grass2"].get();
-	Rigthgrasswall->Geo = mGeometries["grasswallGeo"].get();
-	Rigthgrasswall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Rigthgrasswall->IndexCount = Rigthgrasswall->Geo->DrawArgs["grasswall"].IndexCount;
-	Rigthgrasswall->StartIndexLocation = Rigthgrasswall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Rigthgrasswall->BaseVertexLocation = Rigthgrasswall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Rigthgrasswall.get());
-	mAllRitems.push_back(std::move(Rigthgrasswall));
-
-
-
-	auto LeftFrontgrasswall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&LeftFrontgrasswall->World, XMMatrixTranslation(1.1f, 0.75f, -27.5f)* XMMatrixScaling(22.5f, 12.0f, 5.0f));
-	LeftFrontgrasswall->ObjCBIndex = objCBIndex++;
-	LeftFrontgrasswall->Mat = mMaterials["grass2"].get();
-	LeftFrontgrasswall->Geo = mGeometries["grasswallGeo"].get();
-	LeftFrontgrasswall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	LeftFrontgrasswall->IndexCount = LeftFrontgrasswall->Geo->DrawArgs["grasswall"].IndexCount;
-	LeftFrontgrasswall->StartIndexLocation = LeftFrontgrasswall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	LeftFrontgrasswall->BaseVertexLocation = LeftFrontgrasswall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(LeftFrontgrasswall.get());
-	mAllRitems.push_back(std::move(LeftFrontgrasswall));
-
-	auto RightFrontgrasswall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&RightFrontgrasswall->World, XMMatrixTranslation(-1.1f, 0.75f, -27.5f)* XMMatrixScaling(22.5f, 12.0f, 5.0f));
-	RightFrontgrasswall->ObjCBIndex = objCBIndex++;
-	RightFrontgrasswall->Mat = mMaterials["grass2"].get();
-	RightFrontgrasswall->Geo = mGeometries["grasswallGeo"].get();
-	RightFrontgrasswall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	RightFrontgrasswall->IndexCount = RightFrontgrasswall->Geo->DrawArgs["grasswall"].IndexCount;
-	RightFrontgrasswall->StartIndexLocation = RightFrontgrasswall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	RightFrontgrasswall->BaseVertexLocation = RightFrontgrasswall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(RightFrontgrasswall.get());
-	mAllRitems.push_back(std::move(RightFrontgrasswall));
-
-	auto LeftBackgrasswall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&LeftBackgrasswall->World, XMMatrixTranslation(4.15f, 0.75f, -8.5f)* XMMatrixScaling(7.5f, 12.0f, 5.0f));
-	LeftBackgrasswall->ObjCBIndex = objCBIndex++;
-	LeftBackgrasswall->Mat = mMaterials["grass2"].get();
-	LeftBackgrasswall->Geo = mGeometries["grasswallGeo"].get();
-	LeftBackgrasswall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	LeftBackgrasswall->IndexCount = LeftBackgrasswall->Geo->DrawArgs["grasswall"].IndexCount;
-	LeftBackgrasswall->StartIndexLocation = LeftBackgrasswall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	LeftBackgrasswall->BaseVertexLocation = LeftBackgrasswall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(LeftBackgrasswall.get());
-	mAllRitems.push_back(std::move(LeftBackgrasswall));
-
-	auto RidghtBackgrasswall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&RidghtBackgrasswall->World, XMMatrixTranslation(-4.15f, 0.75f, -8.5f)* XMMatrixScaling(7.5f, 12.0f, 5.0f));
-	RidghtBackgrasswall->ObjCBIndex = objCBIndex++;
-	RidghtBackgrasswall->Mat = mMaterials["grass2"].get();
-	RidghtBackgrasswall->Geo = mGeometries["grasswallGeo"].get();
-	RidghtBackgrasswall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	RidghtBackgrasswall->IndexCount = RidghtBackgrasswall->Geo->DrawArgs["grasswall"].IndexCount;
-	RidghtBackgrasswall->StartIndexLocation = RidghtBackgrasswall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	RidghtBackgrasswall->BaseVertexLocation = RidghtBackgrasswall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(RidghtBackgrasswall.get());
-	mAllRitems.push_back(std::move(RidghtBackgrasswall));
-
-
-
-	//Laberinth
-	auto MazeWall = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&MazeWall->World, XMMatrixTranslation(0.275f, 0.75f, -24.0f)* XMMatrixScaling(45.0f, 10.0f, 5.0f));
-	MazeWall->ObjCBIndex = objCBIndex++;
-	MazeWall->Mat = mMaterials["grass2"].get();
-	MazeWall->Geo = mGeometries["grasswallGeo"].get();
-	MazeWall->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	MazeWall->IndexCount = MazeWall->Geo->DrawArgs["grasswall"].IndexCount;
-	MazeWall->StartIndexLocation = MazeWall->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	MazeWall->BaseVertexLocation = MazeWall->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(MazeWall.get());
-	mAllRitems.push_back(std::move(MazeWall));
-
-	auto Maze2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze2->World, XMMatrixTranslation(-0.0f, 0.75f, -11.5f)* XMMatrixScaling(55.0f, 10.0f, 5.0f));
-	Maze2->ObjCBIndex = objCBIndex++;
-	Maze2->Mat = mMaterials["grass2"].get();
-	Maze2->Geo = mGeometries["grasswallGeo"].get();
-	Maze2->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze2->IndexCount = Maze2->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze2->StartIndexLocation = Maze2->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze2->BaseVertexLocation = Maze2->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze2.get());
-	mAllRitems.push_back(std::move(Maze2));
-
-	auto Maze2_1 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze2_1->World, XMMatrixTranslation(5.0f, 0.75f, -5.0f)* XMMatrixScaling(5.0f, 10.0f, 10.0f));
-	Maze2_1->ObjCBIndex = objCBIndex++;
-	Maze2_1->Mat = mMaterials["grass2"].get();
-	Maze2_1->Geo = mGeometries["grasswallGeo"].get();
-	Maze2_1->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze2_1->IndexCount = Maze2_1->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze2_1->StartIndexLocation = Maze2_1->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze2_1->BaseVertexLocation = Maze2_1->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze2_1.get());
-	mAllRitems.push_back(std::move(Maze2_1));
-
-	auto Maze2_2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze2_2->World, XMMatrixTranslation(-4.5f, 0.75f, -8.0f)* XMMatrixScaling(5.0f, 10.0f, 10.0f));
-	Maze2_2->ObjCBIndex = objCBIndex++;
-	Maze2_2->Mat = mMaterials["grass2"].get();
-	Maze2_2->Geo = mGeometries["grasswallGeo"].get();
-	Maze2_2->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze2_2->IndexCount = Maze2_2->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze2_2->StartIndexLocation = Maze2_2->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze2_2->BaseVertexLocation = Maze2_2->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze2_2.get());
-	mAllRitems.push_back(std::move(Maze2_2));
-
-	auto Maze2_5 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze2_5->World, XMMatrixTranslation(-0.2f, 0.8f, -14.5f)* XMMatrixScaling(50.0f, 10.0f, 5.0f));
-	Maze2_5->ObjCBIndex = objCBIndex++;
-	Maze2_5->Mat = mMaterials["grass2"].get();
-	Maze2_5->Geo = mGeometries["grasswallGeo"].get();
-	Maze2_5->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze2_5->IndexCount = Maze2_5->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze2_5->StartIndexLocation = Maze2_5->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze2_5->BaseVertexLocation = Maze2_5->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze2_5.get());
-	mAllRitems.push_back(std::move(Maze2_5));
-
-	auto Maze3 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze3->World, XMMatrixTranslation(-0.0f, 0.75f, -17.5f)* XMMatrixScaling(50.0f, 10.0f, 5.0f));
-	Maze3->ObjCBIndex = objCBIndex++;
-	Maze3->Mat = mMaterials["grass2"].get();
-	Maze3->Geo = mGeometries["grasswallGeo"].get();
-	Maze3->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze3->IndexCount = Maze3->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze3->StartIndexLocation = Maze3->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze3->BaseVertexLocation = Maze3->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze3.get());
-	mAllRitems.push_back(std::move(Maze3));
-
-	auto Maze4 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze4->World, XMMatrixTranslation(-4.5f, 0.75f, -3.25f)* XMMatrixScaling(5.0f, 10.0f, 32.5f));
-	Maze4->ObjCBIndex = objCBIndex++;
-	Maze4->Mat = mMaterials["grass2"].get();
-	Maze4->Geo = mGeometries["grasswallGeo"].get();
-	Maze4->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze4->IndexCount = Maze4->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze4->StartIndexLocation = Maze4->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze4->BaseVertexLocation = Maze4->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze4.get());
-	mAllRitems.push_back(std::move(Maze4));
-
-	auto Maze5 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze5->World, XMMatrixTranslation(4.5f, 0.75f, -6.0f)* XMMatrixScaling(5.0f, 10.0f, 16.25f));
-	Maze5->ObjCBIndex = objCBIndex++;
-	Maze5->Mat = mMaterials["grass2"].get();
-	Maze5->Geo = mGeometries["grasswallGeo"].get();
-	Maze5->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze5->IndexCount = Maze5->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze5->StartIndexLocation = Maze5->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze5->BaseVertexLocation = Maze5->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze5.get());
-	mAllRitems.push_back(std::move(Maze5));
-
-	auto Maze6 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze6->World, XMMatrixTranslation(0.3f, 0.75f, -20.5f)* XMMatrixScaling(25.0f, 10.0f, 5.0f));
-	Maze6->ObjCBIndex = objCBIndex++;
-	Maze6->Mat = mMaterials["grass2"].get();
-	Maze6->Geo = mGeometries["grasswallGeo"].get();
-	Maze6->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze6->IndexCount = Maze6->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze6->StartIndexLocation = Maze6->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze6->BaseVertexLocation = Maze6->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze6.get());
-	mAllRitems.push_back(std::move(Maze6));
-
-	auto Maze7 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Maze7->World, XMMatrixTranslation(3.0f, 0.75f, -14.5f)* XMMatrixScaling(10.0f, 10.0f, 5.0f));
-	Maze7->ObjCBIndex = objCBIndex++;
-	Maze7->Mat = mMaterials["grass2"].get();
-	Maze7->Geo = mGeometries["grasswallGeo"].get();
-	Maze7->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Maze7->IndexCount = Maze7->Geo->DrawArgs["grasswall"].IndexCount;
-	Maze7->StartIndexLocation = Maze7->Geo->DrawArgs["grasswall"].StartIndexLocation;
-	Maze7->BaseVertexLocation = Maze7->Geo->DrawArgs["grasswall"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Maze7.get());
-	mAllRitems.push_back(std::move(Maze7));
-
-	// diamond
-	auto Diamond = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&Diamond->World, XMMatrixTranslation(0.0, 7.0f, 0.5f)* XMMatrixScaling(5.0f, 5.0f, 5.0f));
-	Diamond->ObjCBIndex = objCBIndex++;
-	Diamond->Mat = mMaterials["shiny"].get();
-	Diamond->Geo = mGeometries["diamondGeo"].get();
-	Diamond->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	Diamond->IndexCount = Diamond->Geo->DrawArgs["diamond"].IndexCount;
-	Diamond->StartIndexLocation = Diamond->Geo->DrawArgs["diamond"].StartIndexLocation;
-	Diamond->BaseVertexLocation = Diamond->Geo->DrawArgs["diamond"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(Diamond.get());
-	mAllRitems.push_back(std::move(Diamond));
-
-
-
-	auto treeSpritesRitem = std::make_unique<RenderItem>();
-	treeSpritesRitem->World = MathHelper::Identity4x4();
-	treeSpritesRitem->ObjCBIndex = objCBIndex++;
-	treeSpritesRitem->Mat = mMaterials["treeSprites"].get();
-	treeSpritesRitem->Geo = mGeometries["treeSpritesGeo"].get();
-	//step2
-	treeSpritesRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_POINTLIST;
-	treeSpritesRitem->IndexCount = treeSpritesRitem->Geo->DrawArgs["points"].IndexCount;
-	treeSpritesRitem->StartIndexLocation = treeSpritesRitem->Geo->DrawArgs["points"].StartIndexLocation;
-	treeSpritesRitem->BaseVertexLocation = treeSpritesRitem->Geo->DrawArgs["points"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].push_back(treeSpritesRitem.get());
-
-	mAllRitems.push_back(std::move(treeSpritesRitem));
-
-
-
-
-}
-
-void TreeBillboardsApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
-{
-    UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
-    UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
-
-	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
-	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+	ThrowIfFailed(cmdList->Close());
+}
+
+void TreeBillboardsApp::DrawLayer(ID3D12GraphicsCommandList* cmdList, DrawState& state, RenderLayer layer)
+{
+	ProfileCpuScope cpuScope(mProfiler.get(), mLayerCpuScopes[(int)layer]);
+
+	mProfiler->BeginGpu(cmdList, mLayerGpuScopes[(int)layer]);
+	DrawRenderItems(cmdList, state, mRitemLayer[(int)layer]);
+	mProfiler->EndGpu(cmdList, mLayerGpuScopes[(int)layer]);
+}
+
+void TreeBillboardsApp::DrawTreeSprites(ID3D12GraphicsCommandList* cmdList, DrawState& state)
+{
+	const int layer = (int)RenderLayer::AlphaTestedTreeSprites;
+	ProfileCpuScope cpuScope(mProfiler.get(), mLayerCpuScopes[layer]);
+
+	mProfiler->BeginGpu(cmdList, mLayerGpuScopes[layer]);
+
+	cmdList->SetGraphicsRootConstantBufferView(0, mCurrFrameResource->ObjectCB.GpuAddress(mTreeSpritesObject));
+
+	// The visible trees take the place of the instance buffer.
+	state.Instances = mGpuTrees->VisibleTrees(mCurrFrameResourceIndex);
+	cmdList->SetGraphicsRootShaderResourceView(3, state.Instances);
+	mGpuTrees->Draw(cmdList, mCurrFrameResourceIndex);
+	state.Topology = D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;
+
+	mProfiler->EndGpu(cmdList, mLayerGpuScopes[layer]);
+}
+
+void TreeBillboardsApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, DrawState& state, const std::vector<RenderItem*>& ritems)
+{
+	const auto& objectCB = mCurrFrameResource->ObjectCB;
+	const auto& instanceBuffer = mCurrFrameResource->InstanceBuffer;
 
     // For each render item...
     for(size_t i = 0; i < ritems.size(); ++i)
     {
         auto ri = ritems[i];
 
-        cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-        cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
+		if(!ri->Visible)
+			continue;
+
+		// The layers are sorted by geometry, so most of these are skipped.
+		if(ri->Geo != state.Geo)
+		{
+			cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
+			cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
+			state.Geo = ri->Geo;
+		}
+
 		//step3
-        cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+		if(ri->PrimitiveType != state.Topology)
+		{
+			cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+			state.Topology = ri->PrimitiveType;
+		}
 
-		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
-		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
+		// The material, its diffuse map and the instance range are all looked
+		// up in the shaders through the object constants.
+        D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB.GpuAddress(ri->Handle);
+        cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
 
-        D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex*objCBByteSize;
-		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
+		if(ri->InstanceCount == 0)
+		{
+			cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+			continue;
+		}
 
-		cmdList->SetGraphicsRootDescriptorTable(0, tex);
-        cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
-        cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
+		// An instanced item draws each range of its visible instances at the
+		// range's level of detail.  The vertex shader indexes the instances
+		// from the start of the item's range by SV_InstanceID, which starts at
+		// 0 in every draw, so the instance SRV is bound at the range instead.
+		for(const auto& range : ri->InstanceRanges)
+		{
+			D3D12_GPU_VIRTUAL_ADDRESS instances = instanceBuffer.GpuAddress(range.First);
+			if(instances != state.Instances)
+			{
+				cmdList->SetGraphicsRootShaderResourceView(3, instances);
+				state.Instances = instances;
+			}
 
-        cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+			const RenderItem::LodArgs& lod = ri->Lods[range.Lod];
+			cmdList->DrawIndexedInstanced(lod.IndexCount, range.Count, lod.StartIndexLocation, lod.BaseVertexLocation, 0);
+		}
     }
 }
 
@@ -2515,21 +3626,12 @@ std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> TreeBillboardsApp::GetStaticSam
 		anisotropicWrap, anisotropicClamp };
 }
 
-float TreeBillboardsApp::GetHillsHeight(float x, float z)const
-{
-	return 0.3f * (z * sinf(0.1f * x) + x * cosf(0.1f * z));
-}
-
-XMFLOAT3 TreeBillboardsApp::GetHillsNormal(float x, float z)const
+float TreeBillboardsApp::GetLandHeight(float x, float z)const
 {
-    // n = (-df/dx, 1, -df/dz)
-    XMFLOAT3 n(
-        -0.03f*z*cosf(0.1f*x) - 0.3f*cosf(0.1f*z),
-        1.0f,
-        -0.3f*sinf(0.1f*x) + 0.03f*x*sinf(0.1f*z));
-
-    XMVECTOR unitNormal = XMVector3Normalize(XMLoadFloat3(&n));
-    XMStoreFloat3(&n, unitNormal);
-
-    return n;
+	// A plateau for the castle along the whole terrain, sloping down to the
+	// seabed over one cell on either side.
+	const float plateauHalfWidth = 48.0f;
+	const float slopeWidth = 4.0f;
+	float t = MathHelper::Clamp((plateauHalfWidth + slopeWidth - fabsf(x)) / slopeWidth, 0.0f, 1.0f);
+	return -8.0f + 8.0f*t;
 }
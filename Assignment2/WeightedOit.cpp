@@ -0,0 +1,149 @@
+//***************************************************************************************
+// WeightedOit.cpp
+//***************************************************************************************
+
+#include "WeightedOit.h"
+
+namespace
+{
+	// Nothing accumulated, everything behind revealed.
+	const float AccumClear[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const float RevealageClear[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+}
+
+WeightedOit::WeightedOit(ID3D12Device* device, UINT width, UINT height)
+	: md3dDevice(device), mWidth(width), mHeight(height)
+{
+	BuildResources();
+}
+
+void WeightedOit::BuildDescriptors(
+	CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuSrv,
+	CD3DX12_GPU_DESCRIPTOR_HANDLE hGpuSrv,
+	CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuRtv,
+	UINT srvDescriptorSize,
+	UINT rtvDescriptorSize)
+{
+	// Save references to the descriptors, for when the targets are resized.
+	mhCpuSrv = hCpuSrv;
+	mhGpuSrv = hGpuSrv;
+	mhCpuRtv = hCpuRtv;
+	mSrvDescriptorSize = srvDescriptorSize;
+	mRtvDescriptorSize = rtvDescriptorSize;
+
+	BuildDescriptors();
+}
+
+void WeightedOit::OnResize(UINT newWidth, UINT newHeight)
+{
+	if(mWidth == newWidth && mHeight == newHeight)
+		return;
+
+	mWidth = newWidth;
+	mHeight = newHeight;
+
+	BuildResources();
+
+	// New resources, so new descriptors, if they were built before.
+	if(mSrvDescriptorSize != 0)
+		BuildDescriptors();
+}
+
+void WeightedOit::Clear(ID3D12GraphicsCommandList* cmdList)
+{
+	CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(mhCpuRtv);
+	cmdList->ClearRenderTargetView(rtv, AccumClear, 0, nullptr);
+	cmdList->ClearRenderTargetView(rtv.Offset(1, mRtvDescriptorSize), RevealageClear, 0, nullptr);
+}
+
+void WeightedOit::Composite(
+	ID3D12GraphicsCommandList* cmdList,
+	ID3D12RootSignature* rootSig,
+	D3D12_CPU_DESCRIPTOR_HANDLE backBuffer)
+{
+	D3D12_RESOURCE_BARRIER toRead[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mAccum.Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(mRevealage.Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE)
+	};
+	cmdList->ResourceBarrier(_countof(toRead), toRead);
+
+	cmdList->OMSetRenderTargets(1, &backBuffer, true, nullptr);
+	cmdList->SetGraphicsRootSignature(rootSig);
+	cmdList->SetGraphicsRootDescriptorTable(0, mhGpuSrv);
+
+	// One triangle over the whole screen, made from SV_VertexID.
+	cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	cmdList->DrawInstanced(3, 1, 0, 0);
+
+	D3D12_RESOURCE_BARRIER toWrite[] =
+	{
+		CD3DX12_RESOURCE_BARRIER::Transition(mAccum.Get(),
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET),
+		CD3DX12_RESOURCE_BARRIER::Transition(mRevealage.Get(),
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET)
+	};
+	cmdList->ResourceBarrier(_countof(toWrite), toWrite);
+}
+
+void WeightedOit::BuildResources()
+{
+	// Free the old resources if they exist.
+	mAccum = nullptr;
+	mRevealage = nullptr;
+
+	D3D12_RESOURCE_DESC texDesc;
+	ZeroMemory(&texDesc, sizeof(D3D12_RESOURCE_DESC));
+	texDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	texDesc.Alignment = 0;
+	texDesc.Width = mWidth;
+	texDesc.Height = mHeight;
+	texDesc.DepthOrArraySize = 1;
+	texDesc.MipLevels = 1;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.SampleDesc.Quality = 0;
+	texDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+	texDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+
+	texDesc.Format = AccumFormat;
+	CD3DX12_CLEAR_VALUE accumClear(AccumFormat, AccumClear);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_RENDER_TARGET,
+		&accumClear,
+		IID_PPV_ARGS(&mAccum)));
+
+	texDesc.Format = RevealageFormat;
+	CD3DX12_CLEAR_VALUE revealageClear(RevealageFormat, RevealageClear);
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_RENDER_TARGET,
+		&revealageClear,
+		IID_PPV_ARGS(&mRevealage)));
+}
+
+void WeightedOit::BuildDescriptors()
+{
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = 1;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE srv(mhCpuSrv);
+	CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(mhCpuRtv);
+
+	srvDesc.Format = AccumFormat;
+	md3dDevice->CreateShaderResourceView(mAccum.Get(), &srvDesc, srv);
+	md3dDevice->CreateRenderTargetView(mAccum.Get(), nullptr, rtv);
+
+	srvDesc.Format = RevealageFormat;
+	md3dDevice->CreateShaderResourceView(mRevealage.Get(), &srvDesc, srv.Offset(1, mSrvDescriptorSize));
+	md3dDevice->CreateRenderTargetView(mRevealage.Get(), nullptr, rtv.Offset(1, mRtvDescriptorSize));
+}
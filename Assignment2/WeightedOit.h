@@ -0,0 +1,83 @@
+//***************************************************************************************
+// WeightedOit.h
+//
+// Render targets for weighted blended order-independent transparency (McGuire and
+// Bavoil, "Weighted Blended Order-Independent Transparency", JCGT 2013).  The blended
+// surfaces are drawn in any order into two targets: the accumulation target adds up
+// their premultiplied colors and alphas, scaled by a weight that falls off with view
+// depth, and the revealage target multiplies together their (1 - alpha).  A full
+// screen pass then blends the weighted average color over the back buffer with the
+// total coverage, 1 - revealage.
+//
+// Nothing has to be sorted, at the price of an approximation where surfaces of very
+// different colors overlap at similar depths.
+//***************************************************************************************
+
+#ifndef WEIGHTEDOIT_H
+#define WEIGHTEDOIT_H
+
+#include "../../Common/d3dUtil.h"
+
+class WeightedOit
+{
+public:
+	static const DXGI_FORMAT AccumFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	static const DXGI_FORMAT RevealageFormat = DXGI_FORMAT_R16_FLOAT;
+
+	// Descriptors BuildDescriptors needs in the RTV and the SRV heaps.
+	static const UINT RtvCount = 2;
+	static const UINT SrvCount = 2;
+
+	WeightedOit(ID3D12Device* device, UINT width, UINT height);
+	WeightedOit(const WeightedOit& rhs) = delete;
+	WeightedOit& operator=(const WeightedOit& rhs) = delete;
+	~WeightedOit() = default;
+
+	// The accumulation and revealage targets, in this order, as one range of
+	// the RTV heap.
+	CD3DX12_CPU_DESCRIPTOR_HANDLE Rtv()const { return mhCpuRtv; }
+
+	void BuildDescriptors(
+		CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuSrv,
+		CD3DX12_GPU_DESCRIPTOR_HANDLE hGpuSrv,
+		CD3DX12_CPU_DESCRIPTOR_HANDLE hCpuRtv,
+		UINT srvDescriptorSize,
+		UINT rtvDescriptorSize);
+
+	// Recreates the targets at the new size; the command queue has to be
+	// flushed.
+	void OnResize(UINT newWidth, UINT newHeight);
+
+	// Records clearing both targets for a new frame.
+	void Clear(ID3D12GraphicsCommandList* cmdList);
+
+	// Records the full screen pass that blends the targets over backBuffer.
+	// The composite PSO has to be set; its root signature takes the
+	// accumulation and revealage SRVs (t0, t1) as a table in parameter 0.
+	void Composite(
+		ID3D12GraphicsCommandList* cmdList,
+		ID3D12RootSignature* rootSig,
+		D3D12_CPU_DESCRIPTOR_HANDLE backBuffer);
+
+private:
+	void BuildResources();
+	void BuildDescriptors();
+
+private:
+	ID3D12Device* md3dDevice = nullptr;
+
+	UINT mWidth = 0;
+	UINT mHeight = 0;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE mhCpuSrv;
+	CD3DX12_GPU_DESCRIPTOR_HANDLE mhGpuSrv;
+	CD3DX12_CPU_DESCRIPTOR_HANDLE mhCpuRtv;
+	UINT mSrvDescriptorSize = 0;
+	UINT mRtvDescriptorSize = 0;
+
+	// Both stay render targets, except during Composite.
+	Microsoft::WRL::ComPtr<ID3D12Resource> mAccum;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mRevealage;
+};
+
+#endif // WEIGHTEDOIT_H